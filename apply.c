@@ -0,0 +1,869 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+#include "hash.h"
+#include "json.h"
+#include "pool.h"
+#include "lock.h"
+#include "apply.h"
+
+extern bool trm;
+
+enum apply_op_type {
+	APPLY_ADD_PATH,
+	APPLY_UNMAP,
+	APPLY_MAP,
+	APPLY_DEL_PATH,
+};
+
+struct apply_path {
+	struct path		p;		/* src is NULL for any */
+	struct rnbd_addr	src;
+	struct rnbd_addr	dst;
+};
+
+struct apply_op {
+	enum apply_op_type	type;
+	char			dir[PATH_MAX];
+	char			arg[4096];
+	const char		*name;		/* device or path */
+};
+
+/*
+ * The operations on one session, they depend on each other: the first map
+ * creates a new session, paths are added before others are removed.
+ */
+struct apply_job {
+	char			sessname[NAME_MAX];
+	const char		*host;
+	struct rnbd_sess	*sess;		/* NULL if not there yet */
+	struct apply_path	paths[MAX_PATHS_PER_SESSION];
+	int			path_cnt;
+	bool			paths_set;	/* listed in the file */
+	int			want_cnt;
+	struct apply_op		*ops;
+	int			op_cnt;
+	int			op_size;
+	int			done;
+	int			err;
+};
+
+struct apply_want {
+	const char		*device_path;
+	const char		*access_mode;	/* NULL for the default */
+	int			job;
+};
+
+struct apply_plan {
+	const struct rnbd_ctx	*ctx;
+	struct apply_want	*wants;
+	int			want_cnt;
+	struct apply_job	*jobs;
+	int			job_cnt;
+	int			job_size;
+	struct rnbd_hash	job_idx;	/* sessname -> job + 1 */
+	int			op_cnt;
+};
+
+/*
+ * Returns the contents of @file as a string or NULL with errno set
+ */
+static char *read_file(const char *file)
+{
+	size_t len = 0, size = 4096, n;
+	char *buf, *tmp;
+	int err = 0;
+	FILE *f;
+
+	f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	if (!f)
+		return NULL;
+
+	buf = malloc(size);
+	if (!buf) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	while ((n = fread(buf + len, 1, size - len - 1, f)) > 0) {
+		len += n;
+		if (len + 1 < size)
+			continue;
+		tmp = realloc(buf, size * 2);
+		if (!tmp) {
+			err = ENOMEM;
+			goto out;
+		}
+		buf = tmp;
+		size *= 2;
+	}
+	buf[len] = '\0';
+
+	if (ferror(f))
+		err = EIO;
+	else if (strlen(buf) != len)
+		err = EINVAL;
+out:
+	if (f != stdin)
+		fclose(f);
+	if (err) {
+		free(buf);
+		errno = err;
+		return NULL;
+	}
+
+	return buf;
+}
+
+static bool same_path(const struct apply_path *ap,
+		      const struct rnbd_path *rp)
+{
+	return (!ap->p.src ||
+		rnbd_addr_match(&ap->src, ap->p.src, &rp->src, rp->src_addr)) &&
+		rnbd_addr_match(&ap->dst, ap->p.dst, &rp->dst, rp->dst_addr);
+}
+
+static bool same_addrs(const struct apply_path *a, const struct apply_path *b)
+{
+	return ((!a->p.src && !b->p.src) ||
+		(a->p.src && b->p.src &&
+		 rnbd_addr_match(&a->src, a->p.src, &b->src, b->p.src))) &&
+		rnbd_addr_match(&a->dst, a->p.dst, &b->dst, b->p.dst);
+}
+
+static void parse_addrs(struct apply_path *ap)
+{
+	if (ap->p.src)
+		rnbd_addr_parse(&ap->src, ap->p.src);
+	rnbd_addr_parse(&ap->dst, ap->p.dst);
+}
+
+/*
+ *	[src_addr(,|@)]dst_addr
+ */
+static int parse_path(const char *arg, struct apply_path *ap)
+{
+	struct path *p = &ap->p;
+	const char *d;
+
+	d = strchr(arg, ',');
+	if (!d)
+		d = strchr(arg, '@');
+
+	p->provided = NULL;
+	p->src = d ? strndup(arg, d - arg) : NULL;
+	p->dst = strdup(d ? d + 1 : arg);
+	if ((d && !p->src) || !p->dst)
+		return -ENOMEM;
+
+	if ((p->src && !is_path_addr(p->src)) || !is_path_addr(p->dst))
+		return -EINVAL;
+
+	parse_addrs(ap);
+
+	return 0;
+}
+
+static void free_path(struct apply_path *ap)
+{
+	free((char *)ap->p.provided);
+	free((char *)ap->p.src);
+	free((char *)ap->p.dst);
+}
+
+static struct rnbd_sess *find_sess_by_name(const char *name,
+					   struct rnbd_sess **sess_clt)
+{
+	for (; *sess_clt; sess_clt++)
+		if (!strcmp((*sess_clt)->sessname, name))
+			return *sess_clt;
+
+	return NULL;
+}
+
+static struct rnbd_sess *find_sess_by_host(const char *host,
+					   struct rnbd_sess **sess_clt)
+{
+	for (; *sess_clt; sess_clt++)
+		if (!strcmp((*sess_clt)->hostname, host))
+			return *sess_clt;
+
+	return NULL;
+}
+
+/*
+ * Returns the index of the job of session @sessname, a new one is added
+ * for a session not seen yet.
+ */
+static int get_job(struct apply_plan *pl, const char *sessname,
+		   struct rnbd_sess **sess_clt)
+{
+	struct apply_job *jobs;
+	void *val;
+
+	val = rnbd_hash_find(&pl->job_idx, sessname);
+	if (val)
+		return (uintptr_t)val - 1;
+
+	if (pl->job_cnt == pl->job_size) {
+		jobs = realloc(pl->jobs, pl->job_size * 2 * sizeof(*jobs));
+		if (!jobs)
+			return -ENOMEM;
+		pl->jobs = jobs;
+		pl->job_size *= 2;
+	}
+
+	memset(&pl->jobs[pl->job_cnt], 0, sizeof(*pl->jobs));
+	snprintf(pl->jobs[pl->job_cnt].sessname, NAME_MAX, "%s", sessname);
+	pl->jobs[pl->job_cnt].sess = find_sess_by_name(sessname, sess_clt);
+
+	if (rnbd_hash_add(&pl->job_idx, sessname,
+			  (void *)(uintptr_t)(pl->job_cnt + 1)))
+		return -ENOMEM;
+
+	return pl->job_cnt++;
+}
+
+static int add_op(struct apply_job *job, enum apply_op_type type,
+		  const char *name, struct apply_op **res)
+{
+	struct apply_op *ops;
+
+	if (job->op_cnt == job->op_size) {
+		job->op_size = job->op_size ? job->op_size * 2 : 4;
+		ops = realloc(job->ops, job->op_size * sizeof(*ops));
+		if (!ops)
+			return -ENOMEM;
+		job->ops = ops;
+	}
+
+	*res = &job->ops[job->op_cnt++];
+	(*res)->type = type;
+	(*res)->name = name;
+
+	return 0;
+}
+
+static const char *get_str(const struct rnbd_json *e, const char *key,
+			   int idx, int *err)
+{
+	const struct rnbd_json *v;
+
+	v = rnbd_json_get(e, key);
+	if (!v)
+		return NULL;
+
+	if (v->type != JSON_STR || !*v->str) {
+		ERR(trm, "Entry %d: '%s' has to be a non-empty string\n",
+		    idx, key);
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	return v->str;
+}
+
+static int entry_paths(struct apply_job *job, const struct rnbd_json *paths,
+		       int idx)
+{
+	struct apply_path p;
+	int i, j, err;
+
+	if (paths->type != JSON_ARR) {
+		ERR(trm, "Entry %d: 'paths' has to be a list of strings\n",
+		    idx);
+		return -EINVAL;
+	}
+
+	job->paths_set = true;
+
+	for (i = 0; i < paths->cnt; i++) {
+		if (paths->items[i]->type != JSON_STR) {
+			ERR(trm,
+			    "Entry %d: 'paths' has to be a list of strings\n",
+			    idx);
+			return -EINVAL;
+		}
+
+		err = parse_path(paths->items[i]->str, &p);
+		if (err) {
+			if (err == -EINVAL)
+				ERR(trm, "Entry %d: Invalid path '%s'\n",
+				    idx, paths->items[i]->str);
+			free_path(&p);
+			return err;
+		}
+
+		for (j = 0; j < job->path_cnt; j++)
+			if (same_addrs(&job->paths[j], &p))
+				break;
+		if (j < job->path_cnt) {
+			free_path(&p);
+			continue;
+		}
+		if (job->path_cnt == MAX_PATHS_PER_SESSION) {
+			ERR(trm, "Entry %d: Too many paths for session '%s'\n",
+			    idx, job->sessname);
+			free_path(&p);
+			return -E2BIG;
+		}
+		job->paths[job->path_cnt++] = p;
+	}
+
+	return 0;
+}
+
+static int plan_entry(struct apply_plan *pl, const struct rnbd_json *e,
+		      int idx, struct rnbd_sess **sess_clt)
+{
+	static const char * const keys[] = {
+		"session", "host", "device_path", "access_mode", "paths", NULL
+	};
+	const char *sessname, *host, *access_mode;
+	struct apply_want *w = &pl->wants[pl->want_cnt];
+	char buf[NAME_MAX];
+	struct rnbd_sess *sess;
+	const struct rnbd_json *paths;
+	int i, j, err = 0;
+
+	if (e->type != JSON_OBJ) {
+		ERR(trm, "Entry %d: Expected an object, found %s\n",
+		    idx, rnbd_json_type_str(e->type));
+		return -EINVAL;
+	}
+
+	for (i = 0; i < e->cnt; i++) {
+		for (j = 0; keys[j] && strcmp(keys[j], e->items[i]->key); j++)
+			;
+		if (!keys[j]) {
+			ERR(trm, "Entry %d: Unknown member '%s'\n",
+			    idx, e->items[i]->key);
+			return -EINVAL;
+		}
+	}
+
+	sessname = get_str(e, "session", idx, &err);
+	host = get_str(e, "host", idx, &err);
+	w->device_path = get_str(e, "device_path", idx, &err);
+	access_mode = get_str(e, "access_mode", idx, &err);
+	if (err)
+		return err;
+
+	if (!w->device_path) {
+		ERR(trm, "Entry %d: Please specify the 'device_path'\n", idx);
+		return -EINVAL;
+	}
+	if (access_mode && strcmp(access_mode, "ro") &&
+	    strcmp(access_mode, "rw") && strcmp(access_mode, "migration")) {
+		ERR(trm, "Entry %d: Invalid access mode '%s'\n",
+		    idx, access_mode);
+		return -EINVAL;
+	}
+	w->access_mode = access_mode;
+
+	if (!sessname && !host) {
+		ERR(trm, "Entry %d: Please specify the 'session' or 'host'\n",
+		    idx);
+		return -EINVAL;
+	}
+	if (!sessname) {
+		sess = find_sess_by_host(host, sess_clt);
+		if (sess) {
+			sessname = sess->sessname;
+		} else {
+			err = sessname_from_host(host, buf, sizeof(buf));
+			if (err) {
+				ERR(trm,
+				    "Entry %d: Failed to generate session name for %s: %s (%d)\n",
+				    idx, host, strerror(-err), err);
+				return err;
+			}
+			sessname = buf;
+		}
+	}
+
+	w->job = get_job(pl, sessname, sess_clt);
+	if (w->job < 0)
+		return w->job;
+	if (host && !pl->jobs[w->job].host)
+		pl->jobs[w->job].host = host;
+	pl->jobs[w->job].want_cnt++;
+
+	paths = rnbd_json_get(e, "paths");
+	if (paths) {
+		err = entry_paths(&pl->jobs[w->job], paths, idx);
+		if (err)
+			return err;
+	}
+
+	pl->want_cnt++;
+
+	return 0;
+}
+
+/*
+ * A new session is established with the paths listed or the ones found
+ * to its host.
+ */
+static int plan_new_session(struct apply_job *job, const struct rnbd_ctx *ctx)
+{
+	struct path paths[MAX_PATHS_PER_SESSION] = { 0 };
+	int i, ret;
+
+	if (job->path_cnt || !job->host)
+		goto out;
+
+	ret = resolve_host(job->host, paths, ctx);
+	for (i = 0; i < ret; i++) {
+		job->paths[i].p = paths[i];
+		parse_addrs(&job->paths[i]);
+	}
+	if (ret > 0)
+		job->path_cnt = ret;
+out:
+	if (!job->path_cnt) {
+		ERR(trm,
+		    "No paths to establish the new session '%s'. Please list its paths.\n",
+		    job->sessname);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void sds_key(char *key, size_t len, const char *sessname,
+		    const char *mapping_path)
+{
+	snprintf(key, len, "%s\t%s", sessname, mapping_path);
+}
+
+static int plan_add_paths(struct apply_job *job, const struct rnbd_ctx *ctx)
+{
+	const struct path *p;
+	struct apply_op *op;
+	int i, j, err;
+
+	for (i = 0; i < job->path_cnt; i++) {
+		for (j = 0; j < job->sess->path_cnt; j++)
+			if (same_path(&job->paths[i], job->sess->paths[j]))
+				break;
+		if (j < job->sess->path_cnt)
+			continue;
+
+		p = &job->paths[i].p;
+		err = add_op(job, APPLY_ADD_PATH, p->dst, &op);
+		if (err)
+			return err;
+		snprintf(op->dir, sizeof(op->dir), "%s%s",
+			 get_sysfs_info(ctx)->path_sess_clt, job->sessname);
+		if (p->src)
+			snprintf(op->arg, sizeof(op->arg), "%s,%s",
+				 p->src, p->dst);
+		else
+			snprintf(op->arg, sizeof(op->arg), "%s", p->dst);
+	}
+
+	return 0;
+}
+
+static int plan_del_paths(struct apply_job *job, const struct rnbd_ctx *ctx)
+{
+	struct rnbd_path *rp;
+	struct apply_op *op;
+	int i, j, err;
+
+	for (j = 0; j < job->sess->path_cnt; j++) {
+		rp = job->sess->paths[j];
+		for (i = 0; i < job->path_cnt; i++)
+			if (same_path(&job->paths[i], rp))
+				break;
+		if (i < job->path_cnt)
+			continue;
+
+		err = add_op(job, APPLY_DEL_PATH, rp->pathname, &op);
+		if (err)
+			return err;
+		snprintf(op->dir, sizeof(op->dir), "%s%s/paths/%s",
+			 get_sysfs_info(ctx)->path_sess_clt, job->sessname,
+			 rp->pathname);
+		snprintf(op->arg, sizeof(op->arg), "1");
+	}
+
+	return 0;
+}
+
+static int plan_map(struct apply_job *job, const struct apply_want *w,
+		    const struct rnbd_ctx *ctx)
+{
+	struct apply_op *op;
+	const struct path *p;
+	int i, cnt, n, err;
+
+	err = add_op(job, APPLY_MAP, w->device_path, &op);
+	if (err)
+		return err;
+
+	snprintf(op->dir, sizeof(op->dir), "%s",
+		 get_sysfs_info(ctx)->path_dev_clt);
+
+	cnt = snprintf(op->arg, sizeof(op->arg), "sessname=%s device_path=%s",
+		       job->sessname, w->device_path);
+
+	/* the driver uses the paths only to establish a new session */
+	if (job->sess) {
+		for (i = 0; i < job->sess->path_cnt; i++) {
+			n = snprintf(op->arg + cnt, sizeof(op->arg) - cnt,
+				     " path=%s@%s",
+				     job->sess->paths[i]->src_addr,
+				     job->sess->paths[i]->dst_addr);
+			cnt += n;
+			if (cnt >= sizeof(op->arg))
+				return -E2BIG;
+		}
+	} else {
+		for (i = 0; i < job->path_cnt; i++) {
+			p = &job->paths[i].p;
+			if (p->src)
+				n = snprintf(op->arg + cnt,
+					     sizeof(op->arg) - cnt,
+					     " path=%s@%s", p->src, p->dst);
+			else
+				n = snprintf(op->arg + cnt,
+					     sizeof(op->arg) - cnt,
+					     " path=%s", p->dst);
+			cnt += n;
+			if (cnt >= sizeof(op->arg))
+				return -E2BIG;
+		}
+	}
+
+	if (w->access_mode)
+		cnt += snprintf(op->arg + cnt, sizeof(op->arg) - cnt,
+				" access_mode=%s", w->access_mode);
+	if (cnt >= sizeof(op->arg))
+		return -E2BIG;
+
+	return 0;
+}
+
+/*
+ * Operations are added to the jobs in the order they are executed.
+ */
+static int plan_ops(struct apply_plan *pl, struct rnbd_sess_dev **sds_clt,
+		    struct rnbd_sess **sess_clt)
+{
+	char key[2 * NAME_MAX + 2];
+	struct rnbd_hash wanted, mapped;
+	const struct rnbd_ctx *ctx = pl->ctx;
+	struct rnbd_sess_dev **sds;
+	struct apply_want *w;
+	struct apply_job *job;
+	struct apply_op *op;
+	int i, j, err;
+
+	err = rnbd_hash_init(&wanted, pl->want_cnt);
+	if (err)
+		return err;
+	err = rnbd_hash_init(&mapped, 64);
+	if (err)
+		goto free_wanted;
+
+	for (i = 0; i < pl->want_cnt; i++) {
+		w = &pl->wants[i];
+		sds_key(key, sizeof(key), pl->jobs[w->job].sessname,
+			w->device_path);
+		if (rnbd_hash_find(&wanted, key)) {
+			ERR(trm, "Device '%s' of session '%s' is listed twice\n",
+			    w->device_path, pl->jobs[w->job].sessname);
+			err = -EINVAL;
+			goto free_mapped;
+		}
+		err = rnbd_hash_add(&wanted, key, w);
+		if (err)
+			goto free_mapped;
+	}
+
+	for (i = 0; i < pl->job_cnt; i++) {
+		job = &pl->jobs[i];
+		if (!job->sess)
+			err = plan_new_session(job, ctx);
+		else
+			err = plan_add_paths(job, ctx);
+		if (err)
+			goto free_mapped;
+	}
+
+	for (sds = sds_clt; *sds; sds++) {
+		sds_key(key, sizeof(key), (*sds)->sess->sessname,
+			(*sds)->mapping_path);
+		err = rnbd_hash_add(&mapped, key, *sds);
+		if (err)
+			goto free_mapped;
+		if (rnbd_hash_find(&wanted, key))
+			continue;
+
+		j = get_job(pl, (*sds)->sess->sessname, sess_clt);
+		if (j < 0) {
+			err = j;
+			goto free_mapped;
+		}
+		err = add_op(&pl->jobs[j], APPLY_UNMAP, (*sds)->dev->devname,
+			     &op);
+		if (err)
+			goto free_mapped;
+		snprintf(op->dir, sizeof(op->dir), "/sys/block/%s/%s",
+			 (*sds)->dev->devname,
+			 get_sysfs_info(ctx)->path_dev_name);
+		snprintf(op->arg, sizeof(op->arg), "%s",
+			 ctx->force_set ? "force" : "normal");
+	}
+
+	for (i = 0; i < pl->want_cnt; i++) {
+		const struct rnbd_sess_dev *ds;
+
+		w = &pl->wants[i];
+		job = &pl->jobs[w->job];
+		sds_key(key, sizeof(key), job->sessname, w->device_path);
+		ds = rnbd_hash_find(&mapped, key);
+		if (!ds) {
+			err = plan_map(job, w, ctx);
+			if (err)
+				goto free_mapped;
+			continue;
+		}
+		if (w->access_mode && strcmp(w->access_mode, ds->access_mode))
+			fprintf(stderr,
+				"warning: Device '%s' of session '%s' is mapped %s, not %s. Please unmap it to change the access mode.\n",
+				w->device_path, job->sessname,
+				ds->access_mode, w->access_mode);
+	}
+
+	for (i = 0; i < pl->job_cnt; i++) {
+		job = &pl->jobs[i];
+		if (job->sess && job->paths_set && job->want_cnt) {
+			err = plan_del_paths(job, ctx);
+			if (err)
+				goto free_mapped;
+		}
+		pl->op_cnt += job->op_cnt;
+	}
+
+free_mapped:
+	rnbd_hash_free(&mapped);
+free_wanted:
+	rnbd_hash_free(&wanted);
+
+	return err;
+}
+
+static const char *op_entry(enum apply_op_type type)
+{
+	switch (type) {
+	case APPLY_ADD_PATH:
+		return "add_path";
+	case APPLY_UNMAP:
+		return "unmap_device";
+	case APPLY_MAP:
+		return "map_device";
+	case APPLY_DEL_PATH:
+		return "remove_path";
+	}
+
+	return NULL;
+}
+
+static void op_report(const struct apply_job *job, const struct apply_op *op,
+		      int ret, const struct rnbd_ctx *ctx)
+{
+	static const char * const fail[] = {
+		[APPLY_ADD_PATH] = "Failed to add path '%s' to session '%s'",
+		[APPLY_UNMAP]	 = "Failed to unmap '%s' of session '%s'",
+		[APPLY_MAP]	 = "Failed to map '%s' from '%s'",
+		[APPLY_DEL_PATH] = "Failed to remove path '%s' from session '%s'",
+	};
+	static const char * const ok[] = {
+		[APPLY_ADD_PATH] = "Successfully added path '%s' to '%s'.\n",
+		[APPLY_UNMAP]	 = "Successfully unmapped '%s' of '%s'.\n",
+		[APPLY_MAP]	 = "Successfully mapped '%s' from '%s'.\n",
+		[APPLY_DEL_PATH] = "Successfully removed path '%s' from '%s'.\n",
+	};
+	char msg[2 * NAME_MAX + 64];
+
+	if (ret) {
+		snprintf(msg, sizeof(msg), fail[op->type],
+			 op->name, job->sessname);
+		ERR(trm, "%s: %s (%d)\n", msg, strerror(-ret), ret);
+	} else if (ctx->verbose_set && !ctx->simulate_set) {
+		printf(ok[op->type], op->name, job->sessname);
+	}
+}
+
+/*
+ * The operations of a session depend on each other, stop at the first
+ * failure. The session stays locked in between.
+ */
+static void run_job(struct apply_job *job, const struct rnbd_ctx *ctx)
+{
+	const struct apply_op *op;
+
+	if (!job->op_cnt)
+		return;
+
+	job->err = rnbd_lock_sess(job->sessname, false, ctx);
+	if (job->err == -EWOULDBLOCK) {
+		if (ctx->verbose_set)
+			printf("Waiting for session '%s' to be unlocked.\n",
+			       job->sessname);
+		job->err = rnbd_lock_sess(job->sessname, true, ctx);
+	}
+	if (job->err) {
+		ERR(trm, "Failed to lock session '%s': %s (%d)\n",
+		    job->sessname, strerror(-job->err), job->err);
+		return;
+	}
+
+	for (; job->done < job->op_cnt; job->done++) {
+		op = &job->ops[job->done];
+		job->err = printf_sysfs(op->dir, op_entry(op->type), ctx,
+					"%s", op->arg);
+		op_report(job, op, job->err, ctx);
+		if (job->err)
+			break;
+	}
+
+	rnbd_unlock_sess(job->sessname);
+}
+
+static void apply_job(void *arg, int i)
+{
+	struct apply_plan *pl = arg;
+
+	run_job(&pl->jobs[i], pl->ctx);
+}
+
+static void run_jobs(struct apply_plan *pl, int jobs)
+{
+	int i, busy = 0;
+
+	for (i = 0; i < pl->job_cnt; i++)
+		if (pl->jobs[i].op_cnt)
+			busy++;
+	if (jobs > busy)
+		jobs = busy;
+
+	/* a dry run prints the plan, in order */
+	if (pl->ctx->simulate_set || pl->ctx->debug_set)
+		jobs = 1;
+
+	rnbd_pool_run(pl->job_cnt, jobs, apply_job, pl);
+}
+
+static void plan_free(struct apply_plan *pl)
+{
+	int i, j;
+
+	for (i = 0; i < pl->job_cnt; i++) {
+		for (j = 0; j < pl->jobs[i].path_cnt; j++)
+			free_path(&pl->jobs[i].paths[j]);
+		free(pl->jobs[i].ops);
+	}
+	free(pl->jobs);
+	free(pl->wants);
+	rnbd_hash_free(&pl->job_idx);
+}
+
+int rnbd_apply(const char *file, struct rnbd_sess_dev **sds_clt,
+	       struct rnbd_sess **sess_clt, int jobs,
+	       const struct rnbd_ctx *ctx)
+{
+	struct apply_plan pl = {
+		.ctx = ctx,
+		.job_size = 16,
+	};
+	struct rnbd_json *desired;
+	int i, done = 0, line, err;
+	char *text;
+
+	text = read_file(file);
+	if (!text) {
+		err = -errno;
+		ERR(trm, "Failed to read '%s': %s (%d)\n",
+		    file, strerror(-err), err);
+		return err;
+	}
+
+	err = rnbd_json_parse(text, &desired, &line);
+	free(text);
+	if (err) {
+		if (err == -EINVAL)
+			ERR(trm, "Invalid JSON in '%s' on line %d\n",
+			    file, line);
+		return err;
+	}
+
+	if (desired->type != JSON_ARR) {
+		ERR(trm, "Expected a list of devices in '%s', found %s\n",
+		    file, rnbd_json_type_str(desired->type));
+		err = -EINVAL;
+		goto free_json;
+	}
+
+	pl.wants = calloc(desired->cnt + 1, sizeof(*pl.wants));
+	pl.jobs = calloc(pl.job_size, sizeof(*pl.jobs));
+	err = rnbd_hash_init(&pl.job_idx, pl.job_size);
+	if (!pl.wants || !pl.jobs || err) {
+		err = -ENOMEM;
+		goto free_plan;
+	}
+
+	for (i = 0; i < desired->cnt; i++) {
+		err = plan_entry(&pl, desired->items[i], i + 1, sess_clt);
+		if (err)
+			goto free_plan;
+	}
+
+	err = plan_ops(&pl, sds_clt, sess_clt);
+	if (err)
+		goto free_plan;
+
+	if (!pl.op_cnt) {
+		if (ctx->verbose_set)
+			printf("Nothing to do, all %d devices are in place.\n",
+			       pl.want_cnt);
+		goto free_plan;
+	}
+
+	run_jobs(&pl, jobs);
+
+	for (i = 0; i < pl.job_cnt; i++) {
+		done += pl.jobs[i].done;
+		if (pl.jobs[i].err && !err)
+			err = pl.jobs[i].err;
+	}
+
+	if (err)
+		ERR(trm, "Applied %d of %d changes\n", done, pl.op_cnt);
+	else if (ctx->verbose_set && !ctx->simulate_set)
+		printf("Applied %d changes.\n", pl.op_cnt);
+
+free_plan:
+	plan_free(&pl);
+free_json:
+	rnbd_json_free(desired);
+
+	return err;
+}
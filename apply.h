@@ -0,0 +1,35 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_APPLY
+#define __H_APPLY
+
+#include "rnbd-sysfs.h"
+
+/*
+ * Bring the client devices and sessions @sds_clt and @sess_clt in line with
+ * the JSON list of desired mappings in @file ("-" for stdin):
+ *
+ *	[{"session": "<name>", "host": "<host>", "device_path": "<path>",
+ *	  "access_mode": "ro|rw|migration", "paths": ["[src@]dst", ..]}, ..]
+ *
+ * Either the session or the host has to be given. Devices which are not
+ * listed are unmapped. Listed paths missing in an existing session are
+ * added and paths not listed are removed, sessions listed without paths
+ * keep theirs.
+ *
+ * The whole plan is made before anything is written. The operations of a
+ * session are executed in order, up to @jobs sessions at once. With
+ * ctx->simulate_set the plan is only printed.
+ */
+int rnbd_apply(const char *file, struct rnbd_sess_dev **sds_clt,
+	       struct rnbd_sess **sess_clt, int jobs,
+	       const struct rnbd_ctx *ctx);
+
+#endif /* __H_APPLY */
@@ -0,0 +1,157 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <dirent.h>	/* for opendir() */
+#include <libgen.h>	/* for basename() */
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>	/* for readlink() */
+
+#include "complete.h"
+#include "table.h"
+#include "misc.h"
+#include "out.h"
+
+static void complete_name(const char *name, const char *prefix)
+{
+	if (prefix && strncmp(name, prefix, strlen(prefix)))
+		return;
+
+	out_str(name);
+	out_chr('\n');
+}
+
+/*
+ * Complete the paths in @dir, normalized the way they are listed
+ */
+static void complete_paths(const char *dir, const char *prefix)
+{
+	char norm[2 * NAME_MAX];
+	struct dirent *ent;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	for (ent = readdir(d); ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		rnbd_pathname_to_norm(norm, sizeof(norm), ent->d_name);
+		complete_name(norm, prefix);
+	}
+
+	closedir(d);
+}
+
+/*
+ * The devices are named after the mapping path with '/' replaced by '!',
+ * on the client followed by '@' and the session name. They link to the
+ * block device directory (the block_dev entry does on the server), which
+ * is named like the device under /dev/.
+ */
+static void complete_devices(const char *dir, const char *prefix,
+			     enum rnbdmode side)
+{
+	char name[NAME_MAX + 1], path[2 * PATH_MAX], link[PATH_MAX];
+	struct dirent *ent;
+	ssize_t len;
+	char *c;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d)
+		return;
+
+	for (ent = readdir(d); ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		snprintf(name, sizeof(name), "%s", ent->d_name);
+		c = strchr(name, '@');
+		if (side == RNBD_CLIENT && c)
+			*c = '\0';
+		for (c = name; *c; c++)
+			if (*c == '!')
+				*c = '/';
+		complete_name(name, prefix);
+
+		snprintf(path, sizeof(path), "%s%s%s", dir, ent->d_name,
+			 side == RNBD_CLIENT ? "" : "/block_dev");
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len <= 0)
+			continue;
+
+		link[len] = '\0';
+		complete_name(basename(link), prefix);
+	}
+
+	closedir(d);
+}
+
+static void complete_sessions(const char *sess_dir, const char *prefix,
+			      unsigned int objs)
+{
+	char path[PATH_MAX];
+	struct dirent *ent;
+	DIR *d;
+
+	d = opendir(sess_dir);
+	if (!d)
+		return;
+
+	for (ent = readdir(d); ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+		if (strcmp(ent->d_name, "ctl") == 0)
+			continue;
+
+		if (objs & RNBD_COMPLETE_SESSIONS)
+			complete_name(ent->d_name, prefix);
+
+		if (objs & RNBD_COMPLETE_PATHS) {
+			snprintf(path, sizeof(path), "%s%s/paths/",
+				 sess_dir, ent->d_name);
+			complete_paths(path, prefix);
+		}
+	}
+
+	closedir(d);
+}
+
+static void complete_side(const char *dev_dir, const char *sess_dir,
+			  enum rnbdmode side, unsigned int objs,
+			  const char *prefix)
+{
+	char path[PATH_MAX];
+
+	if (objs & RNBD_COMPLETE_DEVICES) {
+		snprintf(path, sizeof(path), "%s/devices/", dev_dir);
+		complete_devices(path, prefix, side);
+	}
+
+	if (objs & (RNBD_COMPLETE_SESSIONS | RNBD_COMPLETE_PATHS))
+		complete_sessions(sess_dir, prefix, objs);
+}
+
+void rnbd_complete_names(const struct rnbd_ctx *ctx, enum rnbdmode side,
+			 unsigned int objs, const char *prefix)
+{
+	const struct rnbd_sysfs_info *info = get_sysfs_info(ctx);
+
+	if (side & RNBD_CLIENT)
+		complete_side(info->path_dev_clt, info->path_sess_clt,
+			      RNBD_CLIENT, objs, prefix);
+	if (side & RNBD_SERVER)
+		complete_side(info->path_dev_srv, info->path_sess_srv,
+			      RNBD_SERVER, objs, prefix);
+}
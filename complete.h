@@ -0,0 +1,32 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_COMPLETE
+#define __H_COMPLETE
+
+#include "rnbd-sysfs.h"
+
+struct rnbd_ctx;
+
+/* kinds of objects to complete the names of */
+enum {
+	RNBD_COMPLETE_DEVICES	= 1,
+	RNBD_COMPLETE_SESSIONS	= 1 << 1,
+	RNBD_COMPLETE_PATHS	= 1 << 2,
+};
+
+/*
+ * Print the names of the objects @objs of the sides @side which start
+ * with @prefix (NULL for all), one per line. The names are taken from
+ * the sysfs directory listings and links only, no attribute file is read.
+ */
+void rnbd_complete_names(const struct rnbd_ctx *ctx, enum rnbdmode side,
+			 unsigned int objs, const char *prefix);
+
+#endif /* __H_COMPLETE */
@@ -0,0 +1,518 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "misc.h"
+#include "watch.h"
+#include "daemon.h"
+
+extern bool trm;
+
+#define DAEMON_VERSION		1
+#define DAEMON_REQ_MAX		65536
+#define DAEMON_ARGS_MAX		1024
+
+/* stdin, stdout, stderr and the working directory of the caller */
+#define DAEMON_FDS		4
+
+/*
+ * The objects are read again that often in case uevents are not
+ * available or got lost
+ */
+#define DAEMON_RESCAN_MS	10000
+
+/* a request is the header followed by the NUL terminated arguments */
+struct daemon_req {
+	uint32_t	version;
+	uint32_t	flags;
+	uint32_t	argc;
+};
+
+struct daemon_rsp {
+	int32_t		ret;
+	uint32_t	ran;	/* 0 if the caller is to run it by itself */
+};
+
+struct daemon {
+	const struct rnbd_daemon_ops	*ops;
+	const struct rnbd_ctx		*ctx;
+	int				listen_fd;
+	int				uevent_fd;
+	struct rnbd_snapshot		snap;	/* the loaded objects */
+	bool				loaded;
+	bool				dirty;
+	struct timespec			load_ts; /* CLOCK_MONOTONIC */
+	pid_t				*changing; /* children of changes */
+	int				changing_cnt;
+	int				changing_size;
+};
+
+static volatile sig_atomic_t daemon_stop;
+
+static void daemon_sig(int sig)
+{
+	if (sig != SIGCHLD)
+		daemon_stop = 1;
+}
+
+static void set_addr(struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	snprintf(addr->sun_path, sizeof(addr->sun_path), "%s",
+		 RNBD_DAEMON_SOCK);
+}
+
+static int daemon_connect(void)
+{
+	struct sockaddr_un addr;
+	int fd, err;
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	set_addr(&addr);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static int daemon_listen(void)
+{
+	struct sockaddr_un addr;
+	int fd, err;
+
+	if (mkdir(RNBD_LOCK_DIR, 0755) && errno != EEXIST)
+		return -errno;
+
+	fd = daemon_connect();
+	if (fd >= 0) {
+		close(fd);
+		return -EADDRINUSE;
+	}
+	/* left behind by a daemon which didn't exit cleanly */
+	if (fd == -ECONNREFUSED)
+		unlink(RNBD_DAEMON_SOCK);
+
+	fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	set_addr(&addr);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(RNBD_DAEMON_SOCK, 0600) || listen(fd, 64)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static void send_rsp(int conn, int ret, bool ran)
+{
+	struct daemon_rsp rsp = {
+		.ret = ret,
+		.ran = ran,
+	};
+
+	send(conn, &rsp, sizeof(rsp), MSG_NOSIGNAL);
+}
+
+static long long ms_since(const struct timespec *ts)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - ts->tv_sec) * 1000LL +
+	       (now.tv_nsec - ts->tv_nsec) / 1000000;
+}
+
+static int daemon_refresh(struct daemon *d)
+{
+	struct rnbd_snapshot next;
+	int err;
+
+	/*
+	 * A changing command answers its caller before it is reaped, so
+	 * the objects are read for every request while one is running.
+	 */
+	if (d->loaded && !d->dirty && !d->changing_cnt &&
+	    ms_since(&d->load_ts) < DAEMON_RESCAN_MS)
+		return 0;
+
+	/*
+	 * The old objects stay until the new ones are read. If reading
+	 * fails they are kept, the next request tries again.
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &d->load_ts);
+	err = d->ops->load(&next);
+	if (err) {
+		d->dirty = true;
+		return err;
+	}
+
+	if (d->loaded)
+		d->ops->unload(&d->snap);
+	d->snap = next;
+	d->loaded = true;
+	d->dirty = false;
+
+	return 0;
+}
+
+static void daemon_reap(struct daemon *d)
+{
+	pid_t pid;
+	int i;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+		for (i = 0; i < d->changing_cnt; i++) {
+			if (d->changing[i] != pid)
+				continue;
+			d->changing[i] = d->changing[--d->changing_cnt];
+			d->dirty = true;
+			break;
+		}
+}
+
+static int add_changing(struct daemon *d, pid_t pid)
+{
+	pid_t *changing;
+	int size;
+
+	if (d->changing_cnt == d->changing_size) {
+		size = d->changing_size ? d->changing_size * 2 : 16;
+		changing = realloc(d->changing, size * sizeof(*changing));
+		if (!changing)
+			return -ENOMEM;
+		d->changing = changing;
+		d->changing_size = size;
+	}
+	d->changing[d->changing_cnt++] = pid;
+
+	return 0;
+}
+
+static void daemon_child(struct daemon *d, int conn, const int *fds,
+			 int argc, const char *argv[])
+{
+	int fds_tmp[DAEMON_FDS], i, ret;
+
+	signal(SIGCHLD, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	close(d->listen_fd);
+	if (d->uevent_fd >= 0)
+		close(d->uevent_fd);
+
+	/* out of the way of the ones they are to replace */
+	for (i = 0; i < DAEMON_FDS; i++)
+		if (fds[i] < 3)
+			fds_tmp[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 3);
+		else
+			fds_tmp[i] = fds[i];
+	for (i = 0; i < 3; i++)
+		if (dup2(fds_tmp[i], i) < 0)
+			_exit(1);
+	if (fchdir(fds_tmp[3]))
+		_exit(1);
+
+	setvbuf(stdout, NULL, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF, 0);
+
+	ret = d->ops->run(&d->snap, argc, argv);
+
+	fflush(stdout);
+	fflush(stderr);
+	send_rsp(conn, ret, true);
+
+	_exit(0);
+}
+
+/*
+ * Read the request from @conn and fork a child for it. The child answers
+ * when the command is done, the connection is only answered here if the
+ * command isn't run.
+ */
+static void daemon_serve(struct daemon *d, int conn)
+{
+	char buf[DAEMON_REQ_MAX], cbuf[CMSG_SPACE(DAEMON_FDS * sizeof(int))];
+	const char *argv[DAEMON_ARGS_MAX + 1];
+	int fds[DAEMON_FDS], nfds = 0, argc = 0, err = -EPROTO;
+	struct iovec iov = {
+		.iov_base = buf,
+		.iov_len = sizeof(buf),
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	const struct daemon_req *req = (void *)buf;
+	struct cmsghdr *cmsg;
+	char *s, *end;
+	ssize_t len;
+	pid_t pid;
+	int i;
+
+	do {
+		len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	} while (len < 0 && errno == EINTR);
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS && !nfds) {
+			nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (nfds > DAEMON_FDS)
+				nfds = DAEMON_FDS;
+			memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+		}
+
+	if (len < (ssize_t)sizeof(*req) || (msg.msg_flags & MSG_TRUNC) ||
+	    nfds != DAEMON_FDS || req->version != DAEMON_VERSION ||
+	    req->argc > DAEMON_ARGS_MAX)
+		goto reject;
+
+	end = buf + len;
+	for (s = buf + sizeof(*req); s < end && argc < req->argc; argc++) {
+		argv[argc] = s;
+		s = memchr(s, '\0', end - s);
+		if (!s)
+			goto reject;
+		s++;
+	}
+	if (argc != req->argc || s != end)
+		goto reject;
+	argv[argc] = NULL;
+
+	err = daemon_refresh(d);
+	if (err)
+		goto reject;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (!pid)
+		daemon_child(d, conn, fds, argc, argv);
+	if (pid < 0) {
+		err = -errno;
+		goto reject;
+	}
+
+	if (req->flags & RNBD_DAEMON_CHANGE) {
+		/* also if it isn't known when it is done */
+		d->dirty = true;
+		add_changing(d, pid);
+	}
+
+	if (d->ctx->verbose_set) {
+		printf("Process %d:", pid);
+		for (i = 0; i < argc; i++)
+			printf(" %s", argv[i]);
+		printf("\n");
+	}
+	goto out;
+
+reject:
+	send_rsp(conn, err, false);
+out:
+	for (i = 0; i < nfds; i++)
+		close(fds[i]);
+}
+
+int rnbd_daemon(const struct rnbd_daemon_ops *ops,
+		const struct rnbd_ctx *ctx)
+{
+	struct daemon d = {
+		.ops = ops,
+		.ctx = ctx,
+	};
+	struct sigaction sa = {
+		.sa_handler = daemon_sig,
+	};
+	struct pollfd pfd[2];
+	int conn, n, err;
+
+	d.listen_fd = daemon_listen();
+	if (d.listen_fd < 0) {
+		err = d.listen_fd;
+		if (err == -EADDRINUSE)
+			ERR(trm, "Another daemon is listening on %s\n",
+			    RNBD_DAEMON_SOCK);
+		else
+			ERR(trm, "Failed to listen on %s: %s (%d)\n",
+			    RNBD_DAEMON_SOCK, strerror(-err), err);
+		return err;
+	}
+	d.uevent_fd = rnbd_uevent_open();
+
+	/* no SA_RESTART, a child exiting is to interrupt the poll */
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGCHLD, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	err = daemon_refresh(&d);
+	if (err)
+		goto out;
+
+	if (ctx->verbose_set)
+		printf("Listening on %s.\n", RNBD_DAEMON_SOCK);
+
+	pfd[0].fd = d.listen_fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = d.uevent_fd;
+	pfd[1].events = POLLIN;
+
+	while (!daemon_stop) {
+		n = poll(pfd, 2, DAEMON_RESCAN_MS);
+		err = n < 0 ? -errno : 0;
+		daemon_reap(&d);
+		if (err == -EINTR)
+			err = 0;
+		if (err) {
+			ERR(trm, "Failed to poll: %s (%d)\n",
+			    strerror(-err), err);
+			break;
+		}
+		if (n <= 0)
+			continue;
+
+		if ((pfd[1].revents & POLLIN) && rnbd_uevent_drain(d.uevent_fd))
+			d.dirty = true;
+
+		if (!(pfd[0].revents & POLLIN))
+			continue;
+		conn = accept4(d.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0)
+			continue;
+		daemon_serve(&d, conn);
+		close(conn);
+	}
+
+out:
+	unlink(RNBD_DAEMON_SOCK);
+	close(d.listen_fd);
+	if (d.uevent_fd >= 0)
+		close(d.uevent_fd);
+	if (d.loaded)
+		ops->unload(&d.snap);
+	free(d.changing);
+
+	return err;
+}
+
+int rnbd_daemon_call(int argc, const char *argv[], unsigned int flags,
+		     int *ret)
+{
+	char buf[DAEMON_REQ_MAX], cbuf[CMSG_SPACE(DAEMON_FDS * sizeof(int))];
+	struct daemon_req *req = (void *)buf;
+	int fds[DAEMON_FDS] = {
+		STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1
+	};
+	struct iovec iov = {
+		.iov_base = buf,
+	};
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	struct daemon_rsp rsp;
+	struct cmsghdr *cmsg;
+	size_t len, l;
+	ssize_t n;
+	int fd, i, err;
+
+	if (argc > DAEMON_ARGS_MAX)
+		return -E2BIG;
+
+	req->version = DAEMON_VERSION;
+	req->flags = flags;
+	req->argc = argc;
+	len = sizeof(*req);
+	for (i = 0; i < argc; i++) {
+		l = strlen(argv[i]) + 1;
+		if (len + l > sizeof(buf))
+			return -E2BIG;
+		memcpy(buf + len, argv[i], l);
+		len += l;
+	}
+	iov.iov_len = len;
+
+	fd = daemon_connect();
+	if (fd < 0)
+		return fd;
+
+	fds[3] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fds[3] < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	memset(cbuf, 0, sizeof(cbuf));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if (sendmsg(fd, &msg, MSG_NOSIGNAL) < 0) {
+		err = -errno;
+		goto close_cwd;
+	}
+
+	do {
+		n = recv(fd, &rsp, sizeof(rsp), 0);
+	} while (n < 0 && errno == EINTR);
+
+	if (n != sizeof(rsp)) {
+		/* the command may have been run in part */
+		ERR(trm, "Lost connection to the rnbd daemon\n");
+		*ret = -ECONNRESET;
+		err = 0;
+	} else if (!rsp.ran) {
+		err = rsp.ret ? rsp.ret : -EPROTO;
+	} else {
+		*ret = rsp.ret;
+		err = 0;
+	}
+
+close_cwd:
+	close(fds[3]);
+out:
+	close(fd);
+
+	return err;
+}
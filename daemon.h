@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_DAEMON
+#define __H_DAEMON
+
+#include "lock.h"
+#include "rnbd-sysfs.h"
+
+struct rnbd_ctx;
+
+#define RNBD_DAEMON_SOCK	RNBD_LOCK_DIR "/rnbdd.sock"
+
+/* the request may change sessions, read the objects again afterwards */
+#define RNBD_DAEMON_CHANGE	1
+
+struct rnbd_daemon_ops {
+	/* read the objects from sysfs, again whenever they changed */
+	int	(*load)(struct rnbd_snapshot *snap);
+	void	(*unload)(struct rnbd_snapshot *snap);
+	/* run a command, called in a child with the stdio of the caller */
+	int	(*run)(struct rnbd_snapshot *snap, int argc, const char *argv[]);
+};
+
+/*
+ * Serve the commands sent with rnbd_daemon_call() on the Unix socket
+ * RNBD_DAEMON_SOCK until SIGINT or SIGTERM. Only root can connect.
+ *
+ * The objects are loaded once and kept until a uevent of rnbd or rtrs
+ * comes in, a command sent with RNBD_DAEMON_CHANGE started or they are
+ * older than a few seconds. While such a command runs and until it is
+ * reaped, they are read again for every request. Every command runs in a forked child on the
+ * loaded objects, so commands for different sessions run in parallel.
+ * Those for the same session queue up on the session lock.
+ */
+int rnbd_daemon(const struct rnbd_daemon_ops *ops,
+		const struct rnbd_ctx *ctx);
+
+/*
+ * Have the daemon run the command @argv with the stdin, stdout, stderr
+ * and working directory of the caller and wait for it to finish.
+ * Returns 0 and the result of the command in @ret, or a negative error
+ * code if there is no daemon or it didn't run the command.
+ */
+int rnbd_daemon_call(int argc, const char *argv[], unsigned int flags,
+		     int *ret);
+
+#endif /* __H_DAEMON */
@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+#include "hash.h"
+#include "snapshot.h"
+#include "misc.h"
+#include "rnbd-sysfs.h"
+
+/*
+ * Common view on devices, sessions and paths used for the comparison
+ */
+struct diff_item {
+	enum rnbdmode	side;
+	const char	*sessname;
+	const char	*name;
+	const char	*state;
+	int		reconnects;
+	uint64_t	rx_bytes;
+	uint64_t	tx_bytes;
+};
+
+static void sd_to_item(const void *v, struct diff_item *it)
+{
+	const struct rnbd_sess_dev *sd = v;
+
+	it->side = sd->sess->side;
+	it->sessname = sd->sess->sessname;
+	it->name = sd->mapping_path;
+	it->state = sd->dev->state;
+	it->reconnects = 0;
+	it->rx_bytes = *sd->dev->rx_sect << 9;
+	it->tx_bytes = *sd->dev->tx_sect << 9;
+}
+
+static void sess_to_item(const void *v, struct diff_item *it)
+{
+	const struct rnbd_sess *s = v;
+
+	it->side = s->side;
+	it->sessname = s->sessname;
+	it->name = "";
+	it->state = s->act_path_cnt ? "connected" : "disconnected";
+	it->reconnects = s->reconnects;
+	it->rx_bytes = s->rx_bytes;
+	it->tx_bytes = s->tx_bytes;
+}
+
+static void path_to_item(const void *v, struct diff_item *it)
+{
+	const struct rnbd_path *p = v;
+
+	it->side = p->sess->side;
+	it->sessname = p->sess->sessname;
+	it->name = p->pathname;
+	it->state = p->state;
+	it->reconnects = *p->reconnects;
+	it->rx_bytes = *p->rx_bytes;
+	it->tx_bytes = *p->tx_bytes;
+}
+
+static void item_key(char *key, size_t len, const struct diff_item *it)
+{
+	snprintf(key, len, "%c%s %s", it->side == RNBD_CLIENT ? 'c' : 's',
+		 it->sessname, it->name);
+}
+
+/*
+ * Counters start from zero again when an object is recreated
+ */
+static uint64_t counter_delta(uint64_t old, uint64_t new)
+{
+	return new >= old ? new - old : new;
+}
+
+static int collect_items(void **arr[2],
+			 void (*to_item)(const void *v, struct diff_item *it),
+			 struct diff_item **items)
+{
+	int i, j, cnt = 0;
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; arr[i] && arr[i][j]; j++)
+			cnt++;
+
+	*items = calloc(cnt + 1, sizeof(**items));
+	if (!*items)
+		return -ENOMEM;
+
+	for (cnt = 0, i = 0; i < 2; i++)
+		for (j = 0; arr[i] && arr[i][j]; j++)
+			to_item(arr[i][j], &(*items)[cnt++]);
+
+	return cnt;
+}
+
+static void diff_fill(struct rnbd_diff *d, enum rnbd_diff_obj object,
+		      enum rnbd_diff_change change, const struct diff_item *it)
+{
+	memset(d, 0, sizeof(*d));
+	d->object = object;
+	d->change = change;
+	d->side = it->side;
+	d->sessname = it->sessname;
+	d->name = it->name;
+}
+
+/*
+ * Compare one kind of objects. The objects of @old are hashed by key,
+ * every object of @new is then looked up once.
+ */
+static int diff_objects(enum rnbd_diff_obj object, void **old[2],
+			void **new[2], double interval,
+			void (*to_item)(const void *v, struct diff_item *it),
+			struct rnbd_diff *d)
+{
+	struct diff_item *o_items, *n_items, *o, *n;
+	int i, o_cnt, n_cnt, cnt = 0, ret;
+	char key[2 * NAME_MAX + 2];
+	struct rnbd_hash h;
+	bool *seen;
+	void *v;
+
+	o_cnt = collect_items(old, to_item, &o_items);
+	if (o_cnt < 0)
+		return o_cnt;
+
+	n_cnt = collect_items(new, to_item, &n_items);
+	if (n_cnt < 0) {
+		ret = n_cnt;
+		goto free_old;
+	}
+
+	ret = -ENOMEM;
+	seen = calloc(o_cnt + 1, sizeof(*seen));
+	if (!seen)
+		goto free_new;
+
+	ret = rnbd_hash_init(&h, o_cnt);
+	if (ret)
+		goto free_seen;
+
+	for (i = 0; i < o_cnt; i++) {
+		item_key(key, sizeof(key), &o_items[i]);
+		ret = rnbd_hash_add(&h, key, (void *)(uintptr_t)(i + 1));
+		if (ret)
+			goto free_hash;
+	}
+
+	for (i = 0; i < n_cnt; i++) {
+		n = &n_items[i];
+		item_key(key, sizeof(key), n);
+		v = rnbd_hash_find(&h, key);
+		if (!v) {
+			diff_fill(&d[cnt], object, DIFF_APPEARED, n);
+			d[cnt++].new_state = n->state;
+			continue;
+		}
+
+		o = &o_items[(uintptr_t)v - 1];
+		seen[(uintptr_t)v - 1] = true;
+
+		diff_fill(&d[cnt], object, DIFF_CHANGED, n);
+		d[cnt].old_state = o->state;
+		d[cnt].new_state = n->state;
+		d[cnt].reconnects = counter_delta(o->reconnects,
+						  n->reconnects);
+		d[cnt].rx_bytes = counter_delta(o->rx_bytes, n->rx_bytes);
+		d[cnt].tx_bytes = counter_delta(o->tx_bytes, n->tx_bytes);
+		if (interval > 0) {
+			d[cnt].rx_rate = d[cnt].rx_bytes / interval;
+			d[cnt].tx_rate = d[cnt].tx_bytes / interval;
+		}
+
+		if (strcmp(o->state, n->state) || d[cnt].reconnects ||
+		    d[cnt].rx_bytes || d[cnt].tx_bytes)
+			cnt++;
+	}
+
+	for (i = 0; i < o_cnt; i++) {
+		if (seen[i])
+			continue;
+
+		diff_fill(&d[cnt], object, DIFF_DISAPPEARED, &o_items[i]);
+		d[cnt++].old_state = o_items[i].state;
+	}
+	ret = cnt;
+
+free_hash:
+	rnbd_hash_free(&h);
+free_seen:
+	free(seen);
+free_new:
+	free(n_items);
+free_old:
+	free(o_items);
+
+	return ret;
+}
+
+double rnbd_diff_interval(const struct rnbd_snapshot *old,
+			  const struct rnbd_snapshot *new)
+{
+	return (new->ts.tv_sec - old->ts.tv_sec) +
+	       (new->ts.tv_nsec - old->ts.tv_nsec) / 1e9;
+}
+
+static int snap_obj_cnt(const struct rnbd_snapshot *snap)
+{
+	void **arr[] = {
+		(void **)snap->sds_clt, (void **)snap->sds_srv,
+		(void **)snap->sess_clt, (void **)snap->sess_srv,
+		(void **)snap->paths_clt, (void **)snap->paths_srv,
+	};
+	int i, j, cnt = 0;
+
+	for (i = 0; i < ARRSIZE(arr); i++)
+		for (j = 0; arr[i] && arr[i][j]; j++)
+			cnt++;
+
+	return cnt;
+}
+
+int rnbd_diff(const struct rnbd_snapshot *old,
+	      const struct rnbd_snapshot *new,
+	      struct rnbd_diff **diffs)
+{
+	void **old_sds[2] = { (void **)old->sds_clt, (void **)old->sds_srv };
+	void **new_sds[2] = { (void **)new->sds_clt, (void **)new->sds_srv };
+	void **old_sess[2] = { (void **)old->sess_clt, (void **)old->sess_srv };
+	void **new_sess[2] = { (void **)new->sess_clt, (void **)new->sess_srv };
+	void **old_paths[2] = { (void **)old->paths_clt,
+				(void **)old->paths_srv };
+	void **new_paths[2] = { (void **)new->paths_clt,
+				(void **)new->paths_srv };
+	double interval = rnbd_diff_interval(old, new);
+	struct rnbd_diff *d;
+	int ret, cnt = 0;
+
+	/* every object produces at most one entry */
+	d = calloc(snap_obj_cnt(old) + snap_obj_cnt(new) + 1, sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+
+	ret = diff_objects(DIFF_DEVICE, old_sds, new_sds, interval,
+			   sd_to_item, d + cnt);
+	if (ret < 0)
+		goto err;
+	cnt += ret;
+
+	ret = diff_objects(DIFF_SESSION, old_sess, new_sess, interval,
+			   sess_to_item, d + cnt);
+	if (ret < 0)
+		goto err;
+	cnt += ret;
+
+	ret = diff_objects(DIFF_PATH, old_paths, new_paths, interval,
+			   path_to_item, d + cnt);
+	if (ret < 0)
+		goto err;
+	cnt += ret;
+
+	*diffs = d;
+
+	return cnt;
+
+err:
+	free(d);
+
+	return ret;
+}
+
+static const char * const diff_objects_str[] = {
+	[DIFF_DEVICE] = "device",
+	[DIFF_SESSION] = "session",
+	[DIFF_PATH] = "path",
+};
+
+static const char * const diff_changes_str[] = {
+	[DIFF_APPEARED] = "appeared",
+	[DIFF_DISAPPEARED] = "disappeared",
+	[DIFF_CHANGED] = "changed",
+};
+
+int diff_object_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		       enum color *clr, void *v, bool humanize)
+{
+	*clr = CNRM;
+
+	return snprintf(str, len, "%s",
+			diff_objects_str[*(enum rnbd_diff_obj *)v]);
+}
+
+int diff_side_to_direction(char *str, size_t len, const struct rnbd_ctx *ctx,
+			   enum color *clr, void *v, bool humanize)
+{
+	*clr = CNRM;
+
+	if (*(int *)v == RNBD_CLIENT)
+		return snprintf(str, len, "outgoing");
+	else
+		return snprintf(str, len, "incoming");
+}
+
+int diff_change_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		       enum color *clr, void *v, bool humanize)
+{
+	enum rnbd_diff_change change = *(enum rnbd_diff_change *)v;
+
+	switch (change) {
+	case DIFF_APPEARED:
+		*clr = CGRN;
+		break;
+	case DIFF_DISAPPEARED:
+		*clr = CRED;
+		break;
+	default:
+		*clr = CNRM;
+		break;
+	}
+
+	return snprintf(str, len, "%s", diff_changes_str[change]);
+}
+
+int diff_strp_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		     enum color *clr, void *v, bool humanize)
+{
+	const char *s = *(const char **)v;
+
+	*clr = CNRM;
+
+	return snprintf(str, len, "%s", s ? s : "");
+}
+
+int diff_state_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		      enum color *clr, void *v, bool humanize)
+{
+	const char *s = *(const char **)v;
+
+	if (!s)
+		s = "";
+
+	if (!strcmp(s, "connected") || !strcmp(s, "open"))
+		*clr = CGRN;
+	else if (*s)
+		*clr = CRED;
+	else
+		*clr = CNRM;
+
+	return snprintf(str, len, "%s", s);
+}
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_DIFF
+#define __H_DIFF
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+struct rnbd_snapshot;
+
+enum rnbd_diff_obj {
+	DIFF_DEVICE,
+	DIFF_SESSION,
+	DIFF_PATH,
+};
+
+enum rnbd_diff_change {
+	DIFF_APPEARED,
+	DIFF_DISAPPEARED,
+	DIFF_CHANGED,
+};
+
+/*
+ * Difference of a single object between two snapshots.
+ * The strings point into the snapshots the diff was computed from.
+ */
+struct rnbd_diff {
+	enum rnbd_diff_obj	object;
+	int			side;		/* enum rnbdmode */
+	enum rnbd_diff_change	change;
+	const char		*sessname;
+	const char		*name;		/* pathname or mapping path */
+	const char		*old_state;
+	const char		*new_state;
+	int			reconnects;	/* reconnects increment */
+	uint64_t		rx_bytes;	/* bytes received in between */
+	uint64_t		tx_bytes;	/* bytes sent in between */
+	uint64_t		rx_rate;	/* bytes per second */
+	uint64_t		tx_rate;	/* bytes per second */
+};
+
+/*
+ * Compare the snapshots @old and @new.
+ *
+ * Devices, sessions and paths which appeared, disappeared, changed state,
+ * reconnected or transferred data are stored into @diffs. Objects are
+ * matched by session name, path name and mapping path.
+ *
+ * Returns the number of entries in @diffs or negative error code.
+ * @diffs has to be freed by the caller.
+ */
+int rnbd_diff(const struct rnbd_snapshot *old,
+	      const struct rnbd_snapshot *new,
+	      struct rnbd_diff **diffs);
+
+double rnbd_diff_interval(const struct rnbd_snapshot *old,
+			  const struct rnbd_snapshot *new);
+
+int diff_object_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		       enum color *clr, void *v, bool humanize);
+
+int diff_side_to_direction(char *str, size_t len, const struct rnbd_ctx *ctx,
+			   enum color *clr, void *v, bool humanize);
+
+int diff_change_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		       enum color *clr, void *v, bool humanize);
+
+int diff_strp_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		     enum color *clr, void *v, bool humanize);
+
+int diff_state_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		      enum color *clr, void *v, bool humanize);
+
+#endif /* __H_DIFF */
@@ -0,0 +1,411 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>	/* for strcasecmp() */
+
+#include "table.h"
+#include "misc.h"
+#include "filter.h"
+
+extern bool trm;
+
+static const struct {
+	const char		*str;
+	enum rnbd_filter_op	op;
+} ops[] = {
+	{"!=", FILTER_NE},
+	{"<=", FILTER_LE},
+	{">=", FILTER_GE},
+	{"==", FILTER_EQ},
+	{"=", FILTER_EQ},
+	{"<", FILTER_LT},
+	{">", FILTER_GT},
+};
+
+/*
+ * The expression is read token by token from the words on the command
+ * line, a word may hold a whole condition or only a part of it.
+ */
+struct lexer {
+	int		argc;
+	const char	**argv;
+	int		word;	/* current word */
+	const char	*p;	/* position in the current word */
+};
+
+/*
+ * Skip spaces, continue with the next word if @cross is set.
+ * Returns NULL at the end of the current word or of all the words.
+ */
+static const char *lex_skip(struct lexer *l, bool cross)
+{
+	for (;;) {
+		while (isspace(*l->p))
+			l->p++;
+
+		if (*l->p || !cross || l->word + 1 >= l->argc)
+			return *l->p ? l->p : NULL;
+
+		l->p = l->argv[++l->word];
+	}
+}
+
+static int lex_copy(char *dst, size_t size, const char *src, size_t len)
+{
+	if (!len || len >= size)
+		return -EINVAL;
+
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+
+	return 0;
+}
+
+static int lex_name(struct lexer *l, char *name, size_t size)
+{
+	const char *s = lex_skip(l, true);
+	size_t len = 0;
+
+	if (!s) {
+		ERR(trm, "Field name expected in where clause\n");
+		return -EINVAL;
+	}
+
+	while (isalnum(s[len]) || s[len] == '_')
+		len++;
+
+	if (lex_copy(name, size, s, len)) {
+		ERR(trm, "Invalid field name '%s' in where clause\n", s);
+		return -EINVAL;
+	}
+	l->p = s + len;
+
+	return 0;
+}
+
+static int lex_op(struct lexer *l, enum rnbd_filter_op *op)
+{
+	const char *s = lex_skip(l, true);
+	int i;
+
+	for (i = 0; s && i < ARRSIZE(ops); i++)
+		if (!strncmp(s, ops[i].str, strlen(ops[i].str))) {
+			*op = ops[i].op;
+			l->p = s + strlen(ops[i].str);
+			return 0;
+		}
+
+	ERR(trm, "Comparison operator (=, !=, <, <=, >, >=) expected in where clause\n");
+
+	return -EINVAL;
+}
+
+static int lex_value(struct lexer *l, char *str, size_t size)
+{
+	const char *s = lex_skip(l, true);
+	size_t len = 0;
+
+	if (!s) {
+		ERR(trm, "Value expected in where clause\n");
+		return -EINVAL;
+	}
+
+	while (s[len] && !isspace(s[len]))
+		len++;
+
+	if (lex_copy(str, size, s, len)) {
+		ERR(trm, "Value '%s' in where clause is too long\n", s);
+		return -EINVAL;
+	}
+	l->p = s + len;
+
+	return 0;
+}
+
+static bool is_word(const char *s, const char *word)
+{
+	size_t len = strlen(word);
+
+	return !strncasecmp(s, word, len) && (!s[len] || isspace(s[len]));
+}
+
+/*
+ * Consume "and" or "or" following a condition. Returns 1 for "or",
+ * 0 for "and" and -ENOENT if the expression ends here.
+ */
+static int lex_conj(struct lexer *l)
+{
+	const char *s = lex_skip(l, false);
+	int ret;
+
+	if (!s) {
+		/* the conjunction may start the next word */
+		if (l->word + 1 >= l->argc)
+			return -ENOENT;
+		s = l->argv[l->word + 1];
+		if (!is_word(s, "and") && !is_word(s, "or"))
+			return -ENOENT;
+		l->p = s;
+		l->word++;
+	}
+
+	if (is_word(s, "and"))
+		ret = 0;
+	else if (is_word(s, "or"))
+		ret = 1;
+	else {
+		ERR(trm, "'and' or 'or' expected in where clause instead of '%s'\n",
+		    s);
+		return -EINVAL;
+	}
+	l->p = s + (ret ? 2 : 3);
+
+	return ret;
+}
+
+int rnbd_filter_parse(struct rnbd_filter *f, int argc, const char *argv[])
+{
+	struct lexer l = { .argc = argc, .argv = argv, .word = 0 };
+	struct rnbd_filter_cond *c;
+	bool or = false;
+	int ret;
+
+	memset(f, 0, sizeof(*f));
+
+	if (!argc) {
+		ERR(trm, "Please specify an expression after 'where'\n");
+		return -EINVAL;
+	}
+	l.p = argv[0];
+
+	for (;;) {
+		if (f->cnt == RNBD_FILTER_MAX_CONDS) {
+			ERR(trm, "Too many conditions in where clause (max %d)\n",
+			    RNBD_FILTER_MAX_CONDS);
+			return -EINVAL;
+		}
+		c = &f->conds[f->cnt++];
+		c->or = or;
+
+		ret = lex_name(&l, c->name, sizeof(c->name));
+		if (!ret)
+			ret = lex_op(&l, &c->op);
+		if (!ret)
+			ret = lex_value(&l, c->str, sizeof(c->str));
+		if (ret)
+			return ret;
+
+		ret = lex_conj(&l);
+		if (ret == -ENOENT)
+			break;
+		if (ret < 0)
+			return ret;
+		or = ret;
+	}
+
+	return l.word + 1;
+}
+
+static int parse_num(const char *str, int64_t *val)
+{
+	char *end;
+	int shift;
+
+	*val = strtoll(str, &end, 10);
+	if (end == str)
+		return -EINVAL;
+
+	if (*end) {
+		if (get_unit_shift(end, &shift))
+			return -EINVAL;
+		*val <<= shift;
+	}
+
+	return 0;
+}
+
+enum rnbd_filter_load rnbd_filter_load_of(const struct table_column *clm)
+{
+	/* read the numbers directly where the layout is known */
+	if (clm->m_tostr == byte_ptr_to_str)
+		return FILTER_LOAD_U64_PTR;
+	if (clm->m_tostr == int_ptr_to_str)
+		return FILTER_LOAD_INT_PTR;
+	if (clm->m_tostr == byte_to_str)
+		return FILTER_LOAD_U64;
+	if (clm->m_tostr)
+		return FILTER_LOAD_TOSTR;
+	if (clm->m_type == FLD_LLU)
+		return FILTER_LOAD_U64;
+	if (clm->m_type == FLD_STR)
+		return FILTER_LOAD_STR;
+
+	return FILTER_LOAD_INT;
+}
+
+/*
+ * Sectors are displayed in bytes, so they are compared in bytes as well:
+ * "rx_sect>4K" holds for a device which shows more than 4K received.
+ */
+static int unit_shift_of(const struct table_column *clm)
+{
+	if (clm->m_tostr == sect_to_str || clm->m_tostr == sd_rx_to_str ||
+	    clm->m_tostr == sd_tx_to_str)
+		return 9;
+
+	return 0;
+}
+
+int rnbd_filter_bind(struct rnbd_filter *f, struct table_column **all,
+		     const char **bad)
+{
+	struct rnbd_filter_cond *c;
+	int i;
+
+	for (i = 0; i < f->cnt; i++) {
+		c = &f->conds[i];
+
+		c->clm = table_find_column(c->name, all);
+		if (!c->clm) {
+			*bad = c->name;
+			return -ENOENT;
+		}
+
+		c->num = c->clm->m_type != FLD_STR &&
+			 !parse_num(c->str, &c->val);
+
+		c->load = rnbd_filter_load_of(c->clm);
+		c->shift = unit_shift_of(c->clm);
+
+		if (!c->num && c->load != FILTER_LOAD_TOSTR &&
+		    c->load != FILTER_LOAD_STR) {
+			*bad = c->str;
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+unsigned int rnbd_filter_attrs(const struct rnbd_filter *f)
+{
+	unsigned int attrs = 0;
+	int i;
+
+	for (i = 0; i < f->cnt; i++)
+		if (f->conds[i].clm)
+			attrs |= f->conds[i].clm->m_attrs;
+
+	return attrs;
+}
+
+static bool op_match(enum rnbd_filter_op op, int cmp)
+{
+	switch (op) {
+	case FILTER_EQ:
+		return cmp == 0;
+	case FILTER_NE:
+		return cmp != 0;
+	case FILTER_LT:
+		return cmp < 0;
+	case FILTER_LE:
+		return cmp <= 0;
+	case FILTER_GT:
+		return cmp > 0;
+	case FILTER_GE:
+	default:
+		return cmp >= 0;
+	}
+}
+
+bool rnbd_filter_fetch(const struct table_column *clm,
+		       enum rnbd_filter_load load, bool num, void *s,
+		       const struct rnbd_ctx *ctx, char *buf,
+		       int64_t *n, const char **str)
+{
+	void *v = (char *)s + clm->s_off + clm->m_offset;
+	enum color clr;
+	char *end;
+
+	switch (load) {
+	case FILTER_LOAD_INT:
+		*n = *(int *)v;
+		break;
+	case FILTER_LOAD_U64:
+		*n = *(uint64_t *)v;
+		break;
+	case FILTER_LOAD_INT_PTR:
+		*n = **(int **)v;
+		break;
+	case FILTER_LOAD_U64_PTR:
+		*n = **(uint64_t **)v;
+		break;
+	case FILTER_LOAD_STR:
+		*str = v;
+		break;
+	case FILTER_LOAD_TOSTR:
+	default:
+		/* the raw number is printed when not humanized */
+		buf[0] = '\0';
+		clm->m_tostr(buf, CLM_MAX_WIDTH, ctx, &clr, v, false);
+		*str = buf;
+		if (!num)
+			break;
+
+		*n = strtoll(buf, &end, 10);
+		if (end == buf)
+			return false;
+		break;
+	}
+
+	return true;
+}
+
+static bool cond_match(const struct rnbd_filter_cond *c, void *s,
+		       const struct rnbd_ctx *ctx)
+{
+	char buf[CLM_MAX_WIDTH];
+	const char *str;
+	int64_t n;
+
+	if (!rnbd_filter_fetch(c->clm, c->load, c->num, s, ctx, buf,
+			       &n, &str))
+		return false;
+
+	if (!c->num)
+		return op_match(c->op, strcmp(str, c->str));
+
+	n <<= c->shift;
+
+	return op_match(c->op, (n > c->val) - (n < c->val));
+}
+
+bool rnbd_filter_match(const struct rnbd_filter *f, void *s,
+		       const struct rnbd_ctx *ctx)
+{
+	bool match = true;
+	int i;
+
+	for (i = 0; i < f->cnt; i++) {
+		if (f->conds[i].or) {
+			if (match)
+				return true;
+			match = true;
+		}
+		/* skip the rest of a conjunction which is false already */
+		if (match)
+			match = cond_match(&f->conds[i], s, ctx);
+	}
+
+	return match;
+}
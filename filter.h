@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_FILTER
+#define __H_FILTER
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "table.h"
+
+#define RNBD_FILTER_MAX_CONDS	16
+#define RNBD_FILTER_NAME_LEN	32
+
+enum rnbd_filter_op {
+	FILTER_EQ,
+	FILTER_NE,
+	FILTER_LT,
+	FILTER_LE,
+	FILTER_GT,
+	FILTER_GE,
+};
+
+/* how the value of a column is fetched from an object */
+enum rnbd_filter_load {
+	FILTER_LOAD_INT,	/* int field */
+	FILTER_LOAD_U64,	/* uint64_t field */
+	FILTER_LOAD_INT_PTR,	/* pointer to int */
+	FILTER_LOAD_U64_PTR,	/* pointer to uint64_t */
+	FILTER_LOAD_STR,	/* char array */
+	FILTER_LOAD_TOSTR,	/* anything else, through m_tostr() */
+};
+
+/*
+ * A single comparison "<column><op><value>"
+ */
+struct rnbd_filter_cond {
+	char			name[RNBD_FILTER_NAME_LEN];
+	enum rnbd_filter_op	op;
+	char			str[CLM_MAX_WIDTH];
+	bool			or;	/* preceded by "or" */
+
+	/* set by rnbd_filter_bind() */
+	const struct table_column *clm;
+	enum rnbd_filter_load	load;
+	bool			num;	/* compare as numbers */
+	int			shift;	/* to the displayed unit, e.g. bytes */
+	int64_t			val;
+};
+
+/*
+ * Compiled where clause: "and" binds tighter than "or", so the conditions
+ * are a disjunction of conjunctions, each "or" starts a new conjunction.
+ */
+struct rnbd_filter {
+	struct rnbd_filter_cond	conds[RNBD_FILTER_MAX_CONDS];
+	int			cnt;
+};
+
+/*
+ * Parse the expression in the words @argv, e.g.
+ * "state!=connected and reconnects>0" given as one or several words.
+ * The expression ends with the first value not followed by "and" or "or".
+ * Returns the number of words consumed or negative error code.
+ */
+int rnbd_filter_parse(struct rnbd_filter *f, int argc, const char *argv[]);
+
+/*
+ * Resolve the column names of @f in the NULL terminated array @all.
+ * On -ENOENT @bad points to the name which couldn't be found.
+ */
+int rnbd_filter_bind(struct rnbd_filter *f, struct table_column **all,
+		     const char **bad);
+
+/*
+ * sysfs attributes needed by the columns of a bound filter
+ */
+unsigned int rnbd_filter_attrs(const struct rnbd_filter *f);
+
+/*
+ * How the value of column @clm is fetched
+ */
+enum rnbd_filter_load rnbd_filter_load_of(const struct table_column *clm);
+
+/*
+ * Fetch the value of column @clm from the object @s: into @n if @num is
+ * set, otherwise into @str, which may point to @buf of CLM_MAX_WIDTH
+ * bytes. Returns false if the column doesn't hold a number.
+ */
+bool rnbd_filter_fetch(const struct table_column *clm,
+		       enum rnbd_filter_load load, bool num, void *s,
+		       const struct rnbd_ctx *ctx, char *buf,
+		       int64_t *n, const char **str);
+
+/*
+ * Evaluate the bound filter @f on the object @s
+ */
+bool rnbd_filter_match(const struct rnbd_filter *f, void *s,
+		       const struct rnbd_ctx *ctx);
+
+#endif /* __H_FILTER */
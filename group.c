@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+#include "misc.h"
+#include "hash.h"
+#include "group.h"
+
+static bool is_sum(const struct table_column *c,
+		   const struct table_column *key)
+{
+	return c != key && (c->m_type == FLD_INT || c->m_type == FLD_LLU);
+}
+
+unsigned int rnbd_group_attrs(const struct table_column *key,
+			      struct table_column **all)
+{
+	unsigned int attrs = key->m_attrs;
+	int i;
+
+	for (i = 0; all[i]; i++)
+		if (is_sum(all[i], key))
+			attrs |= all[i]->m_attrs;
+
+	return attrs;
+}
+
+static void clm_init(struct table_column *c, const char *name,
+		     const char *header, enum fld_type type,
+		     unsigned long offset, char align)
+{
+	memset(c, 0, sizeof(*c));
+	c->m_name = name;
+	snprintf(c->m_header, sizeof(c->m_header), "%s", header);
+	c->hdr_width = strlen(c->m_header);
+	c->m_width = c->hdr_width;
+	c->m_type = type;
+	c->m_offset = offset;
+	c->clm_align = align;
+	c->hdr_color = CNRM;
+	c->clm_color = CNRM;
+}
+
+/*
+ * The sums are kept as plain numbers, show them the way the column of the
+ * objects does.
+ */
+static void set_sum_tostr(struct table_column *c,
+			  const struct table_column *src)
+{
+	if (src->m_tostr == byte_to_str || src->m_tostr == byte_ptr_to_str)
+		c->m_tostr = byte_to_str;
+	else if (src->m_tostr == sd_rx_to_str || src->m_tostr == sd_tx_to_str)
+		c->m_tostr = sect_to_str;
+}
+
+static int init_clms(struct rnbd_grouping *g, const struct table_column *key,
+		     struct table_column **all, const struct rnbd_ctx *ctx)
+{
+	struct table_column *c = g->clms;
+	int i, n = 0;
+
+	clm_init(c, key->m_name, key->m_header, FLD_STR,
+		 offsetof(struct rnbd_group, key), 'l');
+	c->m_descr = key->m_descr;
+	c->clm_color = key->clm_color;
+	g->cs[n++] = c++;
+
+	clm_init(c, "count", "Count", FLD_LLU,
+		 offsetof(struct rnbd_group, cnt), 'r');
+	c->m_descr = "Number of objects in the group";
+	g->cs[n++] = c++;
+
+	for (i = 0; all[i]; i++) {
+		if (!is_sum(all[i], key))
+			continue;
+		if (g->sum_cnt == RNBD_GROUP_MAX_SUMS)
+			return -E2BIG;
+
+		clm_init(c, all[i]->m_name,
+			 table_layout_header(ctx->layout, all[i]), FLD_LLU,
+			 offsetof(struct rnbd_group, sums[g->sum_cnt]),
+			 all[i]->clm_align);
+		c->m_descr = all[i]->m_descr;
+		set_sum_tostr(c, all[i]);
+		c->m_attrs = all[i]->m_attrs;
+		g->cs[n++] = c++;
+
+		g->srcs[g->sum_cnt] = all[i];
+		g->loads[g->sum_cnt++] = rnbd_filter_load_of(all[i]);
+	}
+	g->cs[n] = NULL;
+
+	return 0;
+}
+
+static void fetch_key(const struct table_column *key, void *obj,
+		      const struct rnbd_ctx *ctx, char *buf)
+{
+	enum rnbd_filter_load load = rnbd_filter_load_of(key);
+	bool num = key->m_type != FLD_STR;
+	const char *str = buf;
+	int64_t n;
+
+	if (rnbd_filter_fetch(key, load, num, obj, ctx, buf, &n, &str) && num)
+		snprintf(buf, CLM_MAX_WIDTH, "%" PRId64, n);
+	else if (str != buf)
+		snprintf(buf, CLM_MAX_WIDTH, "%s", str);
+}
+
+/*
+ * Returns the index of the new group in @store. The index is kept in the
+ * hash, as @store moves when it grows.
+ */
+static int add_group(struct rnbd_grouping *g, struct rnbd_hash *idx,
+		     const char *key, int *size)
+{
+	struct rnbd_group *store;
+
+	if (g->cnt == *size) {
+		store = realloc(g->store, *size * 2 * sizeof(*store));
+		if (!store)
+			return -ENOMEM;
+		g->store = store;
+		*size *= 2;
+	}
+
+	memset(&g->store[g->cnt], 0, sizeof(*g->store));
+	snprintf(g->store[g->cnt].key, CLM_MAX_WIDTH, "%s", key);
+	if (rnbd_hash_add(idx, key, (void *)(uintptr_t)(g->cnt + 1)))
+		return -ENOMEM;
+
+	return g->cnt++;
+}
+
+int rnbd_group_objs(struct rnbd_grouping *g, const struct table_column *key,
+		    struct table_column **all, void **objs, int cnt,
+		    const struct rnbd_ctx *ctx)
+{
+	char buf[CLM_MAX_WIDTH];
+	struct rnbd_group *grp;
+	struct rnbd_hash idx;
+	int i, j, pos, size = 16;
+	void *val;
+	const char *str;
+	int64_t n;
+	int err;
+
+	memset(g, 0, sizeof(*g));
+
+	err = init_clms(g, key, all, ctx);
+	if (err)
+		return err;
+
+	g->store = malloc(size * sizeof(*g->store));
+	if (!g->store)
+		return -ENOMEM;
+
+	err = rnbd_hash_init(&idx, cnt);
+	if (err)
+		goto err;
+
+	for (i = 0; i < cnt; i++) {
+		fetch_key(key, objs[i], ctx, buf);
+
+		val = rnbd_hash_find(&idx, buf);
+		if (val)
+			pos = (uintptr_t)val - 1;
+		else
+			pos = add_group(g, &idx, buf, &size);
+		if (pos < 0) {
+			err = pos;
+			goto free_idx;
+		}
+		grp = &g->store[pos];
+
+		grp->cnt++;
+
+		for (j = 0; j < g->sum_cnt; j++)
+			if (rnbd_filter_fetch(g->srcs[j], g->loads[j], true,
+					      objs[i], ctx, buf, &n, &str))
+				grp->sums[j] += n;
+	}
+
+	rnbd_hash_free(&idx);
+
+	g->groups = calloc(g->cnt + 1, sizeof(*g->groups));
+	if (!g->groups) {
+		err = -ENOMEM;
+		goto err;
+	}
+
+	for (i = 0; i < g->cnt; i++)
+		g->groups[i] = &g->store[i];
+
+	rnbd_group_total(g);
+
+	return 0;
+
+free_idx:
+	rnbd_hash_free(&idx);
+err:
+	rnbd_group_free(g);
+
+	return err;
+}
+
+void rnbd_group_total(struct rnbd_grouping *g)
+{
+	struct rnbd_group **grp;
+	int j;
+
+	memset(&g->total, 0, sizeof(g->total));
+
+	for (grp = g->groups; *grp; grp++) {
+		g->total.cnt += (*grp)->cnt;
+		for (j = 0; j < g->sum_cnt; j++)
+			g->total.sums[j] += (*grp)->sums[j];
+	}
+}
+
+void rnbd_group_free(struct rnbd_grouping *g)
+{
+	free(g->groups);
+	free(g->store);
+	g->groups = NULL;
+	g->store = NULL;
+	g->cnt = 0;
+}
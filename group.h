@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_GROUP
+#define __H_GROUP
+
+#include <stdint.h>
+
+#include "table.h"
+#include "filter.h"
+
+#define RNBD_GROUP_MAX_SUMS	16
+
+/*
+ * Objects with the same value of the group column
+ */
+struct rnbd_group {
+	char		key[CLM_MAX_WIDTH];
+	uint64_t	cnt;
+	uint64_t	sums[RNBD_GROUP_MAX_SUMS];
+};
+
+/*
+ * The groups and the columns to list them: the group column, the number
+ * of objects and the sums of the numeric columns of the objects.
+ */
+struct rnbd_grouping {
+	struct table_column	clms[RNBD_GROUP_MAX_SUMS + 2];
+	struct table_column	*cs[RNBD_GROUP_MAX_SUMS + 3];
+	/* the columns of the objects summed up */
+	const struct table_column *srcs[RNBD_GROUP_MAX_SUMS];
+	enum rnbd_filter_load	loads[RNBD_GROUP_MAX_SUMS];
+	int			sum_cnt;
+	struct rnbd_group	*store;
+	struct rnbd_group	**groups;	/* NULL terminated, in @store */
+	int			cnt;
+	struct rnbd_group	total;
+};
+
+/*
+ * sysfs attributes needed to group by @key the objects with columns @all
+ */
+unsigned int rnbd_group_attrs(const struct table_column *key,
+			      struct table_column **all);
+
+/*
+ * Group the @cnt objects @objs by the value of column @key in one pass.
+ * Groups are kept in the order they are first seen.
+ */
+int rnbd_group_objs(struct rnbd_grouping *g, const struct table_column *key,
+		    struct table_column **all, void **objs, int cnt,
+		    const struct rnbd_ctx *ctx);
+
+/*
+ * Sum up the groups left in @g->groups into @g->total
+ */
+void rnbd_group_total(struct rnbd_grouping *g);
+
+void rnbd_group_free(struct rnbd_grouping *g);
+
+#endif /* __H_GROUP */
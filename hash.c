@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+
+/* FNV-1a */
+uint32_t rnbd_hash_str(const char *str)
+{
+	uint32_t h = 2166136261u;
+
+	while (*str) {
+		h ^= (unsigned char)*str++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+static int rnbd_hash_resize(struct rnbd_hash *h, size_t size)
+{
+	struct rnbd_hash_ent *ents, *e;
+	size_t i, j, mask = size - 1;
+
+	ents = calloc(size, sizeof(*ents));
+	if (!ents)
+		return -ENOMEM;
+
+	for (i = 0; i < h->size; i++) {
+		e = &h->ents[i];
+		if (!e->key)
+			continue;
+
+		for (j = e->hash & mask; ents[j].key; j = (j + 1) & mask)
+			;
+		ents[j] = *e;
+	}
+
+	free(h->ents);
+	h->ents = ents;
+	h->size = size;
+
+	return 0;
+}
+
+int rnbd_hash_init(struct rnbd_hash *h, size_t nelem)
+{
+	size_t size = 16;
+
+	/* keep the load factor below one half */
+	while (size < nelem * 2)
+		size <<= 1;
+
+	h->ents = NULL;
+	h->size = 0;
+	h->cnt = 0;
+
+	return rnbd_hash_resize(h, size);
+}
+
+void rnbd_hash_free(struct rnbd_hash *h)
+{
+	size_t i;
+
+	for (i = 0; i < h->size; i++)
+		free(h->ents[i].key);
+
+	free(h->ents);
+	h->ents = NULL;
+	h->size = 0;
+	h->cnt = 0;
+}
+
+int rnbd_hash_add(struct rnbd_hash *h, const char *key, void *val)
+{
+	uint32_t hash = rnbd_hash_str(key);
+	size_t i, mask;
+	int ret;
+
+	if ((h->cnt + 1) * 2 > h->size) {
+		ret = rnbd_hash_resize(h, h->size ? h->size * 2 : 16);
+		if (ret)
+			return ret;
+	}
+
+	mask = h->size - 1;
+	for (i = hash & mask; h->ents[i].key; i = (i + 1) & mask)
+		;
+
+	h->ents[i].key = strdup(key);
+	if (!h->ents[i].key)
+		return -ENOMEM;
+
+	h->ents[i].hash = hash;
+	h->ents[i].val = val;
+	h->cnt++;
+
+	return 0;
+}
+
+void *rnbd_hash_find_next(const struct rnbd_hash *h, const char *key,
+			  size_t *pos)
+{
+	uint32_t hash = rnbd_hash_str(key);
+	const struct rnbd_hash_ent *e;
+	size_t mask = h->size - 1;
+
+	if (!h->size)
+		return NULL;
+
+	for (e = &h->ents[(hash + *pos) & mask]; e->key;
+	     e = &h->ents[(hash + *pos) & mask]) {
+		(*pos)++;
+		if (e->hash == hash && !strcmp(e->key, key))
+			return e->val;
+	}
+
+	return NULL;
+}
+
+void *rnbd_hash_find(const struct rnbd_hash *h, const char *key)
+{
+	size_t pos = 0;
+
+	return rnbd_hash_find_next(h, key, &pos);
+}
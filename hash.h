@@ -0,0 +1,58 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_HASH
+#define __H_HASH
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Open addressing hash table with string keys.
+ *
+ * Keys are copied into the table, values are opaque pointers owned by
+ * the caller. The same key can be added more than once, all the values
+ * stored under a key are returned by rnbd_hash_find_next().
+ */
+struct rnbd_hash_ent {
+	uint32_t	hash;
+	char		*key;
+	void		*val;
+};
+
+struct rnbd_hash {
+	struct rnbd_hash_ent	*ents;
+	size_t			size;	/* number of slots, power of two */
+	size_t			cnt;	/* number of used slots */
+};
+
+uint32_t rnbd_hash_str(const char *str);
+
+/*
+ * Prepare table @h for about @nelem entries. The table grows on demand.
+ */
+int rnbd_hash_init(struct rnbd_hash *h, size_t nelem);
+void rnbd_hash_free(struct rnbd_hash *h);
+
+int rnbd_hash_add(struct rnbd_hash *h, const char *key, void *val);
+
+/*
+ * Return the first value stored under @key or NULL
+ */
+void *rnbd_hash_find(const struct rnbd_hash *h, const char *key);
+
+/*
+ * Iterate over all values stored under @key.
+ * @pos has to be initialized with 0 before the first call,
+ * NULL is returned when there are no more values.
+ */
+void *rnbd_hash_find_next(const struct rnbd_hash *h, const char *key,
+			  size_t *pos);
+
+#endif /* __H_HASH */
@@ -0,0 +1,383 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+#define JSON_MAX_DEPTH	64
+
+struct json_parser {
+	const char	*start;
+	const char	*p;
+	int		depth;
+};
+
+static int parse_value(struct json_parser *jp, struct rnbd_json **res);
+
+static void skip_ws(struct json_parser *jp)
+{
+	while (*jp->p == ' ' || *jp->p == '\t' ||
+	       *jp->p == '\n' || *jp->p == '\r')
+		jp->p++;
+}
+
+static int hex4(const char *s, unsigned int *cp)
+{
+	int i;
+
+	*cp = 0;
+	for (i = 0; i < 4; i++) {
+		*cp <<= 4;
+		if (s[i] >= '0' && s[i] <= '9')
+			*cp |= s[i] - '0';
+		else if (s[i] >= 'a' && s[i] <= 'f')
+			*cp |= s[i] - 'a' + 10;
+		else if (s[i] >= 'A' && s[i] <= 'F')
+			*cp |= s[i] - 'A' + 10;
+		else
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static char *put_utf8(char *o, unsigned int cp)
+{
+	if (cp < 0x80) {
+		*o++ = cp;
+	} else if (cp < 0x800) {
+		*o++ = 0xc0 | (cp >> 6);
+		*o++ = 0x80 | (cp & 0x3f);
+	} else if (cp < 0x10000) {
+		*o++ = 0xe0 | (cp >> 12);
+		*o++ = 0x80 | ((cp >> 6) & 0x3f);
+		*o++ = 0x80 | (cp & 0x3f);
+	} else {
+		*o++ = 0xf0 | (cp >> 18);
+		*o++ = 0x80 | ((cp >> 12) & 0x3f);
+		*o++ = 0x80 | ((cp >> 6) & 0x3f);
+		*o++ = 0x80 | (cp & 0x3f);
+	}
+
+	return o;
+}
+
+/*
+ * The unescaped string is never longer than the quoted one, so the
+ * length up to the closing quote is enough for the copy.
+ */
+static int parse_string(struct json_parser *jp, char **res)
+{
+	const char *s = jp->p + 1, *e;
+	unsigned int cp, lo;
+	char *out, *o;
+
+	for (e = s; *e != '"'; e++) {
+		if (!*e || (unsigned char)*e < 0x20)
+			return -EINVAL;
+		if (*e == '\\' && !*++e)
+			return -EINVAL;
+	}
+
+	out = malloc(e - s + 1);
+	if (!out)
+		return -ENOMEM;
+
+	for (o = out; s < e; s++) {
+		if (*s != '\\') {
+			*o++ = *s;
+			continue;
+		}
+		switch (*++s) {
+		case '"':
+		case '\\':
+		case '/':
+			*o++ = *s;
+			break;
+		case 'b':
+			*o++ = '\b';
+			break;
+		case 'f':
+			*o++ = '\f';
+			break;
+		case 'n':
+			*o++ = '\n';
+			break;
+		case 'r':
+			*o++ = '\r';
+			break;
+		case 't':
+			*o++ = '\t';
+			break;
+		case 'u':
+			if (e - s < 5 || hex4(s + 1, &cp))
+				goto err;
+			s += 4;
+			if (cp >= 0xd800 && cp < 0xdc00 && e - s >= 7 &&
+			    s[1] == '\\' && s[2] == 'u' && !hex4(s + 3, &lo) &&
+			    lo >= 0xdc00 && lo < 0xe000) {
+				cp = 0x10000 + ((cp - 0xd800) << 10) +
+				     (lo - 0xdc00);
+				s += 6;
+			}
+			if (!cp)
+				goto err;
+			o = put_utf8(o, cp);
+			break;
+		default:
+			goto err;
+		}
+	}
+	*o = '\0';
+
+	jp->p = e + 1;
+	*res = out;
+
+	return 0;
+
+err:
+	free(out);
+
+	return -EINVAL;
+}
+
+static int parse_number(struct json_parser *jp, double *num)
+{
+	const char *s = jp->p;
+	char *end;
+
+	if (*s == '-')
+		s++;
+	if (*s < '0' || *s > '9')
+		return -EINVAL;
+
+	*num = strtod(jp->p, &end);
+	jp->p = end;
+
+	return 0;
+}
+
+static int add_item(struct rnbd_json *v, struct rnbd_json *item, int *size)
+{
+	struct rnbd_json **items;
+
+	if (v->cnt == *size) {
+		*size = *size ? *size * 2 : 8;
+		items = realloc(v->items, *size * sizeof(*items));
+		if (!items)
+			return -ENOMEM;
+		v->items = items;
+	}
+	v->items[v->cnt++] = item;
+
+	return 0;
+}
+
+/*
+ * Elements of an array or members of an object up to @close
+ */
+static int parse_items(struct json_parser *jp, struct rnbd_json *v, char close)
+{
+	struct rnbd_json *item;
+	int err, size = 0;
+	char *key = NULL;
+
+	if (++jp->depth > JSON_MAX_DEPTH)
+		return -EINVAL;
+
+	jp->p++;
+	skip_ws(jp);
+	if (*jp->p == close)
+		goto out;
+
+	for (;;) {
+		if (close == '}') {
+			if (*jp->p != '"')
+				return -EINVAL;
+			err = parse_string(jp, &key);
+			if (err)
+				return err;
+			skip_ws(jp);
+			if (*jp->p != ':') {
+				free(key);
+				return -EINVAL;
+			}
+			jp->p++;
+		}
+		err = parse_value(jp, &item);
+		if (err) {
+			free(key);
+			return err;
+		}
+		item->key = key;
+		key = NULL;
+
+		err = add_item(v, item, &size);
+		if (err) {
+			rnbd_json_free(item);
+			return err;
+		}
+
+		skip_ws(jp);
+		if (*jp->p == close)
+			break;
+		if (*jp->p != ',')
+			return -EINVAL;
+		jp->p++;
+		skip_ws(jp);
+	}
+out:
+	jp->p++;
+	jp->depth--;
+
+	return 0;
+}
+
+static bool match_word(struct json_parser *jp, const char *word)
+{
+	size_t len = strlen(word);
+
+	if (strncmp(jp->p, word, len))
+		return false;
+	jp->p += len;
+
+	return true;
+}
+
+static int parse_value(struct json_parser *jp, struct rnbd_json **res)
+{
+	struct rnbd_json *v;
+	int err = 0;
+
+	v = calloc(1, sizeof(*v));
+	if (!v)
+		return -ENOMEM;
+
+	skip_ws(jp);
+
+	switch (*jp->p) {
+	case '{':
+		v->type = JSON_OBJ;
+		err = parse_items(jp, v, '}');
+		break;
+	case '[':
+		v->type = JSON_ARR;
+		err = parse_items(jp, v, ']');
+		break;
+	case '"':
+		v->type = JSON_STR;
+		err = parse_string(jp, &v->str);
+		break;
+	case 't':
+	case 'f':
+		v->type = JSON_BOOL;
+		v->b = *jp->p == 't';
+		if (!match_word(jp, v->b ? "true" : "false"))
+			err = -EINVAL;
+		break;
+	case 'n':
+		v->type = JSON_NULL;
+		if (!match_word(jp, "null"))
+			err = -EINVAL;
+		break;
+	default:
+		v->type = JSON_NUM;
+		err = parse_number(jp, &v->num);
+		break;
+	}
+
+	if (err) {
+		rnbd_json_free(v);
+		return err;
+	}
+	*res = v;
+
+	return 0;
+}
+
+int rnbd_json_parse(const char *text, struct rnbd_json **res, int *line)
+{
+	struct json_parser jp = {
+		.start = text,
+		.p = text,
+	};
+	const char *s;
+	int err;
+
+	err = parse_value(&jp, res);
+	if (!err) {
+		skip_ws(&jp);
+		if (*jp.p) {
+			rnbd_json_free(*res);
+			err = -EINVAL;
+		}
+	}
+
+	if (err == -EINVAL) {
+		*line = 1;
+		for (s = jp.start; s < jp.p; s++)
+			if (*s == '\n')
+				(*line)++;
+	}
+
+	return err;
+}
+
+const struct rnbd_json *rnbd_json_get(const struct rnbd_json *obj,
+				      const char *key)
+{
+	int i;
+
+	if (obj->type != JSON_OBJ)
+		return NULL;
+
+	for (i = 0; i < obj->cnt; i++)
+		if (!strcmp(obj->items[i]->key, key))
+			return obj->items[i];
+
+	return NULL;
+}
+
+const char *rnbd_json_type_str(enum rnbd_json_type type)
+{
+	switch (type) {
+	case JSON_NULL:
+		return "null";
+	case JSON_BOOL:
+		return "boolean";
+	case JSON_NUM:
+		return "number";
+	case JSON_STR:
+		return "string";
+	case JSON_ARR:
+		return "array";
+	case JSON_OBJ:
+		return "object";
+	}
+
+	return "unknown";
+}
+
+void rnbd_json_free(struct rnbd_json *v)
+{
+	int i;
+
+	if (!v)
+		return;
+
+	for (i = 0; i < v->cnt; i++)
+		rnbd_json_free(v->items[i]);
+	free(v->items);
+	free(v->key);
+	free(v->str);
+	free(v);
+}
@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_JSON
+#define __H_JSON
+
+#include <stdbool.h>
+
+enum rnbd_json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUM,
+	JSON_STR,
+	JSON_ARR,
+	JSON_OBJ,
+};
+
+/*
+ * A parsed JSON value. The members of an object and the elements of an
+ * array are kept in @items in the order of the text, members have a @key.
+ */
+struct rnbd_json {
+	enum rnbd_json_type	type;
+	char			*key;
+	char			*str;
+	double			num;
+	bool			b;
+	struct rnbd_json	**items;
+	int			cnt;
+};
+
+/*
+ * Parse the JSON @text into @res. On a syntax error -EINVAL is returned
+ * and @line is set to the line the error was found on.
+ */
+int rnbd_json_parse(const char *text, struct rnbd_json **res, int *line);
+
+/*
+ * Return the member @key of object @obj or NULL
+ */
+const struct rnbd_json *rnbd_json_get(const struct rnbd_json *obj,
+				      const char *key);
+
+const char *rnbd_json_type_str(enum rnbd_json_type type);
+
+void rnbd_json_free(struct rnbd_json *v);
+
+#endif /* __H_JSON */
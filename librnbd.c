@@ -0,0 +1,613 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+#include "rnbd-sysfs.h"
+#include "snapshot.h"
+#include "shm.h"
+#include "lock.h"
+#include "librnbd.h"
+
+/* an owned snapshot, the object counts are kept for indexing */
+struct rnbd_topo {
+	struct rnbd_snapshot	snap;
+	int			sess_cnt[2];
+	int			path_cnt[2];
+	int			dev_cnt[2];
+};
+
+static pthread_once_t lib_once = PTHREAD_ONCE_INIT;
+
+static void lib_init(void)
+{
+	struct rnbd_ctx ctx = {
+		.pname = "rnbd",
+	};
+
+	/* rnbd has chosen the names already, this keeps them */
+	check_compat_sysfs(&ctx);
+}
+
+static int lib_err(struct rnbd_error *err, int code, const char *fmt, ...)
+	__attribute__ ((format (printf, 3, 4)));
+
+/*
+ * Fill @err with the message @fmt followed by the error @code
+ */
+static int lib_err(struct rnbd_error *err, int code, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (!err)
+		return code;
+
+	err->code = code;
+	va_start(args, fmt);
+	len = vsnprintf(err->msg, sizeof(err->msg), fmt, args);
+	va_end(args);
+	if (len >= 0 && len < sizeof(err->msg))
+		snprintf(err->msg + len, sizeof(err->msg) - len,
+			 ": %s (%d)", strerror(-code), code);
+
+	return code;
+}
+
+static void lib_ok(struct rnbd_error *err)
+{
+	if (err) {
+		err->code = 0;
+		err->msg[0] = '\0';
+	}
+}
+
+static int side_idx(enum rnbd_side side)
+{
+	return side == RNBD_SIDE_SERVER;
+}
+
+static int arr_cnt(void **arr)
+{
+	int cnt = 0;
+
+	while (arr && arr[cnt])
+		cnt++;
+
+	return cnt;
+}
+
+/*
+ * Make a topology of the snapshot @buf, or of @file if @buf is NULL,
+ * or of sysfs if both are NULL
+ */
+static int topo_new(const char *buf, size_t len, const char *file,
+		    struct rnbd_topo **topo)
+{
+	struct rnbd_topo *t;
+	int ret;
+
+	t = calloc(1, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	if (buf) {
+		ret = rnbd_snapshot_decode(buf, len, &t->snap);
+	} else if (file) {
+		ret = rnbd_snapshot_load(file, &t->snap);
+	} else {
+		ret = rnbd_sysfs_read_all(&t->snap);
+		if (!ret) {
+			rnbd_sysfs_read_attrs(&t->snap, RNBD_ATTR_ALL);
+			ret = rnbd_sysfs_link_all(&t->snap);
+			if (ret)
+				rnbd_snapshot_free(&t->snap);
+		}
+	}
+	if (ret) {
+		free(t);
+		return ret;
+	}
+
+	t->sess_cnt[0] = arr_cnt((void **)t->snap.sess_clt);
+	t->sess_cnt[1] = arr_cnt((void **)t->snap.sess_srv);
+	t->path_cnt[0] = arr_cnt((void **)t->snap.paths_clt);
+	t->path_cnt[1] = arr_cnt((void **)t->snap.paths_srv);
+	t->dev_cnt[0] = arr_cnt((void **)t->snap.sds_clt);
+	t->dev_cnt[1] = arr_cnt((void **)t->snap.sds_srv);
+	*topo = t;
+
+	return 0;
+}
+
+int rnbd_topo_load(struct rnbd_topo **topo, struct rnbd_error *err)
+{
+	int ret;
+
+	pthread_once(&lib_once, lib_init);
+
+	ret = topo_new(NULL, 0, NULL, topo);
+	if (ret)
+		return lib_err(err, ret, "Failed to read sysfs entries");
+
+	lib_ok(err);
+	return 0;
+}
+
+int rnbd_topo_load_file(const char *file, struct rnbd_topo **topo,
+			struct rnbd_error *err)
+{
+	int ret;
+
+	ret = topo_new(NULL, 0, file, topo);
+	if (ret)
+		return lib_err(err, ret, "Failed to load snapshot '%s'", file);
+
+	lib_ok(err);
+	return 0;
+}
+
+int rnbd_topo_load_shm(struct rnbd_topo **topo, struct rnbd_error *err)
+{
+	size_t len;
+	bool live;
+	char *buf;
+	int ret;
+
+	ret = rnbd_shm_read(&buf, &len, &live);
+	if (!ret && !live) {
+		free(buf);
+		ret = -ESTALE;
+	}
+	if (!ret) {
+		ret = topo_new(buf, len, NULL, topo);
+		free(buf);
+	}
+	if (ret == -ESTALE)
+		return lib_err(err, ret, "Nothing publishes %s any more",
+			       RNBD_SHM_PATH);
+	if (ret)
+		return lib_err(err, ret, "Failed to read %s", RNBD_SHM_PATH);
+
+	lib_ok(err);
+	return 0;
+}
+
+void rnbd_topo_free(struct rnbd_topo *topo)
+{
+	if (!topo)
+		return;
+
+	rnbd_snapshot_free(&topo->snap);
+	free(topo);
+}
+
+void rnbd_topo_time(const struct rnbd_topo *topo, struct timespec *ts)
+{
+	*ts = topo->snap.ts;
+}
+
+int rnbd_topo_sess_cnt(const struct rnbd_topo *topo, enum rnbd_side side)
+{
+	return topo->sess_cnt[side_idx(side)];
+}
+
+struct rnbd_sess *rnbd_topo_sess(const struct rnbd_topo *topo,
+				 enum rnbd_side side, int i)
+{
+	struct rnbd_sess **sess;
+
+	sess = side == RNBD_SIDE_SERVER ? topo->snap.sess_srv :
+					  topo->snap.sess_clt;
+
+	return i >= 0 && i < topo->sess_cnt[side_idx(side)] ? sess[i] : NULL;
+}
+
+int rnbd_topo_path_cnt(const struct rnbd_topo *topo, enum rnbd_side side)
+{
+	return topo->path_cnt[side_idx(side)];
+}
+
+struct rnbd_path *rnbd_topo_path(const struct rnbd_topo *topo,
+				 enum rnbd_side side, int i)
+{
+	struct rnbd_path **paths;
+
+	paths = side == RNBD_SIDE_SERVER ? topo->snap.paths_srv :
+					   topo->snap.paths_clt;
+
+	return i >= 0 && i < topo->path_cnt[side_idx(side)] ? paths[i] : NULL;
+}
+
+int rnbd_topo_dev_cnt(const struct rnbd_topo *topo, enum rnbd_side side)
+{
+	return topo->dev_cnt[side_idx(side)];
+}
+
+struct rnbd_sess_dev *rnbd_topo_dev(const struct rnbd_topo *topo,
+				    enum rnbd_side side, int i)
+{
+	struct rnbd_sess_dev **sds;
+
+	sds = side == RNBD_SIDE_SERVER ? topo->snap.sds_srv :
+					 topo->snap.sds_clt;
+
+	return i >= 0 && i < topo->dev_cnt[side_idx(side)] ? sds[i] : NULL;
+}
+
+struct rnbd_sess *rnbd_topo_find_sess(const struct rnbd_topo *topo,
+				      enum rnbd_side side,
+				      const char *sessname)
+{
+	struct rnbd_sess *sess;
+	int i;
+
+	for (i = 0; (sess = rnbd_topo_sess(topo, side, i)); i++)
+		if (!strcmp(sess->sessname, sessname))
+			return sess;
+
+	return NULL;
+}
+
+struct rnbd_sess_dev *rnbd_topo_find_dev(const struct rnbd_topo *topo,
+					 enum rnbd_side side,
+					 const char *name)
+{
+	struct rnbd_sess_dev *ds;
+	int i;
+
+	for (i = 0; (ds = rnbd_topo_dev(topo, side, i)); i++)
+		if (!strcmp(ds->dev->devname, name) ||
+		    !strcmp(ds->dev->devpath, name) ||
+		    !strcmp(ds->mapping_path, name))
+			return ds;
+
+	return NULL;
+}
+
+const char *rnbd_sess_name(const struct rnbd_sess *sess)
+{
+	return sess->sessname;
+}
+
+enum rnbd_side rnbd_sess_side(const struct rnbd_sess *sess)
+{
+	return sess->side == RNBD_SERVER ? RNBD_SIDE_SERVER : RNBD_SIDE_CLIENT;
+}
+
+const char *rnbd_sess_hostname(const struct rnbd_sess *sess)
+{
+	return sess->hostname;
+}
+
+const char *rnbd_sess_mp_policy(const struct rnbd_sess *sess)
+{
+	return sess->mp;
+}
+
+int rnbd_sess_path_cnt(const struct rnbd_sess *sess)
+{
+	return sess->path_cnt;
+}
+
+int rnbd_sess_active_path_cnt(const struct rnbd_sess *sess)
+{
+	return sess->act_path_cnt;
+}
+
+struct rnbd_path *rnbd_sess_path(const struct rnbd_sess *sess, int i)
+{
+	return i >= 0 && i < sess->path_cnt ? sess->paths[i] : NULL;
+}
+
+int rnbd_sess_dev_cnt(const struct rnbd_sess *sess)
+{
+	return sess->sds_cnt;
+}
+
+struct rnbd_sess_dev *rnbd_sess_device(const struct rnbd_sess *sess, int i)
+{
+	return i >= 0 && i < sess->sds_cnt ? sess->sds[i] : NULL;
+}
+
+void rnbd_sess_get_stats(const struct rnbd_sess *sess,
+			 struct rnbd_path_stats *st)
+{
+	st->rx_bytes = sess->rx_bytes;
+	st->tx_bytes = sess->tx_bytes;
+	st->inflights = sess->inflights;
+	st->reconnects = sess->reconnects;
+}
+
+const char *rnbd_path_name(const struct rnbd_path *path)
+{
+	return path->pathname;
+}
+
+struct rnbd_sess *rnbd_path_sess(const struct rnbd_path *path)
+{
+	return path->sess;
+}
+
+const char *rnbd_path_src_addr(const struct rnbd_path *path)
+{
+	return path->src_addr;
+}
+
+const char *rnbd_path_dst_addr(const struct rnbd_path *path)
+{
+	return path->dst_addr;
+}
+
+const char *rnbd_path_hca_name(const struct rnbd_path *path)
+{
+	return path->hca_name;
+}
+
+int rnbd_path_hca_port(const struct rnbd_path *path)
+{
+	return path->hca_port;
+}
+
+const char *rnbd_path_state(const struct rnbd_path *path)
+{
+	return path->state;
+}
+
+void rnbd_path_get_stats(const struct rnbd_path *path,
+			 struct rnbd_path_stats *st)
+{
+	st->rx_bytes = *path->rx_bytes;
+	st->tx_bytes = *path->tx_bytes;
+	st->inflights = *path->inflights;
+	st->reconnects = *path->reconnects;
+}
+
+const char *rnbd_dev_name(const struct rnbd_sess_dev *ds)
+{
+	return ds->dev->devname;
+}
+
+struct rnbd_sess *rnbd_dev_sess(const struct rnbd_sess_dev *ds)
+{
+	return ds->sess;
+}
+
+const char *rnbd_dev_mapping_path(const struct rnbd_sess_dev *ds)
+{
+	return ds->mapping_path;
+}
+
+const char *rnbd_dev_access_mode(const struct rnbd_sess_dev *ds)
+{
+	return ds->access_mode;
+}
+
+const char *rnbd_dev_state(const struct rnbd_sess_dev *ds)
+{
+	return ds->dev->state;
+}
+
+void rnbd_dev_get_stats(const struct rnbd_sess_dev *ds,
+			struct rnbd_dev_stats *st)
+{
+	st->rx_sect = *ds->dev->rx_sect;
+	st->tx_sect = *ds->dev->tx_sect;
+}
+
+static int op_write(const char *sessname, const char *dir, const char *entry,
+		    unsigned int flags, const char *val,
+		    struct rnbd_error *err, const char *fmt, ...)
+	__attribute__ ((format (printf, 7, 8)));
+
+/*
+ * Write @val to @entry in @dir holding the lock of session @sessname.
+ * If the write fails @err gets the message @fmt.
+ */
+static int op_write(const char *sessname, const char *dir, const char *entry,
+		    unsigned int flags, const char *val,
+		    struct rnbd_error *err, const char *fmt, ...)
+{
+	struct rnbd_ctx ctx = {
+		.pname = "rnbd",
+		.simulate_set = flags & RNBD_OP_SIMULATE,
+		.debug_set = flags & RNBD_OP_DEBUG,
+		.verbose_set = flags & RNBD_OP_VERBOSE,
+	};
+	char msg[sizeof(err->msg)];
+	va_list args;
+	int ret;
+
+	pthread_once(&lib_once, lib_init);
+
+	ret = rnbd_lock_sess(sessname, true, &ctx);
+	if (ret)
+		return lib_err(err, ret, "Failed to lock session '%s'",
+			       sessname);
+	ret = printf_sysfs(dir, entry, &ctx, "%s", val);
+	rnbd_unlock_sess(sessname);
+
+	if (ret) {
+		va_start(args, fmt);
+		vsnprintf(msg, sizeof(msg), fmt, args);
+		va_end(args);
+		return lib_err(err, ret, "%s", msg);
+	}
+
+	lib_ok(err);
+	return 0;
+}
+
+static void dev_dir(char *dir, size_t len, const struct rnbd_sess_dev *ds)
+{
+	pthread_once(&lib_once, lib_init);
+
+	snprintf(dir, len, "/sys/block/%s/%s", ds->dev->devname,
+		 get_sysfs_info(NULL)->path_dev_name);
+}
+
+static void path_dir(char *dir, size_t len, const struct rnbd_path *path)
+{
+	const struct rnbd_sysfs_info *info;
+
+	pthread_once(&lib_once, lib_init);
+
+	info = get_sysfs_info(NULL);
+	snprintf(dir, len, "%s%s/paths/%s",
+		 path->sess->side == RNBD_SERVER ? info->path_sess_srv :
+						   info->path_sess_clt,
+		 path->sess->sessname, path->pathname);
+}
+
+int rnbd_map(const char *sessname, const char *device_path,
+	     const struct rnbd_path_addr *paths, int path_cnt,
+	     const char *access_mode, unsigned int flags,
+	     struct rnbd_error *err)
+{
+	char cmd[4096];
+	size_t cnt;
+	int i;
+
+	cnt = snprintf(cmd, sizeof(cmd), "sessname=%s device_path=%s",
+		       sessname, device_path);
+	for (i = 0; i < path_cnt && cnt < sizeof(cmd); i++)
+		if (paths[i].src)
+			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
+					" path=%s@%s",
+					paths[i].src, paths[i].dst);
+		else
+			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
+					" path=%s", paths[i].dst);
+	if (access_mode && cnt < sizeof(cmd))
+		cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
+				" access_mode=%s", access_mode);
+	if (cnt >= sizeof(cmd))
+		return lib_err(err, -ENAMETOOLONG, "Failed to map device");
+
+	pthread_once(&lib_once, lib_init);
+
+	return op_write(sessname, get_sysfs_info(NULL)->path_dev_clt,
+			"map_device", flags, cmd, err, "Failed to map device");
+}
+
+int rnbd_unmap(const struct rnbd_sess_dev *ds, int force,
+	       unsigned int flags, struct rnbd_error *err)
+{
+	char dir[PATH_MAX];
+
+	dev_dir(dir, sizeof(dir), ds);
+
+	return op_write(ds->sess->sessname, dir, "unmap_device", flags,
+			force ? "force" : "normal", err,
+			"Failed to %sunmap '%s'", force ? "force-" : "",
+			ds->dev->devname);
+}
+
+int rnbd_remap(const struct rnbd_sess_dev *ds, unsigned int flags,
+	       struct rnbd_error *err)
+{
+	char dir[PATH_MAX];
+
+	dev_dir(dir, sizeof(dir), ds);
+
+	return op_write(ds->sess->sessname, dir, "remap_device", flags, "1",
+			err, "Failed to remap %s", ds->dev->devname);
+}
+
+int rnbd_resize(const struct rnbd_sess_dev *ds, uint64_t sectors,
+		unsigned int flags, struct rnbd_error *err)
+{
+	char dir[PATH_MAX], val[32];
+
+	dev_dir(dir, sizeof(dir), ds);
+	snprintf(val, sizeof(val), "%" PRIu64, sectors);
+
+	return op_write(ds->sess->sessname, dir, "resize", flags, val, err,
+			"Failed to resize %s to %" PRIu64, ds->dev->devname,
+			sectors);
+}
+
+int rnbd_close(const char *devname, const char *sessname,
+	       unsigned int flags, struct rnbd_error *err)
+{
+	char dir[PATH_MAX];
+
+	pthread_once(&lib_once, lib_init);
+
+	snprintf(dir, sizeof(dir), "%s/devices/%s/sessions/%s",
+		 get_sysfs_info(NULL)->path_dev_srv, devname, sessname);
+
+	return op_write(sessname, dir, "force_close", flags, "1", err,
+			"Failed to close device '%s' for session '%s'",
+			devname, sessname);
+}
+
+int rnbd_addpath(const struct rnbd_sess *sess,
+		 const struct rnbd_path_addr *addr,
+		 unsigned int flags, struct rnbd_error *err)
+{
+	char dir[PATH_MAX], val[2 * NAME_MAX + 2];
+
+	pthread_once(&lib_once, lib_init);
+
+	snprintf(dir, sizeof(dir), "%s%s",
+		 get_sysfs_info(NULL)->path_sess_clt, sess->sessname);
+	if (addr->src)
+		snprintf(val, sizeof(val), "%s@%s", addr->src, addr->dst);
+	else
+		snprintf(val, sizeof(val), "%s", addr->dst);
+
+	return op_write(sess->sessname, dir, "add_path", flags, val, err,
+			"Failed to add path '%s' to session '%s'",
+			val, sess->sessname);
+}
+
+int rnbd_delpath(const struct rnbd_path *path, unsigned int flags,
+		 struct rnbd_error *err)
+{
+	char dir[PATH_MAX];
+
+	path_dir(dir, sizeof(dir), path);
+
+	return op_write(path->sess->sessname, dir, "remove_path", flags, "1",
+			err, "Failed to remove path '%s' from session '%s'",
+			path->pathname, path->sess->sessname);
+}
+
+int rnbd_reconnect(const struct rnbd_path *path, unsigned int flags,
+		   struct rnbd_error *err)
+{
+	char dir[PATH_MAX];
+
+	path_dir(dir, sizeof(dir), path);
+
+	return op_write(path->sess->sessname, dir, "reconnect", flags, "1",
+			err, "Failed to reconnect path '%s' from session '%s'",
+			path->pathname, path->sess->sessname);
+}
+
+int rnbd_disconnect(const struct rnbd_path *path, unsigned int flags,
+		    struct rnbd_error *err)
+{
+	char dir[PATH_MAX];
+
+	path_dir(dir, sizeof(dir), path);
+
+	return op_write(path->sess->sessname, dir, "disconnect", flags, "1",
+			err, "Failed to disconnect path '%s' of session '%s'",
+			path->pathname, path->sess->sessname);
+}
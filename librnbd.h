@@ -0,0 +1,170 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_LIBRNBD
+#define __H_LIBRNBD
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * librnbd - the rnbd objects and operations for programs linking with
+ * -lrnbd instead of running rnbd.
+ *
+ * The objects are opaque, they are only accessed by the functions below.
+ * New functions may be added, the existing ones keep their meaning as long
+ * as LIBRNBD_VERSION stays the same.
+ */
+#define LIBRNBD_VERSION	1
+
+struct rnbd_topo;
+struct rnbd_sess;
+struct rnbd_path;
+struct rnbd_sess_dev;	/* a device as seen by a session */
+
+enum rnbd_side {
+	RNBD_SIDE_CLIENT = 1,
+	RNBD_SIDE_SERVER = 2,
+};
+
+/*
+ * Functions returning int return 0 or a negative error code. If @err is
+ * given, it gets the error code and a message saying what failed.
+ */
+struct rnbd_error {
+	int	code;
+	char	msg[256];
+};
+
+struct rnbd_path_stats {
+	uint64_t	rx_bytes;
+	uint64_t	tx_bytes;
+	int		inflights;
+	int		reconnects;
+};
+
+struct rnbd_dev_stats {
+	uint64_t	rx_sect;
+	uint64_t	tx_sect;
+};
+
+/*
+ * Topology: all sessions, paths and devices at a point in time.
+ * A topology doesn't change after loading, load a new one for changes.
+ * Different topologies can be used by different threads.
+ */
+
+/* read the objects and all their attributes from sysfs */
+int rnbd_topo_load(struct rnbd_topo **topo, struct rnbd_error *err);
+/* read a snapshot saved by rnbd snapshot */
+int rnbd_topo_load_file(const char *file, struct rnbd_topo **topo,
+			struct rnbd_error *err);
+/* read the snapshot of a running rnbd publish, -ESTALE if it stopped */
+int rnbd_topo_load_shm(struct rnbd_topo **topo, struct rnbd_error *err);
+void rnbd_topo_free(struct rnbd_topo *topo);
+
+/* CLOCK_REALTIME when the objects were read */
+void rnbd_topo_time(const struct rnbd_topo *topo, struct timespec *ts);
+
+/*
+ * The objects of a side, @i from 0 to the count - 1. The paths of a
+ * session follow each other, in the order of the session.
+ */
+int rnbd_topo_sess_cnt(const struct rnbd_topo *topo, enum rnbd_side side);
+struct rnbd_sess *rnbd_topo_sess(const struct rnbd_topo *topo,
+				 enum rnbd_side side, int i);
+int rnbd_topo_path_cnt(const struct rnbd_topo *topo, enum rnbd_side side);
+struct rnbd_path *rnbd_topo_path(const struct rnbd_topo *topo,
+				 enum rnbd_side side, int i);
+int rnbd_topo_dev_cnt(const struct rnbd_topo *topo, enum rnbd_side side);
+struct rnbd_sess_dev *rnbd_topo_dev(const struct rnbd_topo *topo,
+				    enum rnbd_side side, int i);
+
+/* NULL if not found */
+struct rnbd_sess *rnbd_topo_find_sess(const struct rnbd_topo *topo,
+				      enum rnbd_side side,
+				      const char *sessname);
+/* by device name (rnbd0), device path (/dev/rnbd0) or mapping path */
+struct rnbd_sess_dev *rnbd_topo_find_dev(const struct rnbd_topo *topo,
+					 enum rnbd_side side,
+					 const char *name);
+
+const char *rnbd_sess_name(const struct rnbd_sess *sess);
+enum rnbd_side rnbd_sess_side(const struct rnbd_sess *sess);
+const char *rnbd_sess_hostname(const struct rnbd_sess *sess);
+const char *rnbd_sess_mp_policy(const struct rnbd_sess *sess);
+int rnbd_sess_path_cnt(const struct rnbd_sess *sess);
+int rnbd_sess_active_path_cnt(const struct rnbd_sess *sess);
+struct rnbd_path *rnbd_sess_path(const struct rnbd_sess *sess, int i);
+int rnbd_sess_dev_cnt(const struct rnbd_sess *sess);
+struct rnbd_sess_dev *rnbd_sess_device(const struct rnbd_sess *sess, int i);
+/* summed up over the paths */
+void rnbd_sess_get_stats(const struct rnbd_sess *sess,
+			 struct rnbd_path_stats *st);
+
+const char *rnbd_path_name(const struct rnbd_path *path);
+struct rnbd_sess *rnbd_path_sess(const struct rnbd_path *path);
+const char *rnbd_path_src_addr(const struct rnbd_path *path);
+const char *rnbd_path_dst_addr(const struct rnbd_path *path);
+const char *rnbd_path_hca_name(const struct rnbd_path *path);
+int rnbd_path_hca_port(const struct rnbd_path *path);
+const char *rnbd_path_state(const struct rnbd_path *path);
+void rnbd_path_get_stats(const struct rnbd_path *path,
+			 struct rnbd_path_stats *st);
+
+const char *rnbd_dev_name(const struct rnbd_sess_dev *ds);
+struct rnbd_sess *rnbd_dev_sess(const struct rnbd_sess_dev *ds);
+const char *rnbd_dev_mapping_path(const struct rnbd_sess_dev *ds);
+const char *rnbd_dev_access_mode(const struct rnbd_sess_dev *ds);
+const char *rnbd_dev_state(const struct rnbd_sess_dev *ds);
+void rnbd_dev_get_stats(const struct rnbd_sess_dev *ds,
+			struct rnbd_dev_stats *st);
+
+/*
+ * Operations. They hold the lock of the session while they write to
+ * sysfs, like rnbd does, and take these @flags:
+ */
+#define RNBD_OP_SIMULATE	1	/* only print the sysfs writes */
+#define RNBD_OP_DEBUG		2	/* print the sysfs writes */
+#define RNBD_OP_VERBOSE		4	/* say when waiting for the lock */
+
+/* address of a path, @src is NULL for the default source address */
+struct rnbd_path_addr {
+	const char	*src;
+	const char	*dst;
+};
+
+/* map @device_path of session @sessname, new sessions need @paths */
+int rnbd_map(const char *sessname, const char *device_path,
+	     const struct rnbd_path_addr *paths, int path_cnt,
+	     const char *access_mode, unsigned int flags,
+	     struct rnbd_error *err);
+int rnbd_unmap(const struct rnbd_sess_dev *ds, int force,
+	       unsigned int flags, struct rnbd_error *err);
+/* -EALREADY if the device doesn't need to be remapped */
+int rnbd_remap(const struct rnbd_sess_dev *ds, unsigned int flags,
+	       struct rnbd_error *err);
+int rnbd_resize(const struct rnbd_sess_dev *ds, uint64_t sectors,
+		unsigned int flags, struct rnbd_error *err);
+/* close device @devname exported to session @sessname on the server */
+int rnbd_close(const char *devname, const char *sessname,
+	       unsigned int flags, struct rnbd_error *err);
+
+int rnbd_addpath(const struct rnbd_sess *sess,
+		 const struct rnbd_path_addr *addr,
+		 unsigned int flags, struct rnbd_error *err);
+int rnbd_delpath(const struct rnbd_path *path, unsigned int flags,
+		 struct rnbd_error *err);
+int rnbd_reconnect(const struct rnbd_path *path, unsigned int flags,
+		   struct rnbd_error *err);
+/* on the client or the server, the side of the session of @path */
+int rnbd_disconnect(const struct rnbd_path *path, unsigned int flags,
+		    struct rnbd_error *err);
+
+#endif /* __H_LIBRNBD */
@@ -10,12 +10,17 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "list.h"
 
 #include "table.h"
 #include "misc.h"
+#include "out.h"
 #include "rnbd-sysfs.h"
+#include "diff.h"
+#include "group.h"
+#include "pool.h"
 
 extern struct table_column *clms_paths_shortdesc[];
 extern bool trm;
@@ -24,14 +29,16 @@ int list_devices_term(struct rnbd_sess_dev **sds,
 		      struct table_column **cs,
 		      const struct rnbd_ctx *ctx)
 {
+	uint64_t rx_sect = 0, tx_sect = 0;
 	struct rnbd_dev d_total = {
-		.rx_sect = 0,
-		.tx_sect = 0
+		.rx_sect = &rx_sect,
+		.tx_sect = &tx_sect
 	};
 	struct rnbd_sess_dev total = {
 		.dev = &d_total,
 		.mapping_path = ""
 	};
+	struct table_layout *lt = ctx->layout;
 	struct table_fld *flds;
 	int i, cs_cnt, dev_num;
 	bool nototals_set = ctx->nototals_set;
@@ -51,27 +58,28 @@ int list_devices_term(struct rnbd_sess_dev **sds,
 	}
 
 	for (i = 0; sds[i]; i++) {
-		table_row_stringify(sds[i], flds + i * cs_cnt, cs, ctx, true, 0);
-		total.dev->rx_sect += sds[i]->dev->rx_sect;
-		total.dev->tx_sect += sds[i]->dev->tx_sect;
+		table_row_stringify(sds[i], flds + i * cs_cnt, cs, lt, ctx,
+				    true, 0);
+		rx_sect += *sds[i]->dev->rx_sect;
+		tx_sect += *sds[i]->dev->tx_sect;
 	}
 
 	if (!nototals_set)
 		table_row_stringify(&total, flds + i * cs_cnt,
-				    cs, ctx, true, 0);
+				    cs, lt, ctx, true, 0);
 
 	if (!ctx->noheaders_set)
-		table_header_print_term("", cs, trm);
+		table_header_print_term("", cs, lt, trm);
 
 	for (i = 0; i < dev_num; i++)
 		table_flds_print_term("", flds + i * cs_cnt,
-				      cs, trm, 0);
+				      cs, lt, trm, 0);
 
 	if (!nototals_set) {
-		table_row_print_line("", cs, trm, 0);
+		table_row_print_line("", cs, lt, trm, 0);
 		table_flds_del_not_num(flds + i * cs_cnt, cs);
 		table_flds_print_term("", flds + i * cs_cnt,
-				      cs, trm, 0);
+				      cs, lt, trm, 0);
 	}
 
 	free(flds);
@@ -79,53 +87,160 @@ int list_devices_term(struct rnbd_sess_dev **sds,
 	return 0;
 }
 
+/* rows rendered by one job, fewer are rendered by the calling thread */
+#define LIST_CHUNK 1024
+
+struct list_rows {
+	void			**objs;
+	int			cnt;
+	enum fmt_type		fmt;
+	const char		*tag;	/* xml element of a row */
+	struct table_column	**cs;
+	const struct rnbd_ctx	*ctx;
+	char			**bufs;	/* the output of the chunks */
+	size_t			*lens;
+};
+
+static void list_row(const struct list_rows *r, int i)
+{
+	switch (r->fmt) {
+	case FMT_CSV:
+		table_row_print(r->objs[i], FMT_CSV, "", r->cs, NULL, false,
+				r->ctx, false, 0);
+		break;
+	case FMT_JSON:
+		if (i)
+			out_str(",\n");
+		table_row_print(r->objs[i], FMT_JSON, "\t\t", r->cs, NULL,
+				false, r->ctx, false, 0);
+		break;
+	case FMT_XML:
+		out_str("\t<");
+		out_str(r->tag);
+		out_str(">\n");
+		table_row_print(r->objs[i], FMT_XML, "\t\t", r->cs, NULL,
+				false, r->ctx, false, 0);
+		out_str("\t</");
+		out_str(r->tag);
+		out_str(">\n");
+		break;
+	default:
+		break;
+	}
+}
+
+static void list_rows_chunk(const struct list_rows *r, int chunk)
+{
+	int i, end;
+
+	end = (chunk + 1) * LIST_CHUNK;
+	if (end > r->cnt)
+		end = r->cnt;
+
+	for (i = chunk * LIST_CHUNK; i < end; i++)
+		list_row(r, i);
+}
+
+static void list_rows_job(void *arg, int chunk)
+{
+	struct list_rows *r = arg;
+
+	if (out_capture_start())
+		return;
+
+	list_rows_chunk(r, chunk);
+
+	if (out_capture_end(&r->bufs[chunk], &r->lens[chunk]))
+		r->bufs[chunk] = NULL;
+}
+
+/*
+ * Print the rows of the NULL terminated @objs in format @fmt. Large
+ * tables are rendered in chunks on several threads and written in order,
+ * the output is the same. A chunk failing to render in memory is
+ * rendered again directly.
+ */
+static void list_rows(void **objs, enum fmt_type fmt, const char *tag,
+		      struct table_column **cs, const struct rnbd_ctx *ctx)
+{
+	struct list_rows r = {
+		.objs = objs,
+		.fmt = fmt,
+		.tag = tag,
+		.cs = cs,
+		.ctx = ctx,
+	};
+	int i, chunks, jobs;
+
+	while (objs[r.cnt])
+		r.cnt++;
+
+	chunks = (r.cnt + LIST_CHUNK - 1) / LIST_CHUNK;
+	if (ctx->jobs_set) {
+		jobs = ctx->jobs;
+	} else {
+		/* rendering only needs cpus, more threads don't help */
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs > RNBD_POOL_JOBS)
+			jobs = RNBD_POOL_JOBS;
+	}
+
+	if (chunks > 1 && jobs > 1) {
+		r.bufs = calloc(chunks, sizeof(*r.bufs));
+		r.lens = calloc(chunks, sizeof(*r.lens));
+	}
+	if (!r.bufs || !r.lens) {
+		for (i = 0; i < r.cnt; i++)
+			list_row(&r, i);
+		goto out;
+	}
+
+	rnbd_pool_run(chunks, jobs, list_rows_job, &r);
+
+	for (i = 0; i < chunks; i++) {
+		if (r.bufs[i])
+			out_mem(r.bufs[i], r.lens[i]);
+		else
+			list_rows_chunk(&r, i);
+		free(r.bufs[i]);
+	}
+out:
+	free(r.bufs);
+	free(r.lens);
+}
+
 void list_devices_csv(struct rnbd_sess_dev **sds,
 		      struct table_column **cs,
 		      const struct rnbd_ctx *ctx)
 {
-	int i;
-
 	if (!sds[0])
 		return;
 
 	if (!ctx->noheaders_set)
 		table_header_print_csv(cs);
 
-	for (i = 0; sds[i]; i++)
-		table_row_print(sds[i], FMT_CSV, "", cs, false, ctx, false, 0);
+	list_rows((void **)sds, FMT_CSV, NULL, cs, ctx);
 }
 
 void list_devices_json(struct rnbd_sess_dev **sds,
 		       struct table_column **cs,
 		       const struct rnbd_ctx *ctx)
 {
-	int i;
-
 	if (!sds[0])
 		return;
 
-	printf("[\n");
+	out_str("[\n");
 
-	for (i = 0; sds[i]; i++) {
-		if (i)
-			printf(",\n");
-		table_row_print(sds[i], FMT_JSON, "\t\t", cs, false, ctx, false, 0);
-	}
+	list_rows((void **)sds, FMT_JSON, NULL, cs, ctx);
 
-	printf("\n\t]");
+	out_str("\n\t]");
 }
 
 void list_devices_xml(struct rnbd_sess_dev **sds,
 		      struct table_column **cs,
 		      const struct rnbd_ctx *ctx)
 {
-	int i;
-
-	for (i = 0; sds[i]; i++) {
-		printf("\t<device>\n");
-		table_row_print(sds[i], FMT_XML, "\t\t", cs, false, ctx, false, 0);
-		printf("\t</device>\n");
-	}
+	list_rows((void **)sds, FMT_XML, "device", cs, ctx);
 }
 
 static int compar_sess_sessname(const void *p1, const void *p2)
@@ -148,6 +263,7 @@ int list_sessions_term(struct rnbd_sess **sessions,
 		.reconnects = 0
 	};
 	int i, cs_cnt, sess_num;
+	struct table_layout *lt = ctx->layout;
 	struct table_fld *flds;
 	struct rnbd_sess **sorted_sessions;
 
@@ -161,7 +277,9 @@ int list_sessions_term(struct rnbd_sess **sessions,
 		return -ENOMEM;
 	}
 	memcpy(sorted_sessions, sessions, sizeof(*sessions) * sess_num);
-	qsort(sorted_sessions, sess_num, sizeof(*sorted_sessions), compar_sess_sessname);
+	if (!ctx->sorted)
+		qsort(sorted_sessions, sess_num, sizeof(*sorted_sessions),
+		      compar_sess_sessname);
 
 	flds = calloc((sess_num + 1) * cs_cnt, sizeof(*flds));
 	if (!flds) {
@@ -172,7 +290,7 @@ int list_sessions_term(struct rnbd_sess **sessions,
 
 	for (i = 0; sorted_sessions[i]; i++) {
 		table_row_stringify(sorted_sessions[i], flds + i * cs_cnt, cs,
-				    ctx, true, 0);
+				    lt, ctx, true, 0);
 
 		total.act_path_cnt += sorted_sessions[i]->act_path_cnt;
 		total.path_cnt += sorted_sessions[i]->path_cnt;
@@ -184,15 +302,15 @@ int list_sessions_term(struct rnbd_sess **sessions,
 
 	if (!ctx->nototals_set) {
 		table_row_stringify(&total, flds + sess_num * cs_cnt,
-				    cs, ctx, true, 0);
+				    cs, lt, ctx, true, 0);
 	}
 
 	if (!ctx->noheaders_set)
-		table_header_print_term("", cs, trm);
+		table_header_print_term("", cs, lt, trm);
 
 	for (i = 0; sorted_sessions[i]; i++) {
 		table_flds_print_term("", flds + i * cs_cnt,
-				      cs, trm, 0);
+				      cs, lt, trm, 0);
 		if (!ctx->notree_set)
 			list_paths_term(sorted_sessions[i]->paths,
 					sorted_sessions[i]->path_cnt,
@@ -201,10 +319,10 @@ int list_sessions_term(struct rnbd_sess **sessions,
 	}
 
 	if (!ctx->nototals_set && table_has_num(cs)) {
-		table_row_print_line("", cs, trm, 0);
+		table_row_print_line("", cs, lt, trm, 0);
 		table_flds_del_not_num(flds + sess_num * cs_cnt, cs);
 		table_flds_print_term("", flds + sess_num * cs_cnt,
-				      cs, trm, 0);
+				      cs, lt, trm, 0);
 	}
 
 	free(sorted_sessions);
@@ -217,45 +335,28 @@ void list_sessions_csv(struct rnbd_sess **sessions,
 		       struct table_column **cs,
 		       const struct rnbd_ctx *ctx)
 {
-	int i;
-
 	if (!ctx->noheaders_set)
 		table_header_print_csv(cs);
 
-	for (i = 0; sessions[i]; i++)
-		table_row_print(sessions[i], FMT_CSV, "", cs, false, ctx, false, 0);
+	list_rows((void **)sessions, FMT_CSV, NULL, cs, ctx);
 }
 
 void list_sessions_json(struct rnbd_sess **sessions,
 			struct table_column **cs,
 			const struct rnbd_ctx *ctx)
 {
-	int i;
-
-	printf("[\n");
+	out_str("[\n");
 
-	for (i = 0; sessions[i]; i++) {
-		if (i)
-			printf(",\n");
-		table_row_print(sessions[i], FMT_JSON, "\t\t", cs,
-				false, ctx, false, 0);
-	}
+	list_rows((void **)sessions, FMT_JSON, NULL, cs, ctx);
 
-	printf("\n\t]");
+	out_str("\n\t]");
 }
 
 void list_sessions_xml(struct rnbd_sess **sessions,
 		       struct table_column **cs,
 		       const struct rnbd_ctx *ctx)
 {
-	int i;
-
-	for (i = 0; sessions[i]; i++) {
-		printf("\t<session>\n");
-		table_row_print(sessions[i], FMT_XML, "\t\t", cs,
-				false, ctx, false, 0);
-		printf("\t</session>\n");
-	}
+	list_rows((void **)sessions, FMT_XML, "session", cs, ctx);
 }
 
 int compar_paths_hca_src(const void *p1, const void *p2)
@@ -291,6 +392,46 @@ static struct rnbd_path **alloc_sorted_paths(struct rnbd_path **paths,
 	return sorted_paths;
 }
 
+/*
+ * Sum up the counters of @paths into @total. The counters of paths with
+ * consecutive ids, like all paths of a session or of one side, are
+ * adjacent in struct rnbd_counters and summed up without touching the
+ * path structures.
+ */
+static void paths_total(struct rnbd_path **paths, int path_cnt,
+			struct rnbd_path *total)
+{
+	const uint64_t *rx_bytes, *tx_bytes;
+	const int *inflights, *reconnects;
+	int i;
+
+	for (i = 1; i < path_cnt; i++)
+		if (paths[i]->id != paths[0]->id + i)
+			break;
+
+	if (path_cnt && i == path_cnt) {
+		rx_bytes = paths[0]->rx_bytes;
+		tx_bytes = paths[0]->tx_bytes;
+		inflights = paths[0]->inflights;
+		reconnects = paths[0]->reconnects;
+
+		for (i = 0; i < path_cnt; i++) {
+			*total->rx_bytes += rx_bytes[i];
+			*total->tx_bytes += tx_bytes[i];
+			*total->inflights += inflights[i];
+			*total->reconnects += reconnects[i];
+		}
+		return;
+	}
+
+	for (i = 0; i < path_cnt; i++) {
+		*total->rx_bytes += *paths[i]->rx_bytes;
+		*total->tx_bytes += *paths[i]->tx_bytes;
+		*total->inflights += *paths[i]->inflights;
+		*total->reconnects += *paths[i]->reconnects;
+	}
+}
+
 static void free_sorted_paths(struct rnbd_path **sorted_paths)
 {
 	free(sorted_paths);
@@ -301,13 +442,16 @@ int list_paths_term(struct rnbd_path **paths, int path_cnt,
 		    const struct rnbd_ctx *ctx,
 		    int (*comp)(const void *p1, const void *p2))
 {
+	uint64_t rx_bytes = 0, tx_bytes = 0;
+	int inflights = 0, reconnects = 0;
 	struct rnbd_path total = {
-		.rx_bytes = 0,
-		.tx_bytes = 0,
-		.inflights = 0,
-		.reconnects = 0
+		.rx_bytes = &rx_bytes,
+		.tx_bytes = &tx_bytes,
+		.inflights = &inflights,
+		.reconnects = &reconnects
 	};
 	int i, cs_cnt, fld_cnt = 0;
+	struct table_layout *lt = ctx->layout;
 	struct table_fld *flds;
 	struct rnbd_path **sorted_paths;
 
@@ -339,34 +483,34 @@ int list_paths_term(struct rnbd_path **paths, int path_cnt,
 			ERR(trm, "inconsistent internal data path_cnt <-> paths\n");
 			return -EFAULT;
 		}
-		table_row_stringify(sorted_paths[i], flds + fld_cnt, cs, ctx, true, 0);
+		table_row_stringify(sorted_paths[i], flds + fld_cnt, cs, lt, ctx,
+				    true, 0);
 
 		fld_cnt += cs_cnt;
 
-		total.rx_bytes += sorted_paths[i]->rx_bytes;
-		total.tx_bytes += sorted_paths[i]->tx_bytes;
-		total.inflights += sorted_paths[i]->inflights;
-		total.reconnects += sorted_paths[i]->reconnects;
 	}
 
+	paths_total(paths, path_cnt, &total);
+
 	if (!ctx->nototals_set)
-		table_row_stringify(&total, flds + fld_cnt, cs, ctx, true, 0);
+		table_row_stringify(&total, flds + fld_cnt, cs, lt, ctx, true,
+				    0);
 
 	if (!ctx->noheaders_set && !tree)
-		table_header_print_term("", cs, trm);
+		table_header_print_term("", cs, lt, trm);
 
 	fld_cnt = 0;
 	for (i = 0; i < path_cnt; i++) {
 		table_flds_print_term(
 			!tree ? "" : i < path_cnt - 1 ?
-			"├─ " : "└─ ", flds + fld_cnt, cs, trm, 0);
+			"├─ " : "└─ ", flds + fld_cnt, cs, lt, trm, 0);
 		fld_cnt += cs_cnt;
 	}
 
 	if (!ctx->nototals_set && table_has_num(cs) && !tree) {
-		table_row_print_line("", cs, trm, 0);
+		table_row_print_line("", cs, lt, trm, 0);
 		table_flds_del_not_num(flds + fld_cnt, cs);
-		table_flds_print_term("", flds + fld_cnt, cs, trm, 0);
+		table_flds_print_term("", flds + fld_cnt, cs, lt, trm, 0);
 	}
 
 	free_sorted_paths(sorted_paths);
@@ -379,45 +523,194 @@ void list_paths_csv(struct rnbd_path **paths,
 		    struct table_column **cs,
 		    const struct rnbd_ctx *ctx)
 {
-	int i;
-
 	if (!ctx->noheaders_set)
 		table_header_print_csv(cs);
 
-	for (i = 0; paths[i]; i++)
-		table_row_print(paths[i], FMT_CSV, "", cs,
-				false, ctx, false, 0);
+	list_rows((void **)paths, FMT_CSV, NULL, cs, ctx);
 }
 
 void list_paths_json(struct rnbd_path **paths,
 		     struct table_column **cs,
 		     const struct rnbd_ctx *ctx)
 {
-	int i;
+	out_str("\n\t[\n");
 
-	printf("\n\t[\n");
+	list_rows((void **)paths, FMT_JSON, NULL, cs, ctx);
 
-	for (i = 0; paths[i]; i++) {
-		if (i)
-			printf(",\n");
-		table_row_print(paths[i], FMT_JSON, "\t\t", cs,
-				false, ctx, false, 0);
+	out_str("\n\t]");
+}
+
+void list_paths_xml(struct rnbd_path **paths,
+		    struct table_column **cs,
+		    const struct rnbd_ctx *ctx)
+{
+	list_rows((void **)paths, FMT_XML, "path", cs, ctx);
+}
+
+
+int list_diff_term(struct rnbd_diff *diffs, int cnt,
+		   struct table_column **cs,
+		   const struct rnbd_ctx *ctx)
+{
+	struct table_layout *lt = ctx->layout;
+	struct table_fld *flds;
+	int i, cs_cnt;
+
+	if (!cnt)
+		return 0;
+
+	cs_cnt = table_clm_cnt(cs);
+
+	flds = calloc(cnt * cs_cnt, sizeof(*flds));
+	if (!flds) {
+		ERR(trm, "not enough memory\n");
+		return -ENOMEM;
 	}
 
-	printf("\n\t]");
+	for (i = 0; i < cnt; i++)
+		table_row_stringify(&diffs[i], flds + i * cs_cnt, cs, lt, ctx,
+				    true, 0);
+
+	if (!ctx->noheaders_set)
+		table_header_print_term("", cs, lt, trm);
+
+	for (i = 0; i < cnt; i++)
+		table_flds_print_term("", flds + i * cs_cnt, cs, lt, trm, 0);
+
+	free(flds);
+
+	return 0;
 }
 
-void list_paths_xml(struct rnbd_path **paths,
+void list_diff_csv(struct rnbd_diff *diffs, int cnt,
+		   struct table_column **cs,
+		   const struct rnbd_ctx *ctx)
+{
+	int i;
+
+	if (!cnt)
+		return;
+
+	if (!ctx->noheaders_set)
+		table_header_print_csv(cs);
+
+	for (i = 0; i < cnt; i++)
+		table_row_print(&diffs[i], FMT_CSV, "", cs, NULL, false, ctx,
+				false, 0);
+}
+
+void list_diff_json(struct rnbd_diff *diffs, int cnt,
 		    struct table_column **cs,
 		    const struct rnbd_ctx *ctx)
 {
 	int i;
 
-	for (i = 0; paths[i]; i++) {
-		printf("\t<path>\n");
-		table_row_print(paths[i], FMT_XML, "\t\t", cs,
+	out_str("[\n");
+
+	for (i = 0; i < cnt; i++) {
+		if (i)
+			out_str(",\n");
+		table_row_print(&diffs[i], FMT_JSON, "\t\t", cs, NULL, false,
+				ctx, false, 0);
+	}
+
+	out_str("\n\t]");
+}
+
+void list_diff_xml(struct rnbd_diff *diffs, int cnt,
+		   struct table_column **cs,
+		   const struct rnbd_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < cnt; i++) {
+		out_str("\t<change>\n");
+		table_row_print(&diffs[i], FMT_XML, "\t\t", cs, NULL, false, ctx,
+				false, 0);
+		out_str("\t</change>\n");
+	}
+}
+
+int list_groups_term(struct rnbd_grouping *g,
+		     const struct rnbd_ctx *ctx)
+{
+	struct table_column **cs = g->cs;
+	struct table_layout *lt = ctx->layout;
+	struct table_fld *flds;
+	int i, cs_cnt;
+
+	cs_cnt = table_clm_cnt(cs);
+
+	flds = calloc((g->cnt + 1) * cs_cnt, sizeof(*flds));
+	if (!flds) {
+		ERR(trm, "not enough memory\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; g->groups[i]; i++)
+		table_row_stringify(g->groups[i], flds + i * cs_cnt, cs, lt, ctx,
+				    true, 0);
+
+	if (!ctx->nototals_set)
+		table_row_stringify(&g->total, flds + i * cs_cnt, cs, lt, ctx,
+				    true, 0);
+
+	if (!ctx->noheaders_set)
+		table_header_print_term("", cs, lt, trm);
+
+	for (i = 0; g->groups[i]; i++)
+		table_flds_print_term("", flds + i * cs_cnt, cs, lt, trm, 0);
+
+	if (!ctx->nototals_set) {
+		table_row_print_line("", cs, lt, trm, 0);
+		table_flds_del_not_num(flds + i * cs_cnt, cs);
+		table_flds_print_term("", flds + i * cs_cnt, cs, lt, trm, 0);
+	}
+
+	free(flds);
+
+	return 0;
+}
+
+void list_groups_csv(struct rnbd_grouping *g,
+		     const struct rnbd_ctx *ctx)
+{
+	int i;
+
+	if (!ctx->noheaders_set)
+		table_header_print_csv(g->cs);
+
+	for (i = 0; g->groups[i]; i++)
+		table_row_print(g->groups[i], FMT_CSV, "", g->cs, NULL, false,
+				ctx, false, 0);
+}
+
+void list_groups_json(struct rnbd_grouping *g,
+		      const struct rnbd_ctx *ctx)
+{
+	int i;
+
+	out_str("[\n");
+
+	for (i = 0; g->groups[i]; i++) {
+		if (i)
+			out_str(",\n");
+		table_row_print(g->groups[i], FMT_JSON, "\t\t", g->cs, NULL,
 				false, ctx, false, 0);
-		printf("\t</path>\n");
 	}
+
+	out_str("\n\t]");
 }
 
+void list_groups_xml(struct rnbd_grouping *g,
+		     const struct rnbd_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; g->groups[i]; i++) {
+		out_str("\t<group>\n");
+		table_row_print(g->groups[i], FMT_XML, "\t\t", g->cs, NULL,
+				false, ctx, false, 0);
+		out_str("\t</group>\n");
+	}
+}
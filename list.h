@@ -11,6 +11,8 @@
 struct rnbd_sess_dev;
 struct rnbd_path;
 struct rnbd_sess;
+struct rnbd_diff;
+struct rnbd_grouping;
 struct table_column;
 struct rnbd_ctx;
 
@@ -63,6 +65,34 @@ void list_paths_xml(struct rnbd_path **paths,
 		    struct table_column **cs,
 		    const struct rnbd_ctx *ctx);
 
+int list_diff_term(struct rnbd_diff *diffs, int cnt,
+		   struct table_column **cs,
+		   const struct rnbd_ctx *ctx);
+
+void list_diff_csv(struct rnbd_diff *diffs, int cnt,
+		   struct table_column **cs,
+		   const struct rnbd_ctx *ctx);
+
+void list_diff_json(struct rnbd_diff *diffs, int cnt,
+		    struct table_column **cs,
+		    const struct rnbd_ctx *ctx);
+
+void list_diff_xml(struct rnbd_diff *diffs, int cnt,
+		   struct table_column **cs,
+		   const struct rnbd_ctx *ctx);
+
+int list_groups_term(struct rnbd_grouping *g,
+		     const struct rnbd_ctx *ctx);
+
+void list_groups_csv(struct rnbd_grouping *g,
+		     const struct rnbd_ctx *ctx);
+
+void list_groups_json(struct rnbd_grouping *g,
+		      const struct rnbd_ctx *ctx);
+
+void list_groups_xml(struct rnbd_grouping *g,
+		     const struct rnbd_ctx *ctx);
+
 /* add more path comparation */
 int compar_paths_hca_src(const void *p1, const void *p2);
 int compar_paths_sessname(const void *p1, const void *p2);
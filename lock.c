@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "misc.h"
+#include "lock.h"
+
+struct sess_lock {
+	struct sess_lock	*next;
+	char			*sessname;
+	int			fd;	/* -1 while a thread is taking it */
+	int			refs;
+};
+
+static struct sess_lock *locks;
+static pthread_mutex_t locks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t locks_cond = PTHREAD_COND_INITIALIZER;
+
+static struct sess_lock *find_lock(const char *sessname)
+{
+	struct sess_lock *l;
+
+	for (l = locks; l; l = l->next)
+		if (!strcmp(l->sessname, sessname))
+			return l;
+
+	return NULL;
+}
+
+static void del_lock(struct sess_lock *l)
+{
+	struct sess_lock **p;
+
+	for (p = &locks; *p != l; p = &(*p)->next)
+		;
+	*p = l->next;
+
+	free(l->sessname);
+	free(l);
+}
+
+/*
+ * Open and flock the lock file of @sessname. The lock files are never
+ * removed, a process could have opened one just before.
+ */
+static int take_lock(const char *sessname, bool wait)
+{
+	char path[PATH_MAX], *s;
+	int fd, len, err;
+
+	if (mkdir(RNBD_LOCK_DIR, 0755) && errno != EEXIST)
+		return -errno;
+
+	len = snprintf(path, sizeof(path), "%s/", RNBD_LOCK_DIR);
+	snprintf(path + len, sizeof(path) - len, "%s.lock", sessname);
+	for (s = path + len; *s; s++)
+		if (*s == '/')
+			*s = '_';
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	do {
+		err = flock(fd, wait ? LOCK_EX : LOCK_EX | LOCK_NB);
+	} while (err && errno == EINTR);
+	if (!err)
+		return fd;
+
+	err = -errno;
+	close(fd);
+
+	return err;
+}
+
+int rnbd_lock_sess(const char *sessname, bool wait,
+		   const struct rnbd_ctx *ctx)
+{
+	struct sess_lock *l;
+	int fd;
+
+	if (ctx->simulate_set)
+		return 0;
+
+	pthread_mutex_lock(&locks_mutex);
+	while ((l = find_lock(sessname)) && l->fd < 0) {
+		if (!wait) {
+			pthread_mutex_unlock(&locks_mutex);
+			return -EWOULDBLOCK;
+		}
+		pthread_cond_wait(&locks_cond, &locks_mutex);
+	}
+	if (l) {
+		l->refs++;
+		pthread_mutex_unlock(&locks_mutex);
+		return 0;
+	}
+
+	l = calloc(1, sizeof(*l));
+	if (l)
+		l->sessname = strdup(sessname);
+	if (!l || !l->sessname) {
+		pthread_mutex_unlock(&locks_mutex);
+		free(l);
+		return -ENOMEM;
+	}
+	l->fd = -1;
+	l->refs = 1;
+	l->next = locks;
+	locks = l;
+	pthread_mutex_unlock(&locks_mutex);
+
+	/* the other threads wait for the entry instead of the file */
+	fd = take_lock(sessname, wait);
+
+	pthread_mutex_lock(&locks_mutex);
+	if (fd < 0)
+		del_lock(l);
+	else
+		l->fd = fd;
+	pthread_cond_broadcast(&locks_cond);
+	pthread_mutex_unlock(&locks_mutex);
+
+	return fd < 0 ? fd : 0;
+}
+
+void rnbd_unlock_sess(const char *sessname)
+{
+	struct sess_lock *l;
+
+	pthread_mutex_lock(&locks_mutex);
+	l = find_lock(sessname);
+	if (l && l->fd >= 0 && !--l->refs) {
+		close(l->fd);
+		del_lock(l);
+	}
+	pthread_mutex_unlock(&locks_mutex);
+}
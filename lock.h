@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_LOCK
+#define __H_LOCK
+
+#include <stdbool.h>
+
+struct rnbd_ctx;
+
+#define RNBD_LOCK_DIR	"/run/rnbd"
+
+/*
+ * Take the advisory lock of session @sessname, a flock() on
+ * RNBD_LOCK_DIR/<sessname>.lock. Other rnbd processes changing the same
+ * session queue up behind it, the ones changing other sessions don't.
+ *
+ * The lock is shared by all threads of the process and can be taken
+ * again while held, it is released by the last rnbd_unlock_sess().
+ * Nothing is locked with ctx->simulate_set. Nothing is printed either,
+ * the caller reports the errors.
+ * Returns 0, -EWOULDBLOCK if the lock is held elsewhere and @wait isn't
+ * set, or other negative error code.
+ */
+int rnbd_lock_sess(const char *sessname, bool wait,
+		   const struct rnbd_ctx *ctx);
+
+void rnbd_unlock_sess(const char *sessname);
+
+#endif /* __H_LOCK */
@@ -23,7 +23,9 @@
 #include "rnbd-sysfs.h"
 
 #define HCA_DIR "/sys/class/infiniband/"
-extern bool trm;
+
+/* print errors in color, set by rnbd if stdout is a terminal */
+bool trm;
 
 const struct bit_str bits[] = {
 	{"B", 0, "Byte"}, {"K", 10, "KiB"}, {"M", 20, "MiB"}, {"G", 30, "GiB"},
@@ -149,6 +151,32 @@ int byte_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 	return i_to_byte_unit(str, len, ctx, *(uint64_t *)v, humanize);
 }
 
+int sect_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		enum color *clr, void *v, bool humanize)
+{
+	*clr = CNRM;
+
+	if (humanize)
+		return i_to_byte_unit(str, len, ctx, *(uint64_t *)v << 9,
+				      humanize);
+	else
+		return snprintf(str, len, "%" PRIu64, *(uint64_t *)v);
+}
+
+int byte_ptr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		    enum color *clr, void *v, bool humanize)
+{
+	*clr = CNRM;
+	return i_to_byte_unit(str, len, ctx, **(uint64_t **)v, humanize);
+}
+
+int int_ptr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		   enum color *clr, void *v, bool humanize)
+{
+	*clr = CNRM;
+	return snprintf(str, len, "%d", **(int **)v);
+}
+
 int sd_devname_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 		      enum color *clr, void *v, bool humanize)
 {
@@ -180,9 +208,9 @@ int sd_rx_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 	*clr = CNRM;
 
 	if (humanize)
-		return i_to_byte_unit(str, len, ctx, sd->dev->rx_sect << 9, humanize);
+		return i_to_byte_unit(str, len, ctx, *sd->dev->rx_sect << 9, humanize);
 	else
-		return snprintf(str, len, "%" PRIu64, sd->dev->rx_sect);
+		return snprintf(str, len, "%" PRIu64, *sd->dev->rx_sect);
 }
 
 int sd_tx_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
@@ -194,9 +222,9 @@ int sd_tx_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 	*clr = CNRM;
 
 	if (humanize)
-		return i_to_byte_unit(str, len, ctx, sd->dev->tx_sect << 9, humanize);
+		return i_to_byte_unit(str, len, ctx, *sd->dev->tx_sect << 9, humanize);
 	else
-		return snprintf(str, len, "%" PRIu64, sd->dev->tx_sect);
+		return snprintf(str, len, "%" PRIu64, *sd->dev->tx_sect);
 }
 
 int dev_sessname_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
@@ -264,8 +292,10 @@ int rnbd_pathname_to_norm(char *str, size_t len, char *v)
 	s = strdup(v);
 
 	at = strchr(s, '@');
-	if (!at)
+	if (!at) {
+		free(s);
 		return snprintf(str, len, "%s", v);
+	}
 
 	*at = 0;
 	cnt = rnbd_addr_to_norm(str, len, s);
@@ -469,81 +499,79 @@ bool is_path_addr(const char *arg)
 }
 
 /**
- * Evaluate whether both left and right string represent
- * equivalent RNBD path addresses.
+ * Parse the path address string @str into @a.
  *
  * Address strings start with either 'ip:' or 'gid:'
  * followed by an valid (IPv4 or IPv6) address
  * or a valid gid (which looks like a link local IPv6 address).
- *
- * If both are neither one or the other string comparison is used
- * as fallback.
- *
- * For both ip and gid two addresses match if they are representations
- * if the same 'normalized' ip address string.
+ * Anything else can only be compared as string.
  */
-bool match_path_addr(const char *left, const char *right)
+void rnbd_addr_parse(struct rnbd_addr *a, const char *str)
 {
-	bool left_is_gid;
-	bool left_is_ip;
-	bool right_is_ip;
-	char left_addr[16];
-	char right_addr[16];
-	char left_normalized[INET6_ADDRSTRLEN];
-	char right_normalized[INET6_ADDRSTRLEN];
+	int off;
 
-	if (!left && !right)
-		return true;
-
-	if ((!left && right) || (left && !right))
-		return false;
-
-	if ((is_gid(left) && is_gid(right))
-	    || (is_ip(left) && is_ip(right))) {
-
-		left_is_gid = is_gid(left);
-		left_is_ip = inet_pton(AF_INET6, left+(left_is_gid ? 4 : 3),
-				       left_addr);
-		right_is_ip = inet_pton(AF_INET6, right+(left_is_gid ? 4 : 3),
-					right_addr);
+	memset(a, 0, sizeof(*a));
 
-		if ((!left_is_ip && right_is_ip)
-		    || (left_is_ip && !right_is_ip))
-			return false;
+	if (is_gid(str)) {
+		a->type = RNBD_ADDR_GID;
+		off = 4;
+	} else if (is_ip(str)) {
+		a->type = RNBD_ADDR_IP;
+		off = 3;
+	} else {
+		a->type = RNBD_ADDR_STR;
+		return;
+	}
 
-		if (left_is_ip) {
+	if (inet_pton(AF_INET6, str + off, a->addr) == 1)
+		a->family = AF_INET6;
+	else if (a->type == RNBD_ADDR_IP &&
+		 inet_aton(str + off, (struct in_addr *)a->addr))
+		a->family = AF_INET;
+}
 
-			inet_ntop(AF_INET6, left_addr, left_normalized,
-				  INET6_ADDRSTRLEN);
-			inet_ntop(AF_INET6, right_addr, right_normalized,
-				  INET6_ADDRSTRLEN);
+/**
+ * Evaluate whether both parsed addresses @left and @right are
+ * equivalent RNBD path addresses. @left_str and @right_str are
+ * the strings the addresses were parsed from.
+ *
+ * For both ip and gid two addresses match if they are
+ * the same binary address. If neither of them could be parsed,
+ * string comparison is used as fallback.
+ */
+bool rnbd_addr_match(const struct rnbd_addr *left, const char *left_str,
+		     const struct rnbd_addr *right, const char *right_str)
+{
+	if (left->type != right->type || left->type == RNBD_ADDR_STR)
+		return !strcmp(left_str, right_str);
 
-			return !strcmp(left_normalized, right_normalized);
+	if (left->family != right->family)
+		return false;
 
-		} else if (!left_is_gid) {
-			left_is_ip = inet_aton(left+3,
-					       (struct in_addr *)left_addr);
-			right_is_ip = inet_aton(right+3,
-						(struct in_addr *)right_addr);
+	if (!left->family)
+		return !strcmp(left_str, right_str);
 
-			if ((!left_is_ip && right_is_ip)
-			    || (left_is_ip && !right_is_ip))
-				return false;
+	return !memcmp(left->addr, right->addr,
+		       left->family == AF_INET6 ? 16 : 4);
+}
 
-			if (left_is_ip) {
+/**
+ * Print a key of address @a parsed from @a_str into @str,
+ * two addresses have the same key iff rnbd_addr_match() says they match.
+ */
+int rnbd_addr_key(char *str, size_t len, const struct rnbd_addr *a,
+		  const char *a_str)
+{
+	int i, cnt;
 
-				inet_ntop(AF_INET, left_addr,
-					  left_normalized, INET6_ADDRSTRLEN);
-				inet_ntop(AF_INET, right_addr,
-					  right_normalized, INET6_ADDRSTRLEN);
+	if (a->type == RNBD_ADDR_STR || !a->family)
+		return snprintf(str, len, "%d %s", a->type, a_str);
 
-				return !strcmp(left_normalized,
-					       right_normalized);
-			}
-		}
-	}
+	cnt = snprintf(str, len, "%d %d ", a->type, a->family);
+	for (i = 0; i < (a->family == AF_INET6 ? 16 : 4); i++)
+		cnt += snprintf(str + cnt, len - cnt, "%02x", a->addr[i]);
 
-	return !strcmp(left, right);
+	return cnt;
 }
 
 int sessname_from_host(const char *from_name, char *out_buf, size_t buf_len)
@@ -14,6 +14,9 @@
 #include <dirent.h>	/* for opendir() */
 #include <stddef.h>
 
+#include "filter.h"
+#include "sort.h"
+
 #define ARRSIZE(x) (sizeof(x) / sizeof(*x))
 #define MAX_PATHS_PER_SESSION 32
 
@@ -90,12 +93,15 @@ struct rnbd_ctx {
 	struct table_column *clms_paths_clt[CLM_MAX_CNT];
 	struct table_column *clms_paths_srv[CLM_MAX_CNT];
 
+	struct table_column *clms_diff[CLM_MAX_CNT];
+
 	bool notree_set;
 	bool noterm_set;
 	bool help_set;
 	bool verbose_set;
 	bool debug_set;
 	bool simulate_set;
+	bool from_shm_set;
 	bool complete_set;
 
 	int unit_id;
@@ -120,6 +126,35 @@ struct rnbd_ctx {
 	const char *from;
 	bool from_set;
 
+	int interval_ms;
+	bool interval_set;
+	int count;
+	bool count_set;
+
+	int wait_ms;	/* negative to wait forever */
+	bool wait_set;
+
+	int jobs;
+	bool jobs_set;
+
+	struct rnbd_filter where;
+	bool where_set;
+
+	struct rnbd_sort sort;
+	bool sort_set;
+	struct rnbd_sort sort_default;	/* for a limit without sort keys */
+	int limit;
+	bool limit_set;
+	bool sorted;	/* objects to list are in the requested order */
+
+	const char *group;
+	bool group_set;
+
+	const char *sel_sess;	/* session name or glob of the devices */
+	bool sel_sess_set;
+
+	struct rnbd_snapshot *snap;	/* the objects the command works on */
+	struct table_layout *layout;	/* widths and headers of the columns */
 };
 
 int get_unit_index(const char *unit, int *index);
@@ -145,6 +180,16 @@ int i_to_byte_unit(char *str, size_t len, const struct rnbd_ctx *ctx,
 int byte_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 		enum color *clr, void *v, bool humanize);
 
+/* a number of sectors, shown in bytes when humanized */
+int sect_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		enum color *clr, void *v, bool humanize);
+
+/* for counters kept in struct rnbd_counters */
+int byte_ptr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		    enum color *clr, void *v, bool humanize);
+int int_ptr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		   enum color *clr, void *v, bool humanize);
+
 int sd_state_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 		    enum color *clr, void *v, bool humanize);
 
@@ -195,7 +240,20 @@ int addr_to_norm(char *str, size_t len, const struct rnbd_ctx *ctx,
 int path_to_norm(char *str, size_t len, const struct rnbd_ctx *ctx,
 		 enum color *clr, void *v, bool humanize);
 
-bool match_path_addr(const char *left, const char *right);
+/*
+ * Write path name @v with normalized addresses to @str, like listed
+ */
+int rnbd_pathname_to_norm(char *str, size_t len, char *v);
+
+struct rnbd_addr;
+
+void rnbd_addr_parse(struct rnbd_addr *a, const char *str);
+
+bool rnbd_addr_match(const struct rnbd_addr *left, const char *left_str,
+		     const struct rnbd_addr *right, const char *right_str);
+
+int rnbd_addr_key(char *str, size_t len, const struct rnbd_addr *a,
+		  const char *a_str);
 
 int read_port_descs(struct port_desc *port_descs, int max_ports);
 
@@ -239,6 +297,13 @@ enum rnbd_token {
 	TOK_ADD,
 	TOK_DELETE,
 	TOK_READD,
+	TOK_SNAPSHOT,
+	TOK_DIFF,
+	TOK_WATCH,
+	TOK_WAIT,
+	TOK_APPLY,
+	TOK_DAEMON,
+	TOK_PUBLISH,
 
 	/* access permissions */
 	TOK_RO,
@@ -246,6 +311,9 @@ enum rnbd_token {
 	TOK_MIGRATION,
 
 	TOK_FROM,
+	TOK_INTERVAL,
+	TOK_COUNT,
+	TOK_JOBS,
 
 	/* output format */
 	TOK_XML,
@@ -279,6 +347,12 @@ enum rnbd_token {
 	TOK_NOTERM,
 
 	TOK_ALL,
+
+	TOK_WHERE,
+	TOK_SORT,
+	TOK_LIMIT,
+	TOK_GROUP,
+	TOK_SESSION,
 };
 
 #endif /* __H_MISC */
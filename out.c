@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	/* for isatty() */
+
+#include "out.h"
+
+#define OUT_BUF_SIZE (256 * 1024)
+
+static char out_buf[OUT_BUF_SIZE];
+
+/* where the calling thread writes to, stdout unless capturing */
+static __thread FILE *out_fp;
+static __thread char *cap_buf;
+static __thread size_t cap_len;
+
+void out_init(void)
+{
+	if (!isatty(STDOUT_FILENO))
+		setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+}
+
+int out_capture_start(void)
+{
+	out_fp = open_memstream(&cap_buf, &cap_len);
+
+	return out_fp ? 0 : -errno;
+}
+
+int out_capture_end(char **buf, size_t *len)
+{
+	int err;
+
+	err = fclose(out_fp) ? -errno : 0;
+	out_fp = NULL;
+	if (err) {
+		free(cap_buf);
+		return err;
+	}
+
+	*buf = cap_buf;
+	*len = cap_len;
+
+	return 0;
+}
+
+int out_mem(const char *s, size_t len)
+{
+	return fwrite_unlocked(s, 1, len, out_fp ? out_fp : stdout);
+}
+
+int out_str(const char *s)
+{
+	return out_mem(s, strlen(s));
+}
+
+int out_chr(char c)
+{
+	putc_unlocked(c, out_fp ? out_fp : stdout);
+
+	return 1;
+}
+
+int out_u64(uint64_t v)
+{
+	char buf[24], *p = buf + sizeof(buf);
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+
+	return out_mem(p, buf + sizeof(buf) - p);
+}
+
+int out_int(int v)
+{
+	if (v < 0)
+		return out_chr('-') + out_u64(-(int64_t)v);
+
+	return out_u64(v);
+}
+
+static int out_spaces(int n)
+{
+	static const char spaces[] = "                                ";
+	int cnt = 0, len;
+
+	while (n > 0) {
+		len = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+		cnt += out_mem(spaces, len);
+		n -= len;
+	}
+
+	return cnt;
+}
+
+int out_pad(const char *s, int width, char align)
+{
+	int len = strlen(s);
+
+	if (align == 'r')
+		return out_spaces(width - len) + out_mem(s, len);
+
+	return out_mem(s, len) + out_spaces(width - len);
+}
+
+int out_clr(bool trm, enum color clr)
+{
+	if (!trm || !clr)
+		return 0;
+
+	return out_str(colors[clr]);
+}
+
+int out_clr_end(bool trm, enum color clr)
+{
+	if (!trm || !clr)
+		return 0;
+
+	return out_str(colors[CNRM]);
+}
+
+static int out_esc_json(const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *start = s;
+	int cnt = 0;
+
+	for (; *s; s++) {
+		if (*s != '"' && *s != '\\' && (unsigned char)*s >= ' ')
+			continue;
+
+		cnt += out_mem(start, s - start);
+		start = s + 1;
+
+		if (*s == '"' || *s == '\\') {
+			cnt += out_chr('\\') + out_chr(*s);
+		} else {
+			cnt += out_str("\\u00");
+			cnt += out_chr(hex[(unsigned char)*s >> 4]);
+			cnt += out_chr(hex[*s & 0xf]);
+		}
+	}
+
+	return cnt + out_mem(start, s - start);
+}
+
+static int out_esc_xml(const char *s)
+{
+	const char *start = s, *ent;
+	int cnt = 0;
+
+	for (; *s; s++) {
+		switch (*s) {
+		case '&':
+			ent = "&amp;";
+			break;
+		case '<':
+			ent = "&lt;";
+			break;
+		case '>':
+			ent = "&gt;";
+			break;
+		default:
+			continue;
+		}
+
+		cnt += out_mem(start, s - start);
+		cnt += out_str(ent);
+		start = s + 1;
+	}
+
+	return cnt + out_mem(start, s - start);
+}
+
+static int out_esc_csv(const char *s)
+{
+	const char *start = s;
+	int cnt = 0;
+
+	for (; *s; s++) {
+		if (*s != '"')
+			continue;
+
+		/* write the quote twice */
+		cnt += out_mem(start, s - start + 1);
+		start = s;
+	}
+
+	return cnt + out_mem(start, s - start);
+}
+
+int out_esc(enum fmt_type fmt, const char *s)
+{
+	switch (fmt) {
+	case FMT_JSON:
+		return out_esc_json(s);
+	case FMT_XML:
+		return out_esc_xml(s);
+	case FMT_CSV:
+		return out_esc_csv(s);
+	default:
+		return out_str(s);
+	}
+}
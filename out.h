@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_OUT
+#define __H_OUT
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+/*
+ * Output to stdout without format string parsing.
+ *
+ * All the functions append to the stdio buffer of stdout, so they can be
+ * freely mixed with printf(). out_init() makes that buffer large when
+ * stdout is not a terminal, so that big outputs are flushed with few
+ * write() calls. The functions return the number of bytes appended.
+ */
+void out_init(void);
+
+int out_mem(const char *s, size_t len);
+int out_str(const char *s);
+int out_chr(char c);
+int out_u64(uint64_t v);
+int out_int(int v);
+
+/*
+ * Append @s padded with spaces to @width, right aligned if @align is 'r'
+ */
+int out_pad(const char *s, int width, char align);
+
+/*
+ * Switch color to @clr and back, only if @trm is set
+ */
+int out_clr(bool trm, enum color clr);
+int out_clr_end(bool trm, enum color clr);
+
+/*
+ * Append @s escaped for the output format @fmt: quotes are doubled
+ * for csv, json gets backslash escapes and xml entities.
+ */
+int out_esc(enum fmt_type fmt, const char *s);
+
+/*
+ * Collect the output of the calling thread in memory instead of stdout
+ * until out_capture_end(), which hands the bytes out in a buffer @buf to
+ * be freed. This way parts of an output can be rendered on several threads
+ * and written in order with out_mem() after.
+ */
+int out_capture_start(void);
+int out_capture_end(char **buf, size_t *len);
+
+#endif /* __H_OUT */
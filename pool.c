@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+struct pool {
+	pthread_mutex_t	lock;
+	int		next;		/* next item to hand out */
+	int		cnt;
+	void		(*fn)(void *arg, int i);
+	void		*arg;
+};
+
+static void *pool_worker(void *arg)
+{
+	struct pool *p = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&p->lock);
+		i = p->next++;
+		pthread_mutex_unlock(&p->lock);
+
+		if (i >= p->cnt)
+			break;
+		p->fn(p->arg, i);
+	}
+
+	return NULL;
+}
+
+void rnbd_pool_run(int cnt, int jobs, void (*fn)(void *arg, int i),
+		   void *arg)
+{
+	struct pool p = {
+		.cnt = cnt,
+		.fn = fn,
+		.arg = arg,
+	};
+	pthread_t *tids = NULL;
+	int i, n = 0;
+
+	if (jobs > cnt)
+		jobs = cnt;
+	if (jobs > 1)
+		tids = calloc(jobs - 1, sizeof(*tids));
+
+	pthread_mutex_init(&p.lock, NULL);
+
+	for (i = 1; tids && i < jobs; i++)
+		if (!pthread_create(&tids[n], NULL, pool_worker, &p))
+			n++;
+
+	pool_worker(&p);
+
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+
+	pthread_mutex_destroy(&p.lock);
+	free(tids);
+}
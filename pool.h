@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_POOL
+#define __H_POOL
+
+/* default number of threads for changes of several objects */
+#define RNBD_POOL_JOBS		4
+
+/*
+ * Call @fn(@arg, i) for i from 0 to @cnt - 1 on up to @jobs threads, the
+ * calling one included. The items are handed out in order, fewer threads
+ * are used if they can't be created.
+ */
+void rnbd_pool_run(int cnt, int jobs, void (*fn)(void *arg, int i),
+		   void *arg);
+
+#endif /* __H_POOL */
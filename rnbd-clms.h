@@ -9,50 +9,55 @@
 
 #include "table.h"
 #include "misc.h"
+#include "diff.h"
+#include "rnbd-sysfs.h"
 
-#define CLM_SD(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr) \
+#define CLM_SD(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr, \
+	       m_attrs) \
 	CLM(rnbd_sess_dev, m_name, m_header, m_type, tostr, align, h_clr,\
-	    c_clr, m_descr, sizeof(m_header) - 1, 0)
+	    c_clr, m_descr, sizeof(m_header) - 1, 0, m_attrs)
 
 #define _CLM_SD(s_name, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
-		m_descr) \
+		m_descr, m_attrs) \
 	_CLM(rnbd_sess_dev, s_name, m_name, m_header, m_type, tostr, \
-	    align, h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0)
+	    align, h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0, m_attrs)
 
 CLM_SD(mapping_path, "Mapping Path", FLD_STR, NULL, 'l', CNRM, CBLD,
-	"Mapping name of the remote device");
+	"Mapping name of the remote device", 0);
 
 CLM_SD(access_mode, "Access Mode", FLD_STR, NULL, 'l', CNRM,
-	CNRM, "RW mode of the device: ro, rw or migration");
+	CNRM, "RW mode of the device: ro, rw or migration",
+	RNBD_ATTR_SD_ACCESS);
 
 static struct table_column clm_rnbd_dev_devname =
 	_CLM_SD("devname", sess, "Device", FLD_STR, sd_devname_to_str, 'l',
-		CNRM, CNRM, "Device name under /dev/. I.e. rnbd0");
+		CNRM, CNRM, "Device name under /dev/. I.e. rnbd0", 0);
 
 static struct table_column clm_rnbd_dev_devpath =
 	_CLM_SD("devpath", sess, "Device path", FLD_STR, sd_devpath_to_str, 'l',
-		CNRM, CNRM, "Device path under /dev/. I.e. /dev/rnbd0");
+		CNRM, CNRM, "Device path under /dev/. I.e. /dev/rnbd0", 0);
 
 static struct table_column clm_rnbd_dev_rx_sect =
 	_CLM_SD("rx_sect", sess, "RX", FLD_LLU, sd_rx_to_str, 'r', CNRM, CNRM,
-	"Amount of data read from the device");
+	"Amount of data read from the device", RNBD_ATTR_DEV_STATS);
 
 static struct table_column clm_rnbd_dev_tx_sect =
 	_CLM_SD("tx_sect", sess, "TX", FLD_LLU, sd_tx_to_str, 'r', CNRM, CNRM,
-	"Amount of data written to the device");
+	"Amount of data written to the device", RNBD_ATTR_DEV_STATS);
 
 static struct table_column clm_rnbd_dev_state =
 	_CLM_SD("state", sess, "State", FLD_STR, sd_state_to_str, 'l', CNRM,
-		CNRM, "State of the RNBD device. (client only)");
+		CNRM, "State of the RNBD device. (client only)",
+		RNBD_ATTR_DEV_STATE);
 
 static struct table_column clm_rnbd_sess_dev_sessname =
 	_CLM_SD("sessname", sess, "Session", FLD_STR, dev_sessname_to_str, 'l',
-		CNRM, CNRM, "Name of the RTRS session of the device");
+		CNRM, CNRM, "Name of the RTRS session of the device", 0);
 
 static struct table_column clm_rnbd_sess_dev_direction =
 	_CLM_SD("direction", sess, "Direction", FLD_STR,
 		sd_sess_to_direction, 'l', CNRM, CNRM,
-		"Direction of data transfer: imported or exported");
+		"Direction of data transfer: imported or exported", 0);
 
 static struct table_column *all_clms_devices[] = {
 	&clm_rnbd_sess_dev_sessname,
@@ -109,49 +114,53 @@ static struct table_column *def_clms_devices_srv[] = {
 	NULL
 };
 
-#define CLM_S(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr) \
+#define CLM_S(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr, \
+	      m_attrs) \
 	CLM(rnbd_sess, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
-	    m_descr, sizeof(m_header) - 1, 0)
+	    m_descr, sizeof(m_header) - 1, 0, m_attrs)
 
 #define _CLM_S(s_name, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
-	       m_descr) \
+	       m_descr, m_attrs) \
 	_CLM(rnbd_sess, s_name, m_name, m_header, m_type, tostr, align, \
-	     h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0)
+	     h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0, m_attrs)
 
 CLM_S(sessname, "Session name", FLD_STR, NULL, 'l', CNRM, CBLD,
-	"Name of the session");
+	"Name of the session", 0);
 CLM_S(hostname, "Hostname", FLD_STR, NULL, 'l', CNRM, CBLD,
-	"Hostname of the counterpart");
+	"Hostname of the counterpart", RNBD_ATTR_SESS_HOSTNAME);
 CLM_S(mp_short, "MP", FLD_STR, NULL, 'l', CNRM, CNRM,
-	"Multipath policy (short)");
+	"Multipath policy (short)", RNBD_ATTR_SESS_MP);
 CLM_S(mp, "MP Policy", FLD_STR, NULL, 'l', CNRM, CNRM,
-	"Multipath policy");
+	"Multipath policy", RNBD_ATTR_SESS_MP);
 CLM_S(path_cnt, "Path cnt", FLD_INT, NULL, 'r', CNRM, CNRM,
-	"Number of paths");
+	"Number of paths", 0);
 CLM_S(act_path_cnt, "Act path cnt", FLD_INT, NULL, 'r', CNRM, CNRM,
-	"Number of active paths");
+	"Number of active paths", RNBD_ATTR_PATH_STATE);
 CLM_S(rx_bytes, "RX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM,
-	"Bytes received");
-CLM_S(tx_bytes, "TX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM, "Bytes send");
-CLM_S(inflights, "Inflights", FLD_INT, NULL, 'r', CNRM, CNRM, "Inflights");
-CLM_S(reconnects, "Reconnects", FLD_INT, NULL, 'r', CNRM, CNRM, "Reconnects");
+	"Bytes received", RNBD_ATTR_PATH_STATS);
+CLM_S(tx_bytes, "TX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM, "Bytes send",
+	RNBD_ATTR_PATH_STATS);
+CLM_S(inflights, "Inflights", FLD_INT, NULL, 'r', CNRM, CNRM, "Inflights",
+	RNBD_ATTR_PATH_STATS);
+CLM_S(reconnects, "Reconnects", FLD_INT, NULL, 'r', CNRM, CNRM, "Reconnects",
+	RNBD_ATTR_PATH_RECONNECTS);
 CLM_S(path_uu, "PS", FLD_STR, NULL, 'l', CNRM, CNRM,
-	"Up (U) or down (_) state of every path");
+	"Up (U) or down (_) state of every path", RNBD_ATTR_PATH_STATE);
 
 static struct table_column clm_rnbd_sess_state =
 	_CLM_S("state", act_path_cnt, "State", FLD_STR,
 		act_path_cnt_to_state, 'l', CNRM, CNRM,
-		"State of the session.");
+		"State of the session.", RNBD_ATTR_PATH_STATE);
 
 static struct table_column clm_rnbd_sess_srvname =
 	_CLM_S("srvname", sessname, "Server Name", FLD_STR,
 		sessname_to_srvname, 'l', CNRM, CNRM,
-		"Server name");
+		"Server name", 0);
 
 static struct table_column clm_rnbd_sess_side =
 	_CLM_S("direction", side, "Direction", FLD_STR,
 		sess_side_to_direction, 'l', CNRM, CNRM,
-		"Direction of the session: incoming or outgoing");
+		"Direction of the session: incoming or outgoing", 0);
 
 static struct table_column *all_clms_sessions[] = {
 	&clm_rnbd_sess_sessname,
@@ -220,42 +229,50 @@ static struct table_column *def_clms_sessions_srv[] = {
 	NULL
 };
 
-#define CLM_P(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr) \
+#define CLM_P(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr, \
+	      m_attrs) \
 	CLM(rnbd_path, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
-	    m_descr, sizeof(m_header) - 1, 0)
+	    m_descr, sizeof(m_header) - 1, 0, m_attrs)
 
 CLM_P(state, "State", FLD_STR, rnbd_path_state_to_str, 'l', CNRM, CBLD,
-	"Name of the path");
+	"Name of the path", RNBD_ATTR_PATH_STATE);
 CLM_P(pathname, "Path name", FLD_STR, path_to_norm, 'l', CNRM, CNRM,
-	"Path name");
+	"Path name", 0);
 CLM_P(src_addr, "Client Addr", FLD_STR, addr_to_norm, 'l', CNRM, CNRM,
-	"Client address of the path");
+	"Client address of the path", RNBD_ATTR_PATH_ADDR);
 CLM_P(dst_addr, "Server Addr", FLD_STR, addr_to_norm, 'l', CNRM, CNRM,
-	"Server address of the path");
-CLM_P(hca_name, "HCA", FLD_STR, NULL, 'l', CNRM, CNRM, "HCA name");
-CLM_P(hca_port, "Port", FLD_VAL, NULL, 'r', CNRM, CNRM, "HCA port");
-CLM_P(rx_bytes, "RX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM, "Bytes received");
-CLM_P(tx_bytes, "TX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM, "Bytes send");
-CLM_P(inflights, "Inflights", FLD_INT, NULL, 'r', CNRM, CNRM, "Inflights");
-CLM_P(reconnects, "Reconnects", FLD_INT, NULL, 'r', CNRM, CNRM, "Reconnects");
+	"Server address of the path", RNBD_ATTR_PATH_ADDR);
+CLM_P(hca_name, "HCA", FLD_STR, NULL, 'l', CNRM, CNRM, "HCA name",
+	RNBD_ATTR_PATH_HCA);
+CLM_P(hca_port, "Port", FLD_VAL, NULL, 'r', CNRM, CNRM, "HCA port",
+	RNBD_ATTR_PATH_HCA);
+CLM_P(rx_bytes, "RX", FLD_LLU, byte_ptr_to_str, 'r', CNRM, CNRM,
+	"Bytes received", RNBD_ATTR_PATH_STATS);
+CLM_P(tx_bytes, "TX", FLD_LLU, byte_ptr_to_str, 'r', CNRM, CNRM, "Bytes send",
+	RNBD_ATTR_PATH_STATS);
+CLM_P(inflights, "Inflights", FLD_INT, int_ptr_to_str, 'r', CNRM, CNRM,
+	"Inflights", RNBD_ATTR_PATH_STATS);
+CLM_P(reconnects, "Reconnects", FLD_INT, int_ptr_to_str, 'r', CNRM, CNRM,
+	"Reconnects", RNBD_ATTR_PATH_RECONNECTS);
 
 #define _CLM_P(s_name, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
-	       m_descr) \
+	       m_descr, m_attrs) \
 	_CLM(rnbd_path, s_name, m_name, m_header, m_type, tostr, align, \
-	     h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0)
+	     h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0, m_attrs)
 
 static struct table_column clm_rnbd_path_sessname =
 	_CLM_P("sessname", sess, "Sessname", FLD_STR, path_to_sessname, 'l',
-	       CNRM, CNRM, "Name of the session.");
+	       CNRM, CNRM, "Name of the session.", 0);
 
 static struct table_column clm_rnbd_path_shortdesc =
 	_CLM_P("shortdesc", sess, "Short", FLD_STR,
-	       path_to_shortdesc, 'l', CNRM, CNRM, "Short description");
+	       path_to_shortdesc, 'l', CNRM, CNRM, "Short description",
+	       RNBD_ATTR_PATH_HCA | RNBD_ATTR_PATH_STATE);
 
 static struct table_column clm_rnbd_path_direction =
 	_CLM_P("direction", sess, "Direction", FLD_STR,
 	       path_sess_to_direction, 'l', CNRM, CNRM,
-	       "Direction of the path: incoming or outgoing");
+	       "Direction of the path: incoming or outgoing", 0);
 
 static struct table_column *all_clms_paths[] = {
 	&clm_rnbd_path_sessname,
@@ -343,3 +360,69 @@ struct table_column *clms_paths_shortdesc[] = {
 	&clm_rnbd_path_shortdesc,
 	NULL
 };
+
+#define CLM_D(m_name, m_header, m_type, tostr, align, h_clr, c_clr, m_descr) \
+	CLM(rnbd_diff, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
+	    m_descr, sizeof(m_header) - 1, 0, 0)
+
+#define _CLM_D(s_name, m_name, m_header, m_type, tostr, align, h_clr, c_clr, \
+	       m_descr) \
+	_CLM(rnbd_diff, s_name, m_name, m_header, m_type, tostr, align, \
+	     h_clr, c_clr, m_descr, sizeof(m_header) - 1, 0, 0)
+
+CLM_D(object, "Object", FLD_STR, diff_object_to_str, 'l', CNRM, CNRM,
+	"Kind of the object: device, session or path");
+CLM_D(sessname, "Session", FLD_STR, diff_strp_to_str, 'l', CNRM, CBLD,
+	"Name of the session");
+CLM_D(name, "Name", FLD_STR, diff_strp_to_str, 'l', CNRM, CNRM,
+	"Mapping path of a device or name of a path");
+CLM_D(change, "Change", FLD_STR, diff_change_to_str, 'l', CNRM, CNRM,
+	"appeared, disappeared or changed");
+CLM_D(old_state, "Old State", FLD_STR, diff_state_to_str, 'l', CNRM, CNRM,
+	"State in the first snapshot");
+CLM_D(new_state, "New State", FLD_STR, diff_state_to_str, 'l', CNRM, CNRM,
+	"State in the second snapshot");
+CLM_D(reconnects, "Reconnects", FLD_INT, NULL, 'r', CNRM, CNRM,
+	"Number of reconnects in between");
+CLM_D(rx_bytes, "RX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM,
+	"Bytes received in between");
+CLM_D(tx_bytes, "TX", FLD_LLU, byte_to_str, 'r', CNRM, CNRM,
+	"Bytes sent in between");
+CLM_D(rx_rate, "RX/s", FLD_LLU, byte_to_str, 'r', CNRM, CNRM,
+	"Bytes received per second");
+CLM_D(tx_rate, "TX/s", FLD_LLU, byte_to_str, 'r', CNRM, CNRM,
+	"Bytes sent per second");
+
+static struct table_column clm_rnbd_diff_direction =
+	_CLM_D("direction", side, "Direction", FLD_STR,
+	       diff_side_to_direction, 'l', CNRM, CNRM,
+	       "Direction of the object: incoming or outgoing");
+
+static struct table_column *all_clms_diff[] = {
+	&clm_rnbd_diff_object,
+	&clm_rnbd_diff_direction,
+	&clm_rnbd_diff_sessname,
+	&clm_rnbd_diff_name,
+	&clm_rnbd_diff_change,
+	&clm_rnbd_diff_old_state,
+	&clm_rnbd_diff_new_state,
+	&clm_rnbd_diff_reconnects,
+	&clm_rnbd_diff_rx_bytes,
+	&clm_rnbd_diff_tx_bytes,
+	&clm_rnbd_diff_rx_rate,
+	&clm_rnbd_diff_tx_rate,
+	NULL
+};
+
+static struct table_column *def_clms_diff[] = {
+	&clm_rnbd_diff_object,
+	&clm_rnbd_diff_sessname,
+	&clm_rnbd_diff_name,
+	&clm_rnbd_diff_change,
+	&clm_rnbd_diff_old_state,
+	&clm_rnbd_diff_new_state,
+	&clm_rnbd_diff_reconnects,
+	&clm_rnbd_diff_rx_rate,
+	&clm_rnbd_diff_tx_rate,
+	NULL
+};
@@ -37,7 +37,9 @@
 #define COMPAT_PATH_SESS_SRV  "/sys/class/ibtrs-server/"
 #define COMPAT_PATH_DEV_NAME  "ibnbd"
 
-struct rnbd_dev *devs[4096]; /* FIXME: this has to be a list */
+#define PATH_ATTRS (RNBD_ATTR_PATH_ADDR | RNBD_ATTR_PATH_HCA | \
+		    RNBD_ATTR_PATH_STATE | RNBD_ATTR_PATH_STATS | \
+		    RNBD_ATTR_PATH_RECONNECTS)
 
 
 static struct rnbd_sysfs_info _sysfs_info =
@@ -128,41 +130,206 @@ int scanf_sysfs(const char *dir, const char *entry, const char *format, ...)
 	return ret;
 }
 
-static void rnbd_sysfs_free(struct rnbd_sess_dev **sds,
-			     struct rnbd_sess **sess,
-			     struct rnbd_path **paths)
+static void free_arr(void **arr)
 {
 	int i;
 
-	for (i = 0; sds[i]; i++)
-		free(sds[i]);
-	free(sds);
+	for (i = 0; arr && arr[i]; i++)
+		free(arr[i]);
+	free(arr);
+}
+
+static void free_sds(struct rnbd_sess_dev **sds)
+{
+	int i;
+
+	for (i = 0; sds && sds[i]; i++)
+		free(sds[i]->sysfs_dir);
+	free_arr((void **)sds);
+}
+
+void rnbd_snapshot_free(struct rnbd_snapshot *snap)
+{
+	int i;
+
+	if (snap->idx_free)
+		snap->idx_free(snap->idx);
+
+	for (i = 0; snap->sess_clt && snap->sess_clt[i]; i++)
+		free(snap->sess_clt[i]->paths);
+	for (i = 0; snap->sess_srv && snap->sess_srv[i]; i++)
+		free(snap->sess_srv[i]->paths);
+	for (i = 0; snap->devs && snap->devs[i]; i++)
+		free(snap->devs[i]->sysfs_dir);
+
+	free_sds(snap->sds_clt);
+	free_sds(snap->sds_srv);
+	free_arr((void **)snap->sess_clt);
+	free_arr((void **)snap->sess_srv);
+	free_arr((void **)snap->paths_clt);
+	free_arr((void **)snap->paths_srv);
+	free_arr((void **)snap->devs);
+	rnbd_counters_free(&snap->counters);
+	free(snap->links);
+
+	memset(snap, 0, sizeof(*snap));
+}
+
+int rnbd_counters_alloc(struct rnbd_counters *c, int paths, int devs)
+{
+	memset(c, 0, sizeof(*c));
+
+	c->rx_bytes = calloc(paths, sizeof(*c->rx_bytes));
+	c->tx_bytes = calloc(paths, sizeof(*c->tx_bytes));
+	c->inflights = calloc(paths, sizeof(*c->inflights));
+	c->reconnects = calloc(paths, sizeof(*c->reconnects));
+	c->rx_sect = calloc(devs, sizeof(*c->rx_sect));
+	c->tx_sect = calloc(devs, sizeof(*c->tx_sect));
+
+	if (!c->rx_bytes || !c->tx_bytes || !c->inflights ||
+	    !c->reconnects || !c->rx_sect || !c->tx_sect) {
+		rnbd_counters_free(c);
+		return -ENOMEM;
+	}
+
+	c->path_size = paths;
+	c->dev_size = devs;
+
+	return 0;
+}
+
+void rnbd_counters_free(struct rnbd_counters *c)
+{
+	free(c->rx_bytes);
+	free(c->tx_bytes);
+	free(c->inflights);
+	free(c->reconnects);
+	free(c->rx_sect);
+	free(c->tx_sect);
+	memset(c, 0, sizeof(*c));
+}
+
+int rnbd_counters_add_path(struct rnbd_counters *c, struct rnbd_path *p)
+{
+	if (c->path_cnt == c->path_size)
+		return -ENOSPC;
+
+	p->id = c->path_cnt++;
+	p->rx_bytes = &c->rx_bytes[p->id];
+	p->tx_bytes = &c->tx_bytes[p->id];
+	p->inflights = &c->inflights[p->id];
+	p->reconnects = &c->reconnects[p->id];
+
+	return 0;
+}
+
+int rnbd_counters_add_dev(struct rnbd_counters *c, struct rnbd_dev *d)
+{
+	if (c->dev_cnt == c->dev_size)
+		return -ENOSPC;
+
+	d->id = c->dev_cnt++;
+	d->rx_sect = &c->rx_sect[d->id];
+	d->tx_sect = &c->tx_sect[d->id];
+
+	return 0;
+}
+
+void rnbd_counters_sum_sess(const struct rnbd_counters *c,
+			    struct rnbd_sess *s)
+{
+	uint64_t rx_bytes = 0, tx_bytes = 0;
+	int i, inflights = 0, reconnects = 0;
+	int end = s->path_id + s->path_cnt;
+
+	for (i = s->path_id; i < end; i++) {
+		rx_bytes += c->rx_bytes[i];
+		tx_bytes += c->tx_bytes[i];
+		inflights += c->inflights[i];
+		reconnects += c->reconnects[i];
+	}
+
+	s->rx_bytes = rx_bytes;
+	s->tx_bytes = tx_bytes;
+	s->inflights = inflights;
+	s->reconnects = reconnects;
+}
+
+static int link_cnt_sds(struct rnbd_sess_dev **sds)
+{
+	int i;
+
+	for (i = 0; sds[i]; i++) {
+		sds[i]->sess->sds_cnt++;
+		sds[i]->dev->sds_cnt++;
+	}
+
+	return i;
+}
+
+static int link_slice_sess(struct rnbd_sess **sess,
+			   struct rnbd_sess_dev **links, int pos)
+{
+	int i;
 
 	for (i = 0; sess[i]; i++) {
-		free(sess[i]->paths);
-		free(sess[i]);
+		sess[i]->sds = &links[pos];
+		pos += sess[i]->sds_cnt + 1;
+		sess[i]->sds_cnt = 0;
 	}
-	free(sess);
 
-	for (i = 0; paths[i]; i++)
-		free(paths[i]);
-	free(paths);
+	return pos;
 }
 
-void rnbd_sysfs_free_all(struct rnbd_sess_dev **sds_clt,
-			  struct rnbd_sess_dev **sds_srv,
-			  struct rnbd_sess **sess_clt,
-			  struct rnbd_sess **sess_srv,
-			  struct rnbd_path **paths_clt,
-			  struct rnbd_path **paths_srv)
+static void link_fill_sds(struct rnbd_sess_dev **sds)
 {
+	struct rnbd_sess *s;
+	struct rnbd_dev *d;
 	int i;
 
-	rnbd_sysfs_free(sds_clt, sess_clt, paths_clt);
-	rnbd_sysfs_free(sds_srv, sess_srv, paths_srv);
+	for (i = 0; sds[i]; i++) {
+		s = sds[i]->sess;
+		d = sds[i]->dev;
+		s->sds[s->sds_cnt++] = sds[i];
+		d->sds[d->sds_cnt++] = sds[i];
+	}
+}
 
-	for (i = 0; devs[i]; i++)
-		free(devs[i]);
+struct rnbd_sess_dev **rnbd_link_sds(struct rnbd_sess_dev **sds_clt,
+				     struct rnbd_sess_dev **sds_srv,
+				     struct rnbd_sess **sess_clt,
+				     struct rnbd_sess **sess_srv,
+				     struct rnbd_dev **devs)
+{
+	struct rnbd_sess_dev **links;
+	int i, cnt = 0, pos = 0;
+
+	for (i = 0; sess_clt[i]; i++, cnt++)
+		sess_clt[i]->sds_cnt = 0;
+	for (i = 0; sess_srv[i]; i++, cnt++)
+		sess_srv[i]->sds_cnt = 0;
+	for (i = 0; devs[i]; i++, cnt++)
+		devs[i]->sds_cnt = 0;
+
+	/* every session-device is in the list of its session and device */
+	cnt += 2 * (link_cnt_sds(sds_clt) + link_cnt_sds(sds_srv));
+
+	links = calloc(cnt + 1, sizeof(*links));
+	if (!links)
+		return NULL;
+
+	pos = link_slice_sess(sess_clt, links, pos);
+	pos = link_slice_sess(sess_srv, links, pos);
+	for (i = 0; devs[i]; i++) {
+		devs[i]->sds = &links[pos];
+		pos += devs[i]->sds_cnt + 1;
+		devs[i]->sds_cnt = 0;
+	}
+
+	link_fill_sds(sds_clt);
+	link_fill_sds(sds_srv);
+
+	return links;
 }
 
 static int dir_cnt(const char *dir)
@@ -249,75 +416,83 @@ static int rnbd_sysfs_alloc(struct rnbd_sess_dev ***sds,
 	*path_cnt += 1;
 
 	*sds = calloc(sds_cnt, sizeof(*sds));
-	if (!*sds)
-		return -ENOMEM;
-
 	*sess = calloc(*sess_cnt, sizeof(*sess));
-	if (!*sess) {
-		free(*sds);
-		return -ENOMEM;
-	}
-
 	*paths = calloc(*path_cnt, sizeof(*paths));
-	if (!*paths) {
-		free(*sds);
-		free(*sess);
+	if (!*sds || !*sess || !*paths)
 		return -ENOMEM;
-	}
 
 	return 0;
 }
 
-int rnbd_sysfs_alloc_all(struct rnbd_sess_dev ***sds_clt,
-			  struct rnbd_sess_dev ***sds_srv,
-			  struct rnbd_sess ***sess_clt,
-			  struct rnbd_sess ***sess_srv,
-			  struct rnbd_path ***paths_clt,
-			  struct rnbd_path ***paths_srv,
-			  int *sds_clt_cnt, int *sds_srv_cnt,
-			  int *sess_clt_cnt, int *sess_srv_cnt,
-			  int *paths_clt_cnt, int *paths_srv_cnt)
+static int rnbd_sysfs_alloc_all(struct rnbd_snapshot *snap)
 {
 	char path[PATH_MAX];
-	int ret = 0;
-
-	devs[0] = NULL;
-
+	int dev_cnt, ret = 0;
 
 	sprintf(path, "%s/devices/", use_sysfs_info->path_dev_clt);
-	*sds_clt_cnt = dir_cnt(path);
-	if (*sds_clt_cnt < 0)
-		return *sds_clt_cnt;
-
-
-	*sds_srv_cnt = rnbd_sysfs_sds_srv_cnt();
-	if (*sds_srv_cnt < 0)
-		return *sds_srv_cnt;
+	snap->sds_clt_cnt = dir_cnt(path);
+	if (snap->sds_clt_cnt < 0)
+		return snap->sds_clt_cnt;
 
+	snap->sds_srv_cnt = rnbd_sysfs_sds_srv_cnt();
+	if (snap->sds_srv_cnt < 0)
+		return snap->sds_srv_cnt;
 
-	*sds_clt_cnt += 1;
-	*sds_srv_cnt += 1;
+	snap->sds_clt_cnt += 1;
+	snap->sds_srv_cnt += 1;
 
-	ret = rnbd_sysfs_alloc(sds_clt, sess_clt, paths_clt,
-				*sds_clt_cnt, sess_clt_cnt, paths_clt_cnt,
+	ret = rnbd_sysfs_alloc(&snap->sds_clt, &snap->sess_clt,
+				&snap->paths_clt, snap->sds_clt_cnt,
+				&snap->sess_clt_cnt, &snap->paths_clt_cnt,
 				use_sysfs_info->path_sess_clt);
 	if (ret)
 		return ret;
 
-	ret = rnbd_sysfs_alloc(sds_srv, sess_srv, paths_srv,
-				*sds_srv_cnt, sess_srv_cnt, paths_srv_cnt,
+	ret = rnbd_sysfs_alloc(&snap->sds_srv, &snap->sess_srv,
+				&snap->paths_srv, snap->sds_srv_cnt,
+				&snap->sess_srv_cnt, &snap->paths_srv_cnt,
 				use_sysfs_info->path_sess_srv);
 	if (ret)
-		rnbd_sysfs_free(*sds_clt, *sess_clt, *paths_clt);
+		return ret;
 
-	return ret;
+	/* a client device has one session-device, a server device many */
+	sprintf(path, "%s/devices/", use_sysfs_info->path_dev_srv);
+	dev_cnt = dir_cnt(path);
+	if (dev_cnt < 0)
+		return dev_cnt;
+	dev_cnt += snap->sds_clt_cnt;
+
+	snap->devs = calloc(dev_cnt, sizeof(*snap->devs));
+	if (!snap->devs)
+		return -ENOMEM;
+
+	return rnbd_counters_alloc(&snap->counters,
+				   snap->paths_clt_cnt + snap->paths_srv_cnt,
+				   dev_cnt - 1);
+}
+
+static void read_dev_attrs(struct rnbd_dev *d, unsigned int attrs)
+{
+	char path[2*PATH_MAX];
+
+	if (attrs & RNBD_ATTR_DEV_STATS)
+		scanf_sysfs(d->sysfs_dir, "stat",
+			    "%*d %*d %" SCNu64 " %*d %*d %*d %" SCNu64,
+			    d->rx_sect, d->tx_sect);
+
+	if ((attrs & RNBD_ATTR_DEV_STATE) && d->side == RNBD_CLIENT) {
+		snprintf(path, sizeof(path), "%s/%s/", d->sysfs_dir,
+			 use_sysfs_info->path_dev_name);
+		scanf_sysfs(path, "state", "%s", d->state);
+	}
 }
 
 static struct rnbd_dev *find_or_add_dev(const char *syspath,
 					 struct rnbd_dev **devs,
+					 struct rnbd_counters *c,
 					 enum rnbdmode side)
 {
-	char *devname, *r, path[2*PATH_MAX], rpath[PATH_MAX];
+	char *devname, *r, path[PATH_MAX], rpath[PATH_MAX];
 	int i;
 
 	strcpy(path, syspath);
@@ -335,24 +510,53 @@ static struct rnbd_dev *find_or_add_dev(const char *syspath,
 	if (!devs[i])
 		return NULL;
 
+	devs[i]->sysfs_dir = strdup(rpath);
+	if (!devs[i]->sysfs_dir ||
+	    rnbd_counters_add_dev(c, devs[i])) {
+		free(devs[i]->sysfs_dir);
+		free(devs[i]);
+		devs[i] = NULL;
+		return NULL;
+	}
+
 	devs[i + 1] = NULL;
 
 	strcpy(devs[i]->devname, devname);
 	sprintf(devs[i]->devpath, "/dev/%s", devname);
-	scanf_sysfs(rpath, "stat", "%*d %*d %ld %*d %*d %*d %ld", &devs[i]->rx_sect,
-		    &devs[i]->tx_sect);
-
-	if (side == RNBD_CLIENT) {
-		snprintf(path, sizeof(path), "%s/%s/", rpath, use_sysfs_info->path_dev_name);
-		scanf_sysfs(path, "state", "%s", devs[i]->state);
-	}
+	devs[i]->side = side;
 
 	return devs[i];
 }
 
+static void read_path_attrs(const char *ppath, struct rnbd_path *p,
+			    unsigned int attrs)
+{
+	if (attrs & RNBD_ATTR_PATH_ADDR) {
+		scanf_sysfs(ppath, "src_addr", "%s", p->src_addr);
+		scanf_sysfs(ppath, "dst_addr", "%s", p->dst_addr);
+		rnbd_addr_parse(&p->src, p->src_addr);
+		rnbd_addr_parse(&p->dst, p->dst_addr);
+	}
+	if (attrs & RNBD_ATTR_PATH_HCA) {
+		scanf_sysfs(ppath, "hca_name", "%s", p->hca_name);
+		scanf_sysfs(ppath, "hca_port", "%d", &p->hca_port);
+	}
+	if (attrs & RNBD_ATTR_PATH_STATE)
+		scanf_sysfs(ppath, "state", "%s", p->state);
+
+	if (attrs & RNBD_ATTR_PATH_STATS)
+		scanf_sysfs(ppath, "/stats/rdma",
+			    "%*u %" SCNu64 " %*u %" SCNu64 " %d %*d",
+			    p->rx_bytes, p->tx_bytes, p->inflights);
+	if (attrs & RNBD_ATTR_PATH_RECONNECTS)
+		scanf_sysfs(ppath, "/stats/reconnects", "%d %*d",
+			    p->reconnects);
+}
+
 static struct rnbd_path *add_path(const char *sdir,
 				   const char *pname,
-				   struct rnbd_path **paths)
+				   struct rnbd_path **paths,
+				   struct rnbd_counters *c)
 {
 	struct rnbd_path *p;
 	char ppath[PATH_MAX];
@@ -367,25 +571,77 @@ static struct rnbd_path *add_path(const char *sdir,
 	p = calloc(1, sizeof(**paths));
 	if (!p)
 		return NULL;
+
+	if (rnbd_counters_add_path(c, p)) {
+		free(p);
+		return NULL;
+	}
 	paths[i] = p;
 
 	strcpy(p->pathname, pname);
-	scanf_sysfs(ppath, "src_addr", "%s", p->src_addr);
-	scanf_sysfs(ppath, "dst_addr", "%s", p->dst_addr);
-	scanf_sysfs(ppath, "hca_name", "%s", p->hca_name);
-	scanf_sysfs(ppath, "hca_port", "%d", &p->hca_port);
-	scanf_sysfs(ppath, "state", "%s", p->state);
-
-	scanf_sysfs(ppath, "/stats/rdma", "%*u %lu %*u %lu %d %*d",
-		    &p->rx_bytes, &p->tx_bytes, &p->inflights);
-	scanf_sysfs(ppath, "/stats/reconnects", "%d %*d", &p->reconnects);
 
 	return p;
 }
 
+void rnbd_sess_account_path(struct rnbd_sess *s, struct rnbd_path *p)
+{
+	p->sess = s;
+	if (!strcmp(p->state, "connected")) {
+		strcat(s->path_uu, "U");
+		s->act_path_cnt++;
+	} else {
+		strcat(s->path_uu, "_");
+	}
+}
+
+static void sess_dir(char *path, const struct rnbd_sess *s)
+{
+	if (s->side == RNBD_CLIENT)
+		sprintf(path, "%s%s", use_sysfs_info->path_sess_clt,
+			s->sessname);
+	else
+		sprintf(path, "%s%s", use_sysfs_info->path_sess_srv,
+			s->sessname);
+}
+
+static void read_sess_attrs(struct rnbd_sess *s,
+			    const struct rnbd_counters *c, unsigned int attrs)
+{
+	char path[PATH_MAX], ppath[2*PATH_MAX];
+	int i;
+
+	sess_dir(path, s);
+
+	if (attrs & RNBD_ATTR_SESS_MP)
+		scanf_sysfs(path, "mpath_policy", "%s (%2s: %*d)",
+			    s->mp, s->mp_short);
+
+	if (attrs & RNBD_ATTR_SESS_HOSTNAME)
+		scanf_sysfs(path, s->side == RNBD_CLIENT ?
+			    "srv_hostname" : "clt_hostname", "%s", s->hostname);
+
+	if (!(attrs & PATH_ATTRS))
+		return;
+
+	/* the fields calculated from the paths might change */
+
+	s->act_path_cnt = 0;
+	s->path_uu[0] = '\0';
+
+	for (i = 0; i < s->path_cnt; i++) {
+		snprintf(ppath, sizeof(ppath), "%s/paths/%s", path,
+			 s->paths[i]->pathname);
+		read_path_attrs(ppath, s->paths[i], attrs);
+		rnbd_sess_account_path(s, s->paths[i]);
+	}
+
+	rnbd_counters_sum_sess(c, s);
+}
+
 static struct rnbd_sess *find_or_add_sess(const char *sessname,
 					   struct rnbd_sess **sess,
 					   struct rnbd_path **paths,
+					   struct rnbd_counters *c,
 					   enum rnbdmode side)
 {
 	struct rnbd_sess *s;
@@ -395,11 +651,6 @@ static struct rnbd_sess *find_or_add_sess(const char *sessname,
 	DIR *pdir;
 	int i;
 
-	if (side == RNBD_CLIENT)
-		sprintf(path, "%s%s", use_sysfs_info->path_sess_clt, sessname);
-	else
-		sprintf(path, "%s%s", use_sysfs_info->path_sess_srv, sessname);
-
 	for (i = 0; sess[i]; i++)
 		if (!strcmp(sessname, sess[i]->sessname))
 			return sess[i];
@@ -412,14 +663,10 @@ static struct rnbd_sess *find_or_add_sess(const char *sessname,
 
 	strcpy(s->sessname, sessname);
 	s->side = side;
-	scanf_sysfs(path, "mpath_policy", "%s (%2s: %*d)", s->mp, s->mp_short);
-
-	if (side == RNBD_CLIENT)
-		scanf_sysfs(path, "srv_hostname", "%s", s->hostname);
-	else
-		scanf_sysfs(path, "clt_hostname", "%s", s->hostname);
 
+	sess_dir(path, s);
 	strcat(path, "/paths/");
+	s->path_id = c->path_cnt;
 	s->path_cnt = dir_cnt(path);
 	if (!s->path_cnt)
 		return s;
@@ -441,27 +688,20 @@ static struct rnbd_sess *find_or_add_sess(const char *sessname,
 			continue;
 		}
 
-		p = add_path(path, pent->d_name, paths);
+		p = add_path(path, pent->d_name, paths, c);
 		if (!p)
 			goto out;
 
 		s->paths[i] = p;
-		p->sess = s;
-		if (!strcmp(p->state, "connected")) {
-			strcat(s->path_uu, "U");
-			s->act_path_cnt++;
-		} else {
-			strcat(s->path_uu, "_");
-		}
-
-		s->rx_bytes += p->rx_bytes;
-		s->tx_bytes += p->tx_bytes;
-		s->inflights += p->inflights;
-		s->reconnects += p->reconnects;
+		rnbd_sess_account_path(s, p);
 	}
 
 	s->paths[i] = NULL;
+	s->path_cnt = i;
 	closedir(pdir);
+
+	rnbd_counters_sum_sess(c, s);
+
 	return s;
 
 out:
@@ -496,8 +736,15 @@ static struct rnbd_sess_dev *add_sess_dev(const char *devname,
 	if (!sds[i])
 		return NULL;
 
+	sds[i]->sysfs_dir = strdup(path);
+	if (!sds[i]->sysfs_dir) {
+		free(sds[i]);
+		sds[i] = NULL;
+		return NULL;
+	}
+
+	/* always read, the session-devices are sorted by it */
 	scanf_sysfs(path, "mapping_path", "%s", sds[i]->mapping_path);
-	scanf_sysfs(path, "access_mode", "%s", sds[i]->access_mode);
 
 	sds[i]->sess = s;
 	sds[i]->dev = d;
@@ -508,6 +755,7 @@ static struct rnbd_sess_dev *add_sess_dev(const char *devname,
 static int rnbd_sysfs_read_sess_path(
 		struct rnbd_sess **sess,
 		struct rnbd_path **paths,
+		struct rnbd_counters *c,
 		enum rnbdmode side)
 {
 	struct dirent *sess_ent;
@@ -526,7 +774,7 @@ static int rnbd_sysfs_read_sess_path(
 		if (strcmp(sess_ent->d_name, "ctl") == 0)
 			continue;
 
-		 find_or_add_sess(sess_ent->d_name, sess, paths, side);
+		 find_or_add_sess(sess_ent->d_name, sess, paths, c, side);
 	}
 	closedir(sp);
 
@@ -536,7 +784,8 @@ static int rnbd_sysfs_read_sess_path(
 static int rnbd_sysfs_read_clt(struct rnbd_sess_dev **sds,
 				struct rnbd_sess **sess,
 				struct rnbd_path **paths,
-				struct rnbd_dev **devs)
+				struct rnbd_dev **devs,
+				struct rnbd_counters *c)
 {
 	char path[PATH_MAX], sessname[NAME_MAX];
 	int res;
@@ -546,7 +795,7 @@ static int rnbd_sysfs_read_clt(struct rnbd_sess_dev **sds,
 	struct rnbd_dev *d;
 	DIR *ddir;
 
-	res = rnbd_sysfs_read_sess_path(sess, paths, RNBD_CLIENT);
+	res = rnbd_sysfs_read_sess_path(sess, paths, c, RNBD_CLIENT);
 	if (res)
 		return res;
 
@@ -562,12 +811,12 @@ static int rnbd_sysfs_read_clt(struct rnbd_sess_dev **sds,
 		sprintf(path, "%s/devices/%s/%s", use_sysfs_info->path_dev_clt, dent->d_name, use_sysfs_info->path_dev_name);
 		scanf_sysfs(path, "session", "%s", sessname);
 
-		s = find_or_add_sess(sessname, sess, paths, RNBD_CLIENT);
+		s = find_or_add_sess(sessname, sess, paths, c, RNBD_CLIENT);
 		if (!s)
 			return -ENOMEM;
 
 		sprintf(path, "%s/devices/%s", use_sysfs_info->path_dev_clt, dent->d_name);
-		d = find_or_add_dev(path, devs, RNBD_CLIENT);
+		d = find_or_add_dev(path, devs, c, RNBD_CLIENT);
 		if (!d)
 			return -ENOMEM;
 
@@ -584,7 +833,8 @@ static int rnbd_sysfs_read_clt(struct rnbd_sess_dev **sds,
 static int rnbd_sysfs_read_srv(struct rnbd_sess_dev **sds,
 				struct rnbd_sess **sess,
 				struct rnbd_path **paths,
-				struct rnbd_dev **devs)
+				struct rnbd_dev **devs,
+				struct rnbd_counters *c)
 {
 	char path[PATH_MAX];
 	int res;
@@ -594,7 +844,7 @@ static int rnbd_sysfs_read_srv(struct rnbd_sess_dev **sds,
 	struct rnbd_dev *d;
 	DIR *ddir, *sdir;
 
-	res = rnbd_sysfs_read_sess_path(sess, paths, RNBD_SERVER);
+	res = rnbd_sysfs_read_sess_path(sess, paths, c, RNBD_SERVER);
 	if (res)
 		return res;
 	
@@ -610,7 +860,7 @@ static int rnbd_sysfs_read_srv(struct rnbd_sess_dev **sds,
 		sprintf(path, "%s/devices/%s/block_dev",
 			use_sysfs_info->path_dev_srv, dent->d_name);
 
-		d = find_or_add_dev(path, devs, RNBD_SERVER);
+		d = find_or_add_dev(path, devs, c, RNBD_SERVER);
 		if (!d)
 			return -ENOMEM;
 
@@ -622,7 +872,7 @@ static int rnbd_sysfs_read_srv(struct rnbd_sess_dev **sds,
 		for (sent = readdir(sdir); sent; sent = readdir(sdir)) {
 			if (sent->d_name[0] == '.')
 				continue;
-			s = find_or_add_sess(sent->d_name, sess, paths,
+			s = find_or_add_sess(sent->d_name, sess, paths, c,
 					     RNBD_SERVER);
 			if (!s)
 				return -ENOMEM;
@@ -640,28 +890,71 @@ static int rnbd_sysfs_read_srv(struct rnbd_sess_dev **sds,
 	return 0;
 }
 
-/*
- * Read all the stuff from sysfs.
- * Use rnbd_sysfs_alloc_all() before and rnbd_sysfs_free_all() after.
- */
-int rnbd_sysfs_read_all(struct rnbd_sess_dev **sds_clt,
-			 struct rnbd_sess_dev **sds_srv,
-			 struct rnbd_sess **sess_clt,
-			 struct rnbd_sess **sess_srv,
-			 struct rnbd_path **paths_clt,
-			 struct rnbd_path **paths_srv)
+int rnbd_sysfs_read_all(struct rnbd_snapshot *snap)
 {
-	int ret = 0;
+	int ret;
 
-	ret = rnbd_sysfs_read_clt(sds_clt, sess_clt, paths_clt, devs);
+	memset(snap, 0, sizeof(*snap));
+	clock_gettime(CLOCK_REALTIME, &snap->ts);
+
+	ret = rnbd_sysfs_alloc_all(snap);
+	if (!ret)
+		ret = rnbd_sysfs_read_clt(snap->sds_clt, snap->sess_clt,
+					  snap->paths_clt, snap->devs,
+					  &snap->counters);
+	if (!ret)
+		ret = rnbd_sysfs_read_srv(snap->sds_srv, snap->sess_srv,
+					  snap->paths_srv, snap->devs,
+					  &snap->counters);
 	if (ret)
-		return ret;
-
-	ret = rnbd_sysfs_read_srv(sds_srv, sess_srv, paths_srv, devs);
+		rnbd_snapshot_free(snap);
 
 	return ret;
 }
 
+void rnbd_sysfs_read_attrs(struct rnbd_snapshot *snap, unsigned int attrs)
+{
+	int i;
+
+	attrs &= ~snap->attrs_read;
+	if (!attrs)
+		return;
+
+	for (i = 0; snap->sess_clt[i]; i++)
+		read_sess_attrs(snap->sess_clt[i], &snap->counters, attrs);
+	for (i = 0; snap->sess_srv[i]; i++)
+		read_sess_attrs(snap->sess_srv[i], &snap->counters, attrs);
+
+	if (attrs & RNBD_ATTR_SD_ACCESS) {
+		for (i = 0; snap->sds_clt[i]; i++)
+			scanf_sysfs(snap->sds_clt[i]->sysfs_dir, "access_mode",
+				    "%s", snap->sds_clt[i]->access_mode);
+		for (i = 0; snap->sds_srv[i]; i++)
+			scanf_sysfs(snap->sds_srv[i]->sysfs_dir, "access_mode",
+				    "%s", snap->sds_srv[i]->access_mode);
+	}
+
+	for (i = 0; snap->devs[i]; i++)
+		read_dev_attrs(snap->devs[i], attrs);
+
+	snap->attrs_read |= attrs;
+}
+
+int rnbd_sysfs_link_all(struct rnbd_snapshot *snap)
+{
+	struct rnbd_sess_dev **links;
+
+	links = rnbd_link_sds(snap->sds_clt, snap->sds_srv, snap->sess_clt,
+			      snap->sess_srv, snap->devs);
+	if (!links)
+		return -ENOMEM;
+
+	free(snap->links);
+	snap->links = links;
+
+	return 0;
+}
+
 enum rnbdmode mode_for_host(void)
 {
 	enum rnbdmode mode = RNBD_NONE;
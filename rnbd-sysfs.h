@@ -1,5 +1,10 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
+#ifndef __H_RNBD_SYSFS
+#define __H_RNBD_SYSFS
+
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
 
 struct rnbd_sysfs_info {
 	const char *path_dev_clt;
@@ -16,15 +21,77 @@ enum rnbdmode {
 	RNBD_BOTH = RNBD_CLIENT | RNBD_SERVER,
 };
 
+/*
+ * Optional sysfs attributes of the objects. rnbd_sysfs_read_all() only
+ * reads what is needed to find the objects and link them together, the
+ * attributes are read later on by rnbd_sysfs_read_attrs() as needed.
+ */
+enum {
+	RNBD_ATTR_PATH_ADDR	  = 1,		/* src_addr and dst_addr */
+	RNBD_ATTR_PATH_HCA	  = 1 << 1,	/* hca_name and hca_port */
+	RNBD_ATTR_PATH_STATE	  = 1 << 2,	/* state of path */
+	RNBD_ATTR_PATH_STATS	  = 1 << 3,	/* stats/rdma */
+	RNBD_ATTR_PATH_RECONNECTS = 1 << 4,	/* stats/reconnects */
+	RNBD_ATTR_SESS_MP	  = 1 << 5,	/* mpath_policy */
+	RNBD_ATTR_SESS_HOSTNAME	  = 1 << 6,	/* srv_hostname, clt_hostname */
+	RNBD_ATTR_DEV_STATS	  = 1 << 7,	/* block device stat */
+	RNBD_ATTR_DEV_STATE	  = 1 << 8,	/* state of client device */
+	RNBD_ATTR_SD_ACCESS	  = 1 << 9,	/* access_mode */
+	RNBD_ATTR_ALL		  = (1 << 10) - 1,
+};
+
+/*
+ * Counters of paths and devices. Every counter is kept in its own array
+ * indexed by the id of the path or the device, the path and device
+ * structures point into these arrays. The arrays are allocated once
+ * for the number of objects found in sysfs and never move.
+ */
+struct rnbd_counters {
+	int		path_cnt;
+	int		path_size;
+	uint64_t	*rx_bytes;
+	uint64_t	*tx_bytes;
+	int		*inflights;
+	int		*reconnects;
+
+	int		dev_cnt;
+	int		dev_size;
+	uint64_t	*rx_sect;
+	uint64_t	*tx_sect;
+};
+
+enum rnbd_addr_type {
+	RNBD_ADDR_STR,	/* neither gid nor ip, compared as string */
+	RNBD_ADDR_GID,
+	RNBD_ADDR_IP,
+};
+
+/*
+ * Path address "gid:<gid>" or "ip:<ipv4 or ipv6>" parsed into binary form
+ * by rnbd_addr_parse()
+ */
+struct rnbd_addr {
+	uint8_t		type;		/* enum rnbd_addr_type */
+	uint8_t		family;		/* AF_INET, AF_INET6 or 0 if unparsable */
+	uint8_t		addr[16];
+};
+
 /*
  * A block device exported or imported
  */
 struct rnbd_dev {
 	char		devname[NAME_MAX]; /* file under /dev/ */
 	char		devpath[PATH_MAX]; /* /dev/rnbd<x>, /dev/ram<x> */
-	unsigned long	rx_sect;	   /* from /sys/block/../stats */
-	unsigned long	tx_sect;	   /* from /sys/block/../stats */
+	int		id;		   /* index in struct rnbd_counters */
+	uint64_t	*rx_sect;	   /* from /sys/block/../stats */
+	uint64_t	*tx_sect;	   /* from /sys/block/../stats */
 	char		state[NAME_MAX];   /* ../rnbd/state sysfs entry */
+	enum rnbdmode	side;		   /* side the device was found on */
+	char		*sysfs_dir;	   /* device directory in sysfs */
+
+	/* session-devices of the device, see rnbd_link_sds() */
+	int		sds_cnt;
+	struct rnbd_sess_dev **sds;
 };
 
 struct rnbd_path {
@@ -32,14 +99,17 @@ struct rnbd_path {
 	char		  pathname[NAME_MAX]; /* path appears in sysfs */
 	char		  src_addr[NAME_MAX]; /* client address */
 	char		  dst_addr[NAME_MAX]; /* server address */
+	struct rnbd_addr  src;		      /* src_addr parsed */
+	struct rnbd_addr  dst;		      /* dst_addr parsed */
 	char		  hca_name[NAME_MAX]; /* hca name */
 	int		  hca_port;	      /* hca port */
 	char		  state[NAME_MAX];    /* state sysfs entry */
+	int		  id;		      /* index in struct rnbd_counters */
 	/* stats/rdma */
-	unsigned long	  rx_bytes;
-	unsigned long	  tx_bytes;
-	int		  inflights;
-	int		  reconnects;
+	uint64_t	  *rx_bytes;
+	uint64_t	  *tx_bytes;
+	int		  *inflights;
+	int		  *reconnects;
 };
 
 struct rnbd_sess {
@@ -58,8 +128,14 @@ struct rnbd_sess {
 	int		  reconnects;
 
 	/* paths */
+	int		  path_id;	/* id of the first path, the ids of */
+					/* the paths of a session are consecutive */
 	int		  path_cnt;	/* path count */
 	struct rnbd_path **paths;	/* paths */
+
+	/* session-devices of the session, see rnbd_link_sds() */
+	int		  sds_cnt;
+	struct rnbd_sess_dev **sds;
 };
 
 struct rnbd_sess_dev {
@@ -67,34 +143,90 @@ struct rnbd_sess_dev {
 	char			mapping_path[NAME_MAX]; /* name for mapping */
 	char			access_mode[64];	/* ro/rw/migration */
 	struct rnbd_dev	*dev;			/* rnbd block device */
+	char			*sysfs_dir;		/* directory in sysfs */
+};
+
+int rnbd_counters_alloc(struct rnbd_counters *c, int paths, int devs);
+void rnbd_counters_free(struct rnbd_counters *c);
+
+/*
+ * Assign the next free id of @c to path @p and point its counters there
+ */
+int rnbd_counters_add_path(struct rnbd_counters *c, struct rnbd_path *p);
+int rnbd_counters_add_dev(struct rnbd_counters *c, struct rnbd_dev *d);
+
+/*
+ * Sum up the counters of the paths of session @s
+ */
+void rnbd_counters_sum_sess(const struct rnbd_counters *c,
+			    struct rnbd_sess *s);
+
+/*
+ * Build the NULL terminated lists of session-devices of each session
+ * and each device from the parent pointers of the session-devices.
+ * Returns the storage of all the lists to be freed with free(),
+ * NULL if out of memory.
+ */
+struct rnbd_sess_dev **rnbd_link_sds(struct rnbd_sess_dev **sds_clt,
+				     struct rnbd_sess_dev **sds_srv,
+				     struct rnbd_sess **sess_clt,
+				     struct rnbd_sess **sess_srv,
+				     struct rnbd_dev **devs);
+
+/*
+ * Add the state of path @p to the fields of session @s calculated from
+ * the list of paths
+ */
+void rnbd_sess_account_path(struct rnbd_sess *s, struct rnbd_path *p);
+
+/*
+ * The object graph at a point in time. The snapshot owns all the objects,
+ * different snapshots don't share anything.
+ * All the arrays are NULL terminated.
+ */
+struct rnbd_snapshot {
+	struct timespec		ts;	/* CLOCK_REALTIME when taken */
+	struct rnbd_sess_dev	**sds_clt;
+	struct rnbd_sess_dev	**sds_srv;
+	struct rnbd_sess	**sess_clt;
+	struct rnbd_sess	**sess_srv;
+	struct rnbd_path	**paths_clt;
+	struct rnbd_path	**paths_srv;
+	struct rnbd_dev		**devs;
+
+	/* sizes of the arrays above, the terminating NULL included */
+	int			sds_clt_cnt, sds_srv_cnt;
+	int			sess_clt_cnt, sess_srv_cnt;
+	int			paths_clt_cnt, paths_srv_cnt;
+
+	struct rnbd_counters	counters;
+	struct rnbd_sess_dev	**links; /* storage of rnbd_link_sds() */
+	unsigned int		attrs_read; /* RNBD_ATTR_* read so far */
+
+	/* lookup indexes the user builds on the snapshot, freed with it */
+	void			*idx;
+	void			(*idx_free)(void *idx);
 };
 
-void rnbd_sysfs_free_all(struct rnbd_sess_dev **sds_clt,
-			  struct rnbd_sess_dev **sds_srv,
-			  struct rnbd_sess **sess_clt,
-			  struct rnbd_sess **sess_srv,
-			  struct rnbd_path **paths_clt,
-			  struct rnbd_path **paths_srv);
-
-int rnbd_sysfs_alloc_all(struct rnbd_sess_dev ***sds_clt,
-			  struct rnbd_sess_dev ***sds_srv,
-			  struct rnbd_sess ***sess_clt,
-			  struct rnbd_sess ***sess_srv,
-			  struct rnbd_path ***paths_clt,
-			  struct rnbd_path ***paths_srv,
-			  int *sds_clt_cnt, int *sds_srv_cnt,
-			  int *sess_clt_cnt, int *sess_srv_cnt,
-			  int *paths_clt_cnt, int *paths_srv_cnt);
 /*
- * Read all the stuff from sysfs.
- * Use rnbd_sysfs_alloc_all() before and rnbd_sysfs_free_all() after.
+ * Read all the objects from sysfs into @snap, but none of the optional
+ * attributes. Use rnbd_snapshot_free() after.
+ */
+int rnbd_sysfs_read_all(struct rnbd_snapshot *snap);
+
+/*
+ * Read the attributes @attrs (RNBD_ATTR_*) of the objects of @snap.
+ * Attributes which were read before are skipped.
+ */
+void rnbd_sysfs_read_attrs(struct rnbd_snapshot *snap, unsigned int attrs);
+
+/*
+ * Link the objects of @snap with rnbd_link_sds(). The lists follow the
+ * order of the sds_clt and sds_srv arrays, so sort them before.
  */
-int rnbd_sysfs_read_all(struct rnbd_sess_dev **sds_clt,
-			struct rnbd_sess_dev **sds_srv,
-			struct rnbd_sess **sess_clt,
-			struct rnbd_sess **sess_srv,
-			struct rnbd_path **paths_clt,
-			struct rnbd_path **paths_srv);
+int rnbd_sysfs_link_all(struct rnbd_snapshot *snap);
+
+void rnbd_snapshot_free(struct rnbd_snapshot *snap);
 
 struct rnbd_ctx;
 
@@ -110,3 +242,5 @@ const char *mode_to_string(enum rnbdmode mode);
 void check_compat_sysfs(struct rnbd_ctx *ctx);
 const struct rnbd_sysfs_info * const
 get_sysfs_info(const struct rnbd_ctx *ctx);
+
+#endif /* __H_RNBD_SYSFS */
@@ -13,6 +13,10 @@
 #include <string.h>
 #include <unistd.h>	/* for isatty() */
 #include <stdbool.h>
+#include <limits.h>
+#include <time.h>	/* for clock_gettime() */
+#include <fnmatch.h>
+#include <signal.h>
 
 #include "levenshtein.h"
 #include "table.h"
@@ -21,6 +25,20 @@
 
 #include "rnbd-sysfs.h"
 #include "rnbd-clms.h"
+#include "snapshot.h"
+#include "diff.h"
+#include "watch.h"
+#include "wait.h"
+#include "apply.h"
+#include "pool.h"
+#include "lock.h"
+#include "daemon.h"
+#include "shm.h"
+#include "librnbd.h"
+#include "out.h"
+#include "hash.h"
+#include "complete.h"
+#include "group.h"
 
 #define INF(verbose_set, fmt, ...)		\
 	do { \
@@ -28,17 +46,7 @@
 			printf(fmt, ##__VA_ARGS__); \
 	} while (0)
 
-bool trm;
-
-static struct rnbd_sess_dev **sds_clt;
-static struct rnbd_sess_dev **sds_srv;
-static struct rnbd_sess **sess_clt;
-static struct rnbd_sess **sess_srv;
-static struct rnbd_path **paths_clt;
-static struct rnbd_path **paths_srv;
-static int sds_clt_cnt, sds_srv_cnt,
-	   sess_clt_cnt, sess_srv_cnt,
-	   paths_clt_cnt, paths_srv_cnt;
+extern bool trm;
 
 struct param {
 	enum rnbd_token tok;
@@ -161,6 +169,159 @@ static int parse_from(int argc, const char *argv[],
 	return 2;
 }
 
+static int parse_interval(int argc, const char *argv[],
+			  const struct param *param, struct rnbd_ctx *ctx)
+{
+	double sec;
+	char *end;
+
+	if (argc < 2) {
+		ERR(trm, "Please specify the interval in seconds\n");
+		return -EINVAL;
+	}
+
+	sec = strtod(argv[1], &end);
+	if (*end || sec < 0.001 || sec > INT_MAX / 1000) {
+		ERR(trm, "Invalid interval '%s'\n", argv[1]);
+		return -EINVAL;
+	}
+
+	ctx->interval_ms = sec * 1000;
+	ctx->interval_set = true;
+
+	return 2;
+}
+
+static int parse_count(int argc, const char *argv[],
+		       const struct param *param, struct rnbd_ctx *ctx)
+{
+	char *end;
+	long cnt;
+
+	if (argc < 2) {
+		ERR(trm, "Please specify the number of samples\n");
+		return -EINVAL;
+	}
+
+	cnt = strtol(argv[1], &end, 10);
+	if (*end || cnt <= 0 || cnt > INT_MAX) {
+		ERR(trm, "Invalid count '%s'\n", argv[1]);
+		return -EINVAL;
+	}
+
+	ctx->count = cnt;
+	ctx->count_set = true;
+
+	return 2;
+}
+
+static int parse_jobs(int argc, const char *argv[],
+		      const struct param *param, struct rnbd_ctx *ctx)
+{
+	char *end;
+	long cnt;
+
+	if (argc < 2) {
+		ERR(trm, "Please specify the number of jobs\n");
+		return -EINVAL;
+	}
+
+	cnt = strtol(argv[1], &end, 10);
+	if (*end || cnt <= 0 || cnt > 256) {
+		ERR(trm, "Invalid number of jobs '%s'\n", argv[1]);
+		return -EINVAL;
+	}
+
+	ctx->jobs = cnt;
+	ctx->jobs_set = true;
+
+	return 2;
+}
+
+static int parse_where(int argc, const char *argv[],
+		       const struct param *param, struct rnbd_ctx *ctx)
+{
+	int ret;
+
+	ret = rnbd_filter_parse(&ctx->where, argc - 1, argv + 1);
+	if (ret < 0)
+		return ret;
+
+	ctx->where_set = true;
+
+	return ret + 1;
+}
+
+static int parse_sort(int argc, const char *argv[],
+		      const struct param *param, struct rnbd_ctx *ctx)
+{
+	int err;
+
+	if (argc < 2) {
+		ERR(trm, "Please specify the fields to sort by\n");
+		return -EINVAL;
+	}
+
+	err = rnbd_sort_parse(&ctx->sort, argv[1]);
+	if (err)
+		return err;
+
+	ctx->sort_set = true;
+
+	return 2;
+}
+
+static int parse_limit(int argc, const char *argv[],
+		       const struct param *param, struct rnbd_ctx *ctx)
+{
+	char *end;
+	long cnt;
+
+	if (argc < 2) {
+		ERR(trm, "Please specify the number of objects to list\n");
+		return -EINVAL;
+	}
+
+	cnt = strtol(argv[1], &end, 10);
+	if (*end || cnt < 0 || cnt > INT_MAX) {
+		ERR(trm, "Invalid limit '%s'\n", argv[1]);
+		return -EINVAL;
+	}
+
+	ctx->limit = cnt;
+	ctx->limit_set = true;
+
+	return 2;
+}
+
+static int parse_group(int argc, const char *argv[],
+		       const struct param *param, struct rnbd_ctx *ctx)
+{
+	if (argc < 2) {
+		ERR(trm, "Please specify the field to group by\n");
+		return -EINVAL;
+	}
+
+	ctx->group = argv[1];
+	ctx->group_set = true;
+
+	return 2;
+}
+
+static int parse_sel_session(int argc, const char *argv[],
+			     const struct param *param, struct rnbd_ctx *ctx)
+{
+	if (argc < 2) {
+		ERR(trm, "Please specify the session of the devices\n");
+		return -EINVAL;
+	}
+
+	ctx->sel_sess = argv[1];
+	ctx->sel_sess_set = true;
+
+	return 2;
+}
+
 static int parse_help(int argc, const char *argv[],
 		      const struct param *param, struct rnbd_ctx *ctx)
 {
@@ -217,19 +378,6 @@ static int parse_rw(int argc, const char *argv[],
 	return 1;
 }
 
-static int clm_set_hdr_unit(struct table_column *clm, char const *unit)
-{
-	size_t len;
-
-	len = strlen(clm->m_header);
-
-	clm->m_width = len + snprintf(clm->m_header + len,
-				      sizeof(clm->m_header) - len, " (%s)",
-				      unit);
-
-	return 0;
-}
-
 static int parse_apply_unit(const char *str, struct rnbd_ctx *ctx)
 {
 	int rc, shift;
@@ -255,21 +403,32 @@ static int parse_apply_unit(const char *str, struct rnbd_ctx *ctx)
 	return 0;
 }
 
+/* the columns showing their unit in the header */
+static const struct table_column *unit_clms[] = {
+	&clm_rnbd_dev_rx_sect,
+	&clm_rnbd_dev_tx_sect,
+	&clm_rnbd_sess_rx_bytes,
+	&clm_rnbd_sess_tx_bytes,
+	&clm_rnbd_path_rx_bytes,
+	&clm_rnbd_path_tx_bytes,
+	&clm_rnbd_diff_rx_bytes,
+	&clm_rnbd_diff_tx_bytes,
+	&clm_rnbd_diff_rx_rate,
+	&clm_rnbd_diff_tx_rate,
+	NULL
+};
+
 static int parse_unit(int argc, const char *argv[],
 		      const struct param *param, struct rnbd_ctx *ctx)
 {
-	int rc;
+	int rc, i;
 
 	rc = get_unit_index(param->param_str, &ctx->unit_id);
 	if (rc < 0)
 		return 0;
 
-	clm_set_hdr_unit(&clm_rnbd_dev_rx_sect, param->descr);
-	clm_set_hdr_unit(&clm_rnbd_dev_tx_sect, param->descr);
-	clm_set_hdr_unit(&clm_rnbd_sess_rx_bytes, param->descr);
-	clm_set_hdr_unit(&clm_rnbd_sess_tx_bytes, param->descr);
-	clm_set_hdr_unit(&clm_rnbd_path_rx_bytes, param->descr);
-	clm_set_hdr_unit(&clm_rnbd_path_tx_bytes, param->descr);
+	for (i = 0; unit_clms[i]; i++)
+		table_layout_set_unit(ctx->layout, unit_clms[i], param->descr);
 
 	ctx->unit_set = true;
 	return 1;
@@ -290,6 +449,8 @@ static int parse_all(int argc, const char *argv[],
 	       ARRSIZE(all_clms_paths_clt) * sizeof(all_clms_paths[0]));
 	memcpy(&ctx->clms_paths_srv, &all_clms_paths_srv,
 	       ARRSIZE(all_clms_paths_srv) * sizeof(all_clms_paths[0]));
+	memcpy(&ctx->clms_diff, &all_clms_diff,
+	       ARRSIZE(all_clms_diff) * sizeof(all_clms_diff[0]));
 
 	return 1;
 }
@@ -325,9 +486,74 @@ static int parse_debug(int argc, const char *argv[],
 	return 1;
 }
 
+/*
+ * Parse the optional timeout in seconds into @timeout_ms.
+ * Returns false if @arg is not a number.
+ */
+static bool parse_wait_timeout(const char *arg, int *timeout_ms)
+{
+	double sec;
+	char *end;
+
+	sec = strtod(arg, &end);
+	if (end == arg || *end || sec < 0 || sec > INT_MAX / 1000)
+		return false;
+
+	*timeout_ms = sec * 1000;
+
+	return true;
+}
+
+static int parse_wait(int argc, const char *argv[],
+		      const struct param *param, struct rnbd_ctx *ctx)
+{
+	ctx->wait_ms = -1;
+	ctx->wait_set = true;
+
+	if (argc > 1 && parse_wait_timeout(argv[1], &ctx->wait_ms))
+		return 2;
+
+	return 1;
+}
+
 static struct param _params_from =
 	{TOK_FROM, "from", "", "", "Destination to map a device from",
 	 NULL, parse_from, 0};
+static struct param _params_interval =
+	{TOK_INTERVAL, "interval", "", "",
+	 "Seconds between two samples, fractions allowed (default: 1)",
+	 "<seconds>", parse_interval, 0};
+static struct param _params_count =
+	{TOK_COUNT, "count", "", "", "Stop after the given number of samples",
+	 "<n>", parse_count, 0};
+static struct param _params_jobs =
+	{TOK_JOBS, "jobs", "", "",
+	 "Changes to make at once (default: 4)",
+	 "<n>", parse_jobs, 0};
+static struct param _params_wait =
+	{TOK_WAIT, "wait", "", "",
+	 "Wait until the device is ready, at most [timeout] seconds",
+	 "[timeout]", parse_wait, 0};
+static struct param _params_where =
+	{TOK_WHERE, "where", "", "",
+	 "Filter rows, e.g. 'state!=connected and reconnects>0', "
+	 "sizes in bytes",
+	 "<expr>", parse_where, 0};
+static struct param _params_sort =
+	{TOK_SORT, "sort", "", "",
+	 "Sort rows by fields, e.g. 'rx_bytes:desc,sessname'",
+	 "<field>[:desc],..", parse_sort, 0};
+static struct param _params_limit =
+	{TOK_LIMIT, "limit", "", "", "List only the first N rows",
+	 "<n>", parse_limit, 0};
+static struct param _params_group =
+	{TOK_GROUP, "group", "", "",
+	 "Count and sum up rows by field, e.g. 'hca_name'",
+	 "<field>", parse_group, 0};
+static struct param _params_sel_session =
+	{TOK_SESSION, "session", "", "",
+	 "Only the devices of the session, globs allowed",
+	 "<session>", parse_sel_session, 0};
 static struct param _params_client =
 	{TOK_CLIENT, "client", "", "", "Operations of client",
 	 NULL, parse_mode, 0};
@@ -439,6 +665,10 @@ static struct param _params_minus_minus_simulate =
 	{TOK_VERBOSE, "--simulate", "", "",
 	 "Only print modifying operations, do not execute",
 	 NULL, parse_flag, NULL, offsetof(struct rnbd_ctx, simulate_set)};
+static struct param _params_minus_minus_from_shm =
+	{TOK_VERBOSE, "--from-shm", "", "",
+	 "Read the objects published by rnbd publish",
+	 NULL, parse_flag, NULL, offsetof(struct rnbd_ctx, from_shm_set)};
 static struct param _params_minus_c =
 	{TOK_VERBOSE, "-c", "", "", "Complete",
 	 NULL, parse_flag, NULL, offsetof(struct rnbd_ctx, complete_set)};
@@ -497,6 +727,10 @@ static struct param *params_options[] = {
 	&_params_verbose,
 	&_params_all_recover,
 	&_params_recover_add_missing,
+	&_params_where,
+	&_params_sort,
+	&_params_limit,
+	&_params_group,
 	&_params_null
 };
 
@@ -745,6 +979,10 @@ static void help_dump_all(const char *program_name,
 	print_param_descr("notree");
 	print_param_descr("noheaders");
 	print_param_descr("nototals");
+	print_param_descr("where");
+	print_param_descr("sort");
+	print_param_descr("limit");
+	print_param_descr("group");
 	print_param_descr("help");
 }
 
@@ -772,6 +1010,10 @@ static void help_list_devices(const char *program_name,
 	print_param_descr("notree");
 	print_param_descr("noheaders");
 	print_param_descr("nototals");
+	print_param_descr("where");
+	print_param_descr("sort");
+	print_param_descr("limit");
+	print_param_descr("group");
 	print_opt("help", "Display help and exit. [fields|all]");
 }
 
@@ -799,6 +1041,10 @@ static void help_list_sessions(const char *program_name,
 	print_param_descr("notree");
 	print_param_descr("noheaders");
 	print_param_descr("nototals");
+	print_param_descr("where");
+	print_param_descr("sort");
+	print_param_descr("limit");
+	print_param_descr("group");
 	print_opt("help", "Display help and exit. [fields|all]");
 }
 
@@ -826,18 +1072,282 @@ static void help_list_paths(const char *program_name,
 	print_param_descr("notree");
 	print_param_descr("noheaders");
 	print_param_descr("nototals");
+	print_param_descr("where");
+	print_param_descr("sort");
+	print_param_descr("limit");
+	print_param_descr("group");
 	print_opt("help", "Display help and exit. [fields|all]");
 }
 
+/*
+ * Read the sysfs attributes @attrs of all objects unless read before.
+ * A published snapshot has all of them.
+ */
+static void read_attrs(const struct rnbd_ctx *ctx, unsigned int attrs)
+{
+	rnbd_sysfs_read_attrs(ctx->snap, attrs);
+}
+
+enum {
+	SELECT_WHERE	= 1,
+	SELECT_SORT	= 1 << 1,
+	SELECT_LIMIT	= 1 << 2,
+};
+
+static const struct rnbd_sort sort_none;
+
+/*
+ * Bind the where clause and the sort keys to the columns @all of the
+ * objects to be listed and read the attributes they need. For dump they
+ * only apply to the kind of objects having all the fields named in them.
+ * A limit without sort keys applies to the objects in the order they are
+ * printed: sorted by @def_key on the terminal, as read from sysfs in csv,
+ * json and xml. If the objects are @grouped, sort and limit apply to the
+ * groups instead.
+ * Returns which of where, sort and limit are to be applied.
+ */
+static int select_bind(struct table_column **all, const char *def_key,
+		       bool grouped, bool is_dump, struct rnbd_ctx *ctx)
+{
+	const char *bad;
+	int err, sel = 0;
+
+	ctx->sorted = false;
+
+	if (ctx->where_set) {
+		err = rnbd_filter_bind(&ctx->where, all, &bad);
+		if (err == -ENOENT && !is_dump) {
+			ERR(trm, "Unknown field '%s' in where clause\n", bad);
+			return err;
+		}
+		if (err && err != -ENOENT) {
+			ERR(trm, "Invalid number '%s' in where clause\n", bad);
+			return err;
+		}
+		if (!err) {
+			read_attrs(ctx, rnbd_filter_attrs(&ctx->where));
+			sel |= SELECT_WHERE;
+		}
+	}
+
+	if (grouped)
+		return sel;
+
+	if (ctx->sort_set) {
+		err = rnbd_sort_bind(&ctx->sort, all, &bad);
+		if (err && !is_dump) {
+			ERR(trm, "Unknown field '%s' to sort by\n", bad);
+			return err;
+		}
+		if (!err) {
+			read_attrs(ctx, rnbd_sort_attrs(&ctx->sort));
+			sel |= SELECT_SORT;
+		}
+	} else if (ctx->limit_set && def_key && ctx->fmt == FMT_TERM) {
+		memset(&ctx->sort_default, 0, sizeof(ctx->sort_default));
+		if (!rnbd_sort_parse(&ctx->sort_default, def_key) &&
+		    !rnbd_sort_bind(&ctx->sort_default, all, &bad))
+			sel |= SELECT_SORT;
+	}
+
+	if (ctx->limit_set)
+		sel |= SELECT_LIMIT;
+
+	ctx->sorted = sel & SELECT_SORT;
+
+	return sel;
+}
+
+/*
+ * Returns a NULL terminated copy of the @cnt objects @objs matching the
+ * where clause, sorted and limited as requested, and updates @cnt.
+ * The conditions and keys are fetched from the fields directly, the
+ * objects filtered out are never formatted.
+ */
+static void **select_objs(void **objs, int *cnt, int sel,
+			  const struct rnbd_ctx *ctx)
+{
+	const struct rnbd_sort *sort = &sort_none;
+	void **res;
+	int i, n = 0;
+
+	res = malloc((*cnt + 1) * sizeof(*res));
+	if (!res)
+		return NULL;
+
+	for (i = 0; i < *cnt; i++)
+		if (!(sel & SELECT_WHERE) ||
+		    rnbd_filter_match(&ctx->where, objs[i], ctx))
+			res[n++] = objs[i];
+
+	if (sel & SELECT_SORT)
+		sort = ctx->sort_set ? &ctx->sort : &ctx->sort_default;
+
+	/* grouped objects are limited in list_groups(), as groups */
+	n = rnbd_sort_objs(sort, res, n,
+			   (sel & SELECT_LIMIT) ? ctx->limit : -1, ctx);
+	if (n < 0) {
+		free(res);
+		return NULL;
+	}
+	res[n] = NULL;
+	*cnt = n;
+
+	return res;
+}
+
+/*
+ * Find the column @key to group the objects with columns @all by. For
+ * dump only the objects having the column are grouped.
+ */
+static int group_bind(struct table_column **all, bool is_dump,
+		      struct rnbd_ctx *ctx, struct table_column **key)
+{
+	*key = NULL;
+
+	if (!ctx->group_set)
+		return 0;
+
+	*key = table_find_column(ctx->group, all);
+	if (!*key && !is_dump) {
+		ERR(trm, "Unknown field '%s' to group by\n", ctx->group);
+		return -ENOENT;
+	}
+
+	if (*key)
+		read_attrs(ctx, rnbd_group_attrs(*key, all));
+
+	return 0;
+}
+
+/*
+ * List the groups of the objects of both sides. @first and @last tell
+ * whether to open and close the json object, it is shared in a dump.
+ */
+static int list_groups(void **clt, int clt_cnt, void **srv, int srv_cnt,
+		       struct table_column *key, struct table_column **all,
+		       const char *kind, bool first, bool last, bool is_dump,
+		       struct rnbd_ctx *ctx)
+{
+	struct rnbd_grouping g;
+	const char *bad;
+	void **objs;
+	int err, cnt;
+
+	objs = malloc((clt_cnt + srv_cnt + 1) * sizeof(*objs));
+	if (!objs)
+		return -ENOMEM;
+
+	if (clt_cnt)
+		memcpy(objs, clt, clt_cnt * sizeof(*objs));
+	if (srv_cnt)
+		memcpy(objs + clt_cnt, srv, srv_cnt * sizeof(*objs));
+
+	err = rnbd_group_objs(&g, key, all, objs, clt_cnt + srv_cnt, ctx);
+	free(objs);
+	if (err) {
+		ERR(trm, "Failed to group %ss: %s (%d)\n", kind,
+		    strerror(-err), err);
+		return err;
+	}
+
+	if (ctx->sort_set || ctx->limit_set) {
+		err = ctx->sort_set ? rnbd_sort_bind(&ctx->sort, g.cs, &bad) : 0;
+		if (err && !is_dump) {
+			ERR(trm, "Unknown field '%s' to sort by\n", bad);
+			goto out;
+		}
+		cnt = rnbd_sort_objs(err || !ctx->sort_set ? &sort_none
+							   : &ctx->sort,
+				     (void **)g.groups, g.cnt,
+				     ctx->limit_set ? ctx->limit : -1, ctx);
+		if (cnt < 0) {
+			err = cnt;
+			goto out;
+		}
+		g.groups[cnt] = NULL;
+		rnbd_group_total(&g);
+		err = 0;
+	}
+
+	switch (ctx->fmt) {
+	case FMT_CSV:
+		if (is_dump)
+			printf("%c%s groups:\n", toupper(*kind), kind + 1);
+		list_groups_csv(&g, ctx);
+		break;
+	case FMT_JSON:
+		if (first)
+			printf("{\n");
+		printf("\t\"%s groups\": ", kind);
+		list_groups_json(&g, ctx);
+		printf(last ? "\n}\n" : ",\n");
+		break;
+	case FMT_XML:
+		printf("<%s-groups>\n", kind);
+		list_groups_xml(&g, ctx);
+		printf("</%s-groups>\n", kind);
+		break;
+	case FMT_TERM:
+	default:
+		if (is_dump) {
+			out_clr(trm, CDIM);
+			out_chr(toupper(*kind));
+			out_str(kind + 1);
+			out_str(" groups");
+			out_clr_end(trm, CDIM);
+			out_chr('\n');
+		}
+		err = list_groups_term(&g, ctx);
+		break;
+	}
+out:
+	rnbd_group_free(&g);
+
+	return err;
+}
+
 static int list_devices(struct rnbd_sess_dev **d_clt, int d_clt_cnt,
 			struct rnbd_sess_dev **d_srv, int d_srv_cnt,
 			bool is_dump, struct rnbd_ctx *ctx)
 {
+	struct table_column *grp;
+	int sel, err = 0;
+
+	read_attrs(ctx, table_clm_attrs(ctx->clms_devices_clt) |
+			table_clm_attrs(ctx->clms_devices_srv));
+
 	if (!(ctx->rnbdmode & RNBD_CLIENT))
 		d_clt_cnt = 0;
 	if (!(ctx->rnbdmode & RNBD_SERVER))
 		d_srv_cnt = 0;
 
+	err = group_bind(all_clms_devices, is_dump, ctx, &grp);
+	if (err)
+		return err;
+
+	sel = select_bind(all_clms_devices, NULL, grp, is_dump, ctx);
+	if (sel < 0)
+		return sel;
+	if (sel) {
+		d_clt = (struct rnbd_sess_dev **)
+			select_objs((void **)d_clt, &d_clt_cnt, sel, ctx);
+		d_srv = (struct rnbd_sess_dev **)
+			select_objs((void **)d_srv, &d_srv_cnt, sel, ctx);
+		if (!d_clt || !d_srv) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (grp) {
+		err = list_groups((void **)d_clt, d_clt_cnt,
+				  (void **)d_srv, d_srv_cnt, grp,
+				  all_clms_devices, "device", true, !is_dump,
+				  is_dump, ctx);
+		goto out;
+	}
+
 	switch (ctx->fmt) {
 	case FMT_CSV:
 		if ((d_clt_cnt && d_srv_cnt) || ctx->rnbdmode == RNBD_BOTH)
@@ -912,18 +1422,60 @@ static int list_devices(struct rnbd_sess_dev **d_clt, int d_clt_cnt,
 
 		break;
 	}
-	return 0;
+out:
+	if (sel) {
+		free(d_clt);
+		free(d_srv);
+	}
+
+	return err;
 }
 
 static int list_sessions(struct rnbd_sess **s_clt, int clt_s_num,
 			 struct rnbd_sess **s_srv, int srv_s_num,
 			 bool is_dump, struct rnbd_ctx *ctx)
 {
+	struct table_column *grp;
+	int sel, err = 0;
+
+	read_attrs(ctx, table_clm_attrs(ctx->clms_sessions_clt) |
+			table_clm_attrs(ctx->clms_sessions_srv));
+	/* the paths in the tree are sorted by hca and address */
+	if (!ctx->notree_set)
+		read_attrs(ctx, table_clm_attrs(clms_paths_shortdesc) |
+				RNBD_ATTR_PATH_HCA | RNBD_ATTR_PATH_ADDR);
+
 	if (!(ctx->rnbdmode & RNBD_CLIENT))
 		clt_s_num = 0;
 	if (!(ctx->rnbdmode & RNBD_SERVER))
 		srv_s_num = 0;
 
+	err = group_bind(all_clms_sessions, is_dump, ctx, &grp);
+	if (err)
+		return err;
+
+	sel = select_bind(all_clms_sessions, "sessname", grp, is_dump, ctx);
+	if (sel < 0)
+		return sel;
+	if (sel) {
+		s_clt = (struct rnbd_sess **)
+			select_objs((void **)s_clt, &clt_s_num, sel, ctx);
+		s_srv = (struct rnbd_sess **)
+			select_objs((void **)s_srv, &srv_s_num, sel, ctx);
+		if (!s_clt || !s_srv) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (grp) {
+		err = list_groups((void **)s_clt, clt_s_num,
+				  (void **)s_srv, srv_s_num, grp,
+				  all_clms_sessions, "session", !is_dump,
+				  !is_dump, is_dump, ctx);
+		goto out;
+	}
+
 	switch (ctx->fmt) {
 	case FMT_CSV:
 		if (clt_s_num && srv_s_num)
@@ -995,26 +1547,63 @@ static int list_sessions(struct rnbd_sess **s_clt, int clt_s_num,
 			list_sessions_term(s_srv, ctx->clms_sessions_srv, ctx);
 		break;
 	}
+out:
+	if (sel) {
+		free(s_clt);
+		free(s_srv);
+	}
 
-	return 0;
+	return err;
 }
 
 static int list_paths(struct rnbd_path **p_clt, int clt_p_num,
 		      struct rnbd_path **p_srv, int srv_p_num,
 		      bool is_dump, struct rnbd_ctx *ctx)
 {
+	struct table_column *grp;
+	int sel, err = 0;
+
+	read_attrs(ctx, table_clm_attrs(ctx->clms_paths_clt) |
+			table_clm_attrs(ctx->clms_paths_srv));
+
 	if (!(ctx->rnbdmode & RNBD_CLIENT))
 		clt_p_num = 0;
 	if (!(ctx->rnbdmode & RNBD_SERVER))
 		srv_p_num = 0;
 
-	switch (ctx->fmt) {
-	case FMT_CSV:
-		if (clt_p_num && srv_p_num)
-			printf("Outgoing paths:\n");
+	err = group_bind(all_clms_paths, is_dump, ctx, &grp);
+	if (err)
+		return err;
 
-		if (clt_p_num)
-			list_paths_csv(p_clt, ctx->clms_paths_clt, ctx);
+	sel = select_bind(all_clms_paths, "sessname", grp, is_dump, ctx);
+	if (sel < 0)
+		return sel;
+	if (sel) {
+		p_clt = (struct rnbd_path **)
+			select_objs((void **)p_clt, &clt_p_num, sel, ctx);
+		p_srv = (struct rnbd_path **)
+			select_objs((void **)p_srv, &srv_p_num, sel, ctx);
+		if (!p_clt || !p_srv) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (grp) {
+		err = list_groups((void **)p_clt, clt_p_num,
+				  (void **)p_srv, srv_p_num, grp,
+				  all_clms_paths, "path", !is_dump, true,
+				  is_dump, ctx);
+		goto out;
+	}
+
+	switch (ctx->fmt) {
+	case FMT_CSV:
+		if (clt_p_num && srv_p_num)
+			printf("Outgoing paths:\n");
+
+		if (clt_p_num)
+			list_paths_csv(p_clt, ctx->clms_paths_clt, ctx);
 
 		if (clt_p_num && srv_p_num)
 			printf("Incoming paths:\n");
@@ -1064,7 +1653,8 @@ static int list_paths(struct rnbd_path **p_clt, int clt_p_num,
 		if (clt_p_num)
 			list_paths_term(p_clt, clt_p_num,
 					ctx->clms_paths_clt, 0, ctx,
-					compar_paths_sessname);
+					ctx->sorted ? NULL
+						    : compar_paths_sessname);
 
 		if (clt_p_num && srv_p_num && is_dump)
 			printf("\n");
@@ -1077,56 +1667,208 @@ static int list_paths(struct rnbd_path **p_clt, int clt_p_num,
 		if (srv_p_num)
 			list_paths_term(p_srv, srv_p_num,
 					ctx->clms_paths_srv, 0, ctx,
-					compar_paths_sessname);
+					ctx->sorted ? NULL
+						    : compar_paths_sessname);
 		break;
 	}
+out:
+	if (sel) {
+		free(p_clt);
+		free(p_srv);
+	}
 
-	return 0;
+	return err;
 }
 
-static bool match_device(struct rnbd_sess_dev *d, const char *name)
+/*
+ * Index of the devices of one side by mapping path, device name and
+ * device path. For every name the index keeps the NULL terminated list
+ * of all the devices with that name in the order of the devices array,
+ * so that a lookup returns the complete result with a single probe.
+ */
+struct dev_index {
+	bool			built;
+	struct rnbd_hash	by_name;	/* name -> list in @lists */
+	struct rnbd_sess_dev	**lists;
+};
+
+/*
+ * Index of the paths of one side for the usual ways to name a single path:
+ * by session and path name, by session and port descriptor, and by
+ * a single address, which can be the source or the destination.
+ */
+struct path_index {
+	bool		built;
+	struct rnbd_hash by_name;	/* "<sessname> <pathname>" */
+	struct rnbd_hash by_port;	/* "<sessname> <hca> <port>" */
+	struct rnbd_hash by_addr;	/* rnbd_addr_key() of src and dst */
+};
+
+/*
+ * The indexes of a snapshot, each built on its first lookup
+ */
+struct snap_index {
+	struct dev_index	dev_clt, dev_srv;
+	struct path_index	path_clt, path_srv;
+};
+
+static void snap_index_free(void *p);
+
+static struct snap_index *snap_index_get(struct rnbd_snapshot *snap)
 {
-	if (!strcmp(d->mapping_path, name) ||
-	    !strcmp(d->dev->devname, name) ||
-	    !strcmp(d->dev->devpath, name))
-		return true;
+	if (!snap->idx) {
+		snap->idx = calloc(1, sizeof(struct snap_index));
+		if (snap->idx)
+			snap->idx_free = snap_index_free;
+	}
 
-	return false;
+	return snap->idx;
 }
 
-static int find_devices(const char *name, struct rnbd_sess_dev **devs,
-			struct rnbd_sess_dev **res)
+static struct rnbd_sess_dev *no_devs[] = { NULL };
+
+struct dev_key {
+	const char	*name;
+	int		pos;		/* in the devices array */
+};
+
+static int dev_key_cmp(const void *a, const void *b)
 {
-	int i, cnt = 0;
+	const struct dev_key *ka = a, *kb = b;
+	int ret;
+
+	ret = strcmp(ka->name, kb->name);
+	if (ret)
+		return ret;
 
-	for (i = 0; devs[i]; i++)
-		if (match_device(devs[i], name))
-			res[cnt++] = devs[i];
+	return ka->pos - kb->pos;
+}
 
-	res[cnt] = NULL;
+static void dev_index_free(struct dev_index *idx)
+{
+	if (!idx->built)
+		return;
 
-	return cnt;
+	rnbd_hash_free(&idx->by_name);
+	free(idx->lists);
+	idx->built = false;
+}
+
+static int dev_index_build(struct dev_index *idx,
+			   struct rnbd_sess_dev **devs, int dev_cnt)
+{
+	struct dev_key *keys;
+	int i, k, cnt = 0, ret;
+
+	memset(idx, 0, sizeof(*idx));
+
+	keys = calloc(3 * dev_cnt + 1, sizeof(*keys));
+	if (!keys)
+		return -ENOMEM;
+
+	for (i = 0; devs[i]; i++) {
+		/* each device only once under the same name */
+		keys[cnt++] = (struct dev_key){devs[i]->mapping_path, i};
+		if (strcmp(devs[i]->dev->devname, devs[i]->mapping_path))
+			keys[cnt++] = (struct dev_key){devs[i]->dev->devname,
+						       i};
+		if (strcmp(devs[i]->dev->devpath, devs[i]->mapping_path) &&
+		    strcmp(devs[i]->dev->devpath, devs[i]->dev->devname))
+			keys[cnt++] = (struct dev_key){devs[i]->dev->devpath,
+						       i};
+	}
+	qsort(keys, cnt, sizeof(*keys), dev_key_cmp);
+
+	/* lists of the devices with the same name, each NULL terminated */
+	idx->lists = calloc(2 * cnt + 1, sizeof(*idx->lists));
+	ret = idx->lists ? rnbd_hash_init(&idx->by_name, cnt) : -ENOMEM;
+	if (ret) {
+		free(idx->lists);
+		goto out;
+	}
+	idx->built = true;
+
+	for (i = 0, k = 0; !ret && i < cnt; i++) {
+		if (!i || strcmp(keys[i - 1].name, keys[i].name)) {
+			if (i)
+				idx->lists[k++] = NULL;
+			ret = rnbd_hash_add(&idx->by_name, keys[i].name,
+					    &idx->lists[k]);
+		}
+		idx->lists[k++] = devs[keys[i].pos];
+	}
+
+	if (ret)
+		dev_index_free(idx);
+out:
+	free(keys);
+
+	return ret;
+}
+
+/*
+ * Find all devices of the array @devs (sds_clt or sds_srv of @snap) which
+ * have the mapping path, device name or device path @name.
+ * Returns the NULL terminated list of them, the list belongs to the index.
+ */
+static struct rnbd_sess_dev **find_devices(struct rnbd_snapshot *snap,
+					   const char *name,
+					   struct rnbd_sess_dev **devs,
+					   int *cnt)
+{
+	struct rnbd_sess_dev **res;
+	struct snap_index *si;
+	struct dev_index *idx;
+	int i;
+
+	si = snap_index_get(snap);
+	if (!si)
+		return NULL;
+
+	if (devs == snap->sds_clt)
+		idx = &si->dev_clt;
+	else
+		idx = &si->dev_srv;
+
+	if (!idx->built &&
+	    dev_index_build(idx, devs, devs == snap->sds_clt ?
+				    snap->sds_clt_cnt : snap->sds_srv_cnt))
+		return NULL;
+
+	res = rnbd_hash_find(&idx->by_name, name);
+	if (!res)
+		res = no_devs;
+
+	for (i = 0; res[i]; i++)
+		;
+	*cnt = i;
+
+	return res;
 }
 
 /*
  * Find all rnbd devices by device name, device path or mapping path
  */
-static int find_devs_all(const char *name, enum rnbdmode rnbdmode,
-			 struct rnbd_sess_dev **ds_imp,
-			 int *ds_imp_cnt, struct rnbd_sess_dev **ds_exp,
+static int find_devs_all(struct rnbd_snapshot *snap,
+			 const char *name, enum rnbdmode rnbdmode,
+			 struct rnbd_sess_dev ***ds_imp,
+			 int *ds_imp_cnt, struct rnbd_sess_dev ***ds_exp,
 			 int *ds_exp_cnt)
 {
-	int cnt_imp = 0, cnt_exp = 0;
+	*ds_imp = no_devs;
+	*ds_exp = no_devs;
+	*ds_imp_cnt = 0;
+	*ds_exp_cnt = 0;
 
 	if (rnbdmode & RNBD_CLIENT)
-		cnt_imp = find_devices(name, sds_clt, ds_imp);
+		*ds_imp = find_devices(snap, name, snap->sds_clt, ds_imp_cnt);
 	if (rnbdmode & RNBD_SERVER)
-		cnt_exp = find_devices(name, sds_srv, ds_exp);
+		*ds_exp = find_devices(snap, name, snap->sds_srv, ds_exp_cnt);
 
-	*ds_imp_cnt = cnt_imp;
-	*ds_exp_cnt = cnt_exp;
+	if (!*ds_imp || !*ds_exp)
+		return -ENOMEM;
 
-	return cnt_imp + cnt_exp;
+	return *ds_imp_cnt + *ds_exp_cnt;
 }
 
 static int show_device(struct rnbd_sess_dev **clt, struct rnbd_sess_dev **srv,
@@ -1157,9 +1899,11 @@ static int show_device(struct rnbd_sess_dev **clt, struct rnbd_sess_dev **srv,
 		break;
 	case FMT_TERM:
 	default:
-		table_row_stringify(ds[0], flds, cs, ctx, true, 0);
-		table_entry_print_term("", flds, cs,
-				       table_get_max_h_width(cs), trm);
+		table_row_stringify(ds[0], flds, cs, ctx->layout, ctx, true,
+				    0);
+		table_entry_print_term("", flds, cs, ctx->layout,
+				       table_get_max_h_width(cs, ctx->layout),
+				       trm);
 		break;
 	}
 
@@ -1193,16 +1937,19 @@ static int find_sess_match(const char *name, enum rnbdmode rnbdmode,
 	return cnt;
 }
 
-static int find_sess_match_all(const char *name, enum rnbdmode rnbdmode,
+static int find_sess_match_all(const struct rnbd_snapshot *snap,
+			 const char *name, enum rnbdmode rnbdmode,
 			 struct rnbd_sess **ss_clt, int *ss_clt_cnt,
 			 struct rnbd_sess **ss_srv, int *ss_srv_cnt)
 {
 	int cnt_srv = 0, cnt_clt = 0;
 
 	if (rnbdmode & RNBD_CLIENT)
-		cnt_clt = find_sess_match(name, rnbdmode, sess_clt, ss_clt);
+		cnt_clt = find_sess_match(name, rnbdmode, snap->sess_clt,
+					  ss_clt);
 	if (rnbdmode & RNBD_SERVER)
-		cnt_srv = find_sess_match(name, rnbdmode, sess_srv, ss_srv);
+		cnt_srv = find_sess_match(name, rnbdmode, snap->sess_srv,
+					  ss_srv);
 
 	*ss_clt_cnt = cnt_clt;
 	*ss_srv_cnt = cnt_srv;
@@ -1250,34 +1997,112 @@ free_error:
 	return 0;
 }
 
-static bool match_path(struct rnbd_path *p, const char *name)
+/*
+ * Path query compiled once by path_matcher_init(), so that checking it
+ * against each path in match_path() needs no parsing
+ */
+struct path_matcher {
+	const char	*sessname;	/* session the path belongs to or NULL */
+	const char	*hca;		/* hca of port descriptor or NULL */
+	bool		port_set;	/* hca port of port descriptor */
+	int		port;
+
+	const char	*name;		/* path name, address, hca or port */
+	bool		is_addr;	/* name is [src@]dst */
+	struct path	addr_str;
+	struct rnbd_addr src;
+	struct rnbd_addr dst;
+	bool		name_is_port;
+	int		name_port;
+	const char	*at;		/* after the last ':' in name or NULL */
+	bool		at_is_port;
+	int		at_port;
+};
+
+static void path_matcher_init(struct path_matcher *m,
+			      const char *session_name,
+			      const char *path_name,
+			      const struct rnbd_ctx *ctx)
 {
-	struct path other = {NULL, NULL};
-	int port;
-	char *at;
+	const char *at;
+
+	memset(m, 0, sizeof(*m));
+
+	m->sessname = session_name;
+
+	if (ctx->port_desc_set) {
+		if (ctx->port_desc_arg.hca[0])
+			m->hca = ctx->port_desc_arg.hca;
+		if (ctx->port_desc_arg.port[0]) {
+			m->port_set = true;
+			if (sscanf(ctx->port_desc_arg.port, "%d\n",
+				   &m->port) != 1)
+				m->port = -1;
+		}
+		/* path name is only considered together with session */
+		if (!session_name)
+			return;
+	}
+
+	if (!path_name)
+		return;
+
+	m->name = path_name;
+
+	m->is_addr = parse_path1(path_name, &m->addr_str);
+	if (m->is_addr) {
+		if (m->addr_str.src)
+			rnbd_addr_parse(&m->src, m->addr_str.src);
+		rnbd_addr_parse(&m->dst, m->addr_str.dst);
+	}
+
+	m->name_is_port = sscanf(path_name, "%d\n", &m->name_port) == 1;
+
+	at = strrchr(path_name, ':');
+	if (at) {
+		m->at = at + 1;
+		m->at_is_port = sscanf(m->at, "%d\n", &m->at_port) == 1;
+	}
+}
+
+static void path_matcher_free(struct path_matcher *m)
+{
+	if (!m->is_addr)
+		return;
+
+	free((char *)m->addr_str.provided);
+	free((char *)m->addr_str.src);
+	free((char *)m->addr_str.dst);
+}
+
+static bool match_path_name(const struct rnbd_path *p,
+			    const struct path_matcher *m)
+{
+	const char *name = m->name;
 
 	if (!strcmp(p->pathname, name) ||
 	    !strcmp(name, p->src_addr) ||
 	    !strcmp(name, p->dst_addr))
 		return true;
 
-	if (parse_path1(name, &other)) {
-		if ((!other.src
-		     || match_path_addr(p->src_addr, other.src))
-		    && match_path_addr(p->dst_addr, other.dst))
+	if (m->is_addr) {
+		if ((!m->addr_str.src
+		     || rnbd_addr_match(&p->src, p->src_addr,
+					&m->src, m->addr_str.src))
+		    && rnbd_addr_match(&p->dst, p->dst_addr,
+				       &m->dst, m->addr_str.dst))
 			return true;
-		if (!other.src
-		     && match_path_addr(p->src_addr, other.dst))
+		if (!m->addr_str.src
+		     && rnbd_addr_match(&p->src, p->src_addr,
+					&m->dst, m->addr_str.dst))
 			return true;
 	}
 
-	if ((sscanf(name, "%d\n", &port) == 1 &&
-	     p->hca_port == port) ||
+	if ((m->name_is_port && p->hca_port == m->name_port) ||
 	    !strcmp(name, p->hca_name))
 		return true;
 
-	at = strrchr(name, ':');
-	if (!at)
+	if (!m->at)
 		return false;
 
 	if (strncmp(p->sess->sessname, name,
@@ -1286,59 +2111,38 @@ static bool match_path(struct rnbd_path *p, const char *name)
 		    strlen(p->hca_name)))
 		return false;
 
-	if ((sscanf(at + 1, "%d\n", &port) == 1 &&
-	     p->hca_port == port) ||
-	    !strcmp(at + 1, p->dst_addr) ||
-	    !strcmp(at + 1, p->src_addr) ||
-	    !strcmp(at + 1, p->hca_name))
+	if ((m->at_is_port && p->hca_port == m->at_port) ||
+	    !strcmp(m->at, p->dst_addr) ||
+	    !strcmp(m->at, p->src_addr) ||
+	    !strcmp(m->at, p->hca_name))
 		return true;
 
 	return false;
 }
 
-static int find_paths(const char *session_name, const char *path_name,
-		      struct rnbd_ctx *ctx,
+static bool match_path(const struct rnbd_path *p,
+		       const struct path_matcher *m)
+{
+	if (m->sessname && strcmp(m->sessname, p->sess->sessname))
+		return false;
+
+	if (m->hca && strcmp(m->hca, p->hca_name))
+		return false;
+
+	if (m->port_set && p->hca_port != m->port)
+		return false;
+
+	return !m->name || match_path_name(p, m);
+}
+
+static int find_paths(const struct path_matcher *m,
 		      struct rnbd_path **pp, struct rnbd_path **res)
 {
-	int i, port, cnt = 0;
-
-	for (i = 0; pp[i]; i++) {
-		if (session_name && path_name && ctx->port_desc_set) {
-			if (!strcmp(session_name, pp[i]->sess->sessname)) {
-				if (ctx->port_desc_arg.hca[0]
-				    && strcmp(ctx->port_desc_arg.hca, pp[i]->hca_name))
-					continue;
-				if (ctx->port_desc_arg.port[0])
-				{
-					sscanf(ctx->port_desc_arg.port, "%d\n", &port);
-					if (pp[i]->hca_port != port)
-						continue;
-				}
-				if (!match_path(pp[i], path_name))
-					continue;
+	int i, cnt = 0;
 
-				res[cnt++] = pp[i];
-			}
-		} else if (path_name != NULL && !ctx->port_desc_set) {
-			if (match_path(pp[i], path_name)
-			    && (session_name == NULL
-				|| !strcmp(session_name, pp[i]->sess->sessname)))
-				res[cnt++] = pp[i];
-		} else {
-			if (!strcmp(session_name, pp[i]->sess->sessname)) {
-				if (ctx->port_desc_arg.hca[0]
-				    && strcmp(ctx->port_desc_arg.hca, pp[i]->hca_name))
-					continue;
-				if (ctx->port_desc_arg.port[0])
-				{
-					sscanf(ctx->port_desc_arg.port, "%d\n", &port);
-					if (pp[i]->hca_port != port)
-						continue;
-				}
-				res[cnt++] = pp[i];
-			}
-		}
-	}
+	for (i = 0; pp[i]; i++)
+		if (match_path(pp[i], m))
+			res[cnt++] = pp[i];
 	res[cnt] = NULL;
 
 	return cnt;
@@ -1358,7 +2162,8 @@ static int find_paths_for_session(const char *session_name,
 	return cnt;
 }
 
-static int find_paths_all(const char *session_name,
+static int find_paths_all(const struct rnbd_snapshot *snap,
+			  const char *session_name,
 			  const char *path_name,
 			  struct rnbd_ctx *ctx,
 			  struct rnbd_path **pp_clt,
@@ -1366,12 +2171,15 @@ static int find_paths_all(const char *session_name,
 			  int *pp_srv_cnt)
 {
 	int cnt_clt = 0, cnt_srv = 0;
+	struct path_matcher m;
 	char *base_path_name;
 
+	path_matcher_init(&m, session_name, path_name, ctx);
 	if (ctx->rnbdmode & RNBD_CLIENT)
-		cnt_clt = find_paths(session_name, path_name, ctx, paths_clt, pp_clt);
+		cnt_clt = find_paths(&m, snap->paths_clt, pp_clt);
 	if (ctx->rnbdmode & RNBD_SERVER)
-		cnt_srv = find_paths(session_name, path_name, ctx, paths_srv, pp_srv);
+		cnt_srv = find_paths(&m, snap->paths_srv, pp_srv);
+	path_matcher_free(&m);
 	if (cnt_clt + cnt_srv == 0 && path_name && strchr(path_name, '%') != NULL) {
 		INF(ctx->debug_set,
 		    "Retry match for path name %s ignoring interface name.\n",
@@ -1379,12 +2187,15 @@ static int find_paths_all(const char *session_name,
 		base_path_name = strdup(path_name);
 		if (base_path_name) {
 			*strchr(base_path_name, '%') = '\0';
+			path_matcher_init(&m, session_name, base_path_name,
+					  ctx);
 			if (ctx->rnbdmode & RNBD_CLIENT)
-				cnt_clt = find_paths(session_name,base_path_name,
-						     ctx, paths_clt, pp_clt);
+				cnt_clt = find_paths(&m, snap->paths_clt,
+						     pp_clt);
 			if (ctx->rnbdmode & RNBD_SERVER)
-				cnt_srv = find_paths(session_name, base_path_name,
-						     ctx, paths_srv, pp_srv);
+				cnt_srv = find_paths(&m, snap->paths_srv,
+						     pp_srv);
+			path_matcher_free(&m);
 			free(base_path_name);
 		}
 	}
@@ -1410,6 +2221,9 @@ static void list_default(struct rnbd_ctx *ctx)
 	       ARRSIZE(def_clms_paths_clt) * sizeof(all_clms_paths[0]));
 	memcpy(&(ctx->clms_paths_srv), &def_clms_paths_srv,
 	       ARRSIZE(def_clms_paths_srv) * sizeof(all_clms_paths[0]));
+
+	memcpy(&(ctx->clms_diff), &def_clms_diff,
+	       ARRSIZE(def_clms_diff) * sizeof(all_clms_diff[0]));
 }
 
 static int show_path(struct rnbd_path **pp_clt, struct rnbd_path **pp_srv,
@@ -1440,9 +2254,11 @@ static int show_path(struct rnbd_path **pp_clt, struct rnbd_path **pp_srv,
 		break;
 	case FMT_TERM:
 	default:
-		table_row_stringify(pp[0], flds, cs, ctx, true, 0);
-		table_entry_print_term("", flds, cs,
-				       table_get_max_h_width(cs), trm);
+		table_row_stringify(pp[0], flds, cs, ctx->layout, ctx, true,
+				    0);
+		table_entry_print_term("", flds, cs, ctx->layout,
+				       table_get_max_h_width(cs, ctx->layout),
+				       trm);
 		break;
 	}
 
@@ -1479,9 +2295,11 @@ static int show_session(struct rnbd_sess **ss_clt, struct rnbd_sess **ss_srv,
 		break;
 	case FMT_TERM:
 	default:
-		table_row_stringify(ss[0], flds, cs, ctx, true, 0);
-		table_entry_print_term("", flds, cs,
-				       table_get_max_h_width(cs), trm);
+		table_row_stringify(ss[0], flds, cs, ctx->layout, ctx, true,
+				    0);
+		table_entry_print_term("", flds, cs, ctx->layout,
+				       table_get_max_h_width(cs, ctx->layout),
+				       trm);
 
 		/* when notree is set explicitly or if exactly one collumn */
 		/* is requested */
@@ -1505,6 +2323,7 @@ static int show_session(struct rnbd_sess **ss_clt, struct rnbd_sess **ss_srv,
 
 static int show_all(const char *name, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_sess_dev **ds_clt, **ds_srv;
 	struct rnbd_path **pp_clt, **pp_srv;
 	struct rnbd_sess **ss_clt, **ss_srv;
@@ -1513,19 +2332,15 @@ static int show_all(const char *name, struct rnbd_ctx *ctx)
 	    c_pp_clt, c_pp_srv, c_pp = 0,
 	    c_ss_clt, c_ss_srv, c_ss = 0, ret;
 
-	pp_clt = calloc(paths_clt_cnt, sizeof(*pp_clt));
-	pp_srv = calloc(paths_srv_cnt, sizeof(*pp_srv));
-	ss_clt = calloc(sess_clt_cnt, sizeof(*ss_clt));
-	ss_srv = calloc(sess_srv_cnt, sizeof(*ss_srv));
-	ds_clt = calloc(sds_clt_cnt, sizeof(*ds_clt));
-	ds_srv = calloc(sds_srv_cnt, sizeof(*ds_srv));
-
-	if ((paths_clt_cnt && !pp_clt) ||
-	    (paths_srv_cnt && !pp_srv) ||
-	    (sess_clt_cnt && !ss_clt) ||
-	    (sess_srv_cnt && !ss_srv) ||
-	    (sds_clt_cnt && !ds_clt) ||
-	    (sds_srv_cnt && !ds_srv)) {
+	pp_clt = calloc(snap->paths_clt_cnt, sizeof(*pp_clt));
+	pp_srv = calloc(snap->paths_srv_cnt, sizeof(*pp_srv));
+	ss_clt = calloc(snap->sess_clt_cnt, sizeof(*ss_clt));
+	ss_srv = calloc(snap->sess_srv_cnt, sizeof(*ss_srv));
+
+	if ((snap->paths_clt_cnt && !pp_clt) ||
+	    (snap->paths_srv_cnt && !pp_srv) ||
+	    (snap->sess_clt_cnt && !ss_clt) ||
+	    (snap->sess_srv_cnt && !ss_srv)) {
 		ERR(trm, "Failed to alloc memory\n");
 		ret = -ENOMEM;
 		goto out;
@@ -1539,15 +2354,22 @@ static int show_all(const char *name, struct rnbd_ctx *ctx)
 		if (ctx->path_cnt > 1)
 			ERR(trm, "Multiple paths specified\n");
 	}
-	c_pp = find_paths_all(session_name, path_name, ctx,
+	c_pp = find_paths_all(ctx->snap, session_name, path_name, ctx,
 			      pp_clt, &c_pp_clt, pp_srv,
 			      &c_pp_srv);
 	if (!(c_pp && ctx->path_cnt == 1))
-		c_ss = find_sess_match_all(name, ctx->rnbdmode, ss_clt,
-					   &c_ss_clt, ss_srv, &c_ss_srv);
-	if (!(c_pp && ctx->path_cnt == 1))
-		c_ds = find_devs_all(name, ctx->rnbdmode, ds_clt,
-				     &c_ds_clt, ds_srv, &c_ds_srv);
+		c_ss = find_sess_match_all(ctx->snap, name, ctx->rnbdmode,
+					   ss_clt, &c_ss_clt, ss_srv,
+					   &c_ss_srv);
+	if (!(c_pp && ctx->path_cnt == 1)) {
+		c_ds = find_devs_all(ctx->snap, name, ctx->rnbdmode, &ds_clt,
+				     &c_ds_clt, &ds_srv, &c_ds_srv);
+		if (c_ds < 0) {
+			ERR(trm, "Failed to alloc memory\n");
+			ret = c_ds;
+			goto out;
+		}
+	}
 	if ((ctx->path_cnt == 1 && c_pp > 1)
 	    || (ctx->path_cnt != 1 && c_pp + c_ss + c_ds > 1)) {
 		ERR(trm, "Multiple entries match '%s'\n", name);
@@ -1587,8 +2409,6 @@ static int show_all(const char *name, struct rnbd_ctx *ctx)
 		ret = -ENOENT;
 	}
 out:
-	free(ds_clt);
-	free(ds_srv);
 	free(pp_clt);
 	free(pp_srv);
 	free(ss_clt);
@@ -1599,19 +2419,14 @@ out:
 static int show_devices(const char *name, struct rnbd_ctx *ctx)
 {
 	struct rnbd_sess_dev **ds_clt, **ds_srv;
-	int c_ds_clt, c_ds_srv, c_ds = 0, ret;
-
-	ds_clt = calloc(sds_clt_cnt, sizeof(*ds_clt));
-	ds_srv = calloc(sds_srv_cnt, sizeof(*ds_srv));
+	int c_ds_clt, c_ds_srv, c_ds = 0;
 
-	if ((sds_clt_cnt && !ds_clt) ||
-	    (sds_srv_cnt && !ds_srv)) {
+	c_ds = find_devs_all(ctx->snap, name, ctx->rnbdmode, &ds_clt,
+			     &c_ds_clt, &ds_srv, &c_ds_srv);
+	if (c_ds < 0) {
 		ERR(trm, "Failed to alloc memory\n");
-		ret = -ENOMEM;
-		goto out;
+		return c_ds;
 	}
-	c_ds = find_devs_all(name, ctx->rnbdmode, ds_clt,
-			     &c_ds_clt, ds_srv, &c_ds_srv);
 	if (c_ds > 1) {
 		ERR(trm, "Multiple devices match '%s'\n", name);
 
@@ -1620,39 +2435,35 @@ static int show_devices(const char *name, struct rnbd_ctx *ctx)
 		printf("Devices:\n");
 		list_devices(ds_clt, c_ds_clt, ds_srv, c_ds_srv, false, ctx);
 
-		ret = -EINVAL;
-		goto out;
+		return -EINVAL;
 	}
 
-	if (c_ds) {
-		ret = show_device(ds_clt, ds_srv, ctx);
-	} else {
+	if (!c_ds) {
 		ERR(trm, "There is no device matching '%s'\n", name);
-		ret = -ENOENT;
+		return -ENOENT;
 	}
-out:
-	free(ds_clt);
-	free(ds_srv);
-	return ret;
+
+	return show_device(ds_clt, ds_srv, ctx);
 }
 
 static int show_client_sessions(const char *name, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_sess **ss_clt;
 	int c_ss_clt = 0, ret;
 
-	ss_clt = calloc(sess_clt_cnt, sizeof(*ss_clt));
+	ss_clt = calloc(snap->sess_clt_cnt, sizeof(*ss_clt));
 
-	if (sess_clt_cnt && !ss_clt) {
+	if (snap->sess_clt_cnt && !ss_clt) {
 		ERR(trm, "Failed to alloc memory\n");
 		ret = -ENOMEM;
 		goto out;
 	}
-	ss_clt[0] = find_sess(name, sess_clt);
+	ss_clt[0] = find_sess(name, snap->sess_clt);
 	if (ss_clt[0])
 		c_ss_clt = 1;
 	else
-		c_ss_clt = find_sess_match(name, ctx->rnbdmode, sess_clt, ss_clt);
+		c_ss_clt = find_sess_match(name, ctx->rnbdmode, snap->sess_clt, ss_clt);
 
 	if (c_ss_clt > 1) {
 		ERR(trm, "Multiple sessions match '%s'\n", name);
@@ -1679,21 +2490,22 @@ out:
 
 static int show_server_sessions(const char *name, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_sess **ss_srv;
 	int c_ss_srv = 0, ret;
 
-	ss_srv = calloc(sess_srv_cnt, sizeof(*ss_srv));
+	ss_srv = calloc(snap->sess_srv_cnt, sizeof(*ss_srv));
 
-	if (sess_srv_cnt && !ss_srv) {
+	if (snap->sess_srv_cnt && !ss_srv) {
 		ERR(trm, "Failed to alloc memory\n");
 		ret = -ENOMEM;
 		goto out;
 	}
-	ss_srv[0] = find_sess(name, sess_srv);
+	ss_srv[0] = find_sess(name, snap->sess_srv);
 	if (ss_srv[0])
 		c_ss_srv = 1;
 	else
-		c_ss_srv = find_sess_match(name, ctx->rnbdmode, sess_srv, ss_srv);
+		c_ss_srv = find_sess_match(name, ctx->rnbdmode, snap->sess_srv, ss_srv);
 
 	if (c_ss_srv > 1) {
 		ERR(trm, "Multiple sessions match '%s'\n", name);
@@ -1720,31 +2532,32 @@ out:
 
 static int show_both_sessions(const char *name, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_sess **ss_clt;
 	struct rnbd_sess **ss_srv;
 	int c_ss_clt = 0;
 	int c_ss_srv = 0, ret;
 
-	ss_srv = calloc(sess_srv_cnt, sizeof(*ss_srv));
-	ss_clt = calloc(sess_clt_cnt, sizeof(*ss_clt));
+	ss_srv = calloc(snap->sess_srv_cnt, sizeof(*ss_srv));
+	ss_clt = calloc(snap->sess_clt_cnt, sizeof(*ss_clt));
 
-	if ((sess_clt_cnt && !ss_clt)
-	    || (sess_srv_cnt && !ss_srv)) {
+	if ((snap->sess_clt_cnt && !ss_clt)
+	    || (snap->sess_srv_cnt && !ss_srv)) {
 		ERR(trm, "Failed to alloc memory\n");
 		ret = -ENOMEM;
 		goto out;
 	}
 
-	ss_clt[0] = find_sess(name, sess_clt);
-	ss_srv[0] = find_sess(name, sess_srv);
+	ss_clt[0] = find_sess(name, snap->sess_clt);
+	ss_srv[0] = find_sess(name, snap->sess_srv);
 	if (ss_clt[0])
 		c_ss_clt = 1;
 	if (ss_srv[0])
 		c_ss_srv = 1;
 
 	if (!ss_clt[0] && !ss_srv[0]) {
-		c_ss_clt = find_sess_match(name, ctx->rnbdmode, sess_clt, ss_clt);
-		c_ss_srv = find_sess_match(name, ctx->rnbdmode, sess_srv, ss_srv);
+		c_ss_clt = find_sess_match(name, ctx->rnbdmode, snap->sess_clt, ss_clt);
+		c_ss_srv = find_sess_match(name, ctx->rnbdmode, snap->sess_srv, ss_srv);
 	}
 
 	if (c_ss_clt + c_ss_srv > 1) {
@@ -1775,15 +2588,16 @@ out:
 
 static int show_paths(const char *name, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_path **pp_clt, **pp_srv;
 	int c_pp_clt, c_pp_srv, c_pp = 0, ret;
 	const char *session_name; const char *path_name;
 
-	pp_clt = calloc(paths_clt_cnt, sizeof(*pp_clt));
-	pp_srv = calloc(paths_srv_cnt, sizeof(*pp_srv));
+	pp_clt = calloc(snap->paths_clt_cnt, sizeof(*pp_clt));
+	pp_srv = calloc(snap->paths_srv_cnt, sizeof(*pp_srv));
 
-	if ((paths_clt_cnt && !pp_clt) ||
-	    (paths_srv_cnt && !pp_srv)) {
+	if ((snap->paths_clt_cnt && !pp_clt) ||
+	    (snap->paths_srv_cnt && !pp_srv)) {
 		ERR(trm, "Failed to alloc memory\n");
 		ret = -ENOMEM;
 		goto out;
@@ -1800,7 +2614,7 @@ static int show_paths(const char *name, struct rnbd_ctx *ctx)
 		if (ctx->path_cnt > 1)
 			ERR(trm, "Multiple paths specified\n");
 	}
-	c_pp = find_paths_all(session_name, path_name, ctx, pp_clt,
+	c_pp = find_paths_all(ctx->snap, session_name, path_name, ctx, pp_clt,
 			      &c_pp_clt, pp_srv, &c_pp_srv);
 
 	if (c_pp > 1) {
@@ -2046,6 +2860,7 @@ static void help_map(const char *program_name,
 
 	print_opt("{rw}",
 		  "Access permission on server side: ro|rw|migration. Default: rw");
+	print_opt("wait [timeout]", _params_wait.descr);
 	print_param_descr("verbose");
 	print_param_descr("help");
 
@@ -2106,6 +2921,148 @@ static struct rnbd_sess *find_single_session(const char *session_name,
 	return res;
 }
 
+#define PATH_KEY_LEN (2 * NAME_MAX + 16)
+
+static void path_index_free(struct path_index *idx)
+{
+	if (!idx->built)
+		return;
+
+	rnbd_hash_free(&idx->by_name);
+	rnbd_hash_free(&idx->by_port);
+	rnbd_hash_free(&idx->by_addr);
+	idx->built = false;
+}
+
+static void snap_index_free(void *p)
+{
+	struct snap_index *si = p;
+
+	dev_index_free(&si->dev_clt);
+	dev_index_free(&si->dev_srv);
+	path_index_free(&si->path_clt);
+	path_index_free(&si->path_srv);
+	free(si);
+}
+
+static int path_index_add(struct path_index *idx, struct rnbd_path *p)
+{
+	char key[PATH_KEY_LEN];
+	int ret;
+
+	snprintf(key, sizeof(key), "%s %s", p->sess->sessname, p->pathname);
+	ret = rnbd_hash_add(&idx->by_name, key, p);
+	if (ret)
+		return ret;
+
+	snprintf(key, sizeof(key), "%s %s %d", p->sess->sessname,
+		 p->hca_name, p->hca_port);
+	ret = rnbd_hash_add(&idx->by_port, key, p);
+	if (ret)
+		return ret;
+
+	rnbd_addr_key(key, sizeof(key), &p->src, p->src_addr);
+	ret = rnbd_hash_add(&idx->by_addr, key, p);
+	if (ret)
+		return ret;
+
+	rnbd_addr_key(key, sizeof(key), &p->dst, p->dst_addr);
+
+	return rnbd_hash_add(&idx->by_addr, key, p);
+}
+
+static int path_index_build(struct path_index *idx,
+			    struct rnbd_path **paths, int path_cnt)
+{
+	int i, ret;
+
+	memset(idx, 0, sizeof(*idx));
+
+	ret = rnbd_hash_init(&idx->by_name, path_cnt);
+	if (!ret)
+		ret = rnbd_hash_init(&idx->by_port, path_cnt);
+	if (!ret)
+		ret = rnbd_hash_init(&idx->by_addr, 2 * path_cnt);
+	idx->built = true;
+
+	for (i = 0; !ret && paths[i]; i++)
+		ret = path_index_add(idx, paths[i]);
+
+	if (ret)
+		path_index_free(idx);
+
+	return ret;
+}
+
+static struct path_index *path_index_get(struct rnbd_snapshot *snap,
+					 struct rnbd_path **paths,
+					 int path_cnt)
+{
+	struct snap_index *si;
+	struct path_index *idx;
+
+	si = snap_index_get(snap);
+	if (!si)
+		return NULL;
+
+	if (paths == snap->paths_clt)
+		idx = &si->path_clt;
+	else if (paths == snap->paths_srv)
+		idx = &si->path_srv;
+	else
+		return NULL;
+
+	if (!idx->built && path_index_build(idx, paths, path_cnt))
+		return NULL;
+
+	return idx;
+}
+
+/*
+ * Return the only path stored under @key or NULL
+ */
+static struct rnbd_path *path_index_find_one(const struct rnbd_hash *h,
+					     const char *key)
+{
+	struct rnbd_path *p;
+	size_t pos = 0;
+
+	p = rnbd_hash_find_next(h, key, &pos);
+	if (!p || rnbd_hash_find_next(h, key, &pos))
+		return NULL;
+
+	return p;
+}
+
+/*
+ * Look up the path for the queries which name it by one of the keys of
+ * the index. NULL means the paths have to be searched with the matcher.
+ */
+static struct rnbd_path *path_index_find(const struct path_index *idx,
+					 const struct path_matcher *m)
+{
+	char key[PATH_KEY_LEN];
+
+	if (m->sessname && m->name && !m->hca && !m->port_set) {
+		snprintf(key, sizeof(key), "%s %s", m->sessname, m->name);
+		return path_index_find_one(&idx->by_name, key);
+	}
+
+	if (m->sessname && !m->name && m->hca && m->port_set) {
+		snprintf(key, sizeof(key), "%s %s %d", m->sessname, m->hca,
+			 m->port);
+		return path_index_find_one(&idx->by_port, key);
+	}
+
+	if (!m->sessname && m->is_addr && !m->addr_str.src &&
+	    !m->hca && !m->port_set) {
+		rnbd_addr_key(key, sizeof(key), &m->dst, m->addr_str.dst);
+		return path_index_find_one(&idx->by_addr, key);
+	}
+
+	return NULL;
+}
+
 static struct rnbd_path *find_single_path(const char *session_name,
 					  const char *path_name,
 					  struct rnbd_ctx *ctx,
@@ -2113,6 +3070,8 @@ static struct rnbd_path *find_single_path(const char *session_name,
 					  int path_cnt, bool print_err)
 {
 	struct rnbd_path **matching_paths, *res = NULL;
+	struct path_index *idx;
+	struct path_matcher m;
 	int match_count;
 	char *base_path_name;
 
@@ -2123,13 +3082,24 @@ static struct rnbd_path *find_single_path(const char *session_name,
 		return NULL;
 	}
 
-	matching_paths = calloc(path_cnt, sizeof(*matching_paths));
+	path_matcher_init(&m, session_name, path_name, ctx);
+	idx = path_index_get(ctx->snap, paths, path_cnt);
+	if (idx)
+		res = path_index_find(idx, &m);
+	if (res) {
+		path_matcher_free(&m);
+		return res;
+	}
 
-	if (path_cnt && !matching_paths) {
+	matching_paths = calloc(path_cnt + 1, sizeof(*matching_paths));
+
+	if (!matching_paths) {
+		path_matcher_free(&m);
 		ERR(trm, "Failed to alloc memory\n");
 		return NULL;
 	}
-	match_count = find_paths(session_name, path_name, ctx, paths, matching_paths);
+	match_count = find_paths(&m, paths, matching_paths);
+	path_matcher_free(&m);
 	if (match_count == 0 && path_name && strchr(path_name, '%') != NULL) {
 		INF(ctx->debug_set,
 		    "Retry to find path for name %s ignoring interface.\n",
@@ -2137,7 +3107,10 @@ static struct rnbd_path *find_single_path(const char *session_name,
 		base_path_name = strdup(path_name);
 		if (base_path_name) {
 			*strchr(base_path_name, '%') = '\0';
-			match_count = find_paths(session_name, base_path_name, ctx, paths, matching_paths);
+			path_matcher_init(&m, session_name, base_path_name,
+					  ctx);
+			match_count = find_paths(&m, paths, matching_paths);
+			path_matcher_free(&m);
 			free(base_path_name);
 		}
 	}
@@ -2191,20 +3164,58 @@ static struct rnbd_path *find_first_path_for_session(const char *session_name,
 	return res;
 }
 
+/* flags of the library operations as given on the command line */
+static unsigned int op_flags(const struct rnbd_ctx *ctx)
+{
+	return (ctx->simulate_set ? RNBD_OP_SIMULATE : 0) |
+	       (ctx->debug_set ? RNBD_OP_DEBUG : 0) |
+	       (ctx->verbose_set ? RNBD_OP_VERBOSE : 0);
+}
+
+/*
+ * Addresses of the @cnt paths @paths followed by those of session @sess
+ */
+static struct rnbd_path_addr *map_paths(const struct path *paths, int cnt,
+					const struct rnbd_sess *sess)
+{
+	struct rnbd_path_addr *addrs;
+	int i;
+
+	addrs = calloc(cnt + (sess ? sess->path_cnt : 0) + 1, sizeof(*addrs));
+	if (!addrs)
+		return NULL;
+
+	for (i = 0; i < cnt; i++) {
+		addrs[i].src = paths[i].src;
+		addrs[i].dst = paths[i].dst;
+	}
+	for (i = 0; sess && i < sess->path_cnt; i++) {
+		addrs[cnt + i].src = sess->paths[i]->src_addr;
+		addrs[cnt + i].dst = sess->paths[i]->dst_addr;
+	}
+
+	return addrs;
+}
+
 static int client_devices_map(const char *from_name, const char *device_name,
 			      struct rnbd_ctx *ctx)
 {
-	char cmd[4096], sessname[NAME_MAX];
+	struct rnbd_snapshot *snap = ctx->snap;
+	struct timespec start, written;
+	struct rnbd_path_addr *addrs;
 	struct rnbd_sess *sess = NULL;
+	char sessname[NAME_MAX];
+	struct rnbd_error err;
 	struct rnbd_path *path;
-	int i, cnt = 0, ret;
+	int ret;
 
 	if (!from_name && ctx->path_cnt) {
 
 		/* User provided only a path to designate a session to use. */
 
 		path = find_single_path(NULL, ctx->paths[0].dst, ctx,
-					paths_clt, paths_clt_cnt, true);
+					snap->paths_clt, snap->paths_clt_cnt,
+					true);
 		if (path) {
 			sess = path->sess;
 			INF(ctx->debug_set,
@@ -2221,8 +3232,8 @@ static int client_devices_map(const char *from_name, const char *device_name,
 	if (!sess) {
 
 		/* Try to match a session in any case */
-		sess = find_single_session(from_name, ctx, sess_clt,
-					   sds_clt_cnt, false);
+		sess = find_single_session(from_name, ctx, snap->sess_clt,
+					   snap->sds_clt_cnt, false);
 
 		if (sess) {
 			INF(ctx->debug_set,
@@ -2281,41 +3292,35 @@ static int client_devices_map(const char *from_name, const char *device_name,
 		return -EINVAL;
 	}
 
-	cnt = snprintf(cmd, sizeof(cmd), "sessname=%s", sessname);
-	cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt, " device_path=%s",
-			device_name);
+	addrs = map_paths(ctx->paths, ctx->path_cnt, sess);
+	if (!addrs) {
+		ERR(trm, "Failed to allocate memory\n");
+		return -ENOMEM;
+	}
 
-	for (i = 0; i < ctx->path_cnt; i++)
-		if (ctx->paths[i].src)
-			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
-					" path=%s@%s",
-					ctx->paths[i].src, ctx->paths[i].dst);
-		else
-			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
-					" path=%s",
-					ctx->paths[i].dst);
-
-	if (sess)
-		for (i = 0; i < sess->path_cnt; i++)
-			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
-					" path=%s@%s", sess->paths[i]->src_addr,
-					sess->paths[i]->dst_addr);
-
-	if (ctx->access_mode_set)
-		cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt, " access_mode=%s",
-				ctx->access_mode);
-
-	ret = printf_sysfs(get_sysfs_info(ctx)->path_dev_clt,
-			   "map_device", ctx, "%s", cmd);
-	if (ret)
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ret = rnbd_map(sessname, device_name, addrs,
+		       ctx->path_cnt + (sess ? sess->path_cnt : 0),
+		       ctx->access_mode_set ? ctx->access_mode : NULL,
+		       op_flags(ctx), &err);
+	free(addrs);
+	if (ret) {
 		if (ctx->sysfs_avail)
-			ERR(trm, "Failed to map device: %s (%d)\n",
-			    strerror(-ret), ret);
+			ERR(trm, "%s\n", err.msg);
 		else
 			ERR(trm, "Failed to map device: modules not loaded.\n");
-	else
-		INF(ctx->verbose_set, "Successfully mapped '%s' from '%s'.\n",
-		    device_name, from_name ? from_name : sessname);
+		return ret;
+	}
+
+	INF(ctx->verbose_set, "Successfully mapped '%s' from '%s'.\n",
+	    device_name, from_name ? from_name : sessname);
+
+	if (ctx->wait_set && !ctx->simulate_set) {
+		clock_gettime(CLOCK_MONOTONIC, &written);
+		ret = rnbd_wait_map(ctx, sessname, device_name, &start,
+				    &written, ctx->wait_ms);
+	}
 
 	return ret;
 }
@@ -2334,13 +3339,12 @@ static struct rnbd_sess_dev *find_single_device(const char *name,
 		return NULL;
 	}
 
-	matching_devs = calloc(dev_cnt, sizeof(*matching_devs));
+	matching_devs = find_devices(ctx->snap, name, devs, &match_count);
 	if (!matching_devs) {
 		ERR(trm, "Failed to allocate memory\n");
 		return NULL;
 	}
 
-	match_count = find_devices(name, devs, matching_devs);
 	if (match_count == 1) {
 
 		res = matching_devs[0];
@@ -2352,27 +3356,18 @@ static struct rnbd_sess_dev *find_single_device(const char *name,
 		    name);
 	}
 
-	free(matching_devs);
 	return res;
 }
 
-static int client_devices_resize(const char *device_name, uint64_t size_sect,
-				 struct rnbd_ctx *ctx)
+static int _client_devices_resize(const struct rnbd_sess_dev *ds,
+				  uint64_t size_sect, struct rnbd_ctx *ctx)
 {
-	const struct rnbd_sess_dev *ds;
-	char tmp[PATH_MAX];
+	struct rnbd_error err;
 	int ret;
 
-	ds = find_single_device(device_name, ctx, sds_clt, sds_clt_cnt, true/*print_err*/);
-	if (!ds)
-		return -EINVAL;
-
-	sprintf(tmp, "/sys/block/%s/%s", ds->dev->devname,
-		get_sysfs_info(ctx)->path_dev_name);
-	ret = printf_sysfs(tmp, "resize", ctx, "%" PRIu64, size_sect);
+	ret = rnbd_resize(ds, size_sect, op_flags(ctx), &err);
 	if (ret)
-		ERR(trm, "Failed to resize %s to %" PRIu64 ": %s (%d)\n",
-		    ds->dev->devname, size_sect, strerror(-ret), ret);
+		ERR(trm, "%s\n", err.msg);
 	else
 		INF(ctx->verbose_set,
 		    "Device '%s' resized sucessfully to %" PRIu64 " sectors.\n",
@@ -2381,8 +3376,28 @@ static int client_devices_resize(const char *device_name, uint64_t size_sect,
 	return ret;
 }
 
-static void help_resize(const char *program_name,
-			const struct param *cmd,
+static int client_devices_resize(const char *device_name, uint64_t size_sect,
+				 struct rnbd_ctx *ctx)
+{
+	struct rnbd_snapshot *snap = ctx->snap;
+	const struct rnbd_sess_dev *ds;
+
+	ds = find_single_device(device_name, ctx, snap->sds_clt, snap->sds_clt_cnt, true/*print_err*/);
+	if (!ds)
+		return -EINVAL;
+
+	return _client_devices_resize(ds, size_sect, ctx);
+}
+
+static void help_select(void)
+{
+	print_opt("session", _params_sel_session.descr);
+	print_param_descr("where");
+	print_opt("jobs", _params_jobs.descr);
+}
+
+static void help_resize(const char *program_name,
+			const struct param *cmd,
 			const struct rnbd_ctx *ctx)
 {
 	if (!program_name)
@@ -2391,11 +3406,12 @@ static void help_resize(const char *program_name,
 	cmd_print_usage_descr(cmd, program_name, ctx);
 
 	printf("\nArguments:\n");
-	print_opt("<device>", "Name of the device to be resized");
+	print_opt("<device>", "Name or glob of the devices to be resized");
 	print_opt("<size>", "New size of the device in bytes");
 	print_opt("{unit}", "Units to use for size (in binary): B|K|M|G|T|P|E");
 
 	printf("\nOptions:\n");
+	help_select();
 	print_param_descr("verbose");
 	print_param_descr("help");
 }
@@ -2410,9 +3426,10 @@ static void help_unmap(const char *program_name,
 	cmd_print_usage_descr(cmd, program_name, ctx);
 
 	printf("\nArguments:\n");
-	print_opt("<device>", "Name of the device to be unmapped");
+	print_opt("<device>", "Name or glob of the devices to be unmapped");
 
 	printf("\nOptions:\n");
+	help_select();
 	print_param_descr("force");
 	print_param_descr("verbose");
 	print_param_descr("help");
@@ -2421,18 +3438,12 @@ static void help_unmap(const char *program_name,
 static int _client_devices_unmap(const struct rnbd_sess_dev *ds, bool force,
 				struct rnbd_ctx *ctx)
 {
-	char tmp[PATH_MAX];
+	struct rnbd_error err;
 	int ret;
 
-	sprintf(tmp, "/sys/block/%s/%s", ds->dev->devname,
-		get_sysfs_info(ctx)->path_dev_name);
-
-	ret = printf_sysfs(tmp, "unmap_device", ctx, "%s",
-			   force ? "force" : "normal");
+	ret = rnbd_unmap(ds, force, op_flags(ctx), &err);
 	if (ret)
-		ERR(trm, "Failed to %sunmap '%s': %s (%d)\n",
-		    force ? "force-" : "",
-		    ds->dev->devname, strerror(-ret), ret);
+		ERR(trm, "%s\n", err.msg);
 	else
 		INF(ctx->verbose_set, "Device '%s' sucessfully unmapped.\n",
 		    ds->dev->devname);
@@ -2443,33 +3454,31 @@ static int _client_devices_unmap(const struct rnbd_sess_dev *ds, bool force,
 static int client_devices_unmap(const char *device_name, bool force,
 				struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const struct rnbd_sess_dev *ds;
 
-	ds = find_single_device(device_name, ctx, sds_clt, sds_clt_cnt, true/*print_err*/);
+	ds = find_single_device(device_name, ctx, snap->sds_clt, snap->sds_clt_cnt, true/*print_err*/);
 	if (!ds)
 		return -EINVAL;
 
 	return _client_devices_unmap(ds, force, ctx);
 }
 
-static int client_device_remap(const struct rnbd_dev *dev,
+static int client_device_remap(const struct rnbd_sess_dev *ds,
 			       struct rnbd_ctx *ctx)
 {
-	char tmp[PATH_MAX];
+	const struct rnbd_dev *dev = ds->dev;
+	struct rnbd_error err;
 	int ret;
 
-	sprintf(tmp, "/sys/block/%s/%s", dev->devname,
-		get_sysfs_info(ctx)->path_dev_name);
-
-	ret = printf_sysfs(tmp, "remap_device", ctx, "1");
+	ret = rnbd_remap(ds, op_flags(ctx), &err);
 	if (ret == -EALREADY) {
 		INF(ctx->verbose_set,
 		    "Device '%s' does not need to be remapped.\n",
 		    dev->devname);
 		ret = 0;
 	} else if (ret) {
-		ERR(trm, "Failed to remap %s: %s (%d)\n",
-		    dev->devname, strerror(-ret), ret);
+		ERR(trm, "%s\n", err.msg);
 	} else {
 		INF(ctx->verbose_set,
 		    "Device '%s' sucessfully remapped.\n",
@@ -2480,107 +3489,131 @@ static int client_device_remap(const struct rnbd_dev *dev,
 
 static int client_devices_remap(const char *device_name, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const struct rnbd_sess_dev *ds;
 
-	ds = find_single_device(device_name, ctx, sds_clt, sds_clt_cnt, true/*print_err*/);
+	ds = find_single_device(device_name, ctx, snap->sds_clt, snap->sds_clt_cnt, true/*print_err*/);
 	if (!ds)
 		return -EINVAL;
 
-	return client_device_remap(ds->dev, ctx);
+	return client_device_remap(ds, ctx);
+}
+
+/*
+ * Take the lock of session @sessname, telling why it takes long
+ */
+static int lock_sess(const char *sessname, const struct rnbd_ctx *ctx)
+{
+	int err;
+
+	err = rnbd_lock_sess(sessname, false, ctx);
+	if (err == -EWOULDBLOCK) {
+		INF(ctx->verbose_set,
+		    "Waiting for session '%s' to be unlocked.\n", sessname);
+		err = rnbd_lock_sess(sessname, true, ctx);
+	}
+	if (err)
+		ERR(trm, "Failed to lock session '%s': %s (%d)\n",
+		    sessname, strerror(-err), err);
+
+	return err;
+}
+
+static int _client_session_remap(const struct rnbd_sess *sess,
+				 struct rnbd_ctx *ctx)
+{
+	struct rnbd_sess_dev *const *sds_iter;
+	struct rnbd_path_addr *addrs;
+	struct rnbd_error map_err;
+	int tmp_err, err = 0;
+
+	if (!ctx->force_set) {
+		for (sds_iter = sess->sds; *sds_iter; sds_iter++) {
+			tmp_err = client_device_remap(*sds_iter, ctx);
+			/*  intentional continue on error */
+			if (!err && tmp_err)
+				err = tmp_err;
+		}
+		return err;
+	}
+	for (sds_iter = sess->sds; *sds_iter; sds_iter++) {
+		tmp_err = _client_devices_unmap((*sds_iter), 0, ctx);
+		/*  intentional continue on error */
+		if (tmp_err)
+			ERR(trm, "Failed to unmap device: %s, %s (%d)\n",
+			    (*sds_iter)->dev->devname, strerror(-tmp_err), tmp_err);
+	}
+	/* All devices should be unmapped now and */
+	/* therefor session should be closed.     */
+	/* The session lock keeps other rnbd      */
+	/* processes from mapping or unmapping    */
+	/* in between.                            */
+	addrs = map_paths(NULL, 0, sess);
+	if (!addrs) {
+		ERR(trm, "Failed to allocate memory\n");
+		return -ENOMEM;
+	}
+	for (sds_iter = sess->sds; *sds_iter; sds_iter++) {
+		tmp_err = rnbd_map(sess->sessname, (*sds_iter)->mapping_path,
+				   addrs, sess->path_cnt,
+				   (*sds_iter)->access_mode, op_flags(ctx),
+				   &map_err);
+		if (tmp_err) {
+			ERR(trm, "%s\n", map_err.msg);
+			if (!err)
+				err = tmp_err;
+		}  else { 
+			INF(ctx->verbose_set, "Successfully mapped '%s' from '%s'.\n",
+			    (*sds_iter)->dev->devname, sess->sessname);
+		}
+	}
+	free(addrs);
+
+	return err;
 }
 
 static int client_session_remap(const char *session_name,
 				struct rnbd_ctx *ctx)
 {
-	int tmp_err, err = 0;
-	int cnt, i;
-	struct rnbd_sess_dev *const *sds_iter;
+	struct rnbd_snapshot *snap = ctx->snap;
 	const struct rnbd_sess *sess;
-	char cmd[4096];
+	int err;
 
 	if (!ctx->sysfs_avail)
 		ERR(trm, "Not possible to remap devices: modules not loaded.\n");
 
-	if (!sds_clt_cnt) {
+	if (!snap->sds_clt_cnt) {
 		ERR(trm,
 		    "No devices mapped. Nothing to be done!\n");
 		return -EINVAL;
 	}
-	sess = find_single_session(session_name, ctx, sess_clt,
-				   sds_clt_cnt, true);
+	sess = find_single_session(session_name, ctx, snap->sess_clt,
+				   snap->sds_clt_cnt, true);
 	if (!sess)
 		return -EINVAL;
 
-	if (!ctx->force_set) {
-		for (sds_iter = sds_clt; *sds_iter; sds_iter++) {
-
-			if ((*sds_iter)->sess == sess) {
-				tmp_err = client_device_remap((*sds_iter)->dev, ctx);
-				/*  intentional continue on error */
-				if (!err && tmp_err)
-					err = tmp_err;
-			}
-		}
+	err = lock_sess(sess->sessname, ctx);
+	if (err)
 		return err;
-	}
-	for (sds_iter = sds_clt; *sds_iter; sds_iter++) {
+	err = _client_session_remap(sess, ctx);
+	rnbd_unlock_sess(sess->sessname);
 
-		if ((*sds_iter)->sess == sess) {
-			tmp_err = _client_devices_unmap((*sds_iter), 0, ctx);
-			/*  intentional continue on error */
-			if (tmp_err)
-				ERR(trm, "Failed to unmap device: %s, %s (%d)\n",
-				    (*sds_iter)->dev->devname, strerror(-tmp_err), tmp_err);
-		}
-	}
-	/* All devices should be unmapped now and */
-	/* therefor session should be closed.     */
-	/* We have a race condition here with     */
-	/* simultanous map/unmap commands         */
-	/* which involve the same hosts.          */
-	for (sds_iter = sds_clt; *sds_iter; sds_iter++) {
-
-		if ((*sds_iter)->sess == sess) {
-			cnt = snprintf(cmd, sizeof(cmd), "sessname=%s", sess->sessname);
-			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt, " device_path=%s",
-					(*sds_iter)->mapping_path);
-			for (i = 0; i < sess->path_cnt; i++)
-				cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt,
-						" path=%s@%s", sess->paths[i]->src_addr,
-						sess->paths[i]->dst_addr);
-			cnt += snprintf(cmd + cnt, sizeof(cmd) - cnt, " access_mode=%s",
-					(*sds_iter)->access_mode);
-			tmp_err = printf_sysfs(get_sysfs_info(ctx)->path_dev_clt,
-					       "map_device", ctx, "%s", cmd);
-			
-			if (tmp_err) {
-				ERR(trm, "Failed to map device: %s (%d)\n",
-				    strerror(-tmp_err), tmp_err);
-				if (!err)
-					err = tmp_err;
-			}  else { 
-				INF(ctx->verbose_set, "Successfully mapped '%s' from '%s'.\n",
-				    (*sds_iter)->dev->devname, sess->sessname);
-			}
-		}
-	}
 	return err;
 }
 
 static int session_do_all_paths(enum rnbdmode mode,
 				const char *session_name,
-				int (*do_it)(const char *session_name,
-					     const char *path_name,
+				int (*do_it)(const struct rnbd_path *path,
 					     struct rnbd_ctx *ctx),
 				struct rnbd_ctx *ctx)
 {
-	int err = 0;
-	struct rnbd_path *const *paths_iter;
+	struct rnbd_snapshot *snap = ctx->snap;
+	int i, err = 0;
 	const struct rnbd_sess *sess;
 
 	if (!(mode == RNBD_CLIENT ?
-	      sess_clt_cnt
-	      : sess_srv_cnt)) {
+	      snap->sess_clt_cnt
+	      : snap->sess_srv_cnt)) {
 		ERR(trm,
 		    "No sessions opened!\n");
 		return -EINVAL;
@@ -2588,23 +3621,24 @@ static int session_do_all_paths(enum rnbdmode mode,
 
 	if (mode == RNBD_CLIENT)
 		sess = find_single_session(session_name, ctx,
-					   sess_clt, sess_clt_cnt,
+					   snap->sess_clt, snap->sess_clt_cnt,
 					   true);
 	else
 		sess = find_single_session(session_name, ctx,
-					   sess_srv, sess_srv_cnt,
+					   snap->sess_srv, snap->sess_srv_cnt,
 					   true);
 
 	if (!sess)
 		/*find_single_session has printed an error message*/
 		return -EINVAL;
 
-	for (paths_iter = (mode == RNBD_CLIENT ? paths_clt : paths_srv);
-	     *paths_iter && !err; paths_iter++) {
+	err = lock_sess(sess->sessname, ctx);
+	if (err)
+		return err;
+	for (i = 0; i < sess->path_cnt && !err; i++)
+		err = do_it(sess->paths[i], ctx);
+	rnbd_unlock_sess(sess->sessname);
 
-		if ((*paths_iter)->sess == sess)
-			err = do_it(session_name, (*paths_iter)->pathname, ctx);
-	}
 	return err;
 }
 
@@ -2618,9 +3652,10 @@ static void help_remap(const char *program_name,
 	cmd_print_usage_descr(cmd, program_name, ctx);
 
 	printf("\nArguments:\n");
-	print_opt("<identifier>", "Identifier of a device to be remapped.");
+	print_opt("<identifier>", "Identifier or glob of the devices to be remapped.");
 
 	printf("\nOptions:\n");
+	help_select();
 	print_param_descr("force");
 	print_param_descr("verbose");
 	print_param_descr("help");
@@ -2641,8 +3676,10 @@ static void help_remap_device_or_session(const char *program_name,
 	print_opt("", "If identifier designates a session,");
 	print_opt("",
 		  "all devices of this particular session will be remapped.");
+	print_opt("", "A glob selects all the devices matching it.");
 
 	printf("\nOptions:\n");
+	help_select();
 	print_param_descr("force");
 	print_opt("",
 		  "When provided, all devices will be unmapped and mapped again.");
@@ -2685,11 +3722,12 @@ static void help_close_device(const char *program_name,
 
 	printf("\nArguments:\n");
 	print_opt("<device>",
-		  "Identifier of a device to be closed.");
+		  "Identifier or glob of the devices to be closed.");
 
 	printf("\nOptions:\n");
 	print_opt("<session>",
 		  "Identifier of a session for which the device is to be closed.");
+	help_select();
 	print_param_descr("force");
 	print_param_descr("verbose");
 	print_param_descr("help");
@@ -2857,12 +3895,15 @@ static int client_session_add(const char *session_name,
 			      const struct path *path,
 			      struct rnbd_ctx *ctx)
 {
-	char address_string[4096];
-	char sysfs_path[4096];
+	struct rnbd_path_addr addr = {
+		.src = path->src,
+		.dst = path->dst,
+	};
+	struct rnbd_error err;
 	struct rnbd_sess *sess;
 	int ret;
 
-	sess = find_sess(session_name, sess_clt);
+	sess = find_sess(session_name, ctx->snap->sess_clt);
 
 	if (!sess) {
 		ERR(trm,
@@ -2870,23 +3911,15 @@ static int client_session_add(const char *session_name,
 		return -EINVAL;
 	}
 
-	snprintf(sysfs_path, sizeof(sysfs_path), "%s%s",
-		 get_sysfs_info(ctx)->path_sess_clt, sess->sessname);
-	if (path->src)
-		snprintf(address_string, sizeof(address_string),
-			 "%s,%s", path->src, path->dst);
-	else
-		snprintf(address_string, sizeof(address_string),
-			 "%s", path->dst);
-
-	ret = printf_sysfs(sysfs_path, "add_path", ctx, "%s", address_string);
+	ret = rnbd_addpath(sess, &addr, op_flags(ctx), &err);
 	if (ret)
-		ERR(trm,
-		    "Failed to add path '%s' to session '%s': %s (%d)\n",
-		    address_string, sess->sessname, strerror(-ret), ret);
+		ERR(trm, "%s\n", err.msg);
+	else if (path->src)
+		INF(ctx->verbose_set, "Successfully added path '%s@%s' to '%s'.\n",
+		    path->src, path->dst, sess->sessname);
 	else
 		INF(ctx->verbose_set, "Successfully added path '%s' to '%s'.\n",
-		    address_string, sess->sessname);
+		    path->dst, sess->sessname);
 	return ret;
 }
 
@@ -2928,148 +3961,182 @@ static void help_delpath(const char *program_name,
 	print_param_descr("help");
 }
 
+typedef int (*path_op_t)(const struct rnbd_path *path, unsigned int flags,
+			 struct rnbd_error *err);
+
+static int client_path_do_path(const struct rnbd_path *path,
+			       path_op_t op,
+			       const char *message_success,
+			       struct rnbd_ctx *ctx)
+{
+	struct rnbd_error err;
+	int ret;
+
+	ret = op(path, op_flags(ctx), &err);
+	if (ret)
+		ERR(trm, "%s\n", err.msg);
+	else
+		INF(ctx->verbose_set, message_success,
+		    path->pathname, path->sess->sessname);
+	return ret;
+}
+
 static int client_path_do(const char *session_name,
 			  const char *path_name,
-			  const char *sysfs_entry,
+			  path_op_t op,
 			  const char *message_success,
-			  const char *message_fail, struct rnbd_ctx *ctx)
+			  struct rnbd_ctx *ctx)
 {
-	char sysfs_path[4096];
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_path *path;
-	int ret;
 
-	path = find_single_path(session_name, path_name,
-				ctx, paths_clt, paths_clt_cnt, true);
+	path = find_single_path(session_name, path_name, ctx,
+				snap->paths_clt, snap->paths_clt_cnt, true);
 
 	if (!path)
 		return -EINVAL;
 
-	snprintf(sysfs_path, sizeof(sysfs_path), "%s%s/paths/%s",
-		 get_sysfs_info(ctx)->path_sess_clt,
-		 path->sess->sessname, path->pathname);
-
-	ret = printf_sysfs(sysfs_path, sysfs_entry, ctx, "1");
-	if (ret)
-		ERR(trm, message_fail, path->pathname,
-		    path->sess->sessname, strerror(-ret), ret);
-	else
-		INF(ctx->verbose_set, message_success,
-		    path->pathname, path->sess->sessname);
-	return ret;
+	return client_path_do_path(path, op, message_success, ctx);
 }
 
 static int client_path_delete(const char *session_name,
 			      const char *path_name,
 			      struct rnbd_ctx *ctx)
 {
-	return client_path_do(session_name, path_name, "remove_path",
+	return client_path_do(session_name, path_name, rnbd_delpath,
 			      "Successfully removed path '%s' from '%s'.\n",
-			      "Failed to remove path '%s' from session '%s': %s (%d)\n",
 			      ctx);
 }
 
+static int client_path_reconnect_path(const struct rnbd_path *path,
+				      struct rnbd_ctx *ctx)
+{
+	return client_path_do_path(path, rnbd_reconnect,
+				   "Successfully reconnected path '%s' of session '%s'.\n",
+				   ctx);
+}
+
 static int client_path_reconnect(const char *session_name,
 				 const char *path_name,
 				 struct rnbd_ctx *ctx)
 {
-	return client_path_do(session_name, path_name, "reconnect",
+	return client_path_do(session_name, path_name, rnbd_reconnect,
 			      "Successfully reconnected path '%s' of session '%s'.\n",
-			      "Failed to reconnect path '%s' from session '%s': %s (%d)\n",
 			      ctx);
 }
 
+static int client_path_recover_path(const struct rnbd_path *path,
+				    struct rnbd_ctx *ctx)
+{
+	/*
+	 * Return success for connected paths
+	 */
+	if (!strcmp(path->state, "connected")) {
+		INF(ctx->debug_set,
+		    "Path '%s' is connected, skipping.\n",
+		    path->pathname);
+		return 0;
+	}
+
+	INF(ctx->debug_set, "Path '%s' is '%s', recovering.\n",
+		    path->pathname, path->state);
+
+	return client_path_reconnect_path(path, ctx);
+}
+
 static int client_path_recover(const char *session_name,
 			       const char *path_name,
 			       struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_path *path;
 
 	if (!session_name && !strcmp(path_name, "all")) {
 		ERR(trm, "Please provide session to recover all paths for\n");
 		return -EINVAL;
 	} else if (session_name && !strcmp(path_name, "all")) {
-		path = find_single_path(session_name, path_name, ctx, paths_clt,
-					paths_clt_cnt, false);
+		path = find_single_path(session_name, path_name, ctx,
+					snap->paths_clt, snap->paths_clt_cnt,
+					false);
 		if (!path)
 			return session_do_all_paths(RNBD_CLIENT, session_name,
-						    client_path_recover, ctx);
+						    client_path_recover_path,
+						    ctx);
 	} else {
-		path = find_single_path(session_name, path_name, ctx, paths_clt,
-					paths_clt_cnt, true);
+		path = find_single_path(session_name, path_name, ctx,
+					snap->paths_clt, snap->paths_clt_cnt,
+					true);
 	}
 
 	if (!path)
 		return -EINVAL;
 
-	/*
-	 * Return success for connected paths
-	 */
-	if (!strcmp(path->state, "connected")) {
-		INF(ctx->debug_set,
-		    "Path '%s' is connected, skipping.\n",
-		    path_name);
-		return 0;
-	}
-
-	INF(ctx->debug_set, "Path '%s' is '%s', recovering.\n",
-		    path_name, path->state);
+	return client_path_recover_path(path, ctx);
+}
 
-	return client_path_do(session_name, path_name, "reconnect",
-			      "Successfully reconnected path '%s' of session '%s'.\n",
-			      "Failed to reconnect path '%s' from session '%s': %s (%d)\n",
-			      ctx);
+static int client_path_disconnect_path(const struct rnbd_path *path,
+				       struct rnbd_ctx *ctx)
+{
+	return client_path_do_path(path, rnbd_disconnect,
+				   "Successfully disconnected path '%s' from session '%s'.\n",
+				   ctx);
 }
 
 static int client_path_disconnect(const char *session_name,
 				  const char *path_name,
 				  struct rnbd_ctx *ctx)
 {
-	return client_path_do(session_name, path_name, "disconnect",
-			      "Successfully disconnected path '%s' from session '%s'.\n",
-			      "Failed to disconnect path '%s' of session '%s': %s (%d)\n",
-			      ctx);
+	struct rnbd_snapshot *snap = ctx->snap;
+	struct rnbd_path *path;
+
+	path = find_single_path(session_name, path_name, ctx,
+				snap->paths_clt, snap->paths_clt_cnt, true);
+
+	if (!path)
+		return -EINVAL;
+
+	return client_path_disconnect_path(path, ctx);
 }
 
 static int client_path_readd(const char *session_name,
 			     const char *path_name,
 			     struct rnbd_ctx *ctx)
 {
-	char sysfs_path[4096];
+	struct rnbd_snapshot *snap = ctx->snap;
+	struct rnbd_path_addr addr;
+	struct rnbd_error err;
 	struct rnbd_path *path;
 	int ret;
 
-	path = find_single_path(session_name, path_name, ctx, paths_clt,
-				paths_clt_cnt, true);
+	path = find_single_path(session_name, path_name, ctx, snap->paths_clt,
+				snap->paths_clt_cnt, true);
 
 	if (!path)
 		return -EINVAL;
 
-	snprintf(sysfs_path, sizeof(sysfs_path), "%s%s/paths/%s",
-		 get_sysfs_info(ctx)->path_sess_clt,
-		 path->sess->sessname, path->pathname);
+	/* nobody else is to use the session while the path is gone */
+	ret = lock_sess(path->sess->sessname, ctx);
+	if (ret)
+		return ret;
 
-	ret = printf_sysfs(sysfs_path, "remove_path", ctx, "1");
+	ret = rnbd_delpath(path, op_flags(ctx), &err);
 	if (ret) {
-		ERR(trm,
-		    "Failed to remove path '%s' from session '%s': %s (%d)\n",
-		    path->pathname,
-		    path->sess->sessname, strerror(-ret), ret);
-		return ret;
+		ERR(trm, "%s\n", err.msg);
+		goto out;
 	}
 	INF(ctx->verbose_set, "Successfully removed path '%s' from '%s'.\n",
 	    path->pathname, path->sess->sessname);
 
-	snprintf(sysfs_path, sizeof(sysfs_path), "%s%s",
-		 get_sysfs_info(ctx)->path_sess_clt,
-		 path->sess->sessname);
-
 	if (strncmp("ip:fe80:", path_name, 8) == 0 && strchr(path_name, '%') != NULL) {
 		/* for a link local IPv6 address use the original address string */
 		/* only here not for remove_path */
-		ret = printf_sysfs(sysfs_path, "add_path", ctx, "%s", path_name);
+		addr.src = NULL;
+		addr.dst = path_name;
 	} else {
-		ret = printf_sysfs(sysfs_path, "add_path", ctx, "%s@%s", path->src_addr, path->dst_addr);
+		addr.src = path->src_addr;
+		addr.dst = path->dst_addr;
 	}
+	ret = rnbd_addpath(path->sess, &addr, op_flags(ctx), NULL);
 	if (ret)
 		ERR(trm,
 		    "Failed to readd path '%s' to session '%s': %s (%d)\n",
@@ -3078,6 +4145,25 @@ static int client_path_readd(const char *session_name,
 		INF(ctx->verbose_set,
 		    "Successfully readded path '%s' to '%s'.\n",
 		    path->pathname, path->sess->sessname);
+out:
+	rnbd_unlock_sess(path->sess->sessname);
+
+	return ret;
+}
+
+static int server_path_disconnect_path(const struct rnbd_path *path,
+				       struct rnbd_ctx *ctx)
+{
+	struct rnbd_error err;
+	int ret;
+
+	ret = rnbd_disconnect(path, op_flags(ctx), &err);
+	if (ret)
+		ERR(trm, "%s\n", err.msg);
+	else
+		INF(ctx->verbose_set,
+		    "Successfully disconnected path '%s' from session '%s'.\n",
+		    path->pathname, path->sess->sessname);
 	return ret;
 }
 
@@ -3085,50 +4171,28 @@ static int server_path_disconnect(const char *session_name,
 				  const char *path_name,
 				  struct rnbd_ctx *ctx)
 {
-	char sysfs_path[4096];
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_path *path;
-	int ret;
 
-	path = find_single_path(session_name, path_name, ctx, paths_srv,
-				paths_srv_cnt, true);
+	path = find_single_path(session_name, path_name, ctx, snap->paths_srv,
+				snap->paths_srv_cnt, true);
 
 	if (!path)
 		return -EINVAL;
 
-	snprintf(sysfs_path, sizeof(sysfs_path), "%s%s/paths/%s",
-		 get_sysfs_info(ctx)->path_sess_srv,
-		 path->sess->sessname, path->pathname);
-
-	ret = printf_sysfs(sysfs_path, "disconnect", ctx, "1");
-	if (ret)
-		ERR(trm,
-		    "Failed to disconnect path '%s' of session '%s': %s (%d)\n",
-		    path->pathname,
-		    path->sess->sessname, strerror(-ret), ret);
-	else
-		INF(ctx->verbose_set,
-		    "Successfully disconnected path '%s' from session '%s'.\n",
-		    path->pathname, path->sess->sessname);
-	return ret;
+	return server_path_disconnect_path(path, ctx);
 }
 
 static int server_devices_force_close(const char *device_name,
 				      const char *session_name,
 				      struct rnbd_ctx *ctx)
 {
-	char sysfs_path[4096];
+	struct rnbd_error err;
 	int ret;
 
-	snprintf(sysfs_path, sizeof(sysfs_path), "%s/devices/%s/sessions/%s",
-		 get_sysfs_info(ctx)->path_dev_srv,
-		 device_name, session_name);
-
-	ret = printf_sysfs(sysfs_path, "force_close", ctx, "1");
+	ret = rnbd_close(device_name, session_name, op_flags(ctx), &err);
 	if (ret)
-		ERR(trm,
-		    "Failed to close device '%s' for session '%s': %s (%d)\n",
-		    device_name, session_name,
-		    strerror(-ret), ret);
+		ERR(trm, "%s\n", err.msg);
 	else
 		INF(ctx->verbose_set,
 		    "Successfully closed device '%s' for session '%s'.\n",
@@ -3137,1140 +4201,2262 @@ static int server_devices_force_close(const char *device_name,
 	return ret;
 }
 
-static struct param _cmd_dump_all =
-	{TOK_DUMP, "dump",
-		"Dump information about all",
-		"",
-		"Dump information about all rnbd objects.",
-		NULL, NULL, help_dump_all};
-static struct param _cmd_list_devices =
-	{TOK_LIST, "list",
-		"List information on all",
-		"s",
-		"List information on devices.",
-		NULL, NULL, help_list_devices};
-static struct param _cmd_list_sessions =
-	{TOK_LIST, "list",
-		"List information on all",
-		"s",
-		"List information on sessions.",
-		NULL, NULL, help_list_sessions};
-static struct param _cmd_list_paths =
-	{TOK_LIST, "list",
-		"List information on all",
-		"s",
-		"List information on paths.",
-		NULL, NULL, help_list_paths};
-static struct param _cmd_show =
-	{TOK_SHOW, "show",
-		"Show information about the object that is designated by <name>",
-		"",
-		"Show information about an rnbd device, session, or path.",
-	 "<name>",
-		NULL, help_show};
-static struct param _cmd_show_devices =
-	{TOK_SHOW, "show",
-		"Show information about a",
-		"",
-		"Show information about an rnbd block device.",
-		"<device>",
-		NULL, help_show_devices};
-static struct param _cmd_show_sessions =
-	{TOK_SHOW, "show",
-		"Show information about a",
-		"",
-		"Show information about an rnbd session.",
-		"<session>",
-		NULL, help_show_sessions};
-static struct param _cmd_show_paths =
-	{TOK_SHOW, "show",
-		"Show information about a",
-		"",
-		"Show information about an rnbd transport path.",
-		"[session] <path>",
-		NULL, help_show_paths};
-static struct param _cmd_map =
-	{TOK_MAP, "map",
-		"Map a",
-		" from a given server",
-		"Map a device from a given server",
-		"<device> from <server>",
-		 NULL, help_map};
-static struct param _cmd_resize =
-	{TOK_RESIZE, "resize",
-		"Resize a mapped",
-		"",
-		"Change size of a mapped device",
-		"<device> <size>",
-		 NULL, help_resize};
-static struct param _cmd_unmap =
-	{TOK_UNMAP, "unmap",
-		"Unmap an imported",
-		"",
-		"Unmap a given imported device",
-		"<device>",
-		NULL, help_unmap};
-static struct param _cmd_remap =
-	{TOK_REMAP, "remap",
-		"Remap a",
-		"",
-		"Remap an imported device",
-		"<device>",
-		 NULL, help_remap};
-static struct param _cmd_remap_device_or_session =
-	{TOK_REMAP, "remap",
-		"Remap a",
-		"",
-		"Remap a devices or all devices of a given session",
-		"<device|session>",
-		 NULL, help_remap_device_or_session};
-static struct param _cmd_remap_session =
-	{TOK_REMAP, "remap",
-		"Remap all devicess on a",
-		"",
-		"Remap all devices of a given session",
-		"<session>",
-		 NULL, help_remap_session};
-static struct param _cmd_close_device =
-	{TOK_CLOSE, "close",
-		"Close a",
-		" for a session",
-		"Close a particular device for a given session",
-		"<device>",
-		 NULL, help_close_device};
-static struct param _cmd_client_recover_device =
-	{TOK_RECOVER, "recover",
-		"Recover a",
-		"",
-		"Recover a device: recover a device when it is not open.",
-		"<device>|all",
-		 NULL, help_recover_device};
-static struct param _cmd_recover_device_session_or_path =
-	{TOK_RECOVER, "recover",
-		"Recover a",
-		"",
-		"Recover a device, session, or path.",
-		"<device>|<session>|<path>|all",
-		 NULL, help_recover_device_session_or_path};
-static struct param _cmd_disconnect_session =
-	{TOK_DISCONNECT, "disconnect",
-		"Disconnect a",
-		"",
-		"Disconnect all paths on a given session",
-		"<session>",
-		NULL, help_disconnect_session};
-static struct param _cmd_dis_session =
-	{TOK_DISCONNECT, "dis",
-		"Disconnect a",
-		"",
-		"Disconnect all paths on a given session",
-		"<session>",
-		NULL, help_disconnect_session};
-static struct param _cmd_disconnect_path =
-	{TOK_DISCONNECT, "disconnect",
-		"Disconnect a",
-		"",
-		"Disconnect a path of a given session",
-		"[session] <path>",
-		NULL, help_disconnect_path};
-static struct param _cmd_dis_path =
-	{TOK_DISCONNECT, "dis",
-		"Disconnect a",
-		"",
-		"Disconnect a path of a given session",
-		"[session] <path>",
-		NULL, help_disconnect_path};
-static struct param _cmd_reconnect_session =
-	{TOK_RECONNECT, "reconnect",
-		"Reconnect a",
-		"",
-		"Disconnect and connect again a whole session",
-		"<session>",
-		 NULL, help_reconnect_session};
-static struct param _cmd_recover_session =
-	{TOK_RECOVER, "recover",
-		"Recover a",
-		"",
-		"Recover a session: reconnect disconnected paths.",
-		"<session>|all [add-missing]",
-		 NULL, help_recover_session};
-static struct param _cmd_reconnect_path =
-	{TOK_RECONNECT, "reconnect",
-		"Reconnect a",
-		"",
-		"Disconnect and connect again a single path of a session",
-		"[session] <path>",
-		 NULL, help_reconnect_path};
-static struct param _cmd_recover_path =
-	{TOK_RECOVER, "recover",
-		"Recover a",
-		"",
-		"Recover a path: reconnect if not in connected state.",
-		"[session] <path>|all",
-		 NULL, help_recover_path};
-static struct param _cmd_add =
-	{TOK_ADD, "add",
-		"Add a",
-		" to an existing session",
-		"Add a new path to an existing session",
-		"<session> <path>",
-		 NULL, help_addpath};
-static struct param _cmd_delete =
-	{TOK_DELETE, "delete",
-		"Delete a",
-		"",
-		"Delete a given path from the corresponding session",
-		"[session] <path>",
-		 NULL, help_delpath};
-static struct param _cmd_del =
-	{TOK_DELETE, "del",
-		"Delete a",
-		"",
-		"Delete a given path from the corresponding session",
-		"[session] <path>",
-		 NULL, help_delpath};
-static struct param _cmd_readd =
-	{TOK_READD, "readd",
-		"Readd a",
-		"",
-		"Delete and add again a given path to the corresponding session",
-		"[session] <path>",
-		 NULL, help_delpath};
-static struct param _cmd_help =
-	{TOK_HELP, "help",
-		"Display help on",
-		"s",
-		"Display help message and exit.",
-		NULL, NULL, help_object};
-static struct param _cmd_null =
-		{ 0 };
+static bool is_glob(const char *name)
+{
+	return strpbrk(name, "*?[");
+}
 
-static struct param *params_flags[] = {
-	&_params_minus_minus_help,
-	&_params_minus_h,
-	&_params_minus_minus_verbose,
-	&_params_minus_v,
-	&_params_minus_minus_debug,
-	&_params_minus_d,
-	&_params_minus_minus_simulate,
-	&_params_minus_s,
-	&_params_minus_c,
-	&_params_minus_minus_complete,
-	&_params_minus_minus_version,
-	&_params_null
-};
+/*
+ * Whether the devices are given by a selector rather than by a single
+ * name: a glob, a session or a where clause.
+ */
+static bool is_selector(const char *name, const struct rnbd_ctx *ctx)
+{
+	return is_glob(name) || ctx->sel_sess_set || ctx->where_set;
+}
 
-static struct param *params_flags_help[] = {
-	&_params_minus_minus_help,
-	&_params_minus_minus_verbose,
-	&_params_minus_minus_debug,
-	&_params_minus_minus_simulate,
-	&_params_null
-};
+static bool dev_glob_match(const char *glob, const struct rnbd_sess_dev *ds)
+{
+	return !fnmatch(glob, ds->mapping_path, 0) ||
+	       !fnmatch(glob, ds->dev->devname, 0) ||
+	       !fnmatch(glob, ds->dev->devpath, 0);
+}
 
-static struct param *params_default[] = {
-	&_params_help,
-	&_params_verbose,
-	&_params_minus_v,
-	&_params_null
-};
+/*
+ * Put the NULL terminated list of the devices @devs matching the name or
+ * glob @name, the session or glob @sessname, if not NULL, and the where
+ * clause bound to the columns @all into @sds, their number into @cnt.
+ * Returns -ENOENT if no device matches, the list is to be freed otherwise.
+ */
+static int select_devices(const char *name, const char *sessname,
+			  struct rnbd_sess_dev **devs,
+			  struct table_column **all, struct rnbd_ctx *ctx,
+			  struct rnbd_sess_dev ***sds, int *cnt)
+{
+	struct rnbd_sess_dev **cands, **res;
+	int i, n = 0, cand_cnt, sel;
 
-static struct param *params_mode[] = {
-	&_params_client,
-	&_params_clt,
-	&_params_cli,
-	&_params_server,
-	&_params_serv,
-	&_params_srv,
-	&_params_both,
-	&_params_help,
-	&_params_version,
-	&_params_minus_minus_version,
-	&_params_null
-};
+	sel = select_bind(all, NULL, false, false, ctx);
+	if (sel < 0)
+		return sel;
 
-static struct param *params_mode_help[] = {
-	&_params_client,
-	&_params_server,
-	&_params_help,
-	&_params_version,
-	&_params_null
-};
+	if (is_glob(name)) {
+		cands = devs;
+	} else {
+		cands = find_devices(ctx->snap, name, devs, &cand_cnt);
+		if (!cands) {
+			ERR(trm, "Failed to allocate memory\n");
+			return -ENOMEM;
+		}
+	}
 
-static struct param *params_both[] = {
-	&_params_devices,
-	&_params_device,
-	&_params_devs,
-	&_params_dev,
-	&_params_sessions,
-	&_params_session,
-	&_params_sess,
-	&_params_paths,
-	&_params_path,
-	&_cmd_list_devices,
-	&_cmd_dump_all,
-	&_cmd_show,
-	&_cmd_map,
-	&_cmd_resize,
-	&_cmd_unmap,
-	&_cmd_remap,
-	&_cmd_recover_device_session_or_path,
-	&_params_help,
-	&_params_null
+	for (cand_cnt = 0; cands[cand_cnt]; cand_cnt++)
+		;
+
+	res = calloc(cand_cnt + 1, sizeof(*res));
+	if (!res) {
+		ERR(trm, "Failed to allocate memory\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < cand_cnt; i++) {
+		if (cands == devs && !dev_glob_match(name, cands[i]))
+			continue;
+		if (sessname && fnmatch(sessname, cands[i]->sess->sessname, 0))
+			continue;
+		if ((sel & SELECT_WHERE) &&
+		    !rnbd_filter_match(&ctx->where, cands[i], ctx))
+			continue;
+		res[n++] = cands[i];
+	}
+
+	if (!n) {
+		ERR(trm, "No device matches '%s'%s%s%s\n", name,
+		    sessname ? " of session '" : "",
+		    sessname ? sessname : "", sessname ? "'" : "");
+		free(res);
+		return -ENOENT;
+	}
+
+	*sds = res;
+	*cnt = n;
+
+	return 0;
+}
+
+struct bulk {
+	struct rnbd_sess_dev	**sds;
+	int			(*op)(const struct rnbd_sess_dev *ds,
+				      struct rnbd_ctx *ctx);
+	struct rnbd_ctx		*ctx;
+	int			*errs;
 };
 
-static struct param *params_both_help[] = {
-	&_params_devices,
-	&_params_sessions,
-	&_params_paths,
-	&_params_help,
-	&_params_null
-};
+static void bulk_one(void *arg, int i)
+{
+	struct bulk *b = arg;
+
+	b->errs[i] = b->op(b->sds[i], b->ctx);
+}
+
+/*
+ * Run @op on the @cnt devices @sds on up to ctx->jobs threads. As for the
+ * devices of a session, a failure doesn't stop the others. Each failure
+ * is reported by @op, the summary says how many of them failed.
+ * Returns the first error.
+ */
+static int bulk_devices(struct rnbd_sess_dev **sds, int cnt,
+			int (*op)(const struct rnbd_sess_dev *ds,
+				  struct rnbd_ctx *ctx),
+			const char *what, const char *done,
+			struct rnbd_ctx *ctx)
+{
+	struct bulk b = {
+		.sds = sds,
+		.op = op,
+		.ctx = ctx,
+	};
+	int i, jobs, failed = 0, err = 0;
+
+	b.errs = calloc(cnt, sizeof(*b.errs));
+	if (!b.errs) {
+		ERR(trm, "Failed to allocate memory\n");
+		return -ENOMEM;
+	}
+
+	jobs = ctx->jobs_set ? ctx->jobs : RNBD_POOL_JOBS;
+	/* the commands are printed in order */
+	if (ctx->simulate_set || ctx->debug_set)
+		jobs = 1;
+
+	rnbd_pool_run(cnt, jobs, bulk_one, &b);
+
+	for (i = 0; i < cnt; i++) {
+		if (!b.errs[i])
+			continue;
+		if (!err)
+			err = b.errs[i];
+		failed++;
+	}
+
+	if (failed)
+		ERR(trm, "Failed to %s %d of %d devices\n", what, failed, cnt);
+	else
+		INF(ctx->verbose_set, "%s %d devices.\n", done, cnt);
+
+	free(b.errs);
+
+	return err;
+}
+
+static int bulk_unmap(const struct rnbd_sess_dev *ds, struct rnbd_ctx *ctx)
+{
+	return _client_devices_unmap(ds, ctx->force_set, ctx);
+}
+
+static int bulk_remap(const struct rnbd_sess_dev *ds, struct rnbd_ctx *ctx)
+{
+	return client_device_remap(ds, ctx);
+}
+
+static int bulk_resize(const struct rnbd_sess_dev *ds, struct rnbd_ctx *ctx)
+{
+	return _client_devices_resize(ds, ctx->size_sect, ctx);
+}
+
+static int bulk_close(const struct rnbd_sess_dev *ds, struct rnbd_ctx *ctx)
+{
+	return server_devices_force_close(ds->dev->devname,
+					  ds->sess->sessname, ctx);
+}
+
+/*
+ * Run @op on the devices selected by @name, ctx->sel_sess and ctx->where
+ */
+static int select_bulk(const char *name, const char *sessname,
+		       struct rnbd_sess_dev **devs,
+		       struct table_column **all,
+		       int (*op)(const struct rnbd_sess_dev *ds,
+				 struct rnbd_ctx *ctx),
+		       const char *what, const char *done,
+		       struct rnbd_ctx *ctx)
+{
+	struct rnbd_sess_dev **sds;
+	int cnt, err;
+
+	err = select_devices(name, sessname, devs, all, ctx, &sds, &cnt);
+	if (err)
+		return err;
+
+	err = bulk_devices(sds, cnt, op, what, done, ctx);
+	free(sds);
+
+	return err;
+}
+
+static void help_snapshot(const char *program_name,
+			  const struct param *cmd,
+			  const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("<file>", "File to store the snapshot in");
+
+	printf("\nOptions:\n");
+	print_param_descr("verbose");
+	print_param_descr("help");
+}
+
+static void help_diff(const char *program_name,
+		      const struct param *cmd,
+		      const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("<old>", "Snapshot file saved with the snapshot command");
+	print_opt("<new>", "Snapshot file to compare with,");
+	print_opt("", "or 'now' for the current state");
+
+	printf("\nOptions:\n");
+	help_fields();
+	table_tbl_print_term(HPRE, all_clms_diff, trm, ctx);
+	printf("\n%sDefault: ", HPRE);
+	print_clms_list(def_clms_diff);
+	printf("\n");
+
+	print_opt("{format}", "Output format: csv|json|xml");
+	print_opt("{unit}", "Units to use for size (in binary): B|K|M|G|T|P|E");
+	print_param_descr("noheaders");
+	print_param_descr("help");
+}
+
+static void help_watch(const char *program_name,
+		       const struct param *cmd,
+		       const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nOptions:\n");
+	print_opt("interval", _params_interval.descr);
+	print_opt("count", _params_count.descr);
+	print_param_descr("verbose");
+	print_param_descr("help");
+}
+
+static void help_wait_state(void)
+{
+	print_opt("<state>", "State to wait for, e.g. open, connected");
+	print_opt("", "or disconnected");
+	print_opt("[timeout]", "Seconds to wait at most, fractions allowed");
+
+	printf("\nOptions:\n");
+	print_param_descr("verbose");
+	print_param_descr("help");
+}
+
+static void help_wait(const char *program_name,
+		      const struct param *cmd,
+		      const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("<name>", "Name of an rnbd device, session, or path.");
+	help_wait_state();
+}
+
+static void help_wait_devices(const char *program_name,
+			      const struct param *cmd,
+			      const struct rnbd_ctx *ctx)
+{
+	if (!program_name)
+		program_name = "devices";
+
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("<device>", "Name, path or mapping path of the device");
+	help_wait_state();
+}
+
+static void help_wait_sessions(const char *program_name,
+			       const struct param *cmd,
+			       const struct rnbd_ctx *ctx)
+{
+	if (!program_name)
+		program_name = "sessions";
+
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("<session>", "Session name, a session is connected as long");
+	print_opt("", "as one of its paths is connected");
+	help_wait_state();
+}
+
+static void help_wait_paths(const char *program_name,
+			    const struct param *cmd,
+			    const struct rnbd_ctx *ctx)
+{
+	if (!program_name)
+		program_name = "paths";
+
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("[session]", "Optional session name to select the path");
+	print_opt("<path>", "Name, source or destination address of the path");
+	help_wait_state();
+}
+
+static void help_apply(const char *program_name,
+		       const struct param *cmd,
+		       const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nArguments:\n");
+	print_opt("<file>", "JSON list of the devices to be mapped, - for stdin:");
+	print_opt("", "[{\"session\": <name>, \"host\": <host>,");
+	print_opt("", "  \"device_path\": <path>, \"access_mode\": ro|rw|migration,");
+	print_opt("", "  \"paths\": [\"[src_addr@]dst_addr\", ..]}, ..]");
+	print_opt("", "Devices not listed are unmapped, paths not listed are");
+	print_opt("", "removed from sessions listed with paths.");
+
+	printf("\nOptions:\n");
+	print_opt("jobs", _params_jobs.descr);
+	print_param_descr("force");
+	print_param_descr("verbose");
+	print_param_descr("help");
+}
+
+static void help_daemon(const char *program_name,
+			const struct param *cmd,
+			const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nWhile the daemon listens on %s, rnbd sends it\n",
+	       RNBD_DAEMON_SOCK);
+	printf("all commands but watch and wait. It can be started as rnbdd.\n");
+
+	printf("\nOptions:\n");
+	print_param_descr("verbose");
+	print_param_descr("help");
+}
+
+static void help_publish(const char *program_name,
+			 const struct param *cmd,
+			 const struct rnbd_ctx *ctx)
+{
+	cmd_print_usage_descr(cmd, program_name, ctx);
+
+	printf("\nThe snapshot in %s is read by calls with --from-shm\n",
+	       RNBD_SHM_PATH);
+	printf("without reading sysfs. It is kept after publishing stopped.\n");
+
+	printf("\nOptions:\n");
+	print_opt("interval", _params_interval.descr);
+	print_opt("count", _params_count.descr);
+	print_param_descr("verbose");
+	print_param_descr("help");
+}
+
+static struct param _cmd_dump_all =
+	{TOK_DUMP, "dump",
+		"Dump information about all",
+		"",
+		"Dump information about all rnbd objects.",
+		NULL, NULL, help_dump_all};
+static struct param _cmd_list_devices =
+	{TOK_LIST, "list",
+		"List information on all",
+		"s",
+		"List information on devices.",
+		NULL, NULL, help_list_devices};
+static struct param _cmd_list_sessions =
+	{TOK_LIST, "list",
+		"List information on all",
+		"s",
+		"List information on sessions.",
+		NULL, NULL, help_list_sessions};
+static struct param _cmd_list_paths =
+	{TOK_LIST, "list",
+		"List information on all",
+		"s",
+		"List information on paths.",
+		NULL, NULL, help_list_paths};
+static struct param _cmd_show =
+	{TOK_SHOW, "show",
+		"Show information about the object that is designated by <name>",
+		"",
+		"Show information about an rnbd device, session, or path.",
+	 "<name>",
+		NULL, help_show};
+static struct param _cmd_show_devices =
+	{TOK_SHOW, "show",
+		"Show information about a",
+		"",
+		"Show information about an rnbd block device.",
+		"<device>",
+		NULL, help_show_devices};
+static struct param _cmd_show_sessions =
+	{TOK_SHOW, "show",
+		"Show information about a",
+		"",
+		"Show information about an rnbd session.",
+		"<session>",
+		NULL, help_show_sessions};
+static struct param _cmd_show_paths =
+	{TOK_SHOW, "show",
+		"Show information about a",
+		"",
+		"Show information about an rnbd transport path.",
+		"[session] <path>",
+		NULL, help_show_paths};
+static struct param _cmd_map =
+	{TOK_MAP, "map",
+		"Map a",
+		" from a given server",
+		"Map a device from a given server",
+		"<device> from <server>",
+		 NULL, help_map};
+static struct param _cmd_resize =
+	{TOK_RESIZE, "resize",
+		"Resize a mapped",
+		"",
+		"Change size of a mapped device",
+		"<device> <size>",
+		 NULL, help_resize};
+static struct param _cmd_unmap =
+	{TOK_UNMAP, "unmap",
+		"Unmap an imported",
+		"",
+		"Unmap a given imported device",
+		"<device>",
+		NULL, help_unmap};
+static struct param _cmd_remap =
+	{TOK_REMAP, "remap",
+		"Remap a",
+		"",
+		"Remap an imported device",
+		"<device>",
+		 NULL, help_remap};
+static struct param _cmd_remap_device_or_session =
+	{TOK_REMAP, "remap",
+		"Remap a",
+		"",
+		"Remap a devices or all devices of a given session",
+		"<device|session>",
+		 NULL, help_remap_device_or_session};
+static struct param _cmd_remap_session =
+	{TOK_REMAP, "remap",
+		"Remap all devicess on a",
+		"",
+		"Remap all devices of a given session",
+		"<session>",
+		 NULL, help_remap_session};
+static struct param _cmd_close_device =
+	{TOK_CLOSE, "close",
+		"Close a",
+		" for a session",
+		"Close a particular device for a given session",
+		"<device>",
+		 NULL, help_close_device};
+static struct param _cmd_client_recover_device =
+	{TOK_RECOVER, "recover",
+		"Recover a",
+		"",
+		"Recover a device: recover a device when it is not open.",
+		"<device>|all",
+		 NULL, help_recover_device};
+static struct param _cmd_recover_device_session_or_path =
+	{TOK_RECOVER, "recover",
+		"Recover a",
+		"",
+		"Recover a device, session, or path.",
+		"<device>|<session>|<path>|all",
+		 NULL, help_recover_device_session_or_path};
+static struct param _cmd_disconnect_session =
+	{TOK_DISCONNECT, "disconnect",
+		"Disconnect a",
+		"",
+		"Disconnect all paths on a given session",
+		"<session>",
+		NULL, help_disconnect_session};
+static struct param _cmd_dis_session =
+	{TOK_DISCONNECT, "dis",
+		"Disconnect a",
+		"",
+		"Disconnect all paths on a given session",
+		"<session>",
+		NULL, help_disconnect_session};
+static struct param _cmd_disconnect_path =
+	{TOK_DISCONNECT, "disconnect",
+		"Disconnect a",
+		"",
+		"Disconnect a path of a given session",
+		"[session] <path>",
+		NULL, help_disconnect_path};
+static struct param _cmd_dis_path =
+	{TOK_DISCONNECT, "dis",
+		"Disconnect a",
+		"",
+		"Disconnect a path of a given session",
+		"[session] <path>",
+		NULL, help_disconnect_path};
+static struct param _cmd_reconnect_session =
+	{TOK_RECONNECT, "reconnect",
+		"Reconnect a",
+		"",
+		"Disconnect and connect again a whole session",
+		"<session>",
+		 NULL, help_reconnect_session};
+static struct param _cmd_recover_session =
+	{TOK_RECOVER, "recover",
+		"Recover a",
+		"",
+		"Recover a session: reconnect disconnected paths.",
+		"<session>|all [add-missing]",
+		 NULL, help_recover_session};
+static struct param _cmd_reconnect_path =
+	{TOK_RECONNECT, "reconnect",
+		"Reconnect a",
+		"",
+		"Disconnect and connect again a single path of a session",
+		"[session] <path>",
+		 NULL, help_reconnect_path};
+static struct param _cmd_recover_path =
+	{TOK_RECOVER, "recover",
+		"Recover a",
+		"",
+		"Recover a path: reconnect if not in connected state.",
+		"[session] <path>|all",
+		 NULL, help_recover_path};
+static struct param _cmd_add =
+	{TOK_ADD, "add",
+		"Add a",
+		" to an existing session",
+		"Add a new path to an existing session",
+		"<session> <path>",
+		 NULL, help_addpath};
+static struct param _cmd_delete =
+	{TOK_DELETE, "delete",
+		"Delete a",
+		"",
+		"Delete a given path from the corresponding session",
+		"[session] <path>",
+		 NULL, help_delpath};
+static struct param _cmd_del =
+	{TOK_DELETE, "del",
+		"Delete a",
+		"",
+		"Delete a given path from the corresponding session",
+		"[session] <path>",
+		 NULL, help_delpath};
+static struct param _cmd_readd =
+	{TOK_READD, "readd",
+		"Readd a",
+		"",
+		"Delete and add again a given path to the corresponding session",
+		"[session] <path>",
+		 NULL, help_delpath};
+static struct param _cmd_snapshot =
+	{TOK_SNAPSHOT, "snapshot",
+		"Save a snapshot of all",
+		"",
+		"Save devices, sessions, paths and their counters to a file.",
+		"<file>",
+		 NULL, help_snapshot};
+static struct param _cmd_diff =
+	{TOK_DIFF, "diff",
+		"Compare two snapshots of all",
+		"",
+		"Show objects which appeared, disappeared or changed between two snapshots.",
+		"<old> <new>",
+		 NULL, help_diff};
+static struct param _cmd_watch =
+	{TOK_WATCH, "watch",
+		"Watch state changes of all",
+		"",
+		"Print a JSON line for every change of devices, sessions and paths.",
+		NULL,
+		 NULL, help_watch};
+static struct param _cmd_wait =
+	{TOK_WAIT, "wait",
+		"Wait for the state of",
+		"",
+		"Wait until an rnbd device, session, or path is in the given state.",
+		"<name> <state> [timeout]",
+		 NULL, help_wait};
+static struct param _cmd_wait_devices =
+	{TOK_WAIT, "wait",
+		"Wait for the state of a",
+		"",
+		"Wait until an rnbd device is in the given state.",
+		"<device> <state> [timeout]",
+		 NULL, help_wait_devices};
+static struct param _cmd_wait_sessions =
+	{TOK_WAIT, "wait",
+		"Wait for the state of a",
+		"",
+		"Wait until an rnbd session is connected or disconnected.",
+		"<session> <state> [timeout]",
+		 NULL, help_wait_sessions};
+static struct param _cmd_wait_paths =
+	{TOK_WAIT, "wait",
+		"Wait for the state of a",
+		"",
+		"Wait until an rnbd transport path is in the given state.",
+		"[session] <path> <state> [timeout]",
+		 NULL, help_wait_paths};
+static struct param _cmd_apply =
+	{TOK_APPLY, "apply",
+		"Apply a list of desired mappings to",
+		"",
+		"Map, unmap and change the paths of rnbd devices to match a list.",
+		"<file>",
+		 NULL, help_apply};
+static struct param _cmd_daemon =
+	{TOK_DAEMON, "daemon",
+		"Serve commands for all",
+		"",
+		"Keep the rnbd objects in memory and run the commands of rnbd calls on them.",
+		NULL,
+		 NULL, help_daemon};
+static struct param _cmd_publish =
+	{TOK_PUBLISH, "publish",
+		"Publish a snapshot of all",
+		"",
+		"Write a snapshot of all rnbd objects to shared memory every interval.",
+		NULL,
+		 NULL, help_publish};
+static struct param _cmd_help =
+	{TOK_HELP, "help",
+		"Display help on",
+		"s",
+		"Display help message and exit.",
+		NULL, NULL, help_object};
+static struct param _cmd_null =
+		{ 0 };
+
+static struct param *params_flags[] = {
+	&_params_minus_minus_help,
+	&_params_minus_h,
+	&_params_minus_minus_verbose,
+	&_params_minus_v,
+	&_params_minus_minus_debug,
+	&_params_minus_d,
+	&_params_minus_minus_simulate,
+	&_params_minus_s,
+	&_params_minus_minus_from_shm,
+	&_params_minus_c,
+	&_params_minus_minus_complete,
+	&_params_minus_minus_version,
+	&_params_null
+};
+
+static struct param *params_flags_help[] = {
+	&_params_minus_minus_help,
+	&_params_minus_minus_verbose,
+	&_params_minus_minus_debug,
+	&_params_minus_minus_simulate,
+	&_params_minus_minus_from_shm,
+	&_params_null
+};
+
+static struct param *params_default[] = {
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_apply_parameters[] = {
+	&_params_jobs,
+	&_params_force,
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_daemon_parameters[] = {
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_watch_parameters[] = {
+	&_params_interval,
+	&_params_count,
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_publish_parameters[] = {
+	&_params_interval,
+	&_params_count,
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_mode[] = {
+	&_params_client,
+	&_params_clt,
+	&_params_cli,
+	&_params_server,
+	&_params_serv,
+	&_params_srv,
+	&_params_both,
+	&_params_help,
+	&_params_version,
+	&_params_minus_minus_version,
+	&_params_null
+};
+
+static struct param *params_mode_help[] = {
+	&_params_client,
+	&_params_server,
+	&_params_help,
+	&_params_version,
+	&_params_null
+};
+
+static struct param *params_both[] = {
+	&_params_devices,
+	&_params_device,
+	&_params_devs,
+	&_params_dev,
+	&_params_sessions,
+	&_params_session,
+	&_params_sess,
+	&_params_paths,
+	&_params_path,
+	&_cmd_list_devices,
+	&_cmd_dump_all,
+	&_cmd_show,
+	&_cmd_map,
+	&_cmd_resize,
+	&_cmd_unmap,
+	&_cmd_remap,
+	&_cmd_recover_device_session_or_path,
+	&_cmd_snapshot,
+	&_cmd_diff,
+	&_cmd_watch,
+	&_cmd_wait,
+	&_cmd_apply,
+	&_cmd_daemon,
+	&_cmd_publish,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_both_help[] = {
+	&_params_devices,
+	&_params_sessions,
+	&_params_paths,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_object_type_client[] = {
+	&_params_devices,
+	&_params_device,
+	&_params_devs,
+	&_params_dev,
+	&_params_sessions,
+	&_params_session,
+	&_params_sess,
+	&_params_paths,
+	&_params_path,
+	&_cmd_dump_all,
+	&_cmd_list_devices,
+	&_cmd_show,
+	&_cmd_map,
+	&_cmd_resize,
+	&_cmd_unmap,
+	&_cmd_remap_device_or_session,
+	&_cmd_recover_device_session_or_path,
+	&_cmd_snapshot,
+	&_cmd_diff,
+	&_cmd_watch,
+	&_cmd_wait,
+	&_cmd_apply,
+	&_cmd_daemon,
+	&_cmd_publish,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_object_type_server[] = {
+	&_params_devices,
+	&_params_device,
+	&_params_devs,
+	&_params_dev,
+	&_params_sessions,
+	&_params_session,
+	&_params_sess,
+	&_params_paths,
+	&_params_path,
+	&_cmd_close_device,
+	&_cmd_dump_all,
+	&_cmd_list_devices,
+	&_cmd_show,
+	&_cmd_snapshot,
+	&_cmd_diff,
+	&_cmd_watch,
+	&_cmd_daemon,
+	&_cmd_publish,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_object_type_help_client[] = {
+	&_params_devices_client,
+	&_params_sessions,
+	&_params_paths,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_object_type_help_server[] = {
+	&_params_devices,
+	&_params_sessions,
+	&_params_paths,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_list_parameters[] = {
+	&_params_xml,
+	&_params_cvs,
+	&_params_json,
+	&_params_term,
+	&_params_byte,
+	&_params_kib,
+	&_params_mib,
+	&_params_gib,
+	&_params_tib,
+	&_params_pib,
+	&_params_eib,
+	&_params_notree,
+	&_params_noheaders,
+	&_params_nototals,
+	&_params_noterm,
+	&_params_all,
+	&_params_where,
+	&_params_sort,
+	&_params_limit,
+	&_params_group,
+	&_params_verbose,
+	&_params_help,
+	&_params_null
+};
+
+static struct param *params_fmt_parameters[] = {
+	&_params_xml,
+	&_params_cvs,
+	&_params_json,
+	&_params_term,
+	&_params_null
+};
+
+static struct param *params_map_parameters[] = {
+	&_params_from,
+	&_params_ro,
+	&_params_rw,
+	&_params_migration,
+	&_params_wait,
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+/* help when somthing is given after from <host> that can not be parsed */
+static struct param *params_map_parameters_help_tail[] = {
+	&_params_path_param_ip,
+	&_params_path_param_gid,
+	&_params_ro,
+	&_params_rw,
+	&_params_migration,
+	&_params_wait,
+	&_params_help,
+	&_params_verbose,
+	&_params_null
+};
+
+static struct param *params_unmap_parameters[] = {
+	&_params_help,
+	&_params_force,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_select_parameters[] = {
+	&_params_help,
+	&_params_force,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_sel_session,
+	&_params_where,
+	&_params_jobs,
+	&_params_null
+};
+
+static struct param *params_resize_parameters[] = {
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_sel_session,
+	&_params_where,
+	&_params_jobs,
+	&_params_null
+};
+
+static struct param *params_add_path_parameters[] = {
+	&_params_help,
+	&_params_path_param,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_null
+};
+
+static struct param *params_recover_session_parameters[] = {
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_recover_add_missing,
+	&_params_null
+};
+
+static struct param *params_recover_session_parameters_help[] = {
+	&_params_help,
+	&_params_verbose,
+	&_params_minus_v,
+	&_params_all_recover,
+	&_params_recover_add_missing,
+	&_params_null
+};
+
+static struct param *params_add_path_help[] = {
+	&_params_help,
+	&_params_path_param,
+	&_params_verbose,
+	&_params_null
+};
+
+static struct param *cmds_client_sessions[] = {
+	&_cmd_list_sessions,
+	&_cmd_show_sessions,
+	&_cmd_reconnect_session,
+	&_cmd_recover_session,
+	&_cmd_remap_session,
+	&_cmd_wait_sessions,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_client_sessions_help[] = {
+	&_cmd_list_sessions,
+	&_cmd_show_sessions,
+	&_cmd_reconnect_session,
+	&_cmd_recover_session,
+	&_cmd_remap_session,
+	&_cmd_wait_sessions,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_client_devices[] = {
+	&_cmd_list_devices,
+	&_cmd_show_devices,
+	&_cmd_map,
+	&_cmd_resize,
+	&_cmd_unmap,
+	&_cmd_remap,
+	&_cmd_client_recover_device,
+	&_cmd_wait_devices,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_client_paths[] = {
+	&_cmd_list_paths,
+	&_cmd_show_paths,
+	&_cmd_disconnect_path,
+	&_cmd_dis_path,
+	&_cmd_reconnect_path,
+	&_cmd_recover_path,
+	&_cmd_add,
+	&_cmd_delete,
+	&_cmd_del,
+	&_cmd_readd,
+	&_cmd_wait_paths,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_client_paths_help[] = {
+	&_cmd_list_paths,
+	&_cmd_show_paths,
+	&_cmd_disconnect_path,
+	&_cmd_reconnect_path,
+	&_cmd_recover_path,
+	&_cmd_add,
+	&_cmd_delete,
+	&_cmd_readd,
+	&_cmd_wait_paths,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_server_sessions[] = {
+	&_cmd_list_sessions,
+	&_cmd_show_sessions,
+	&_cmd_disconnect_session,
+	&_cmd_dis_session,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_server_sessions_help[] = {
+	&_cmd_list_sessions,
+	&_cmd_show_sessions,
+	&_cmd_disconnect_session,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_server_devices[] = {
+	&_cmd_list_devices,
+	&_cmd_show_devices,
+	&_cmd_close_device,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_server_paths[] = {
+	&_cmd_list_paths,
+	&_cmd_show_paths,
+	&_cmd_disconnect_path,
+	&_cmd_dis_path,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_server_paths_help[] = {
+	&_cmd_list_paths,
+	&_cmd_show_paths,
+	&_cmd_disconnect_path,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_both_sessions[] = {
+	&_cmd_list_sessions,
+	&_cmd_show_sessions,
+	&_cmd_remap_session,
+	&_cmd_disconnect_session,
+	&_cmd_dis_session,
+	&_cmd_reconnect_session,
+	&_cmd_recover_session,
+	&_cmd_wait_sessions,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_both_sessions_help[] = {
+	&_cmd_list_sessions,
+	&_cmd_show_sessions,
+	&_cmd_remap_session,
+	&_cmd_recover_session,
+	&_cmd_wait_sessions,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_both_paths[] = {
+	&_cmd_list_paths,
+	&_cmd_show_paths,
+	&_cmd_disconnect_session,
+	&_cmd_dis_session,
+	&_cmd_reconnect_session,
+	&_cmd_add,
+	&_cmd_delete,
+	&_cmd_del,
+	&_cmd_readd,
+	&_cmd_wait_paths,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static struct param *cmds_both_paths_help[] = {
+	&_cmd_list_paths,
+	&_cmd_show_paths,
+	&_cmd_add,
+	&_cmd_delete,
+	&_cmd_readd,
+	&_cmd_wait_paths,
+	&_cmd_help,
+	&_cmd_null
+};
+
+static int levenstein_compare(int d1, int d2, const char *s1, const char *s2)
+{
+	return d1 != d2 ? d1 - d2 : strcmp(s1, s2);
+}
+
+static int param_compare(const void *p1, const void *p2)
+{
+	const struct param *const*c1 = p1;
+	const struct param *const*c2 = p2;
+
+	return levenstein_compare((*c1)->dist, (*c2)->dist,
+				  (*c1)->param_str, (*c2)->param_str);
+}
+
+static void handle_unknown_param(const char *param, struct param *params[])
+{
+	struct param **cs;
+	size_t len = 0, cnt = 0, i;
+
+	ERR(trm, "Unknown '%s'\n", param);
+
+	for (cs = params; (*cs)->param_str; cs++) {
+		(*cs)->dist = levenshtein((*cs)->param_str, param, 1, 2, 1, 0)
+				+ 1;
+		if (strlen((*cs)->param_str) < 2)
+			(*cs)->dist += 3;
+		len++;
+		if ((*cs)->dist < 4)
+			cnt++;
+	}
+
+	if (!cnt || cnt == len) {
+
+		if (len > 7)
+			return;
+
+		cnt = len;
+	} else {
+
+		qsort(params, len, sizeof(*params), param_compare);
+	}
+	printf("Did you mean:\n");
+	if (cnt > 3)
+		cnt = 3;
+
+	for (i = 0; i < cnt; i++)
+		printf("\t%s\n", params[i]->param_str);
+}
+
+static int parse_precision(const char *str,
+			   struct rnbd_ctx *ctx)
+{
+	unsigned int prec;
+	char e;
+
+	if (strncmp(str, "prec", 4))
+		return -EINVAL;
+
+	if (str[4] == '=')
+		str += 5;
+	else
+		str += 4;
+	if (sscanf(str, "%u%c\n", &prec, &e) != 2)
+		return -EINVAL;
+
+	ctx->prec = prec;
+	ctx->prec_set = true;
+
+	return 0;
+}
+
+static const char *comma = ",";
+
+static int parse_clt_devices_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_devices_clt,
+				    ctx->clms_devices_clt, CLM_MAX_CNT);
+}
+
+static int parse_srv_devices_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_devices_srv,
+				    ctx->clms_devices_srv, CLM_MAX_CNT);
+}
+
+static int parse_clt_sessions_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_sessions_clt,
+				    ctx->clms_sessions_clt, CLM_MAX_CNT);
+}
+
+static int parse_srv_sessions_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_sessions_srv,
+				    ctx->clms_sessions_srv, CLM_MAX_CNT);
+}
+
+static int parse_both_sessions_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	int tmp_err, err;
+
+	err = table_extend_columns(arg, comma, all_clms_sessions_clt,
+				   ctx->clms_sessions_clt, CLM_MAX_CNT);
+	tmp_err = table_extend_columns(arg, comma, all_clms_sessions_srv,
+				       ctx->clms_sessions_srv, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	/* if any of the parse commands succeed return success */
+	return err;
+}
+
+static int parse_clt_paths_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_paths_clt,
+				    ctx->clms_paths_clt, CLM_MAX_CNT);
+}
+
+static int parse_srv_paths_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_paths_srv,
+				    ctx->clms_paths_srv, CLM_MAX_CNT);
+}
+
+static int parse_both_paths_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	int tmp_err, err;
+
+	err = table_extend_columns(arg, comma, all_clms_paths_clt,
+				   ctx->clms_paths_clt, CLM_MAX_CNT);
+	tmp_err = table_extend_columns(arg, comma, all_clms_paths_srv,
+				       ctx->clms_paths_srv, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	/* if any of the parse commands succeed return success */
+	return err;
+}
+
+static int parse_clt_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	int tmp_err, err;
+
+	err = table_extend_columns(arg, comma, all_clms_devices_clt,
+				   ctx->clms_devices_clt, CLM_MAX_CNT);
+	tmp_err = table_extend_columns(arg, comma, all_clms_sessions_clt,
+				       ctx->clms_sessions_clt, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	tmp_err = table_extend_columns(arg, comma, all_clms_paths_clt,
+				       ctx->clms_paths_clt, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	/* if any of the parse commands succeed return success */
+	return err;
+}
+
+static int parse_srv_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	int tmp_err, err;
+
+	err = table_extend_columns(arg, comma, all_clms_devices_srv,
+				   ctx->clms_devices_srv, CLM_MAX_CNT);
+	tmp_err = table_extend_columns(arg, comma, all_clms_sessions_srv,
+				       ctx->clms_sessions_srv, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	tmp_err = table_extend_columns(arg, comma, all_clms_paths_srv,
+				       ctx->clms_paths_srv, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	/* if any of the parse commands succeed return success */
+	return err;
+}
+
+static int parse_both_devices_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	int tmp_err, err;
+
+	err = table_extend_columns(arg, comma, all_clms_devices_clt,
+				    ctx->clms_devices_clt, CLM_MAX_CNT);
+	tmp_err = table_extend_columns(arg, comma, all_clms_devices_srv,
+				    ctx->clms_devices_srv, CLM_MAX_CNT);
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	/* if any of the parse commands succeed return success */
+	return err;
+}
+
+static int parse_diff_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	return table_extend_columns(arg, comma, all_clms_diff,
+				    ctx->clms_diff, CLM_MAX_CNT);
+}
+
+static int parse_both_clms(const char *arg, struct rnbd_ctx *ctx)
+{
+	int tmp_err, err;
+
+	err =  parse_clt_clms(arg, ctx);
+	tmp_err = parse_srv_clms(arg, ctx);
+
+	if (!tmp_err && err)
+		err = tmp_err;
+
+	/* if any of the parse commands succeed return success */
+	return err;
+}
+
+static int parse_sign(char s,
+		      struct rnbd_ctx *ctx)
+{
+	if (s == '+')
+		ctx->sign = 1;
+	else if (s == '-')
+		ctx->sign = -1;
+	else
+		ctx->sign = 0;
+
+	return ctx->sign;
+}
+
+static int parse_size(const char *str,
+		      struct rnbd_ctx *ctx)
+{
+	if (parse_sign(*str, ctx))
+		str++;
+
+	return str_to_size(str, ctx);
+}
+
+static void init_rnbd_ctx(struct rnbd_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(struct rnbd_ctx));
+
+	list_default(ctx);
+
+	trm = (isatty(STDOUT_FILENO) == 1);
+}
 
-static struct param *params_object_type_client[] = {
-	&_params_devices,
-	&_params_device,
-	&_params_devs,
-	&_params_dev,
-	&_params_sessions,
-	&_params_session,
-	&_params_sess,
-	&_params_paths,
-	&_params_path,
-	&_cmd_dump_all,
-	&_cmd_list_devices,
-	&_cmd_show,
-	&_cmd_map,
-	&_cmd_resize,
-	&_cmd_unmap,
-	&_cmd_remap_device_or_session,
-	&_cmd_recover_device_session_or_path,
-	&_params_help,
-	&_params_null
-};
+static void deinit_rnbd_ctx(struct rnbd_ctx *ctx)
+{
+	int i;
 
-static struct param *params_object_type_server[] = {
-	&_params_devices,
-	&_params_device,
-	&_params_devs,
-	&_params_dev,
-	&_params_sessions,
-	&_params_session,
-	&_params_sess,
-	&_params_paths,
-	&_params_path,
-	&_cmd_close_device,
-	&_cmd_dump_all,
-	&_cmd_list_devices,
-	&_cmd_show,
-	&_params_help,
-	&_params_null
-};
+	for (i = 0; i < ctx->path_cnt; i++) {
+		if (ctx->paths[i].src)
+			free((char *)ctx->paths[i].src);
+		if (ctx->paths[i].dst)
+			free((char *)ctx->paths[i].dst);
+		if (ctx->paths[i].provided)
+			free((char *)ctx->paths[i].provided);
+	}
+}
 
-static struct param *params_object_type_help_client[] = {
-	&_params_devices_client,
-	&_params_sessions,
-	&_params_paths,
-	&_params_help,
-	&_params_null
-};
+static void rnbd_ctx_default(struct rnbd_ctx *ctx)
+{
+	struct rnbd_snapshot *snap = ctx->snap;
 
-static struct param *params_object_type_help_server[] = {
-	&_params_devices,
-	&_params_sessions,
-	&_params_paths,
-	&_params_help,
-	&_params_null
-};
+	if (!ctx->lstmode_set)
+		ctx->lstmode = LST_DEVICES;
 
-static struct param *params_list_parameters[] = {
-	&_params_xml,
-	&_params_cvs,
-	&_params_json,
-	&_params_term,
-	&_params_byte,
-	&_params_kib,
-	&_params_mib,
-	&_params_gib,
-	&_params_tib,
-	&_params_pib,
-	&_params_eib,
-	&_params_notree,
-	&_params_noheaders,
-	&_params_nototals,
-	&_params_noterm,
-	&_params_all,
-	&_params_verbose,
-	&_params_help,
-	&_params_null
-};
+	if (!ctx->fmt_set)
+		ctx->fmt = FMT_TERM;
 
-static struct param *params_fmt_parameters[] = {
-	&_params_xml,
-	&_params_cvs,
-	&_params_json,
-	&_params_term,
-	&_params_null
-};
+	if (!ctx->prec_set)
+		ctx->prec = 3;
 
-static struct param *params_map_parameters[] = {
-	&_params_from,
-	&_params_ro,
-	&_params_rw,
-	&_params_migration,
-	&_params_help,
-	&_params_verbose,
-	&_params_minus_v,
-	&_params_null
-};
+	if (!ctx->rnbdmode_set && snap->sess_clt) {
+		if (snap->sess_clt[0])
+			ctx->rnbdmode |= RNBD_CLIENT;
+		if (snap->sess_srv[0])
+			ctx->rnbdmode |= RNBD_SERVER;
+	}
+}
 
-/* help when somthing is given after from <host> that can not be parsed */
-static struct param *params_map_parameters_help_tail[] = {
-	&_params_path_param_ip,
-	&_params_path_param_gid,
-	&_params_ro,
-	&_params_rw,
-	&_params_migration,
-	&_params_help,
-	&_params_verbose,
-	&_params_null
-};
+static void help_mode(const char *mode, struct param *const params[],
+		      const struct rnbd_ctx *ctx)
+{
+	char buff[PATH_MAX];
 
-static struct param *params_unmap_parameters[] = {
-	&_params_help,
-	&_params_force,
-	&_params_verbose,
-	&_params_minus_v,
-	&_params_null
-};
+	if (ctx->pname_with_mode) {
 
-static struct param *params_add_path_parameters[] = {
-	&_params_help,
-	&_params_path_param,
-	&_params_verbose,
-	&_params_minus_v,
-	&_params_null
-};
+		help_param(ctx->pname, params, ctx);
+	} else {
 
-static struct param *params_recover_session_parameters[] = {
-	&_params_help,
-	&_params_verbose,
-	&_params_minus_v,
-	&_params_recover_add_missing,
-	&_params_null
-};
+		snprintf(buff, sizeof(buff), "%s %s", ctx->pname, mode);
+		help_param(buff, params, ctx);
+	}
+}
 
-static struct param *params_recover_session_parameters_help[] = {
-	&_params_help,
-	&_params_verbose,
-	&_params_minus_v,
-	&_params_all_recover,
-	&_params_recover_add_missing,
-	&_params_null
-};
+static void help_start(const struct rnbd_ctx *ctx)
+{
+	if (help_print_flags(ctx)) {
+		help_param(ctx->pname, params_flags_help, ctx);
+		printf("\n\n");
+	}
 
-static struct param *params_add_path_help[] = {
-	&_params_help,
-	&_params_path_param,
-	&_params_verbose,
-	&_params_null
-};
+	help_param(ctx->pname, params_mode_help, ctx);
+}
 
-static struct param *cmds_client_sessions[] = {
-	&_cmd_list_sessions,
-	&_cmd_show_sessions,
-	&_cmd_reconnect_session,
-	&_cmd_recover_session,
-	&_cmd_remap_session,
-	&_cmd_help,
-	&_cmd_null
-};
+static int init_show(enum rnbdmode rnbdmode,
+		     enum lstmode object_type,
+		     struct rnbd_ctx *ctx)
+{
+	(void) parse_all(0, NULL, NULL, ctx);
+	switch (object_type) {
+	case LST_PATHS:
+	case LST_ALL:
+		if (rnbdmode & RNBD_CLIENT) {
+			parse_clt_paths_clms("-src_addr", ctx);
+			parse_clt_paths_clms("-dst_addr", ctx);
+		}
+		if (rnbdmode & RNBD_SERVER) {
+			parse_srv_paths_clms("-src_addr", ctx);
+			parse_srv_paths_clms("-dst_addr", ctx);
+		}
+		break;
+	default:
+		;
+	}
+	return 0;
+}
+
+/**
+ * Parse all the possible parameters to list or show commands.
+ * The results are collected in the rnbd_ctx struct
+ *
+ *  Assumtions:
+ * * all types  accept the same parameters (except for collums)
+ * * it is always the end of a command line, so a left over argument
+ *   that can not be interpreded is an error
+ *
+ * Returns:
+ * > 0 number of arguments accepted
+ * < 0 error code
+ * == 0 there are no arguments to the list command
+ */
+int parse_list_parameters(int argc, const char *argv[], struct rnbd_ctx *ctx,
+		int (*parse_clms)(const char *arg, struct rnbd_ctx *ctx),
+			  const struct param *cmd, const char *program_name, int allow_paths)
+{
+	int err = 0; int start_argc = argc;
+	const struct param *param;
+
+	while (argc && err >= 0) {
+		/* parse the list flags */
+		param = find_param(*argv, params_list_parameters);
+		if (param) {
+			err = param->parse(argc, argv, param, ctx);
+			if (err < 0)
+				return err;
+			if (err > 0) {
+				argc -= err; argv += err;
+				continue;
+			}
+		}
+		/* parse collumn parameters */
+		err = (*parse_clms)(*argv, ctx);
+		if (err == 0) {
 
-static struct param *cmds_client_sessions_help[] = {
-	&_cmd_list_sessions,
-	&_cmd_show_sessions,
-	&_cmd_reconnect_session,
-	&_cmd_recover_session,
-	&_cmd_remap_session,
-	&_cmd_help,
-	&_cmd_null
-};
+			argc--; argv++;
+			continue;
+		}
+		if (err == -EINVAL) {
 
-static struct param *cmds_client_devices[] = {
-	&_cmd_list_devices,
-	&_cmd_show_devices,
-	&_cmd_map,
-	&_cmd_resize,
-	&_cmd_unmap,
-	&_cmd_remap,
-	&_cmd_client_recover_device,
-	&_cmd_help,
-	&_cmd_null
-};
+			err = parse_precision(*argv, ctx);
+			if (err == 0) {
+				argc--; argv++;
+				continue;
+			}
+		}
+		if (err == -EINVAL && allow_paths)
+			err = parse_path(*argv, ctx);
 
-static struct param *cmds_client_paths[] = {
-	&_cmd_list_paths,
-	&_cmd_show_paths,
-	&_cmd_disconnect_path,
-	&_cmd_dis_path,
-	&_cmd_reconnect_path,
-	&_cmd_recover_path,
-	&_cmd_add,
-	&_cmd_delete,
-	&_cmd_del,
-	&_cmd_readd,
-	&_cmd_help,
-	&_cmd_null
-};
+		if (err == 0) {
+			argc--; argv++;
+			continue;
+		}
+		if (err == -EINVAL && allow_paths)
+			err = parse_port_desc(*argv, ctx);
 
-static struct param *cmds_client_paths_help[] = {
-	&_cmd_list_paths,
-	&_cmd_show_paths,
-	&_cmd_disconnect_path,
-	&_cmd_reconnect_path,
-	&_cmd_recover_path,
-	&_cmd_add,
-	&_cmd_delete,
-	&_cmd_readd,
-	&_cmd_help,
-	&_cmd_null
-};
+		if (err == 0) {
+			argc--; argv++;
+		}
+	}
+	if (ctx->help_set) {
+		cmd->help(program_name, cmd, ctx);
+		err = -EAGAIN;
+	} else if (err == -EINVAL) {
+		handle_unknown_param(*argv, params_list_parameters);
+	}
+	return err < 0 ? err : start_argc - argc;
+}
 
-static struct param *cmds_server_sessions[] = {
-	&_cmd_list_sessions,
-	&_cmd_show_sessions,
-	&_cmd_disconnect_session,
-	&_cmd_dis_session,
-	&_cmd_help,
-	&_cmd_null
-};
+/**
+ * Parse parameters for a command as described by cmd.
+ */
+int parse_cmd_parameters(int argc, const char *argv[],
+			 struct param *const params[], struct rnbd_ctx *ctx,
+			 const struct param *cmd, const char *program_name,
+			 int allow_option_name)
+{
+	int err = 0; int start_argc = argc;
+	const struct param *param;
 
-static struct param *cmds_server_sessions_help[] = {
-	&_cmd_list_sessions,
-	&_cmd_show_sessions,
-	&_cmd_disconnect_session,
-	&_cmd_help,
-	&_cmd_null
-};
+	while (argc && err >= 0) {
+		param = find_param(*argv, params);
+		if (param)
+			err = param->parse(argc, argv, param, ctx);
+		if (!param || err <= 0) {
+			if (allow_option_name
+			    && parse_option_name(argc, argv, cmd, ctx)) {
+				err = 1;
+			} else {
+				break;
+			}
+		}
+		argc -= err; argv += err;
+	}
+	if (ctx->help_set && cmd) {
+		cmd->help(program_name, cmd, ctx);
+		err = -EAGAIN;
+	}
+	return err < 0 ? err : start_argc - argc;
+}
 
-static struct param *cmds_server_devices[] = {
-	&_cmd_list_devices,
-	&_cmd_show_devices,
-	&_cmd_close_device,
-	&_cmd_help,
-	&_cmd_null
-};
+int parse_all_parameters(int argc, const char *argv[],
+			 struct param *const params[], struct rnbd_ctx *ctx,
+			 const struct param *cmd, const char *program_name)
+{
+	int err = 0;
+	const struct param *param;
 
-static struct param *cmds_server_paths[] = {
-	&_cmd_list_paths,
-	&_cmd_show_paths,
-	&_cmd_disconnect_path,
-	&_cmd_dis_path,
-	&_cmd_help,
-	&_cmd_null
-};
+	while (argc && err >= 0) {
+		param = find_param(*argv, params);
+		if (param)
+			err = param->parse(argc, argv, param, ctx);
+		else
+			err = 1; /* skip unknown parameter */
 
-static struct param *cmds_server_paths_help[] = {
-	&_cmd_list_paths,
-	&_cmd_show_paths,
-	&_cmd_disconnect_path,
-	&_cmd_help,
-	&_cmd_null
-};
+		argc -= err; argv += err;
+	}
+	return err;
+}
 
-static struct param *cmds_both_sessions[] = {
-	&_cmd_list_sessions,
-	&_cmd_show_sessions,
-	&_cmd_remap_session,
-	&_cmd_disconnect_session,
-	&_cmd_dis_session,
-	&_cmd_reconnect_session,
-	&_cmd_recover_session,
-	&_cmd_help,
-	&_cmd_null
-};
+/**
+ * Parse parameters for the map command as described by cmd.
+ */
+int parse_map_parameters(int argc, const char *argv[], int *accepted,
+			 struct param *const params[], struct rnbd_ctx *ctx,
+			 const struct param *cmd, const char *program_name,
+			 int allow_port_desc)
+{
+	int err = 0; int start_argc = argc;
+	const struct param *param;
 
-static struct param *cmds_both_sessions_help[] = {
-	&_cmd_list_sessions,
-	&_cmd_show_sessions,
-	&_cmd_remap_session,
-	&_cmd_recover_session,
-	&_cmd_help,
-	&_cmd_null
-};
+	while (argc && err >= 0) {
+		param = find_param(*argv, params);
+		if (param) {
+			err = param->parse(argc, argv, param, ctx);
+		} else {
+			err = parse_path(*argv, ctx);
+			if (err == 0) {
+				err = 1;
+			} else if (allow_port_desc) {
+				err = parse_port_desc(*argv, ctx);
+				if (err == 0)
+					err = 1;
+			}
+		}
+		if (err <= 0)
+			break;
 
-static struct param *cmds_both_paths[] = {
-	&_cmd_list_paths,
-	&_cmd_show_paths,
-	&_cmd_disconnect_session,
-	&_cmd_dis_session,
-	&_cmd_reconnect_session,
-	&_cmd_add,
-	&_cmd_delete,
-	&_cmd_del,
-	&_cmd_readd,
-	&_cmd_help,
-	&_cmd_null
-};
+		argc -= err; argv += err;
+	}
+	if (ctx->help_set) {
+		cmd->help(program_name, cmd, ctx);
+		err = -EAGAIN;
+	}
+	*accepted = start_argc - argc;
+	return err;
+}
 
-static struct param *cmds_both_paths_help[] = {
-	&_cmd_list_paths,
-	&_cmd_show_paths,
-	&_cmd_add,
-	&_cmd_delete,
-	&_cmd_readd,
-	&_cmd_help,
-	&_cmd_null
-};
+int cmd_dump_all(int argc, const char *argv[], const struct param *cmd,
+		 const char *help_context, struct rnbd_ctx *ctx)
 
-static int levenstein_compare(int d1, int d2, const char *s1, const char *s2)
 {
-	return d1 != d2 ? d1 - d2 : strcmp(s1, s2);
-}
+	struct rnbd_snapshot *snap = ctx->snap;
+	int err, tmp_err;
 
-static int param_compare(const void *p1, const void *p2)
-{
-	const struct param *const*c1 = p1;
-	const struct param *const*c2 = p2;
+	err = parse_all_parameters(argc, argv, params_fmt_parameters,
+				   ctx, cmd, "");
+	if (err < 0)
+		return err;
+
+	/* default format for dump is all except when output to terminal */
+	if (ctx->fmt == FMT_TERM) {
+		ctx->notree_set = true;
+		ctx->nototals_set = true;
+	} else	{
+		(void) parse_all(0, NULL, NULL, ctx);
+	}
+	/* parse from beginning again! */
+	err = parse_list_parameters(argc, argv, ctx,
+				    parse_both_clms,
+				    cmd, "", 0);
+	if (err < 0)
+		return err;
 
-	return levenstein_compare((*c1)->dist, (*c2)->dist,
-				  (*c1)->param_str, (*c2)->param_str);
-}
+	ctx->rnbdmode = RNBD_BOTH;
 
-static void handle_unknown_param(const char *param, struct param *params[])
-{
-	struct param **cs;
-	size_t len = 0, cnt = 0, i;
+	err = list_devices(snap->sds_clt, snap->sds_clt_cnt - 1, snap->sds_srv,
+			   snap->sds_srv_cnt - 1, true, ctx);
 
-	ERR(trm, "Unknown '%s'\n", param);
+	if ((snap->sds_clt_cnt - 1 + snap->sds_srv_cnt - 1)
+	    && (snap->sess_clt_cnt - 1 + snap->sess_srv_cnt - 1))
+		printf("\n");
 
-	for (cs = params; (*cs)->param_str; cs++) {
-		(*cs)->dist = levenshtein((*cs)->param_str, param, 1, 2, 1, 0)
-				+ 1;
-		if (strlen((*cs)->param_str) < 2)
-			(*cs)->dist += 3;
-		len++;
-		if ((*cs)->dist < 4)
-			cnt++;
-	}
+	tmp_err = list_sessions(snap->sess_clt, snap->sess_clt_cnt - 1,
+				snap->sess_srv, snap->sess_srv_cnt - 1,
+				true, ctx);
 
-	if (!cnt || cnt == len) {
+	if (!err && tmp_err)
+		err = tmp_err;
 
-		if (len > 7)
-			return;
+	if ((snap->sds_clt_cnt - 1 + snap->sds_srv_cnt - 1
+	     + snap->sess_clt_cnt - 1 + snap->sess_srv_cnt - 1)
+	    && (snap->paths_clt_cnt - 1 + snap->paths_srv_cnt - 1))
+		printf("\n");
 
-		cnt = len;
-	} else {
+	tmp_err = list_paths(snap->paths_clt, snap->paths_clt_cnt - 1,
+			     snap->paths_srv, snap->paths_srv_cnt - 1,
+			     true, ctx);
 
-		qsort(params, len, sizeof(*params), param_compare);
-	}
-	printf("Did you mean:\n");
-	if (cnt > 3)
-		cnt = 3;
+	if (!err && tmp_err)
+		err = tmp_err;
 
-	for (i = 0; i < cnt; i++)
-		printf("\t%s\n", params[i]->param_str);
+	return err;
 }
 
-static int parse_precision(const char *str,
-			   struct rnbd_ctx *ctx)
+int cmd_snapshot(int argc, const char *argv[], const struct param *cmd,
+		 const char *help_context, struct rnbd_ctx *ctx)
 {
-	unsigned int prec;
-	char e;
-
-	if (strncmp(str, "prec", 4))
-		return -EINVAL;
+	int err;
 
-	if (str[4] == '=')
-		str += 5;
-	else
-		str += 4;
-	if (sscanf(str, "%u%c\n", &prec, &e) != 2)
+	if (argc <= 0) {
+		cmd_print_usage_short(cmd, help_context, ctx);
+		ERR(trm, "Please specify the file argument\n");
 		return -EINVAL;
+	}
 
-	ctx->prec = prec;
-	ctx->prec_set = true;
+	err = parse_name_help(argc--, argv++, help_context, cmd, ctx);
+	if (err < 0)
+		return err;
 
-	return 0;
-}
+	err = parse_cmd_parameters(argc, argv, params_default,
+				   ctx, cmd, help_context, 0);
+	if (err < 0)
+		return err;
 
-static const char *comma = ",";
+	argc -= err; argv += err;
 
-static int parse_clt_devices_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	return table_extend_columns(arg, comma, all_clms_devices_clt,
-				    ctx->clms_devices_clt, CLM_MAX_CNT);
-}
+	if (argc > 0) {
+		handle_unknown_param(*argv, params_default);
+		return -EINVAL;
+	}
 
-static int parse_srv_devices_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	return table_extend_columns(arg, comma, all_clms_devices_srv,
-				    ctx->clms_devices_srv, CLM_MAX_CNT);
-}
+	err = rnbd_snapshot_save(ctx->name, ctx->snap);
+	if (err)
+		ERR(trm, "Failed to save snapshot to '%s': %s (%d)\n",
+		    ctx->name, strerror(-err), err);
+	else
+		INF(ctx->verbose_set, "Saved snapshot to '%s'.\n",
+		    ctx->name);
 
-static int parse_clt_sessions_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	return table_extend_columns(arg, comma, all_clms_sessions_clt,
-				    ctx->clms_sessions_clt, CLM_MAX_CNT);
+	return err;
 }
 
-static int parse_srv_sessions_clms(const char *arg, struct rnbd_ctx *ctx)
+/*
+ * Load the snapshot @name into @buf and return it in @snap.
+ * "now" is the snapshot the command runs on.
+ */
+static int load_snapshot(const char *name, struct rnbd_snapshot *buf,
+			 struct rnbd_snapshot **snap,
+			 const struct rnbd_ctx *ctx)
 {
-	return table_extend_columns(arg, comma, all_clms_sessions_srv,
-				    ctx->clms_sessions_srv, CLM_MAX_CNT);
-}
+	int err;
 
-static int parse_both_sessions_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	int tmp_err, err;
+	if (!strcmp(name, "now")) {
+		*snap = ctx->snap;
+		return 0;
+	}
 
-	err = table_extend_columns(arg, comma, all_clms_sessions_clt,
-				   ctx->clms_sessions_clt, CLM_MAX_CNT);
-	tmp_err = table_extend_columns(arg, comma, all_clms_sessions_srv,
-				       ctx->clms_sessions_srv, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	err = rnbd_snapshot_load(name, buf);
+	if (err)
+		ERR(trm, "Failed to load snapshot '%s': %s (%d)\n",
+		    name, strerror(-err), err);
+	else
+		*snap = buf;
 
-	/* if any of the parse commands succeed return success */
 	return err;
 }
 
-static int parse_clt_paths_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	return table_extend_columns(arg, comma, all_clms_paths_clt,
-				    ctx->clms_paths_clt, CLM_MAX_CNT);
-}
-
-static int parse_srv_paths_clms(const char *arg, struct rnbd_ctx *ctx)
+static void put_snapshot(struct rnbd_snapshot *snap,
+			 const struct rnbd_ctx *ctx)
 {
-	return table_extend_columns(arg, comma, all_clms_paths_srv,
-				    ctx->clms_paths_srv, CLM_MAX_CNT);
+	if (snap != ctx->snap)
+		rnbd_snapshot_free(snap);
 }
 
-static int parse_both_paths_clms(const char *arg, struct rnbd_ctx *ctx)
+static int list_diff(struct rnbd_diff *diffs, int cnt, double interval,
+		     struct rnbd_ctx *ctx)
 {
-	int tmp_err, err;
+	int err = 0;
 
-	err = table_extend_columns(arg, comma, all_clms_paths_clt,
-				   ctx->clms_paths_clt, CLM_MAX_CNT);
-	tmp_err = table_extend_columns(arg, comma, all_clms_paths_srv,
-				       ctx->clms_paths_srv, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	switch (ctx->fmt) {
+	case FMT_CSV:
+		list_diff_csv(diffs, cnt, ctx->clms_diff, ctx);
+		break;
+	case FMT_JSON:
+		printf("{\n");
+		printf("\t\"interval\": %.3f,\n", interval);
+		printf("\t\"changes\": ");
+		list_diff_json(diffs, cnt, ctx->clms_diff, ctx);
+		printf("\n}\n");
+		break;
+	case FMT_XML:
+		printf("<changes interval=\"%.3f\">\n", interval);
+		list_diff_xml(diffs, cnt, ctx->clms_diff, ctx);
+		printf("</changes>\n");
+		break;
+	case FMT_TERM:
+	default:
+		err = list_diff_term(diffs, cnt, ctx->clms_diff, ctx);
+		break;
+	}
 
-	/* if any of the parse commands succeed return success */
 	return err;
 }
 
-static int parse_clt_clms(const char *arg, struct rnbd_ctx *ctx)
+/*
+ * Apply where, sort and limit to the @cnt changes @diffs
+ */
+static int select_diffs(struct rnbd_diff **diffs, int *cnt,
+			struct rnbd_ctx *ctx)
 {
-	int tmp_err, err;
+	struct rnbd_diff *res = NULL;
+	void **ptrs, **sel_ptrs = NULL;
+	int sel, i, err = 0;
 
-	err = table_extend_columns(arg, comma, all_clms_devices_clt,
-				   ctx->clms_devices_clt, CLM_MAX_CNT);
-	tmp_err = table_extend_columns(arg, comma, all_clms_sessions_clt,
-				       ctx->clms_sessions_clt, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	sel = select_bind(all_clms_diff, NULL, false, false, ctx);
+	if (sel <= 0)
+		return sel;
 
-	tmp_err = table_extend_columns(arg, comma, all_clms_paths_clt,
-				       ctx->clms_paths_clt, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	ptrs = malloc((*cnt + 1) * sizeof(*ptrs));
+	if (!ptrs)
+		return -ENOMEM;
 
-	/* if any of the parse commands succeed return success */
-	return err;
-}
+	for (i = 0; i < *cnt; i++)
+		ptrs[i] = &(*diffs)[i];
 
-static int parse_srv_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	int tmp_err, err;
+	sel_ptrs = select_objs(ptrs, cnt, sel, ctx);
+	if (sel_ptrs)
+		res = malloc((*cnt + 1) * sizeof(*res));
+	if (!res) {
+		err = -ENOMEM;
+		goto out;
+	}
 
-	err = table_extend_columns(arg, comma, all_clms_devices_srv,
-				   ctx->clms_devices_srv, CLM_MAX_CNT);
-	tmp_err = table_extend_columns(arg, comma, all_clms_sessions_srv,
-				       ctx->clms_sessions_srv, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	for (i = 0; i < *cnt; i++)
+		res[i] = *(struct rnbd_diff *)sel_ptrs[i];
 
-	tmp_err = table_extend_columns(arg, comma, all_clms_paths_srv,
-				       ctx->clms_paths_srv, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	free(*diffs);
+	*diffs = res;
+out:
+	free(sel_ptrs);
+	free(ptrs);
 
-	/* if any of the parse commands succeed return success */
 	return err;
 }
 
-static int parse_both_devices_clms(const char *arg, struct rnbd_ctx *ctx)
+int cmd_diff(int argc, const char *argv[], const struct param *cmd,
+	     const char *help_context, struct rnbd_ctx *ctx)
 {
-	int tmp_err, err;
+	struct rnbd_snapshot old_buf, new_buf, *old, *new;
+	struct rnbd_diff *diffs;
+	const char *old_name;
+	int err, cnt;
 
-	err = table_extend_columns(arg, comma, all_clms_devices_clt,
-				    ctx->clms_devices_clt, CLM_MAX_CNT);
-	tmp_err = table_extend_columns(arg, comma, all_clms_devices_srv,
-				    ctx->clms_devices_srv, CLM_MAX_CNT);
-	if (!tmp_err && err)
-		err = tmp_err;
+	if (argc <= 0 || (argc == 1 && strcmp(*argv, "help"))) {
+		cmd_print_usage_short(cmd, help_context, ctx);
+		ERR(trm, "Please specify two snapshots to compare\n");
+		return -EINVAL;
+	}
 
-	/* if any of the parse commands succeed return success */
-	return err;
-}
+	err = parse_name_help(argc--, argv++, help_context, cmd, ctx);
+	if (err < 0)
+		return err;
 
-static int parse_both_clms(const char *arg, struct rnbd_ctx *ctx)
-{
-	int tmp_err, err;
+	old_name = ctx->name;
 
-	err =  parse_clt_clms(arg, ctx);
-	tmp_err = parse_srv_clms(arg, ctx);
+	err = parse_name_help(argc--, argv++, help_context, cmd, ctx);
+	if (err < 0)
+		return err;
 
-	if (!tmp_err && err)
-		err = tmp_err;
+	err = parse_list_parameters(argc, argv, ctx, parse_diff_clms,
+				    cmd, help_context, 0);
+	if (err < 0)
+		return err;
+
+	err = load_snapshot(old_name, &old_buf, &old, ctx);
+	if (err)
+		return err;
+
+	err = load_snapshot(ctx->name, &new_buf, &new, ctx);
+	if (err)
+		goto free_old;
+
+	cnt = rnbd_diff(old, new, &diffs);
+	if (cnt < 0) {
+		err = cnt;
+		ERR(trm, "Failed to compare snapshots: %s (%d)\n",
+		    strerror(-err), err);
+		goto free_new;
+	}
+
+	err = select_diffs(&diffs, &cnt, ctx);
+	if (err < 0)
+		goto free_diffs;
+
+	err = list_diff(diffs, cnt, rnbd_diff_interval(old, new), ctx);
+
+free_diffs:
+	free(diffs);
+free_new:
+	put_snapshot(new, ctx);
+free_old:
+	put_snapshot(old, ctx);
 
-	/* if any of the parse commands succeed return success */
 	return err;
 }
 
-static int parse_sign(char s,
-		      struct rnbd_ctx *ctx)
+int cmd_watch(int argc, const char *argv[], const struct param *cmd,
+	      const char *help_context, struct rnbd_ctx *ctx)
 {
-	if (s == '+')
-		ctx->sign = 1;
-	else if (s == '-')
-		ctx->sign = -1;
-	else
-		ctx->sign = 0;
+	int err;
 
-	return ctx->sign;
-}
+	err = parse_cmd_parameters(argc, argv, params_watch_parameters,
+				   ctx, cmd, help_context, 0);
+	if (err < 0)
+		return err;
 
-static int parse_size(const char *str,
-		      struct rnbd_ctx *ctx)
-{
-	if (parse_sign(*str, ctx))
-		str++;
+	argc -= err; argv += err;
 
-	return str_to_size(str, ctx);
-}
+	if (argc > 0) {
+		handle_unknown_param(*argv, params_watch_parameters);
+		return -EINVAL;
+	}
 
-static void init_rnbd_ctx(struct rnbd_ctx *ctx)
-{
-	memset(ctx, 0, sizeof(struct rnbd_ctx));
+	if (!ctx->interval_set)
+		ctx->interval_ms = 1000;
 
-	list_default(ctx);
+	err = rnbd_watch(ctx);
+	if (err)
+		ERR(trm, "Failed to watch state changes: %s (%d)\n",
+		    strerror(-err), err);
 
-	trm = (isatty(STDOUT_FILENO) == 1);
+	return err;
 }
 
-static void deinit_rnbd_ctx(struct rnbd_ctx *ctx)
+/*
+ *	<name> <state> [timeout] [OPTIONS]
+ *
+ * A path can be preceded by the name of its session.
+ */
+int cmd_wait(int argc, const char *argv[], const struct param *cmd,
+	     const char *help_context, unsigned int kinds,
+	     struct rnbd_ctx *ctx)
 {
-	int i;
+	const char *sessname = NULL, *state;
+	int err, n, timeout_ms = -1;
 
-	for (i = 0; i < ctx->path_cnt; i++) {
-		if (ctx->paths[i].src)
-			free((char *)ctx->paths[i].src);
-		if (ctx->paths[i].dst)
-			free((char *)ctx->paths[i].dst);
-		if (ctx->paths[i].provided)
-			free((char *)ctx->paths[i].provided);
+	if (argc <= 0) {
+		cmd_print_usage_short(cmd, help_context, ctx);
+		ERR(trm, "Please specify the object to wait for\n");
+		return -EINVAL;
 	}
-}
 
-static void rnbd_ctx_default(struct rnbd_ctx *ctx)
-{
-	if (!ctx->lstmode_set)
-		ctx->lstmode = LST_DEVICES;
+	err = parse_name_help(argc, argv, help_context, cmd, ctx);
+	if (err < 0)
+		return err;
 
-	if (!ctx->fmt_set)
-		ctx->fmt = FMT_TERM;
+	for (n = 0; n < argc && !find_param(argv[n], params_default); n++)
+		;
 
-	if (!ctx->prec_set)
-		ctx->prec = 3;
+	if (n > 2 && parse_wait_timeout(argv[n - 1], &timeout_ms)) {
+		n--;
+	} else if (n > 2 && !(kinds == RNBD_WAIT_PATH && n == 3)) {
+		ERR(trm, "Invalid timeout '%s'\n", argv[n - 1]);
+		return -EINVAL;
+	}
 
-	if (!ctx->rnbdmode_set) {
-		if (sess_clt[0])
-			ctx->rnbdmode |= RNBD_CLIENT;
-		if (sess_srv[0])
-			ctx->rnbdmode |= RNBD_SERVER;
+	if (n == 3 && kinds == RNBD_WAIT_PATH) {
+		sessname = argv[0];
+		ctx->name = argv[1];
+	} else if (n > 2) {
+		cmd_print_usage_short(cmd, help_context, ctx);
+		ERR(trm, "Too many arguments\n");
+		return -EINVAL;
 	}
-}
+	state = n == 2 || sessname ? argv[n - 1] : NULL;
+	if (timeout_ms >= 0)
+		n++;
 
-static void help_mode(const char *mode, struct param *const params[],
-		      const struct rnbd_ctx *ctx)
-{
-	char buff[PATH_MAX];
+	argc -= n; argv += n;
 
-	if (ctx->pname_with_mode) {
+	err = parse_cmd_parameters(argc, argv, params_default,
+				   ctx, cmd, help_context, 0);
+	if (err < 0)
+		return err;
 
-		help_param(ctx->pname, params, ctx);
-	} else {
+	argc -= err; argv += err;
 
-		snprintf(buff, sizeof(buff), "%s %s", ctx->pname, mode);
-		help_param(buff, params, ctx);
+	if (argc > 0) {
+		handle_unknown_param(*argv, params_default);
+		return -EINVAL;
 	}
-}
 
-static void help_start(const struct rnbd_ctx *ctx)
-{
-	if (help_print_flags(ctx)) {
-		help_param(ctx->pname, params_flags_help, ctx);
-		printf("\n\n");
+	if (!state) {
+		cmd_print_usage_short(cmd, help_context, ctx);
+		ERR(trm, "Please specify the state to wait for\n");
+		return -EINVAL;
 	}
 
-	help_param(ctx->pname, params_mode_help, ctx);
+	return rnbd_wait(ctx, kinds, sessname, ctx->name, state, timeout_ms);
 }
 
-static int init_show(enum rnbdmode rnbdmode,
-		     enum lstmode object_type,
-		     struct rnbd_ctx *ctx)
+int check_root(const struct rnbd_ctx *ctx)
 {
-	(void) parse_all(0, NULL, NULL, ctx);
-	switch (object_type) {
-	case LST_PATHS:
-	case LST_ALL:
-		if (rnbdmode & RNBD_CLIENT) {
-			parse_clt_paths_clms("-src_addr", ctx);
-			parse_clt_paths_clms("-dst_addr", ctx);
-		}
-		if (rnbdmode & RNBD_SERVER) {
-			parse_srv_paths_clms("-src_addr", ctx);
-			parse_srv_paths_clms("-dst_addr", ctx);
-		}
-		break;
-	default:
-		;
+	int err = 0;
+	uid_t uid;
+
+	uid = geteuid();
+	/* according to man page "this function is always successful" */
+	if (ctx->simulate_set) {
+		INF((uid != 0 && ctx->verbose_set),
+		    "warning: Modifying operations require root permission.\n");
+		return err;
 	}
-	return 0;
+	if (uid != 0) {
+		ERR(trm, "Modifying operations require root permission.\n");
+		err = -EPERM;
+	}
+	return err;
 }
 
-/**
- * Parse all the possible parameters to list or show commands.
- * The results are collected in the rnbd_ctx struct
- *
- *  Assumtions:
- * * all types  accept the same parameters (except for collums)
- * * it is always the end of a command line, so a left over argument
- *   that can not be interpreded is an error
- *
- * Returns:
- * > 0 number of arguments accepted
- * < 0 error code
- * == 0 there are no arguments to the list command
- */
-int parse_list_parameters(int argc, const char *argv[], struct rnbd_ctx *ctx,
-		int (*parse_clms)(const char *arg, struct rnbd_ctx *ctx),
-			  const struct param *cmd, const char *program_name, int allow_paths)
+int cmd_apply(int argc, const char *argv[], const struct param *cmd,
+	      const char *help_context, struct rnbd_ctx *ctx)
 {
-	int err = 0; int start_argc = argc;
-	const struct param *param;
+	struct rnbd_snapshot *snap = ctx->snap;
+	int err;
 
-	while (argc && err >= 0) {
-		/* parse the list flags */
-		param = find_param(*argv, params_list_parameters);
-		if (param) {
-			err = param->parse(argc, argv, param, ctx);
-			if (err > 0) {
-				argc -= err; argv += err;
-				continue;
-			}
-		}
-		/* parse collumn parameters */
-		err = (*parse_clms)(*argv, ctx);
-		if (err == 0) {
+	if (argc <= 0) {
+		cmd_print_usage_short(cmd, help_context, ctx);
+		ERR(trm, "Please specify the file argument\n");
+		return -EINVAL;
+	}
 
-			argc--; argv++;
-			continue;
-		}
-		if (err == -EINVAL) {
+	err = parse_name_help(argc--, argv++, help_context, cmd, ctx);
+	if (err < 0)
+		return err;
 
-			err = parse_precision(*argv, ctx);
-			if (err == 0) {
-				argc--; argv++;
-				continue;
-			}
-		}
-		if (err == -EINVAL && allow_paths)
-			err = parse_path(*argv, ctx);
+	err = parse_cmd_parameters(argc, argv, params_apply_parameters,
+				   ctx, cmd, help_context, 0);
+	if (err < 0)
+		return err;
 
-		if (err == 0) {
-			argc--; argv++;
-			continue;
-		}
-		if (err == -EINVAL && allow_paths)
-			err = parse_port_desc(*argv, ctx);
+	argc -= err; argv += err;
 
-		if (err == 0) {
-			argc--; argv++;
-		}
-	}
-	if (ctx->help_set) {
-		cmd->help(program_name, cmd, ctx);
-		err = -EAGAIN;
-	} else if (err == -EINVAL) {
-		handle_unknown_param(*argv, params_list_parameters);
+	if (argc > 0) {
+		handle_unknown_param(*argv, params_apply_parameters);
+		return -EINVAL;
 	}
-	return err < 0 ? err : start_argc - argc;
+
+	err = check_root(ctx);
+	if (err < 0)
+		return err;
+
+	return rnbd_apply(ctx->name, snap->sds_clt, snap->sess_clt,
+			  ctx->jobs_set ? ctx->jobs : RNBD_POOL_JOBS, ctx);
 }
 
-/**
- * Parse parameters for a command as described by cmd.
+static int read_sysfs(struct rnbd_snapshot *snap)
+{
+	int ret;
+
+	ret = rnbd_sysfs_read_all(snap);
+	if (ret)
+		ERR(trm, "Failed to read sysfs entries: %d\n", ret);
+
+	return ret;
+}
+
+/*
+ * Take the objects from the snapshot published by rnbd publish
  */
-int parse_cmd_parameters(int argc, const char *argv[],
-			 struct param *const params[], struct rnbd_ctx *ctx,
-			 const struct param *cmd, const char *program_name,
-			 int allow_option_name)
+static int read_shm(struct rnbd_snapshot *snap)
 {
-	int err = 0; int start_argc = argc;
-	const struct param *param;
+	struct timespec now;
+	size_t len;
+	bool live;
+	char *buf;
+	int ret;
 
-	while (argc && err >= 0) {
-		param = find_param(*argv, params);
-		if (param)
-			err = param->parse(argc, argv, param, ctx);
-		if (!param || err <= 0) {
-			if (allow_option_name
-			    && parse_option_name(argc, argv, cmd, ctx)) {
-				err = 1;
-			} else {
-				break;
-			}
-		}
-		argc -= err; argv += err;
+	ret = rnbd_shm_read(&buf, &len, &live);
+	if (ret) {
+		if (ret == -ENOENT)
+			ERR(trm, "Nothing published in %s, is rnbd publish running?\n",
+			    RNBD_SHM_PATH);
+		else
+			ERR(trm, "Failed to read %s: %s (%d)\n",
+			    RNBD_SHM_PATH, strerror(-ret), ret);
+		return ret;
 	}
-	if (ctx->help_set && cmd) {
-		cmd->help(program_name, cmd, ctx);
-		err = -EAGAIN;
+
+	ret = rnbd_snapshot_decode(buf, len, snap);
+	free(buf);
+	if (ret) {
+		ERR(trm, "Failed to load the snapshot in %s: %s (%d)\n",
+		    RNBD_SHM_PATH, strerror(-ret), ret);
+		return ret;
 	}
-	return err < 0 ? err : start_argc - argc;
+
+	if (!live) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		ERR(trm, "rnbd publish isn't running, the snapshot in %s is %llds old\n",
+		    RNBD_SHM_PATH, (long long)(now.tv_sec - snap->ts.tv_sec));
+		rnbd_snapshot_free(snap);
+		return -ESTALE;
+	}
+
+	return 0;
 }
 
-int parse_all_parameters(int argc, const char *argv[],
-			 struct param *const params[], struct rnbd_ctx *ctx,
-			 const struct param *cmd, const char *program_name)
+/*
+ * Devices are listed by session name and mapping path
+ */
+static int sort_devices(struct rnbd_sess_dev **sds, int cnt,
+			const struct rnbd_ctx *ctx)
 {
-	int err = 0;
-	const struct param *param;
+	struct rnbd_sort sort = { .cnt = 0 };
+	const char *bad;
+	int ret;
 
-	while (argc && err >= 0) {
-		param = find_param(*argv, params);
-		if (param)
-			err = param->parse(argc, argv, param, ctx);
-		else
-			err = 1; /* skip unknown parameter */
+	ret = rnbd_sort_parse(&sort, "sessname,mapping_path");
+	if (!ret)
+		ret = rnbd_sort_bind(&sort, all_clms_devices, &bad);
+	if (!ret)
+		ret = rnbd_sort_objs(&sort, (void **)sds, cnt, -1, ctx);
 
-		argc -= err; argv += err;
-	}
-	return err;
+	return ret < 0 ? ret : 0;
 }
 
-/**
- * Parse parameters for the map command as described by cmd.
+/*
+ * Sort the objects just read and link them in that order
  */
-int parse_map_parameters(int argc, const char *argv[], int *accepted,
-			 struct param *const params[], struct rnbd_ctx *ctx,
-			 const struct param *cmd, const char *program_name,
-			 int allow_port_desc)
+static int link_sysfs(const struct rnbd_ctx *ctx)
+{
+	struct rnbd_snapshot *snap = ctx->snap;
+	int ret;
+
+	ret = sort_devices(snap->sds_clt, snap->sds_clt_cnt - 1, ctx);
+	if (!ret)
+		ret = sort_devices(snap->sds_srv, snap->sds_srv_cnt - 1, ctx);
+	if (ret) {
+		ERR(trm, "Failed to sort devices: %d\n", ret);
+		return ret;
+	}
+
+	ret = rnbd_sysfs_link_all(snap);
+	if (ret)
+		ERR(trm, "Failed to alloc memory for sysfs entries: %d\n", ret);
+
+	return ret;
+}
+
+static int rnbd_main(int argc, const char *argv[],
+		     struct rnbd_snapshot *cached);
+
+/* the daemon keeps these, the others change all the time */
+#define DAEMON_ATTRS (RNBD_ATTR_PATH_ADDR | RNBD_ATTR_PATH_HCA | \
+		      RNBD_ATTR_SESS_HOSTNAME | RNBD_ATTR_SD_ACCESS)
+
+static int daemon_load(struct rnbd_snapshot *snap)
 {
-	int err = 0; int start_argc = argc;
-	const struct param *param;
+	int err;
 
-	while (argc && err >= 0) {
-		param = find_param(*argv, params);
-		if (param) {
-			err = param->parse(argc, argv, param, ctx);
-		} else {
-			err = parse_path(*argv, ctx);
-			if (err == 0) {
-				err = 1;
-			} else if (allow_port_desc) {
-				err = parse_port_desc(*argv, ctx);
-				if (err == 0)
-					err = 1;
-			}
-		}
-		if (err <= 0)
-			break;
+	err = read_sysfs(snap);
+	if (!err)
+		rnbd_sysfs_read_attrs(snap, DAEMON_ATTRS);
 
-		argc -= err; argv += err;
-	}
-	if (ctx->help_set) {
-		cmd->help(program_name, cmd, ctx);
-		err = -EAGAIN;
-	}
-	*accepted = start_argc - argc;
 	return err;
 }
 
-int cmd_dump_all(int argc, const char *argv[], const struct param *cmd,
-		 const char *help_context, struct rnbd_ctx *ctx)
+/* in a child of the daemon, which has a copy of @snap of its own */
+static int daemon_run(struct rnbd_snapshot *snap, int argc,
+		      const char *argv[])
+{
+	return rnbd_main(argc, argv, snap);
+}
 
+int cmd_daemon(int argc, const char *argv[], const struct param *cmd,
+	       const char *help_context, struct rnbd_ctx *ctx)
 {
-	int err, tmp_err;
+	static const struct rnbd_daemon_ops ops = {
+		.load = daemon_load,
+		.unload = rnbd_snapshot_free,
+		.run = daemon_run,
+	};
+	int err;
 
-	err = parse_all_parameters(argc, argv, params_fmt_parameters,
-				   ctx, cmd, "");
+	err = parse_cmd_parameters(argc, argv, params_daemon_parameters,
+				   ctx, cmd, help_context, 0);
 	if (err < 0)
 		return err;
 
-	/* default format for dump is all except when output to terminal */
-	if (ctx->fmt == FMT_TERM) {
-		ctx->notree_set = true;
-		ctx->nototals_set = true;
-	} else	{
-		(void) parse_all(0, NULL, NULL, ctx);
+	argc -= err; argv += err;
+
+	if (argc > 0) {
+		handle_unknown_param(*argv, params_daemon_parameters);
+		return -EINVAL;
 	}
-	/* parse from beginning again! */
-	err = parse_list_parameters(argc, argv, ctx,
-				    parse_both_clms,
-				    cmd, "", 0);
+
+	err = check_root(ctx);
 	if (err < 0)
 		return err;
 
-	ctx->rnbdmode = RNBD_BOTH;
-
-	err = list_devices(sds_clt, sds_clt_cnt - 1, sds_srv,
-			   sds_srv_cnt - 1, true, ctx);
-
-	if ((sds_clt_cnt - 1 + sds_srv_cnt - 1)
-	    && (sess_clt_cnt - 1 + sess_srv_cnt - 1))
-		printf("\n");
+	return rnbd_daemon(&ops, ctx);
+}
 
-	tmp_err = list_sessions(sess_clt, sess_clt_cnt - 1, sess_srv,
-				sess_srv_cnt - 1, true, ctx);
+static volatile sig_atomic_t publish_stop;
 
-	if (!err && tmp_err)
-		err = tmp_err;
+static void publish_sig(int sig)
+{
+	publish_stop = 1;
+}
 
-	if ((sds_clt_cnt - 1 + sds_srv_cnt - 1
-	     + sess_clt_cnt - 1 + sess_srv_cnt - 1)
-	    && (paths_clt_cnt - 1 + paths_srv_cnt - 1))
-		printf("\n");
+static int publish_snapshot(struct rnbd_shm *shm,
+			    const struct rnbd_snapshot *snap)
+{
+	size_t len;
+	char *buf;
+	int err;
 
-	tmp_err = list_paths(paths_clt, paths_clt_cnt - 1, paths_srv,
-			     paths_srv_cnt - 1, true, ctx);
+	err = rnbd_snapshot_encode(snap, &buf, &len);
+	if (err)
+		return err;
 
-	if (!err && tmp_err)
-		err = tmp_err;
+	err = rnbd_shm_publish(shm, buf, len);
+	free(buf);
 
 	return err;
 }
 
-int check_root(const struct rnbd_ctx *ctx)
+int cmd_publish(int argc, const char *argv[], const struct param *cmd,
+		const char *help_context, struct rnbd_ctx *ctx)
 {
-	int err = 0;
-	uid_t uid;
+	struct sigaction sa = {
+		.sa_handler = publish_sig,
+	};
+	struct rnbd_snapshot next;
+	struct timespec delay;
+	struct rnbd_shm shm;
+	int err, n;
 
-	uid = geteuid();
-	/* according to man page "this function is always successful" */
-	if (ctx->simulate_set) {
-		INF((uid != 0 && ctx->verbose_set),
-		    "warning: Modifying operations require root permission.\n");
+	err = parse_cmd_parameters(argc, argv, params_publish_parameters,
+				   ctx, cmd, help_context, 0);
+	if (err < 0)
 		return err;
+
+	argc -= err; argv += err;
+
+	if (argc > 0) {
+		handle_unknown_param(*argv, params_publish_parameters);
+		return -EINVAL;
 	}
-	if (uid != 0) {
-		ERR(trm, "Modifying operations require root permission.\n");
-		err = -EPERM;
+
+	err = check_root(ctx);
+	if (err < 0)
+		return err;
+
+	if (!ctx->interval_set)
+		ctx->interval_ms = 1000;
+	delay.tv_sec = ctx->interval_ms / 1000;
+	delay.tv_nsec = (ctx->interval_ms % 1000) * 1000000L;
+
+	err = rnbd_shm_create(&shm);
+	if (err) {
+		if (err == -EBUSY)
+			ERR(trm, "Another rnbd publish is running\n");
+		else
+			ERR(trm, "Failed to create %s: %s (%d)\n",
+			    RNBD_SHM_PATH, strerror(-err), err);
+		return err;
+	}
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* the objects of the first round are read already */
+	for (n = 1; ; n++) {
+		err = publish_snapshot(&shm, ctx->snap);
+		if (err) {
+			ERR(trm, "Failed to publish snapshot: %s (%d)\n",
+			    strerror(-err), err);
+			break;
+		}
+		INF(ctx->verbose_set, "Published snapshot %d.\n", n);
+
+		if (ctx->count_set && n >= ctx->count)
+			break;
+
+		/* a signal cuts the sleep short */
+		nanosleep(&delay, NULL);
+		if (publish_stop)
+			break;
+
+		err = read_sysfs(&next);
+		if (err)
+			break;
+		rnbd_snapshot_free(ctx->snap);
+		*ctx->snap = next;
+
+		err = link_sysfs(ctx);
+		if (err)
+			break;
+		read_attrs(ctx, RNBD_ATTR_ALL);
 	}
+
+	rnbd_shm_close(&shm);
+
 	return err;
 }
 
@@ -4341,7 +6527,7 @@ int cmd_resize(int argc, const char *argv[], const struct param *cmd,
 	}
 	argc--; argv++;
 
-	if (argc > 0) {
+	if (argc > 0 && !find_param(*argv, params_resize_parameters)) {
 		err = parse_apply_unit(*argv, ctx);
 		if (err < 0) {
 			if (!strcmp(*argv, "help")) {
@@ -4357,22 +6543,34 @@ int cmd_resize(int argc, const char *argv[], const struct param *cmd,
 				return err;
 			}
 		}
+		argc--; argv++;
 	} else if (ctx->size_state == size_number) {
 
 		ctx->size_sect >>= 9;
 		ctx->size_state = size_unit;
 	}
-	argc--; argv++;
+
+	err = parse_cmd_parameters(argc, argv, params_resize_parameters,
+				   ctx, cmd, help_context, 0);
+	if (err < 0)
+		return err;
+
+	argc -= err; argv += err;
 
 	if (argc > 0) {
 
-		handle_unknown_param(*argv, params_default);
+		handle_unknown_param(*argv, params_resize_parameters);
 		return -EINVAL;
 	}
 	err = check_root(ctx);
 	if (err < 0)
 		return err;
 
+	if (is_selector(ctx->name, ctx))
+		return select_bulk(ctx->name, ctx->sel_sess, ctx->snap->sds_clt,
+				   all_clms_devices_clt, bulk_resize,
+				   "resize", "Resized", ctx);
+
 	return client_devices_resize(ctx->name, ctx->size_sect, ctx);
 }
 
@@ -4385,7 +6583,7 @@ int cmd_unmap(int argc, const char *argv[], const struct param *cmd,
 		return err;
 
 	err = parse_cmd_parameters(argc, argv,
-				   params_unmap_parameters,
+				   params_select_parameters,
 				   ctx, cmd, help_context, 0);
 	if (err < 0)
 		return err;
@@ -4394,25 +6592,31 @@ int cmd_unmap(int argc, const char *argv[], const struct param *cmd,
 
 	if (argc > 0) {
 
-		handle_unknown_param(*argv, params_unmap_parameters);
+		handle_unknown_param(*argv, params_select_parameters);
 		return -EINVAL;
 	}
 	err = check_root(ctx);
 	if (err < 0)
 		return err;
 
+	if (is_selector(ctx->name, ctx))
+		return select_bulk(ctx->name, ctx->sel_sess, ctx->snap->sds_clt,
+				   all_clms_devices_clt, bulk_unmap,
+				   "unmap", "Unmapped", ctx);
+
 	return client_devices_unmap(ctx->name, ctx->force_set, ctx);
 }
 
 int cmd_remap(int argc, const char *argv[], const struct param *cmd,
 	      bool allowSession, const char *help_context, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	int err = parse_name_help(argc--, argv++,
 				  help_context, cmd, ctx);
 	if (err < 0)
 		return err;
 
-	err = parse_cmd_parameters(argc, argv, params_unmap_parameters,
+	err = parse_cmd_parameters(argc, argv, params_select_parameters,
 				   ctx, cmd, help_context, 0);
 	if (err < 0)
 		return err;
@@ -4428,9 +6632,14 @@ int cmd_remap(int argc, const char *argv[], const struct param *cmd,
 	if (err < 0)
 		return err;
 
+	if (is_selector(ctx->name, ctx))
+		return select_bulk(ctx->name, ctx->sel_sess, snap->sds_clt,
+				   all_clms_devices_clt, bulk_remap,
+				   "remap", "Remapped", ctx);
+
 	if (allowSession
-	    && find_single_session(ctx->name, ctx, sess_clt,
-				   sds_clt_cnt, false))
+	    && find_single_session(ctx->name, ctx, snap->sess_clt,
+				   snap->sds_clt_cnt, false))
 		return client_session_remap(ctx->name, ctx);
 
 	return client_devices_remap(ctx->name, ctx);
@@ -4468,6 +6677,7 @@ int cmd_client_recover_device(int argc, const char *argv[],
 			       const struct param *cmd,
 			       const char *help_context, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const struct rnbd_sess_dev *ds;
 	int i, err, tmp_err;
 
@@ -4493,9 +6703,10 @@ int cmd_client_recover_device(int argc, const char *argv[],
 		return err;
 
 	if (!strcmp(ctx->name, "all")) {
-		for (i = 0; sds_clt[i]; i++) {
-			if (!strcmp(sds_clt[i]->dev->state, "closed")) {
-				tmp_err = client_device_remap(sds_clt[i]->dev, ctx);
+		for (i = 0; snap->sds_clt[i]; i++) {
+			if (!strcmp(snap->sds_clt[i]->dev->state, "closed")) {
+				tmp_err = client_device_remap(snap->sds_clt[i],
+							      ctx);
 				if (!err)
 					err = tmp_err;
 			} else {
@@ -4505,12 +6716,12 @@ int cmd_client_recover_device(int argc, const char *argv[],
 			}
 		}
 	} else {
-		ds = find_single_device(ctx->name, ctx, sds_clt, sds_clt_cnt, true/*print_err*/);
+		ds = find_single_device(ctx->name, ctx, snap->sds_clt, snap->sds_clt_cnt, true/*print_err*/);
 		if (!ds)
 			return -EINVAL;
 
 		if (!strcmp(ds->dev->state, "closed")) {
-			err = client_device_remap(ds->dev, ctx);
+			err = client_device_remap(ds, ctx);
 		} else {
 			INF(ctx->debug_set,
 			    "Device is still open, no need to recover.\n");
@@ -4661,7 +6872,7 @@ int cmd_client_session_reconnect(int argc, const char *argv[], const struct para
 	/* We want the session to change it's state to */
 	/* disconnected. So disconnect all paths first.*/
 	err = session_do_all_paths(RNBD_CLIENT, ctx->name,
-				   client_path_disconnect,
+				   client_path_disconnect_path,
 				   ctx);
 	/* If the session does not exist at all we will   */
 	/* get -EINVAL. In all other error cases we try   */
@@ -4669,7 +6880,7 @@ int cmd_client_session_reconnect(int argc, const char *argv[], const struct para
 	if (err != -EINVAL)
 		err = session_do_all_paths(RNBD_CLIENT,
 					   ctx->name,
-					   client_path_reconnect,
+					   client_path_reconnect_path,
 					   ctx);
 	return err;
 }
@@ -4677,6 +6888,7 @@ int cmd_client_session_reconnect(int argc, const char *argv[], const struct para
 static int client_session_add_missing_paths(const char *session_name,
 					    struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	int err = 0;
 	char hostname[NAME_MAX];
 	struct path paths[MAX_PATHS_PER_SESSION]; /* lazy */
@@ -4689,7 +6901,7 @@ static int client_session_add_missing_paths(const char *session_name,
 	INF(ctx->debug_set, "Looking for missing paths of session %s\n", session_name);
 
 	sess = find_single_session(session_name, ctx,
-				   sess_clt, sess_clt_cnt,
+				   snap->sess_clt, snap->sess_clt_cnt,
 				   false);
 	if (sess && strlen(sess->hostname)) {
 
@@ -4702,8 +6914,9 @@ static int client_session_add_missing_paths(const char *session_name,
 		INF(ctx->debug_set,
 		    "No hostname for session, attempting to use existing path(s)\n");
 
-		path = find_first_path_for_session(session_name, paths_clt,
-						   paths_clt_cnt);
+		path = find_first_path_for_session(session_name,
+						   snap->paths_clt,
+						   snap->paths_clt_cnt);
 		if (!path) {
 			INF(trm, "No paths in session %s, not possible to recover\n",
 			    session_name);
@@ -4735,7 +6948,7 @@ static int client_session_add_missing_paths(const char *session_name,
 	if (path_cnt) {
 		for (i = 0; i < path_cnt; i++) {
 			path = find_single_path(session_name, paths[i].dst, ctx,
-						paths_clt, paths_clt_cnt, false);
+						snap->paths_clt, snap->paths_clt_cnt, false);
 			if (path) {
 				INF(ctx->debug_set,
 				    "Path %s of session %s already exists.\n",
@@ -4756,6 +6969,7 @@ int cmd_client_session_recover(int argc, const char *argv[],
 			       const struct param *cmd,
 			       const char *help_context, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	struct rnbd_sess *sess;
 	int i, err, tmp_err;
 
@@ -4787,17 +7001,17 @@ int cmd_client_session_recover(int argc, const char *argv[],
 
 		err = 0;
 		sess = find_single_session(ctx->name, ctx,
-					   sess_clt, sess_clt_cnt,
+					   snap->sess_clt, snap->sess_clt_cnt,
 					   false);
 		/*
 		 * If session with the name "all" doesn't exist
 		 * recover all sessions
 		 */
 		if (!sess) {
-			for (i = 0; sess_clt[i]; i++) {
+			for (i = 0; snap->sess_clt[i]; i++) {
 				tmp_err = session_do_all_paths(RNBD_CLIENT,
-							sess_clt[i]->sessname,
-							client_path_recover,
+							snap->sess_clt[i]->sessname,
+							client_path_recover_path,
 							ctx);
 				if (tmp_err < 0 && err >= 0)
 					err = tmp_err;
@@ -4805,7 +7019,7 @@ int cmd_client_session_recover(int argc, const char *argv[],
 				if (ctx->add_missing_set) {
 
 					tmp_err = client_session_add_missing_paths(
-							sess_clt[i]->sessname, ctx);
+							snap->sess_clt[i]->sessname, ctx);
 					if (tmp_err < 0 && err >= 0)
 						err = tmp_err;
 				}
@@ -4815,7 +7029,7 @@ int cmd_client_session_recover(int argc, const char *argv[],
 	}
 	err = session_do_all_paths(RNBD_CLIENT,
 				   ctx->name,
-				   client_path_recover,
+				   client_path_recover_path,
 				   ctx);
 
 	if (ctx->add_missing_set) {
@@ -4832,6 +7046,7 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 				       const struct param *cmd,
 				       const char *help_context, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const struct rnbd_sess_dev *ds = NULL;
 	const struct rnbd_sess *sess = NULL;
 	const struct rnbd_path *path = NULL;
@@ -4866,10 +7081,10 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 		return err;
 
 	if (!strcmp(ctx->name, "all")) {
-		for (i = 0; sess_clt[i]; i++) {
+		for (i = 0; snap->sess_clt[i]; i++) {
 			tmp_err = session_do_all_paths(RNBD_CLIENT,
-						       sess_clt[i]->sessname,
-						       client_path_recover,
+						       snap->sess_clt[i]->sessname,
+						       client_path_recover_path,
 						       ctx);
 			if (tmp_err < 0 && err >= 0)
 				err = tmp_err;
@@ -4877,14 +7092,15 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 			if (ctx->add_missing_set) {
 
 				tmp_err = client_session_add_missing_paths(
-					sess_clt[i]->sessname, ctx);
+					snap->sess_clt[i]->sessname, ctx);
 				if (tmp_err < 0 && err >= 0)
 						err = tmp_err;
 			}
 		}
-		for (i = 0; sds_clt[i]; i++) {
-			if (!strcmp(sds_clt[i]->dev->state, "closed")) {
-				tmp_err = client_device_remap(sds_clt[i]->dev, ctx);
+		for (i = 0; snap->sds_clt[i]; i++) {
+			if (!strcmp(snap->sds_clt[i]->dev->state, "closed")) {
+				tmp_err = client_device_remap(snap->sds_clt[i],
+							      ctx);
 				if (!err)
 					err = tmp_err;
 			} else {
@@ -4893,12 +7109,12 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 			}
 		}
 	} else {
-		ds = find_single_device(ctx->name, ctx, sds_clt, sds_clt_cnt, false/*print_err*/);
+		ds = find_single_device(ctx->name, ctx, snap->sds_clt, snap->sds_clt_cnt, false/*print_err*/);
 		if (ds) {
 			INF(ctx->verbose_set,
 			    "Recovering device %s.\n", ctx->name);
 			if (!strcmp(ds->dev->state, "closed")) {
-				err = client_device_remap(ds->dev, ctx);
+				err = client_device_remap(ds, ctx);
 			} else {
 				INF(ctx->debug_set,
 				    "Device is still open, no need to recover.\n");
@@ -4907,8 +7123,8 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 		} else {
 			if (ctx->path_cnt == 0)
 				sess = find_single_session(ctx->name, ctx,
-							   sess_clt,
-							   sess_clt_cnt,
+							   snap->sess_clt,
+							   snap->sess_clt_cnt,
 							   false);
 			if (sess) {
 				INF(ctx->verbose_set,
@@ -4916,7 +7132,7 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 
 				err = session_do_all_paths(RNBD_CLIENT,
 							   ctx->name,
-							   client_path_recover,
+							   client_path_recover_path,
 							   ctx);
 
 				if (ctx->add_missing_set) {
@@ -4930,14 +7146,14 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 			} else {
 				if (ctx->path_cnt == 0)
 					path = find_single_path(NULL, ctx->name,
-								ctx, paths_clt,
-								paths_clt_cnt,
+								ctx, snap->paths_clt,
+								snap->paths_clt_cnt,
 								false);
 				else
 					path = find_single_path(ctx->name,
 								ctx->paths[0].dst,
-								ctx, paths_clt,
-								paths_clt_cnt,
+								ctx, snap->paths_clt,
+								snap->paths_clt_cnt,
 								false);
 				if (path) {
 					if (!strcmp(path->state, "connected")) {
@@ -4950,12 +7166,7 @@ int cmd_recover_device_session_or_path(int argc, const char *argv[],
 						INF(ctx->verbose_set, "Path '%s' is '%s', recovering.\n",
 						    ctx->name, path->state);
 
-						err = client_path_do((ctx->path_cnt == 0) ? NULL : ctx->name,
-								     (ctx->path_cnt == 0) ? ctx->name : ctx->paths[0].dst,
-								     "reconnect",
-								     "Successfully reconnected path '%s' of session '%s'.\n",
-								     "Failed to reconnect path '%s' from session '%s': %s (%d)\n",
-								     ctx);
+						err = client_path_reconnect_path(path, ctx);
 					}
 				} else {
 					ERR(trm,
@@ -4997,13 +7208,14 @@ int cmd_server_session_disconnect(int argc, const char *argv[], const struct par
 		return err;
 
 	return session_do_all_paths(RNBD_SERVER, ctx->name,
-				    server_path_disconnect,
+				    server_path_disconnect_path,
 				    ctx);
 }
 
 int cmd_server_devices_force_close(int argc, const char *argv[], const struct param *cmd,
 				   const char *help_context, struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *device_name = NULL;
 	const char *session_name = NULL;
 	struct rnbd_sess_dev **ds_exp = NULL;
@@ -5019,7 +7231,7 @@ int cmd_server_devices_force_close(int argc, const char *argv[], const struct pa
 	ctx->name = NULL;
 
 	err = parse_cmd_parameters(argc, argv,
-				   params_unmap_parameters,
+				   params_select_parameters,
 				   ctx, cmd, help_context, 1);
 	if (err < 0)
 		return err;
@@ -5029,30 +7241,40 @@ int cmd_server_devices_force_close(int argc, const char *argv[], const struct pa
 	if (argc > 0)
 		return -EINVAL;
 
-	ds_exp = calloc(sds_srv_cnt, sizeof(*ds_exp));
+	if (is_selector(device_name, ctx) || (ctx->name && is_glob(ctx->name))) {
+		err = check_root(ctx);
+		if (err < 0)
+			return err;
+
+		return select_bulk(device_name,
+				   ctx->sel_sess_set ? ctx->sel_sess : ctx->name,
+				   snap->sds_srv, all_clms_devices_srv, bulk_close,
+				   "close", "Closed", ctx);
+	}
+
+	ds_exp = find_devices(ctx->snap, device_name, snap->sds_srv,
+			      &devs_cnt);
 	if (!ds_exp) {
 		ERR(trm, "Failed to allocate memory\n");
 		return -ENOMEM;
 	}
 
-	devs_cnt = find_devices(device_name, sds_srv, ds_exp);
-
 	if (ctx->name) {
 		int sess_cnt = 0;
 
-		ss_srv = calloc(sess_srv_cnt, sizeof(*ss_srv));
+		ss_srv = calloc(snap->sess_srv_cnt, sizeof(*ss_srv));
 
-		if (sess_srv_cnt && !ss_srv) {
+		if (snap->sess_srv_cnt && !ss_srv) {
 			ERR(trm, "Failed to alloc memory\n");
 			err = -ENOMEM;
 			goto cleanup_err;
 		}
 		session_name = ctx->name;
-		ss_srv[0] = find_sess(session_name, sess_srv);
+		ss_srv[0] = find_sess(session_name, snap->sess_srv);
 		if (ss_srv[0])
 			sess_cnt = 1;
 		else
-			sess_cnt = find_sess_match(session_name, ctx->rnbdmode, sess_srv, ss_srv);
+			sess_cnt = find_sess_match(session_name, ctx->rnbdmode, snap->sess_srv, ss_srv);
 
 		if (sess_cnt > 1) {
 			ERR(trm, "Multiple sessions match '%s'\n", session_name);
@@ -5115,7 +7337,6 @@ int cmd_server_devices_force_close(int argc, const char *argv[], const struct pa
 		err = -ENOENT;
 		goto cleanup_err;
 	}
-	free(ds_exp);
 
 	INF(ctx->verbose_set,
 	    "Device name '%s' matches %s (%s).\n",
@@ -5133,8 +7354,6 @@ int cmd_server_devices_force_close(int argc, const char *argv[], const struct pa
 cleanup_err:
 	if (ss_srv)
 		free(ss_srv);
-	if (ds_exp)
-		free(ds_exp);
 	return err;
 }
 
@@ -5195,6 +7414,7 @@ int cmd_ambiguous(int argc, const char *argv[], const struct param *cmd,
 
 int cmd_both_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = "session";
 
 	int err = 0;
@@ -5226,8 +7446,10 @@ int cmd_both_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_sessions(sess_clt, sess_clt_cnt - 1,
-					    sess_srv, sess_srv_cnt - 1, false, ctx);
+			err = list_sessions(snap->sess_clt,
+					    snap->sess_clt_cnt - 1,
+					    snap->sess_srv,
+					    snap->sess_srv_cnt - 1, false, ctx);
 			break;
 		case TOK_SHOW:
 			err = parse_name_help(argc--, argv++,
@@ -5257,6 +7479,10 @@ int cmd_both_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			err = cmd_client_session_recover(argc, argv, cmd, _help_context, ctx);
 			break;
 
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, cmd, "client session",
+				       RNBD_WAIT_SESSION, ctx);
+			break;
 		case TOK_HELP:
 			parse_help(argc, argv, NULL, ctx);
 			print_help(_help_context,
@@ -5276,6 +7502,7 @@ int cmd_both_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_both_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context_client = ctx->pname_with_mode
 		? "path" : "client path";
 	const char *_help_context_both = "path";
@@ -5309,8 +7536,10 @@ int cmd_both_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_paths(paths_clt, paths_clt_cnt - 1,
-					 paths_srv, paths_srv_cnt - 1,
+			err = list_paths(snap->paths_clt,
+					 snap->paths_clt_cnt - 1,
+					 snap->paths_srv,
+					 snap->paths_srv_cnt - 1,
 					 false, ctx);
 			break;
 		case TOK_SHOW:
@@ -5346,6 +7575,10 @@ int cmd_both_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 		case TOK_DISCONNECT:
 			err = cmd_ambiguous(argc, argv, cmd, "both path");
 			break;
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, cmd, _help_context_client,
+				       RNBD_WAIT_PATH, ctx);
+			break;
 		case TOK_HELP:
 			parse_help(argc, argv, NULL, ctx);
 			print_help(_help_context_both, cmd,
@@ -5364,6 +7597,7 @@ int cmd_both_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_client_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = ctx->pname_with_mode
 		? "session" : "client session";
 
@@ -5396,7 +7630,8 @@ int cmd_client_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_sessions(sess_clt, sess_clt_cnt - 1,
+			err = list_sessions(snap->sess_clt,
+					    snap->sess_clt_cnt - 1,
 					    NULL, 0, false, ctx);
 			break;
 		case TOK_SHOW:
@@ -5425,6 +7660,10 @@ int cmd_client_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			err = cmd_session_remap(argc, argv, cmd,
 						_help_context, ctx);
 			break;
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, cmd, _help_context,
+				       RNBD_WAIT_SESSION, ctx);
+			break;
 		case TOK_HELP:
 			parse_help(argc, argv, NULL, ctx);
 			print_help(_help_context,
@@ -5444,6 +7683,7 @@ int cmd_client_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_client_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context_client = ctx->pname_with_mode
 		? "device" : "client device";
 	const char *_help_context_both = ctx->pname_with_mode ? "device" :
@@ -5480,11 +7720,11 @@ int cmd_client_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_devices(sds_clt, sds_clt_cnt - 1,
+			err = list_devices(snap->sds_clt, snap->sds_clt_cnt - 1,
 					   (ctx->rnbdmode == RNBD_CLIENT ?
-					    NULL : sds_srv),
+					    NULL : snap->sds_srv),
 					   (ctx->rnbdmode == RNBD_CLIENT ?
-					    0 : sds_srv_cnt - 1),
+					    0 : snap->sds_srv_cnt - 1),
 					   false, ctx);
 			break;
 		case TOK_SHOW:
@@ -5520,6 +7760,10 @@ int cmd_client_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			err = cmd_client_recover_device(argc, argv, cmd,
 							_help_context_client, ctx);
 			break;
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, cmd, _help_context_client,
+				       RNBD_WAIT_DEVICE, ctx);
+			break;
 		case TOK_HELP:
 			parse_help(argc, argv, NULL, ctx);
 			print_help(_help_context_client, cmd,
@@ -5538,6 +7782,7 @@ int cmd_client_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_client_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = ctx->pname_with_mode
 		? "path" : "client path";
 
@@ -5570,7 +7815,8 @@ int cmd_client_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_paths(paths_clt, paths_clt_cnt - 1,
+			err = list_paths(snap->paths_clt,
+					 snap->paths_clt_cnt - 1,
 					 NULL, 0, false, ctx);
 			break;
 		case TOK_SHOW:
@@ -5614,6 +7860,10 @@ int cmd_client_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 						 argc, argv, cmd,
 						 _help_context, ctx);
 			break;
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, cmd, _help_context,
+				       RNBD_WAIT_PATH, ctx);
+			break;
 		case TOK_HELP:
 			parse_help(argc, argv, NULL, ctx);
 			print_help(_help_context, cmd,
@@ -5632,6 +7882,7 @@ int cmd_client_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_server_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = ctx->pname_with_mode
 		? "session" : "server session";
 
@@ -5664,8 +7915,8 @@ int cmd_server_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_sessions(NULL, 0, sess_srv,
-					    sess_srv_cnt - 1, false, ctx);
+			err = list_sessions(NULL, 0, snap->sess_srv,
+					    snap->sess_srv_cnt - 1, false, ctx);
 			break;
 		case TOK_SHOW:
 			err = parse_name_help(argc--, argv++,
@@ -5705,6 +7956,7 @@ int cmd_server_sessions(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_server_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = ctx->pname_with_mode
 		? "device" : "server device";
 
@@ -5737,8 +7989,8 @@ int cmd_server_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_devices(NULL, 0, sds_srv,
-					   sds_srv_cnt - 1, false, ctx);
+			err = list_devices(NULL, 0, snap->sds_srv,
+					   snap->sds_srv_cnt - 1, false, ctx);
 			break;
 		case TOK_SHOW:
 			err = parse_name_help(argc--, argv++,
@@ -5778,6 +8030,7 @@ int cmd_server_devices(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_server_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = ctx->pname_with_mode
 		? "path" : "server path";
 
@@ -5809,8 +8062,8 @@ int cmd_server_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_paths(NULL, 0, paths_srv,
-					 paths_srv_cnt - 1, false, ctx);
+			err = list_paths(NULL, 0, snap->paths_srv,
+					 snap->paths_srv_cnt - 1, false, ctx);
 			break;
 		case TOK_SHOW:
 			err = parse_name_help(argc--, argv++,
@@ -5850,6 +8103,7 @@ int cmd_server_paths(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_client(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = "client";
 	int err = 0;
 	const struct param *param;
@@ -5892,6 +8146,27 @@ int cmd_client(int argc, const char *argv[], struct rnbd_ctx *ctx)
 		case TOK_DUMP:
 			err = cmd_dump_all(argc, argv, param, "", ctx);
 			break;
+		case TOK_SNAPSHOT:
+			err = cmd_snapshot(argc, argv, param, "", ctx);
+			break;
+		case TOK_DIFF:
+			err = cmd_diff(argc, argv, param, "", ctx);
+			break;
+		case TOK_WATCH:
+			err = cmd_watch(argc, argv, param, "", ctx);
+			break;
+		case TOK_DAEMON:
+			err = cmd_daemon(argc, argv, param, "", ctx);
+			break;
+		case TOK_PUBLISH:
+			err = cmd_publish(argc, argv, param, "", ctx);
+			break;
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, param, "", RNBD_WAIT_ALL, ctx);
+			break;
+		case TOK_APPLY:
+			err = cmd_apply(argc, argv, param, "", ctx);
+			break;
 		case TOK_LIST:
 
 			err = parse_list_parameters(argc, argv, ctx,
@@ -5900,7 +8175,7 @@ int cmd_client(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_devices(sds_clt, sds_clt_cnt - 1,
+			err = list_devices(snap->sds_clt, snap->sds_clt_cnt - 1,
 					   NULL, 0, false, ctx);
 			break;
 		case TOK_SHOW:
@@ -5957,6 +8232,7 @@ int cmd_client(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_server(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	const char *_help_context = "server";
 	int err = 0;
 	const struct param *param;
@@ -5999,6 +8275,21 @@ int cmd_server(int argc, const char *argv[], struct rnbd_ctx *ctx)
 		case TOK_DUMP:
 			err = cmd_dump_all(argc, argv, param, "", ctx);
 			break;
+		case TOK_SNAPSHOT:
+			err = cmd_snapshot(argc, argv, param, "", ctx);
+			break;
+		case TOK_DIFF:
+			err = cmd_diff(argc, argv, param, "", ctx);
+			break;
+		case TOK_WATCH:
+			err = cmd_watch(argc, argv, param, "", ctx);
+			break;
+		case TOK_DAEMON:
+			err = cmd_daemon(argc, argv, param, "", ctx);
+			break;
+		case TOK_PUBLISH:
+			err = cmd_publish(argc, argv, param, "", ctx);
+			break;
 		case TOK_CLOSE:
 			err = cmd_server_devices_force_close(argc, argv, param, _help_context, ctx);
 			break;
@@ -6010,8 +8301,8 @@ int cmd_server(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_devices(NULL, 0, sds_srv,
-					   sds_srv_cnt - 1, false, ctx);
+			err = list_devices(NULL, 0, snap->sds_srv,
+					   snap->sds_srv_cnt - 1, false, ctx);
 			break;
 		case TOK_SHOW:
 			err = parse_name_help(argc--, argv++,
@@ -6051,6 +8342,7 @@ int cmd_server(int argc, const char *argv[], struct rnbd_ctx *ctx)
 
 int cmd_both(int argc, const char *argv[], struct rnbd_ctx *ctx)
 {
+	struct rnbd_snapshot *snap = ctx->snap;
 	int err = 0;
 	const struct param *param;
 
@@ -6092,6 +8384,27 @@ int cmd_both(int argc, const char *argv[], struct rnbd_ctx *ctx)
 		case TOK_DUMP:
 			err = cmd_dump_all(argc, argv, param, "", ctx);
 			break;
+		case TOK_SNAPSHOT:
+			err = cmd_snapshot(argc, argv, param, "", ctx);
+			break;
+		case TOK_DIFF:
+			err = cmd_diff(argc, argv, param, "", ctx);
+			break;
+		case TOK_WATCH:
+			err = cmd_watch(argc, argv, param, "", ctx);
+			break;
+		case TOK_DAEMON:
+			err = cmd_daemon(argc, argv, param, "", ctx);
+			break;
+		case TOK_PUBLISH:
+			err = cmd_publish(argc, argv, param, "", ctx);
+			break;
+		case TOK_WAIT:
+			err = cmd_wait(argc, argv, param, "", RNBD_WAIT_ALL, ctx);
+			break;
+		case TOK_APPLY:
+			err = cmd_apply(argc, argv, param, "", ctx);
+			break;
 		case TOK_LIST:
 			err = parse_list_parameters(argc, argv, ctx,
 						    parse_both_devices_clms,
@@ -6099,8 +8412,8 @@ int cmd_both(int argc, const char *argv[], struct rnbd_ctx *ctx)
 			if (err < 0)
 				break;
 
-			err = list_devices(sds_clt, sds_clt_cnt - 1,
-					   sds_srv, sds_srv_cnt - 1,
+			err = list_devices(snap->sds_clt, snap->sds_clt_cnt - 1,
+					   snap->sds_srv, snap->sds_srv_cnt - 1,
 					   false, ctx);
 			break;
 		case TOK_SHOW:
@@ -6225,51 +8538,239 @@ int cmd_start(int argc, const char *argv[], struct rnbd_ctx *ctx)
 	return err;
 }
 
-static int compar_sds_sess(const void *p1, const void *p2)
+/*
+ * The token of the command in
+ *
+ *	[client|server|both] [devices|sessions|paths] <command> ...
+ *
+ * The listings read only the sysfs attributes of the columns they print
+ * and wait reads only the state of the object it waits for, all other
+ * commands get all the attributes read in advance.
+ */
+static enum rnbd_token cmd_tok(int argc, const char *argv[])
 {
-	const struct rnbd_sess_dev *const *sd1 = p1, *const *sd2 = p2;
+	const struct param *param;
+
+	param = argc ? find_param(*argv, params_mode) : NULL;
+	if (param && (param->tok == TOK_CLIENT || param->tok == TOK_SERVER ||
+		      param->tok == TOK_BOTH)) {
+		argc--; argv++;
+	}
+
+	param = argc ? find_param(*argv, params_object_type_client) : NULL;
+	if (param && (param->tok == TOK_DEVICES || param->tok == TOK_SESSIONS ||
+		      param->tok == TOK_PATHS)) {
+		argc--; argv++;
+		param = argc ? find_param(*argv, cmds_client_devices) : NULL;
+	}
 
-	return strcmp((*sd1)->sess->sessname, (*sd2)->sess->sessname);
+	return param ? param->tok : TOK_NONE;
 }
 
-static int compar_sds_dev(const void *p1, const void *p2)
+static const struct param *find_cmd(const char *str)
 {
-	const struct rnbd_sess_dev *const *sd1 = p1, *const *sd2 = p2;
+	static struct param *const *cmds[] = {
+		params_object_type_client, params_object_type_server,
+		cmds_client_devices, cmds_client_sessions, cmds_client_paths,
+		cmds_server_devices, cmds_server_sessions, cmds_server_paths,
+		NULL
+	};
+	const struct param *param = NULL;
+	int i;
 
-	return strcmp((*sd1)->mapping_path, (*sd2)->mapping_path);
+	for (i = 0; cmds[i] && !param; i++)
+		param = find_param(str, cmds[i]);
+
+	return param;
 }
 
-int main(int argc, const char *argv[])
+/*
+ * Complete the names of objects for the commands which expect one
+ *
+ *	-c [client|server|both] [devices|sessions|paths] <command> [prefix]
+ *
+ * without reading sysfs. Returns false if the command line is not
+ * asking for names, it is handled by the commands then.
+ */
+static bool complete_names(int argc, const char *argv[],
+			   const struct rnbd_ctx *ctx)
+{
+	enum rnbdmode side = RNBD_BOTH;
+	const struct param *param;
+	unsigned int objs = 0;
+
+	param = argc ? find_param(*argv, params_mode) : NULL;
+	if (param && (param->tok == TOK_CLIENT || param->tok == TOK_SERVER ||
+		      param->tok == TOK_BOTH)) {
+		if (param->tok == TOK_CLIENT)
+			side = RNBD_CLIENT;
+		else if (param->tok == TOK_SERVER)
+			side = RNBD_SERVER;
+		argc--; argv++;
+	}
+
+	param = argc ? find_cmd(*argv) : NULL;
+	if (param && param->tok == TOK_DEVICES)
+		objs = RNBD_COMPLETE_DEVICES;
+	else if (param && param->tok == TOK_SESSIONS)
+		objs = RNBD_COMPLETE_SESSIONS;
+	else if (param && param->tok == TOK_PATHS)
+		objs = RNBD_COMPLETE_PATHS;
+
+	if (objs) {
+		argc--; argv++;
+		param = argc ? find_cmd(*argv) : NULL;
+	}
+
+	if (!param || argc > 2)
+		return false;
+
+	switch (param->tok) {
+	case TOK_SHOW:
+	case TOK_RECOVER:
+	case TOK_WAIT:
+		if (!objs)
+			objs = RNBD_COMPLETE_DEVICES | RNBD_COMPLETE_SESSIONS |
+			       RNBD_COMPLETE_PATHS;
+		break;
+	case TOK_REMAP:
+		if (!objs)
+			objs = RNBD_COMPLETE_DEVICES | RNBD_COMPLETE_SESSIONS;
+		break;
+	case TOK_UNMAP:
+	case TOK_RESIZE:
+	case TOK_CLOSE:
+		if (!objs)
+			objs = RNBD_COMPLETE_DEVICES;
+		break;
+	case TOK_ADD:
+		/* a path is added to a session */
+		objs = RNBD_COMPLETE_SESSIONS;
+		break;
+	case TOK_RECONNECT:
+	case TOK_DISCONNECT:
+	case TOK_DELETE:
+	case TOK_READD:
+		if (!objs)
+			return false;
+		break;
+	default:
+		return false;
+	}
+
+	rnbd_complete_names(ctx, side, objs, argc > 1 ? argv[1] : NULL);
+
+	return true;
+}
+
+/*
+ * Commands which read the objects from sysfs are sent to the daemon if
+ * there is one, the ones running for long are not: Ctrl-C of the caller
+ * wouldn't reach the daemon's child. That includes map with wait, which
+ * is also assumed if a device called "wait" is mapped, without harm.
+ */
+static bool daemon_tok(enum rnbd_token tok, int argc, const char *argv[])
+{
+	int i;
+
+	if (tok == TOK_MAP)
+		for (i = 0; i < argc; i++)
+			if (!strcmp(argv[i], _params_wait.param_str))
+				return false;
+
+	return tok != TOK_NONE && tok != TOK_WATCH && tok != TOK_WAIT &&
+	       tok != TOK_DAEMON && tok != TOK_PUBLISH;
+}
+
+/*
+ * Commands which only read the objects
+ */
+static bool shm_tok(enum rnbd_token tok)
+{
+	switch (tok) {
+	case TOK_DUMP:
+	case TOK_LIST:
+	case TOK_SHOW:
+	case TOK_SNAPSHOT:
+	case TOK_DIFF:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static unsigned int daemon_flags(enum rnbd_token tok)
+{
+	return shm_tok(tok) ? 0 : RNBD_DAEMON_CHANGE;
+}
+
+/*
+ * Run the command @argv, on the objects @cached if they are read already
+ */
+static int rnbd_main(int argc, const char *argv[],
+		     struct rnbd_snapshot *cached)
 {
+	const char **all_argv = argv;
+	struct rnbd_snapshot snap = {};
+	struct table_layout layout = {};
+	int all_argc = argc;
+	enum rnbd_token tok;
+	bool rnbdd;
 	int ret = 0;
 
 	struct rnbd_ctx ctx;
 
+	out_init();
 	init_rnbd_ctx(&ctx);
+	ctx.snap = &snap;
+	ctx.layout = &layout;
 	parse_argv0(argv[0], &ctx);
 	check_compat_sysfs(&ctx);
+	rnbdd = !strcmp(ctx.pname, "rnbdd");
 
-	ret = rnbd_sysfs_alloc_all(&sds_clt, &sds_srv,
-				    &sess_clt, &sess_srv,
-				    &paths_clt, &paths_srv,
-				    &sds_clt_cnt, &sds_srv_cnt,
-				    &sess_clt_cnt, &sess_srv_cnt,
-				    &paths_clt_cnt, &paths_srv_cnt);
-	if (ret) {
-		ERR(trm, "Failed to alloc memory for sysfs entries: %d\n", ret);
+	ret = parse_cmd_parameters(--argc, ++argv, params_flags,
+				   &ctx, NULL, NULL, 0);
+	if (ret < 0)
+		goto out;
+
+	argc -= ret; argv += ret; ret = 0;
+
+	if (ctx.complete_set && complete_names(argc, argv, &ctx))
+		goto out;
+
+	tok = rnbdd ? TOK_DAEMON : cmd_tok(argc, argv);
+	if (ctx.from_shm_set && tok != TOK_NONE && !shm_tok(tok)) {
+		ERR(trm, "--from-shm only works with dump, list, show, snapshot and diff\n");
+		ret = -EINVAL;
 		goto out;
 	}
+	if (tok == TOK_WAIT || tok == TOK_DAEMON)
+		/* open the state files or read sysfs by themselves */
+		goto start;
 
-	ret = rnbd_sysfs_read_all(sds_clt, sds_srv, sess_clt, sess_srv,
-				   paths_clt, paths_srv);
-	if (ret) {
-		ERR(trm, "Failed to read sysfs entries: %d\n", ret);
-		goto free;
+	if (ctx.from_shm_set && tok != TOK_NONE) {
+		ret = read_shm(&snap);
+		if (ret)
+			goto out;
+	} else {
+		if (!cached && daemon_tok(tok, argc, argv) &&
+		    !rnbd_daemon_call(all_argc, all_argv, daemon_flags(tok),
+				      &ret))
+			goto out;
+
+		if (cached) {
+			snap = *cached;
+		} else {
+			ret = read_sysfs(&snap);
+			if (ret)
+				goto out;
+		}
+		clock_gettime(CLOCK_REALTIME, &snap.ts);
 	}
-	qsort(sds_clt, sds_clt_cnt - 1, sizeof(*sds_clt), compar_sds_dev);
-	qsort(sds_srv, sds_srv_cnt - 1, sizeof(*sds_srv), compar_sds_dev);
-	qsort(sds_clt, sds_clt_cnt - 1, sizeof(*sds_clt), compar_sds_sess);
-	qsort(sds_srv, sds_srv_cnt - 1, sizeof(*sds_srv), compar_sds_sess);
+
+	ret = link_sysfs(&ctx);
+	if (ret)
+		goto free;
 
 	ret = read_port_descs(ctx.port_descs, MAX_PATHS_PER_SESSION);
 	if (ret < 0) {
@@ -6278,20 +8779,16 @@ int main(int argc, const char *argv[])
 		goto free;
 	}
 	ctx.port_cnt = ret; ret = 0;
-
+start:
 	rnbd_ctx_default(&ctx);
 
-	ret = parse_cmd_parameters(--argc, ++argv, params_flags,
-				   &ctx, NULL, NULL, 0);
-	if (ret < 0)
-		goto free;
-
-	argc -= ret; argv += ret;
-
 	INF(ctx.debug_set, "%s using '%s' sysfs.\n",
 	    ctx.pname, get_sysfs_info(&ctx)->path_dev_name);
 
-	if (argc && *argv[0] == '-') {
+	if (rnbdd) {
+		ret = cmd_daemon(argc, argv, &_cmd_daemon, "", &ctx);
+		goto free;
+	} else if (argc && *argv[0] == '-') {
 		handle_unknown_param(*argv, params_flags);
 		help_param(ctx.pname, params_flags_help, &ctx);
 		ret = -EINVAL;
@@ -6301,11 +8798,14 @@ int main(int argc, const char *argv[])
 		ret = -EINVAL;
 		goto free;
 	}
+
+	if (tok != TOK_LIST && tok != TOK_WAIT && tok != TOK_DAEMON)
+		read_attrs(&ctx, RNBD_ATTR_ALL);
+
 	ret = cmd_start(argc, argv, &ctx);
 
 free:
-	rnbd_sysfs_free_all(sds_clt, sds_srv, sess_clt, sess_srv,
-			     paths_clt, paths_srv);
+	rnbd_snapshot_free(&snap);
 out:
 	deinit_rnbd_ctx(&ctx);
 
@@ -6315,3 +8815,8 @@ out:
 
 	return ret;
 }
+
+int main(int argc, const char *argv[])
+{
+	return rnbd_main(argc, argv, NULL);
+}
@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <fcntl.h>	/* for open() */
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	/* for pread() */
+
+#include "sampler.h"
+#include "table.h"
+#include "misc.h"
+
+/* stats/rdma: "<rx cnt> <rx bytes> <tx cnt> <tx bytes> <inflights> <..>" */
+#define RDMA_RX_IDX		1
+#define RDMA_TX_IDX		3
+#define RDMA_INFLIGHTS_IDX	4
+
+/* block stat: "<reads> <merged> <sectors read> <ms> <writes> <merged>
+ *		<sectors written> <ms> <in flight> ..."
+ */
+#define STAT_RX_IDX		2
+#define STAT_TX_IDX		6
+#define STAT_INFLIGHTS_IDX	8
+
+#define STATS_MAX_FIELDS	11
+
+static int grow(void *arr, size_t elem, int size)
+{
+	void *p;
+
+	p = realloc(*(void **)arr, elem * size);
+	if (!p)
+		return -ENOMEM;
+
+	*(void **)arr = p;
+
+	return 0;
+}
+
+static int set_resize(struct rnbd_sampler_set *set, int size)
+{
+	if (grow(&set->free, sizeof(*set->free), size) ||
+	    grow(&set->state_fd, sizeof(*set->state_fd), size) ||
+	    grow(&set->stats_fd, sizeof(*set->stats_fd), size) ||
+	    grow(&set->reconnects_fd, sizeof(*set->reconnects_fd), size) ||
+	    grow(&set->gone, sizeof(*set->gone), size) ||
+	    grow(&set->state, sizeof(*set->state), size) ||
+	    grow(&set->rx, sizeof(*set->rx), size) ||
+	    grow(&set->tx, sizeof(*set->tx), size) ||
+	    grow(&set->inflights, sizeof(*set->inflights), size) ||
+	    grow(&set->reconnects, sizeof(*set->reconnects), size))
+		return -ENOMEM;
+
+	set->size = size;
+
+	return 0;
+}
+
+static int set_init(struct rnbd_sampler_set *set, int size,
+		    int rx_idx, int tx_idx, int inflights_idx)
+{
+	memset(set, 0, sizeof(*set));
+	set->rx_idx = rx_idx;
+	set->tx_idx = tx_idx;
+	set->inflights_idx = inflights_idx;
+
+	return set_resize(set, size > 0 ? size : 16);
+}
+
+static void close_fd(int *fd)
+{
+	if (*fd >= 0)
+		close(*fd);
+	*fd = -1;
+}
+
+static void set_close(struct rnbd_sampler_set *set, int slot)
+{
+	close_fd(&set->state_fd[slot]);
+	close_fd(&set->stats_fd[slot]);
+	close_fd(&set->reconnects_fd[slot]);
+}
+
+static void set_free(struct rnbd_sampler_set *set)
+{
+	int i;
+
+	for (i = 0; i < set->cnt; i++)
+		set_close(set, i);
+
+	free(set->free);
+	free(set->state_fd);
+	free(set->stats_fd);
+	free(set->reconnects_fd);
+	free(set->gone);
+	free(set->state);
+	free(set->rx);
+	free(set->tx);
+	free(set->inflights);
+	free(set->reconnects);
+	memset(set, 0, sizeof(*set));
+}
+
+static int set_get_slot(struct rnbd_sampler_set *set)
+{
+	int slot;
+
+	if (set->free_cnt)
+		slot = set->free[--set->free_cnt];
+	else if (set->cnt < set->size || !set_resize(set, set->size * 2))
+		slot = set->cnt++;
+	else
+		return -ENOMEM;
+
+	set->state_fd[slot] = -1;
+	set->stats_fd[slot] = -1;
+	set->reconnects_fd[slot] = -1;
+	set->gone[slot] = false;
+	set->state[slot][0] = '\0';
+	set->rx[slot] = 0;
+	set->tx[slot] = 0;
+	set->inflights[slot] = 0;
+	set->reconnects[slot] = 0;
+
+	return slot;
+}
+
+static void set_put_slot(struct rnbd_sampler_set *set, int slot)
+{
+	set_close(set, slot);
+	set->gone[slot] = false;
+	set->free[set->free_cnt++] = slot;
+}
+
+static int open_attr(const char *dir, const char *entry)
+{
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, entry) >= sizeof(path))
+		return -1;
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * Returns false if the file disappeared from sysfs
+ */
+static bool read_attr(int fd, char *buf, size_t len)
+{
+	ssize_t ret;
+
+	buf[0] = '\0';
+	if (fd < 0)
+		return true;
+
+	ret = pread(fd, buf, len - 1, 0);
+	if (ret < 0)
+		return errno != ENODEV && errno != ENOENT;
+
+	buf[ret] = '\0';
+
+	return true;
+}
+
+static int parse_fields(const char *buf, uint64_t *v, int n)
+{
+	char *end;
+	int i;
+
+	for (i = 0; i < n; i++, buf = end) {
+		v[i] = strtoull(buf, &end, 10);
+		if (end == buf)
+			break;
+	}
+
+	return i;
+}
+
+static bool set_read(struct rnbd_sampler_set *set, int slot)
+{
+	uint64_t v[STATS_MAX_FIELDS];
+	char buf[256];
+	int n;
+
+	if (set->gone[slot])
+		return false;
+
+	if (!read_attr(set->state_fd[slot], buf, sizeof(buf)))
+		goto gone;
+
+	if (set->state_fd[slot] >= 0) {
+		trim(buf);
+		snprintf(set->state[slot], sizeof(set->state[slot]), "%s", buf);
+	}
+
+	if (!read_attr(set->stats_fd[slot], buf, sizeof(buf)))
+		goto gone;
+
+	n = parse_fields(buf, v, ARRSIZE(v));
+	if (n > set->rx_idx)
+		set->rx[slot] = v[set->rx_idx];
+	if (n > set->tx_idx)
+		set->tx[slot] = v[set->tx_idx];
+	if (n > set->inflights_idx)
+		set->inflights[slot] = v[set->inflights_idx];
+
+	if (!read_attr(set->reconnects_fd[slot], buf, sizeof(buf)))
+		goto gone;
+
+	if (parse_fields(buf, v, 1))
+		set->reconnects[slot] = v[0];
+
+	return true;
+
+gone:
+	set_close(set, slot);
+	set->gone[slot] = true;
+
+	return false;
+}
+
+static int set_sample(struct rnbd_sampler_set *set)
+{
+	int i, gone = 0;
+
+	/* released slots have no open files and cost nothing */
+	for (i = 0; i < set->cnt; i++)
+		if (!set->gone[i] && !set_read(set, i))
+			gone++;
+
+	return gone;
+}
+
+int rnbd_sampler_init(struct rnbd_sampler *smp, int paths, int devs)
+{
+	int ret;
+
+	memset(smp, 0, sizeof(*smp));
+
+	ret = set_init(&smp->paths, paths, RDMA_RX_IDX, RDMA_TX_IDX,
+		       RDMA_INFLIGHTS_IDX);
+	if (ret)
+		goto err;
+
+	ret = set_init(&smp->devs, devs, STAT_RX_IDX, STAT_TX_IDX,
+		       STAT_INFLIGHTS_IDX);
+	if (ret)
+		goto err;
+
+	return 0;
+
+err:
+	rnbd_sampler_free(smp);
+
+	return ret;
+}
+
+void rnbd_sampler_free(struct rnbd_sampler *smp)
+{
+	set_free(&smp->paths);
+	set_free(&smp->devs);
+}
+
+int rnbd_sampler_add_path(struct rnbd_sampler *smp, const char *dir,
+			  unsigned int attrs)
+{
+	struct rnbd_sampler_set *set = &smp->paths;
+	int slot;
+
+	slot = set_get_slot(set);
+	if (slot < 0)
+		return slot;
+
+	if (attrs & RNBD_SMP_STATE)
+		set->state_fd[slot] = open_attr(dir, "state");
+	if (attrs & RNBD_SMP_STATS)
+		set->stats_fd[slot] = open_attr(dir, "stats/rdma");
+	if (attrs & RNBD_SMP_RECONNECTS)
+		set->reconnects_fd[slot] = open_attr(dir, "stats/reconnects");
+
+	return slot;
+}
+
+int rnbd_sampler_add_dev(struct rnbd_sampler *smp, const char *blkdir,
+			 const char *rnbddir, unsigned int attrs)
+{
+	struct rnbd_sampler_set *set = &smp->devs;
+	int slot;
+
+	slot = set_get_slot(set);
+	if (slot < 0)
+		return slot;
+
+	if ((attrs & RNBD_SMP_STATE) && rnbddir)
+		set->state_fd[slot] = open_attr(rnbddir, "state");
+	if ((attrs & RNBD_SMP_STATS) && blkdir)
+		set->stats_fd[slot] = open_attr(blkdir, "stat");
+
+	return slot;
+}
+
+void rnbd_sampler_del_path(struct rnbd_sampler *smp, int slot)
+{
+	set_put_slot(&smp->paths, slot);
+}
+
+void rnbd_sampler_del_dev(struct rnbd_sampler *smp, int slot)
+{
+	set_put_slot(&smp->devs, slot);
+}
+
+bool rnbd_sampler_read_path(struct rnbd_sampler *smp, int slot)
+{
+	return set_read(&smp->paths, slot);
+}
+
+bool rnbd_sampler_read_dev(struct rnbd_sampler *smp, int slot)
+{
+	return set_read(&smp->devs, slot);
+}
+
+int rnbd_sampler_sample(struct rnbd_sampler *smp)
+{
+	clock_gettime(CLOCK_MONOTONIC, &smp->ts);
+
+	return set_sample(&smp->paths) + set_sample(&smp->devs);
+}
@@ -0,0 +1,100 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_SAMPLER
+#define __H_SAMPLER
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define RNBD_SAMPLER_STATE_LEN 32
+
+/* attributes to sample for an object */
+enum {
+	RNBD_SMP_STATE		= 1,		/* state */
+	RNBD_SMP_STATS		= 1 << 1,	/* stats/rdma or block stat */
+	RNBD_SMP_RECONNECTS	= 1 << 2,	/* stats/reconnects */
+	RNBD_SMP_ALL		= RNBD_SMP_STATE | RNBD_SMP_STATS |
+				  RNBD_SMP_RECONNECTS,
+};
+
+/*
+ * Sampled objects of one kind. Objects are identified by their slot
+ * number, every attribute is kept in its own array indexed by the slot.
+ * The sysfs files are opened when an object is added and re-read with
+ * pread() on every sample.
+ */
+struct rnbd_sampler_set {
+	int		cnt;		/* slots handed out so far */
+	int		size;		/* slots allocated */
+	int		*free;		/* stack of released slots */
+	int		free_cnt;
+
+	/* where to find the counters in the stats file */
+	int		rx_idx;
+	int		tx_idx;
+	int		inflights_idx;
+
+	int		*state_fd;
+	int		*stats_fd;
+	int		*reconnects_fd;
+	bool		*gone;		/* object disappeared from sysfs */
+
+	char		(*state)[RNBD_SAMPLER_STATE_LEN];
+	uint64_t	*rx;		/* bytes for paths, sectors for devices */
+	uint64_t	*tx;
+	int		*inflights;
+	int		*reconnects;
+};
+
+struct rnbd_sampler {
+	struct rnbd_sampler_set	paths;
+	struct rnbd_sampler_set	devs;
+	struct timespec		ts;	/* CLOCK_MONOTONIC of last sample */
+};
+
+/*
+ * Preallocate @smp for @paths paths and @devs devices, it grows on demand
+ */
+int rnbd_sampler_init(struct rnbd_sampler *smp, int paths, int devs);
+void rnbd_sampler_free(struct rnbd_sampler *smp);
+
+/*
+ * Open the @attrs files of the path in sysfs directory @dir.
+ * Returns the slot of the path or negative error code.
+ */
+int rnbd_sampler_add_path(struct rnbd_sampler *smp, const char *dir,
+			  unsigned int attrs);
+
+/*
+ * Open the stat file in block device directory @blkdir and the state
+ * file in @rnbddir (NULL for devices of the server).
+ * Returns the slot of the device or negative error code.
+ */
+int rnbd_sampler_add_dev(struct rnbd_sampler *smp, const char *blkdir,
+			 const char *rnbddir, unsigned int attrs);
+
+void rnbd_sampler_del_path(struct rnbd_sampler *smp, int slot);
+void rnbd_sampler_del_dev(struct rnbd_sampler *smp, int slot);
+
+/*
+ * Re-read the attributes of a single object.
+ * Returns false if the object is gone, its files are closed then.
+ */
+bool rnbd_sampler_read_path(struct rnbd_sampler *smp, int slot);
+bool rnbd_sampler_read_dev(struct rnbd_sampler *smp, int slot);
+
+/*
+ * Re-read the attributes of all objects.
+ * Returns the number of objects which disappeared since the last sample.
+ */
+int rnbd_sampler_sample(struct rnbd_sampler *smp);
+
+#endif /* __H_SAMPLER */
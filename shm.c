@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm.h"
+
+#define SHM_MIN_SIZE	(64 * 1024)
+
+/* a reader gives up if the publisher keeps it from a copy for ~1s */
+#define SHM_TRIES	10000
+#define SHM_RETRY_NS	100000
+
+/* replacing segments is rare, a reader follows a few of them */
+#define SHM_REOPEN	3
+
+/* a reader holds the lock for a moment to tell if a publisher runs */
+#define SHM_LOCK_TRIES	10
+#define SHM_LOCK_NS	1000000
+
+static void shm_unmap(struct rnbd_shm *shm)
+{
+	munmap(shm->hdr, shm->map_len);
+	close(shm->fd);
+	shm->hdr = NULL;
+	shm->fd = -1;
+}
+
+/*
+ * Create a segment for snapshots up to @size bytes in @tmp. The publisher
+ * keeps it flocked, so the next one knows it is running.
+ */
+static int shm_new(struct rnbd_shm *shm, size_t size, char *tmp, size_t n)
+{
+	struct rnbd_shm_hdr *hdr;
+	size_t map_len;
+	int fd, err;
+
+	snprintf(tmp, n, "%s.%d", RNBD_SHM_PATH, getpid());
+
+	fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	map_len = sizeof(*hdr) + size;
+	if (flock(fd, LOCK_EX | LOCK_NB) || ftruncate(fd, map_len)) {
+		err = -errno;
+		goto err;
+	}
+
+	hdr = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (hdr == MAP_FAILED) {
+		err = -errno;
+		goto err;
+	}
+
+	memcpy(hdr->magic, RNBD_SHM_MAGIC, sizeof(hdr->magic));
+	hdr->version = RNBD_SHM_VERSION;
+	hdr->hdr_size = sizeof(*hdr);
+	hdr->size = size;
+
+	shm->fd = fd;
+	shm->hdr = hdr;
+	shm->map_len = map_len;
+
+	return 0;
+
+err:
+	close(fd);
+	unlink(tmp);
+	return err;
+}
+
+static void shm_write(struct rnbd_shm_hdr *hdr, const char *buf, size_t len)
+{
+	uint64_t seq = hdr->seq;
+
+	__atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(hdr + 1, buf, len);
+	__atomic_store_n(&hdr->len, len, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+int rnbd_shm_create(struct rnbd_shm *shm)
+{
+	const struct timespec delay = { .tv_nsec = SHM_LOCK_NS };
+	char tmp[PATH_MAX];
+	int fd, i, err;
+
+	fd = open(RNBD_SHM_PATH, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		for (i = 0; i < SHM_LOCK_TRIES; i++) {
+			err = flock(fd, LOCK_EX | LOCK_NB) ? -errno : 0;
+			if (err != -EWOULDBLOCK)
+				break;
+			nanosleep(&delay, NULL);
+		}
+		close(fd);
+		if (err == -EWOULDBLOCK)
+			return -EBUSY;
+	}
+
+	err = shm_new(shm, SHM_MIN_SIZE, tmp, sizeof(tmp));
+	if (err)
+		return err;
+
+	if (rename(tmp, RNBD_SHM_PATH)) {
+		err = -errno;
+		unlink(tmp);
+		shm_unmap(shm);
+		return err;
+	}
+
+	return 0;
+}
+
+int rnbd_shm_publish(struct rnbd_shm *shm, const char *buf, size_t len)
+{
+	struct rnbd_shm old = *shm;
+	char tmp[PATH_MAX];
+	int err;
+
+	if (len <= shm->hdr->size) {
+		shm_write(shm->hdr, buf, len);
+		return 0;
+	}
+
+	/*
+	 * Fill the new segment before it replaces the old one, readers
+	 * opening it never see it empty.
+	 */
+	err = shm_new(shm, 2 * len, tmp, sizeof(tmp));
+	if (err) {
+		*shm = old;
+		return err;
+	}
+
+	shm_write(shm->hdr, buf, len);
+
+	if (rename(tmp, RNBD_SHM_PATH)) {
+		err = -errno;
+		unlink(tmp);
+		shm_unmap(shm);
+		*shm = old;
+		return err;
+	}
+
+	__atomic_store_n(&old.hdr->replaced, 1, __ATOMIC_RELEASE);
+	shm_unmap(&old);
+
+	return 0;
+}
+
+void rnbd_shm_close(struct rnbd_shm *shm)
+{
+	shm_unmap(shm);
+}
+
+/*
+ * Copy the snapshot out of the segment currently at RNBD_SHM_PATH.
+ * Sets @replaced if a newer segment took its place.
+ */
+static int shm_read_once(char **buf, size_t *len, bool *live, int *replaced)
+{
+	const struct timespec delay = { .tv_nsec = SHM_RETRY_NS };
+	const struct rnbd_shm_hdr *hdr;
+	uint64_t seq, l;
+	struct stat st;
+	char *copy;
+	void *map;
+	int fd, i, err;
+
+	fd = open(RNBD_SHM_PATH, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	/* the publisher keeps the segment flocked */
+	*live = flock(fd, LOCK_SH | LOCK_NB) && errno == EWOULDBLOCK;
+	if (!*live)
+		flock(fd, LOCK_UN);
+
+	if (st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	err = map == MAP_FAILED ? -errno : 0;
+	close(fd);
+	if (err)
+		return err;
+
+	hdr = map;
+	if (memcmp(hdr->magic, RNBD_SHM_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != RNBD_SHM_VERSION ||
+	    hdr->hdr_size != sizeof(*hdr) ||
+	    hdr->size > st.st_size - sizeof(*hdr)) {
+		err = -EINVAL;
+		goto unmap;
+	}
+
+	copy = malloc(hdr->size ? hdr->size : 1);
+	if (!copy) {
+		err = -ENOMEM;
+		goto unmap;
+	}
+
+	err = -EAGAIN;
+	for (i = 0; i < SHM_TRIES; i++) {
+		seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+		if (!seq) {
+			err = -ENOENT;
+			break;
+		}
+		if (!(seq & 1)) {
+			l = __atomic_load_n(&hdr->len, __ATOMIC_RELAXED);
+			if (l <= hdr->size) {
+				memcpy(copy, hdr + 1, l);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&hdr->seq,
+						    __ATOMIC_RELAXED) == seq) {
+					err = 0;
+					break;
+				}
+			}
+		}
+		nanosleep(&delay, NULL);
+	}
+
+	*replaced = __atomic_load_n(&hdr->replaced, __ATOMIC_ACQUIRE);
+
+	if (err) {
+		free(copy);
+	} else {
+		*buf = copy;
+		*len = l;
+	}
+
+unmap:
+	munmap(map, st.st_size);
+	return err;
+}
+
+int rnbd_shm_read(char **buf, size_t *len, bool *live)
+{
+	int i, err, replaced;
+
+	for (i = 0; i < SHM_REOPEN; i++) {
+		replaced = 0;
+		err = shm_read_once(buf, len, live, &replaced);
+		if (!replaced)
+			return err;
+		if (!err)
+			free(*buf);
+	}
+
+	return -EAGAIN;
+}
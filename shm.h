@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_SHM
+#define __H_SHM
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RNBD_SHM_PATH		"/dev/shm/rnbd"
+#define RNBD_SHM_MAGIC		"RNBDSHM"
+#define RNBD_SHM_VERSION	1
+
+/*
+ * Layout of the shared memory segment:
+ *
+ *   struct rnbd_shm_hdr
+ *   char                [size]  snapshot as of rnbd_snapshot_encode()
+ *
+ * The publisher makes @seq odd before it changes the snapshot and even
+ * again after. Readers copy the snapshot out and retry if @seq was odd
+ * or changed meanwhile, nobody ever waits for a reader.
+ * A snapshot not fitting into @size goes to a new segment which replaces
+ * the file, the old one gets @replaced set.
+ */
+struct rnbd_shm_hdr {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	hdr_size;
+	uint64_t	seq;
+	uint64_t	size;
+	uint64_t	len;		/* of the current snapshot */
+	uint32_t	replaced;
+	uint32_t	reserved;
+};
+
+struct rnbd_shm {
+	int			fd;
+	struct rnbd_shm_hdr	*hdr;
+	size_t			map_len;
+};
+
+/*
+ * Create the segment for rnbd_shm_publish(). Fails with -EBUSY if
+ * another publisher is running.
+ */
+int rnbd_shm_create(struct rnbd_shm *shm);
+
+/*
+ * Make the @len bytes at @buf the current snapshot of the segment
+ */
+int rnbd_shm_publish(struct rnbd_shm *shm, const char *buf, size_t len);
+
+/*
+ * Stop publishing. The last snapshot stays readable until the next
+ * publisher replaces it, rnbd_shm_read() tells that it is stale.
+ */
+void rnbd_shm_close(struct rnbd_shm *shm);
+
+/*
+ * Copy the current snapshot out of the segment into a buffer allocated
+ * for it. Returns -ENOENT if nothing is published. @live is cleared if
+ * no publisher is running, the snapshot may be arbitrarily old then.
+ */
+int rnbd_shm_read(char **buf, size_t *len, bool *live);
+
+#endif /* __H_SHM */
@@ -0,0 +1,626 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <stdio.h>	/* for fopen() */
+#include <stdlib.h>	/* for calloc() */
+#include <string.h>
+#include <sys/stat.h>	/* for fstat() */
+#include <unistd.h>	/* for unlink() */
+
+#include "snapshot.h"
+#include "hash.h"
+#include "table.h"
+#include "misc.h"
+#include "rnbd-sysfs.h"
+
+struct strtab {
+	char		*buf;
+	size_t		len;
+	size_t		size;
+	struct rnbd_hash idx;	/* string -> offset, to store each only once */
+};
+
+static int strtab_init(struct strtab *t)
+{
+	t->size = 4096;
+	t->buf = malloc(t->size);
+	if (!t->buf)
+		return -ENOMEM;
+
+	/* offset 0 is the empty string */
+	t->buf[0] = '\0';
+	t->len = 1;
+
+	return rnbd_hash_init(&t->idx, 64);
+}
+
+static void strtab_free(struct strtab *t)
+{
+	rnbd_hash_free(&t->idx);
+	free(t->buf);
+}
+
+static int strtab_add(struct strtab *t, const char *str, uint32_t *off)
+{
+	size_t len;
+	void *v;
+	char *b;
+
+	if (!*str) {
+		*off = 0;
+		return 0;
+	}
+
+	v = rnbd_hash_find(&t->idx, str);
+	if (v) {
+		*off = (uint32_t)(uintptr_t)v;
+		return 0;
+	}
+
+	len = strlen(str) + 1;
+	if (t->len + len > t->size) {
+		while (t->len + len > t->size)
+			t->size *= 2;
+
+		b = realloc(t->buf, t->size);
+		if (!b)
+			return -ENOMEM;
+		t->buf = b;
+	}
+
+	memcpy(t->buf + t->len, str, len);
+	*off = t->len;
+	t->len += len;
+
+	return rnbd_hash_add(&t->idx, str, (void *)(uintptr_t)*off);
+}
+
+static uint32_t arr_cnt(void **arr)
+{
+	uint32_t cnt = 0;
+
+	while (arr && arr[cnt])
+		cnt++;
+
+	return cnt;
+}
+
+static void sess_key(char *key, size_t len, const struct rnbd_sess *s)
+{
+	snprintf(key, len, "%c%s", s->side == RNBD_CLIENT ? 'c' : 's',
+		 s->sessname);
+}
+
+static int snap_save_sess(const struct rnbd_sess *s,
+			  struct rnbd_snap_sess *ss,
+			  struct rnbd_snap_path *sp, uint32_t *path_idx,
+			  struct strtab *t)
+{
+	const struct rnbd_path *p;
+	int i, ret = 0;
+
+	ss->side = s->side;
+	ret |= strtab_add(t, s->sessname, &ss->sessname);
+	ret |= strtab_add(t, s->mp, &ss->mp);
+	ret |= strtab_add(t, s->mp_short, &ss->mp_short);
+	ret |= strtab_add(t, s->hostname, &ss->hostname);
+
+	for (i = 0; s->paths && s->paths[i]; i++, sp++) {
+		p = s->paths[i];
+
+		ret |= strtab_add(t, p->pathname, &sp->pathname);
+		ret |= strtab_add(t, p->src_addr, &sp->src_addr);
+		ret |= strtab_add(t, p->dst_addr, &sp->dst_addr);
+		ret |= strtab_add(t, p->hca_name, &sp->hca_name);
+		ret |= strtab_add(t, p->state, &sp->state);
+		sp->hca_port = p->hca_port;
+		sp->inflights = *p->inflights;
+		sp->reconnects = *p->reconnects;
+		sp->rx_bytes = *p->rx_bytes;
+		sp->tx_bytes = *p->tx_bytes;
+	}
+	ss->path_cnt = i;
+	*path_idx += i;
+
+	return ret ? -ENOMEM : 0;
+}
+
+int rnbd_snapshot_encode(const struct rnbd_snapshot *snap, char **buf,
+			 size_t *len)
+{
+	struct rnbd_sess **sessions[] = { snap->sess_clt, snap->sess_srv };
+	struct rnbd_sess_dev **sds[] = { snap->sds_clt, snap->sds_srv };
+	struct rnbd_snap_hdr hdr = {
+		.magic = RNBD_SNAP_MAGIC,
+		.version = RNBD_SNAP_VERSION,
+		.hdr_size = sizeof(hdr),
+		.tv_sec = snap->ts.tv_sec,
+		.tv_nsec = snap->ts.tv_nsec,
+	};
+	struct rnbd_snap_sess *ss = NULL;
+	struct rnbd_snap_path *sp = NULL;
+	struct rnbd_snap_dev *sdev = NULL;
+	struct rnbd_snap_sd *ssd = NULL;
+	struct rnbd_hash dev_idx, sess_idx;
+	char key[NAME_MAX + 2], *p;
+	struct rnbd_sess_dev *sd;
+	uint32_t i, j, n, pi;
+	struct strtab t;
+	size_t size;
+	void *v;
+	int ret;
+
+	hdr.dev_cnt = arr_cnt((void **)snap->devs);
+	hdr.sess_cnt = arr_cnt((void **)snap->sess_clt) +
+		       arr_cnt((void **)snap->sess_srv);
+	/* paths are stored as found in sess->paths */
+	for (i = 0; i < ARRSIZE(sessions); i++)
+		for (j = 0; sessions[i] && sessions[i][j]; j++)
+			hdr.path_cnt += arr_cnt((void **)sessions[i][j]->paths);
+	hdr.sd_cnt = arr_cnt((void **)snap->sds_clt) +
+		     arr_cnt((void **)snap->sds_srv);
+
+	ret = strtab_init(&t);
+	if (ret)
+		return ret;
+
+	ret = rnbd_hash_init(&dev_idx, hdr.dev_cnt);
+	if (ret)
+		goto free_strtab;
+
+	ret = rnbd_hash_init(&sess_idx, hdr.sess_cnt);
+	if (ret)
+		goto free_dev_idx;
+
+	ret = -ENOMEM;
+	sdev = calloc(hdr.dev_cnt + 1, sizeof(*sdev));
+	ss = calloc(hdr.sess_cnt + 1, sizeof(*ss));
+	sp = calloc(hdr.path_cnt + 1, sizeof(*sp));
+	ssd = calloc(hdr.sd_cnt + 1, sizeof(*ssd));
+	if (!sdev || !ss || !sp || !ssd)
+		goto free_recs;
+
+	for (i = 0; i < hdr.dev_cnt; i++) {
+		if (strtab_add(&t, snap->devs[i]->devname, &sdev[i].devname) ||
+		    strtab_add(&t, snap->devs[i]->state, &sdev[i].state) ||
+		    rnbd_hash_add(&dev_idx, snap->devs[i]->devname,
+				  (void *)(uintptr_t)(i + 1)))
+			goto free_recs;
+
+		sdev[i].rx_sect = *snap->devs[i]->rx_sect;
+		sdev[i].tx_sect = *snap->devs[i]->tx_sect;
+	}
+
+	for (n = 0, pi = 0, i = 0; i < ARRSIZE(sessions); i++) {
+		for (j = 0; sessions[i] && sessions[i][j]; j++, n++) {
+			ret = snap_save_sess(sessions[i][j], &ss[n], &sp[pi],
+					     &pi, &t);
+			if (ret)
+				goto free_recs;
+
+			sess_key(key, sizeof(key), sessions[i][j]);
+			ret = rnbd_hash_add(&sess_idx, key,
+					    (void *)(uintptr_t)(n + 1));
+			if (ret)
+				goto free_recs;
+		}
+	}
+
+	ret = -EINVAL;
+	for (n = 0, i = 0; i < ARRSIZE(sds); i++) {
+		for (j = 0; sds[i] && sds[i][j]; j++, n++) {
+			sd = sds[i][j];
+
+			sess_key(key, sizeof(key), sd->sess);
+			v = rnbd_hash_find(&sess_idx, key);
+			if (!v)
+				goto free_recs;
+			ssd[n].sess = (uintptr_t)v - 1;
+
+			v = rnbd_hash_find(&dev_idx, sd->dev->devname);
+			if (!v)
+				goto free_recs;
+			ssd[n].dev = (uintptr_t)v - 1;
+
+			if (strtab_add(&t, sd->mapping_path,
+				       &ssd[n].mapping_path) ||
+			    strtab_add(&t, sd->access_mode,
+				       &ssd[n].access_mode)) {
+				ret = -ENOMEM;
+				goto free_recs;
+			}
+		}
+	}
+	hdr.str_len = t.len;
+
+	size = sizeof(hdr) + hdr.dev_cnt * sizeof(*sdev) +
+	       hdr.sess_cnt * sizeof(*ss) + hdr.path_cnt * sizeof(*sp) +
+	       hdr.sd_cnt * sizeof(*ssd) + t.len;
+	p = malloc(size);
+	if (!p) {
+		ret = -ENOMEM;
+		goto free_recs;
+	}
+	*buf = p;
+	*len = size;
+
+	memcpy(p, &hdr, sizeof(hdr));
+	p += sizeof(hdr);
+	memcpy(p, sdev, hdr.dev_cnt * sizeof(*sdev));
+	p += hdr.dev_cnt * sizeof(*sdev);
+	memcpy(p, ss, hdr.sess_cnt * sizeof(*ss));
+	p += hdr.sess_cnt * sizeof(*ss);
+	memcpy(p, sp, hdr.path_cnt * sizeof(*sp));
+	p += hdr.path_cnt * sizeof(*sp);
+	memcpy(p, ssd, hdr.sd_cnt * sizeof(*ssd));
+	p += hdr.sd_cnt * sizeof(*ssd);
+	memcpy(p, t.buf, t.len);
+	ret = 0;
+
+free_recs:
+	free(ssd);
+	free(sp);
+	free(ss);
+	free(sdev);
+	rnbd_hash_free(&sess_idx);
+free_dev_idx:
+	rnbd_hash_free(&dev_idx);
+free_strtab:
+	strtab_free(&t);
+
+	return ret;
+}
+
+int rnbd_snapshot_save(const char *file, const struct rnbd_snapshot *snap)
+{
+	char tmp[PATH_MAX], *buf;
+	size_t len;
+	FILE *f;
+	int ret;
+
+	ret = rnbd_snapshot_encode(snap, &buf, &len);
+	if (ret)
+		return ret;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	f = fopen(tmp, "w");
+	if (!f) {
+		ret = -errno;
+		goto free_buf;
+	}
+
+	if (fwrite(buf, 1, len, f) != len) {
+		ret = -errno;
+		fclose(f);
+		unlink(tmp);
+		goto free_buf;
+	}
+
+	if (fclose(f)) {
+		ret = -errno;
+		unlink(tmp);
+		goto free_buf;
+	}
+
+	if (rename(tmp, file)) {
+		ret = -errno;
+		unlink(tmp);
+	}
+
+free_buf:
+	free(buf);
+
+	return ret;
+}
+
+static int snap_strcpy(char *dst, size_t len, const char *strtab,
+		       uint32_t str_len, uint32_t off)
+{
+	if (off >= str_len)
+		return -EINVAL;
+
+	snprintf(dst, len, "%s", strtab + off);
+
+	return 0;
+}
+
+static int snap_load_paths(const struct rnbd_snap_sess *ss,
+			   const struct rnbd_snap_path *sp,
+			   struct rnbd_sess *s, struct rnbd_path **paths,
+			   struct rnbd_counters *c,
+			   const char *strtab, uint32_t str_len)
+{
+	struct rnbd_path *p;
+	uint32_t i;
+	int ret = 0;
+
+	s->path_id = c->path_cnt;
+	if (!ss->path_cnt)
+		return 0;
+
+	s->paths = calloc(ss->path_cnt + 1, sizeof(*s->paths));
+	if (!s->paths)
+		return -ENOMEM;
+
+	for (i = 0; i < ss->path_cnt; i++, sp++) {
+		p = calloc(1, sizeof(*p));
+		if (!p)
+			return -ENOMEM;
+
+		*paths++ = p;
+		s->paths[i] = p;
+		s->path_cnt++;
+
+		if (rnbd_counters_add_path(c, p))
+			return -EINVAL;
+
+		ret |= snap_strcpy(p->pathname, sizeof(p->pathname),
+				   strtab, str_len, sp->pathname);
+		ret |= snap_strcpy(p->src_addr, sizeof(p->src_addr),
+				   strtab, str_len, sp->src_addr);
+		ret |= snap_strcpy(p->dst_addr, sizeof(p->dst_addr),
+				   strtab, str_len, sp->dst_addr);
+		ret |= snap_strcpy(p->hca_name, sizeof(p->hca_name),
+				   strtab, str_len, sp->hca_name);
+		ret |= snap_strcpy(p->state, sizeof(p->state),
+				   strtab, str_len, sp->state);
+		rnbd_addr_parse(&p->src, p->src_addr);
+		rnbd_addr_parse(&p->dst, p->dst_addr);
+		p->hca_port = sp->hca_port;
+		*p->inflights = sp->inflights;
+		*p->reconnects = sp->reconnects;
+		*p->rx_bytes = sp->rx_bytes;
+		*p->tx_bytes = sp->tx_bytes;
+
+		rnbd_sess_account_path(s, p);
+	}
+	rnbd_counters_sum_sess(c, s);
+
+	return ret ? -EINVAL : 0;
+}
+
+static int snap_load(const char *buf, size_t size, struct rnbd_snapshot *snap)
+{
+	const struct rnbd_snap_hdr *hdr = (const void *)buf;
+	const struct rnbd_snap_dev *sdev;
+	const struct rnbd_snap_sess *ss;
+	const struct rnbd_snap_path *sp;
+	const struct rnbd_snap_sd *ssd;
+	uint32_t i, clt_cnt = 0, clt_path_cnt = 0, clt_sd_cnt = 0, pi;
+	uint32_t s_clt = 0, s_srv = 0, p_clt = 0, p_srv = 0;
+	uint32_t d_clt = 0, d_srv = 0;
+	struct rnbd_sess **sess_by_idx, *s;
+	struct rnbd_path **paths;
+	struct rnbd_sess_dev *sd;
+	const char *strtab;
+	struct rnbd_dev *d;
+	uint64_t expected;
+	int ret = -EINVAL;
+
+	if (size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, RNBD_SNAP_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != RNBD_SNAP_VERSION ||
+	    hdr->hdr_size != sizeof(*hdr))
+		return -EINVAL;
+
+	expected = sizeof(*hdr) +
+		   (uint64_t)hdr->dev_cnt * sizeof(*sdev) +
+		   (uint64_t)hdr->sess_cnt * sizeof(*ss) +
+		   (uint64_t)hdr->path_cnt * sizeof(*sp) +
+		   (uint64_t)hdr->sd_cnt * sizeof(*ssd) +
+		   hdr->str_len;
+	if (expected != size || !hdr->str_len)
+		return -EINVAL;
+
+	sdev = (const void *)(hdr + 1);
+	ss = (const void *)(sdev + hdr->dev_cnt);
+	sp = (const void *)(ss + hdr->sess_cnt);
+	ssd = (const void *)(sp + hdr->path_cnt);
+	strtab = (const char *)(ssd + hdr->sd_cnt);
+
+	if (strtab[hdr->str_len - 1] != '\0')
+		return -EINVAL;
+
+	snap->ts.tv_sec = hdr->tv_sec;
+	snap->ts.tv_nsec = hdr->tv_nsec;
+
+	for (pi = 0, i = 0; i < hdr->sess_cnt; i++) {
+		if (ss[i].side != RNBD_CLIENT && ss[i].side != RNBD_SERVER)
+			return -EINVAL;
+		if (ss[i].path_cnt > hdr->path_cnt - pi)
+			return -EINVAL;
+		if (ss[i].side == RNBD_CLIENT) {
+			clt_cnt++;
+			clt_path_cnt += ss[i].path_cnt;
+		}
+		pi += ss[i].path_cnt;
+	}
+
+	for (i = 0; i < hdr->sd_cnt; i++) {
+		if (ssd[i].sess >= hdr->sess_cnt || ssd[i].dev >= hdr->dev_cnt)
+			return -EINVAL;
+		if (ss[ssd[i].sess].side == RNBD_CLIENT)
+			clt_sd_cnt++;
+	}
+
+	ret = rnbd_counters_alloc(&snap->counters, hdr->path_cnt,
+				  hdr->dev_cnt);
+	if (ret)
+		return ret;
+	ret = -EINVAL;
+
+	sess_by_idx = calloc(hdr->sess_cnt + 1, sizeof(*sess_by_idx));
+	snap->devs = calloc(hdr->dev_cnt + 1, sizeof(*snap->devs));
+	snap->sess_clt = calloc(clt_cnt + 1, sizeof(*snap->sess_clt));
+	snap->sess_srv = calloc(hdr->sess_cnt - clt_cnt + 1,
+				sizeof(*snap->sess_srv));
+	snap->paths_clt = calloc(clt_path_cnt + 1, sizeof(*snap->paths_clt));
+	snap->paths_srv = calloc(hdr->path_cnt - clt_path_cnt + 1,
+				 sizeof(*snap->paths_srv));
+	snap->sds_clt = calloc(clt_sd_cnt + 1, sizeof(*snap->sds_clt));
+	snap->sds_srv = calloc(hdr->sd_cnt - clt_sd_cnt + 1,
+			       sizeof(*snap->sds_srv));
+	snap->sess_clt_cnt = clt_cnt + 1;
+	snap->sess_srv_cnt = hdr->sess_cnt - clt_cnt + 1;
+	snap->paths_clt_cnt = clt_path_cnt + 1;
+	snap->paths_srv_cnt = hdr->path_cnt - clt_path_cnt + 1;
+	snap->sds_clt_cnt = clt_sd_cnt + 1;
+	snap->sds_srv_cnt = hdr->sd_cnt - clt_sd_cnt + 1;
+	/* a snapshot has all the attributes */
+	snap->attrs_read = RNBD_ATTR_ALL;
+	if (!sess_by_idx || !snap->devs || !snap->sess_clt ||
+	    !snap->sess_srv || !snap->paths_clt || !snap->paths_srv ||
+	    !snap->sds_clt || !snap->sds_srv) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < hdr->dev_cnt; i++) {
+		d = calloc(1, sizeof(*d));
+		if (!d) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		snap->devs[i] = d;
+
+		if (rnbd_counters_add_dev(&snap->counters, d))
+			goto out;
+
+		if (snap_strcpy(d->devname, sizeof(d->devname), strtab,
+				hdr->str_len, sdev[i].devname) ||
+		    snap_strcpy(d->state, sizeof(d->state), strtab,
+				hdr->str_len, sdev[i].state))
+			goto out;
+
+		snprintf(d->devpath, sizeof(d->devpath), "/dev/%s",
+			 d->devname);
+		*d->rx_sect = sdev[i].rx_sect;
+		*d->tx_sect = sdev[i].tx_sect;
+	}
+
+	for (i = 0; i < hdr->sess_cnt; i++) {
+		s = calloc(1, sizeof(*s));
+		if (!s) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		if (ss[i].side == RNBD_CLIENT) {
+			snap->sess_clt[s_clt++] = s;
+			paths = &snap->paths_clt[p_clt];
+			p_clt += ss[i].path_cnt;
+		} else {
+			snap->sess_srv[s_srv++] = s;
+			paths = &snap->paths_srv[p_srv];
+			p_srv += ss[i].path_cnt;
+		}
+		sess_by_idx[i] = s;
+
+		s->side = ss[i].side;
+		if (snap_strcpy(s->sessname, sizeof(s->sessname), strtab,
+				hdr->str_len, ss[i].sessname) ||
+		    snap_strcpy(s->mp, sizeof(s->mp), strtab,
+				hdr->str_len, ss[i].mp) ||
+		    snap_strcpy(s->mp_short, sizeof(s->mp_short), strtab,
+				hdr->str_len, ss[i].mp_short) ||
+		    snap_strcpy(s->hostname, sizeof(s->hostname), strtab,
+				hdr->str_len, ss[i].hostname))
+			goto out;
+
+		ret = snap_load_paths(&ss[i], sp, s, paths, &snap->counters,
+				      strtab, hdr->str_len);
+		if (ret)
+			goto out;
+		ret = -EINVAL;
+
+		sp += ss[i].path_cnt;
+	}
+
+	for (i = 0; i < hdr->sd_cnt; i++) {
+		sd = calloc(1, sizeof(*sd));
+		if (!sd) {
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		s = sess_by_idx[ssd[i].sess];
+		if (s->side == RNBD_CLIENT)
+			snap->sds_clt[d_clt++] = sd;
+		else
+			snap->sds_srv[d_srv++] = sd;
+
+		sd->sess = s;
+		sd->dev = snap->devs[ssd[i].dev];
+		if (snap_strcpy(sd->mapping_path, sizeof(sd->mapping_path),
+				strtab, hdr->str_len, ssd[i].mapping_path) ||
+		    snap_strcpy(sd->access_mode, sizeof(sd->access_mode),
+				strtab, hdr->str_len, ssd[i].access_mode))
+			goto out;
+	}
+
+	snap->links = rnbd_link_sds(snap->sds_clt, snap->sds_srv,
+				    snap->sess_clt, snap->sess_srv, snap->devs);
+	ret = snap->links ? 0 : -ENOMEM;
+
+out:
+	free(sess_by_idx);
+
+	return ret;
+}
+
+int rnbd_snapshot_decode(const char *buf, size_t len,
+			 struct rnbd_snapshot *snap)
+{
+	int ret;
+
+	memset(snap, 0, sizeof(*snap));
+
+	ret = snap_load(buf, len, snap);
+	if (ret)
+		rnbd_snapshot_free(snap);
+
+	return ret;
+}
+
+int rnbd_snapshot_load(const char *file, struct rnbd_snapshot *snap)
+{
+	struct stat st;
+	char *buf;
+	FILE *f;
+	int ret;
+
+	memset(snap, 0, sizeof(*snap));
+
+	f = fopen(file, "r");
+	if (!f)
+		return -errno;
+
+	if (fstat(fileno(f), &st)) {
+		ret = -errno;
+		fclose(f);
+		return ret;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (!buf) {
+		fclose(f);
+		return -ENOMEM;
+	}
+
+	if (fread(buf, 1, st.st_size, f) != (size_t)st.st_size)
+		ret = ferror(f) ? -EIO : -EINVAL;
+	else
+		ret = rnbd_snapshot_decode(buf, st.st_size, snap);
+
+	free(buf);
+	fclose(f);
+
+	return ret;
+}
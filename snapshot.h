@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_SNAPSHOT
+#define __H_SNAPSHOT
+
+#include <stdint.h>
+
+#include "rnbd-sysfs.h"
+
+#define RNBD_SNAP_MAGIC		"RNBDSNAP"
+#define RNBD_SNAP_VERSION	1
+
+/*
+ * On disk layout of a snapshot:
+ *
+ *   struct rnbd_snap_hdr
+ *   struct rnbd_snap_dev   [dev_cnt]
+ *   struct rnbd_snap_sess  [sess_cnt]
+ *   struct rnbd_snap_path  [path_cnt]  grouped by session, in session order
+ *   struct rnbd_snap_sd    [sd_cnt]
+ *   char                   [str_len]   NUL terminated strings
+ *
+ * Strings are stored as offsets into the string table,
+ * other objects are referenced by their index.
+ * All values are in host byte order.
+ */
+struct rnbd_snap_hdr {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	hdr_size;
+	int64_t		tv_sec;
+	int64_t		tv_nsec;
+	uint32_t	dev_cnt;
+	uint32_t	sess_cnt;
+	uint32_t	path_cnt;
+	uint32_t	sd_cnt;
+	uint32_t	str_len;
+	uint32_t	reserved;
+};
+
+struct rnbd_snap_dev {
+	uint32_t	devname;
+	uint32_t	state;
+	uint64_t	rx_sect;
+	uint64_t	tx_sect;
+};
+
+struct rnbd_snap_sess {
+	uint32_t	side;
+	uint32_t	sessname;
+	uint32_t	mp;
+	uint32_t	mp_short;
+	uint32_t	hostname;
+	uint32_t	path_cnt;
+};
+
+struct rnbd_snap_path {
+	uint32_t	pathname;
+	uint32_t	src_addr;
+	uint32_t	dst_addr;
+	uint32_t	hca_name;
+	uint32_t	state;
+	int32_t		hca_port;
+	int32_t		inflights;
+	int32_t		reconnects;
+	uint64_t	rx_bytes;
+	uint64_t	tx_bytes;
+};
+
+struct rnbd_snap_sd {
+	uint32_t	sess;
+	uint32_t	dev;
+	uint32_t	mapping_path;
+	uint32_t	access_mode;
+};
+
+/*
+ * Write @snap to @file. The file is replaced atomically.
+ */
+int rnbd_snapshot_save(const char *file, const struct rnbd_snapshot *snap);
+
+/*
+ * Lay out @snap in the on disk format in a buffer allocated for it.
+ * The caller frees @buf.
+ */
+int rnbd_snapshot_encode(const struct rnbd_snapshot *snap, char **buf,
+			 size_t *len);
+
+/*
+ * Read a snapshot saved by rnbd_snapshot_save() from @file.
+ * Use rnbd_snapshot_free() after.
+ */
+int rnbd_snapshot_load(const char *file, struct rnbd_snapshot *snap);
+
+/*
+ * Read a snapshot from the @len bytes at @buf, as rnbd_snapshot_load()
+ */
+int rnbd_snapshot_decode(const char *buf, size_t len,
+			 struct rnbd_snapshot *snap);
+
+#endif /* __H_SNAPSHOT */
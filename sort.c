@@ -0,0 +1,268 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#define _GNU_SOURCE	/* for qsort_r() */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>	/* for strcasecmp() */
+
+#include "table.h"
+#include "misc.h"
+#include "sort.h"
+
+extern bool trm;
+
+/* the value of one key of an object */
+struct sort_val {
+	int64_t		n;
+	const char	*str;
+};
+
+struct sort_item {
+	void		*obj;
+	int		pos;	/* in the input, to keep the sort stable */
+	struct sort_val	*vals;
+};
+
+int rnbd_sort_parse(struct rnbd_sort *s, const char *arg)
+{
+	struct rnbd_sort_key *k;
+	char *str, *name, *dir;
+	int err = 0;
+
+	str = strdup(arg);
+	if (!str)
+		return -ENOMEM;
+
+	for (name = strtok(str, ","); name; name = strtok(NULL, ",")) {
+		if (s->cnt == RNBD_SORT_MAX_KEYS) {
+			ERR(trm, "Too many sort keys (max %d)\n",
+			    RNBD_SORT_MAX_KEYS);
+			err = -EINVAL;
+			break;
+		}
+		k = &s->keys[s->cnt];
+		memset(k, 0, sizeof(*k));
+
+		dir = strchr(name, ':');
+		if (dir) {
+			*dir++ = '\0';
+			if (!strcasecmp(dir, "desc")) {
+				k->desc = true;
+			} else if (strcasecmp(dir, "asc")) {
+				ERR(trm, "Invalid sort order '%s', use asc or desc\n",
+				    dir);
+				err = -EINVAL;
+				break;
+			}
+		}
+
+		if (!*name || strlen(name) >= sizeof(k->name)) {
+			ERR(trm, "Invalid sort field '%s'\n", name);
+			err = -EINVAL;
+			break;
+		}
+		strcpy(k->name, name);
+		s->cnt++;
+	}
+
+	if (!err && !s->cnt) {
+		ERR(trm, "Please specify the fields to sort by\n");
+		err = -EINVAL;
+	}
+
+	free(str);
+
+	return err;
+}
+
+int rnbd_sort_bind(struct rnbd_sort *s, struct table_column **all,
+		   const char **bad)
+{
+	struct rnbd_sort_key *k;
+	int i;
+
+	for (i = 0; i < s->cnt; i++) {
+		k = &s->keys[i];
+
+		k->clm = table_find_column(k->name, all);
+		if (!k->clm) {
+			*bad = k->name;
+			return -ENOENT;
+		}
+		k->load = rnbd_filter_load_of(k->clm);
+		k->num = k->clm->m_type != FLD_STR;
+	}
+
+	return 0;
+}
+
+unsigned int rnbd_sort_attrs(const struct rnbd_sort *s)
+{
+	unsigned int attrs = 0;
+	int i;
+
+	for (i = 0; i < s->cnt; i++)
+		if (s->keys[i].clm)
+			attrs |= s->keys[i].clm->m_attrs;
+
+	return attrs;
+}
+
+static int item_cmp(const struct sort_item *i1, const struct sort_item *i2,
+		    const struct rnbd_sort *s)
+{
+	const struct rnbd_sort_key *k;
+	int i, ret;
+
+	for (i = 0; i < s->cnt; i++) {
+		k = &s->keys[i];
+
+		if (k->num)
+			ret = (i1->vals[i].n > i2->vals[i].n) -
+			      (i1->vals[i].n < i2->vals[i].n);
+		else
+			ret = strcmp(i1->vals[i].str, i2->vals[i].str);
+
+		if (ret)
+			return k->desc ? -ret : ret;
+	}
+
+	return (i1->pos > i2->pos) - (i1->pos < i2->pos);
+}
+
+/* for qsort_r(), @arg are the keys */
+static int item_qcmp(const void *p1, const void *p2, void *arg)
+{
+	return item_cmp(p1, p2, arg);
+}
+
+static void heap_swap(struct sort_item *items, int a, int b)
+{
+	struct sort_item tmp = items[a];
+
+	items[a] = items[b];
+	items[b] = tmp;
+}
+
+static void heap_up(struct sort_item *heap, int i,
+		    const struct rnbd_sort *s)
+{
+	int parent;
+
+	for (; i; i = parent) {
+		parent = (i - 1) / 2;
+		if (item_cmp(&heap[parent], &heap[i], s) >= 0)
+			break;
+		heap_swap(heap, parent, i);
+	}
+}
+
+static void heap_down(struct sort_item *heap, int cnt, int i,
+		      const struct rnbd_sort *s)
+{
+	int child;
+
+	for (; (child = 2 * i + 1) < cnt; i = child) {
+		if (child + 1 < cnt &&
+		    item_cmp(&heap[child + 1], &heap[child], s) > 0)
+			child++;
+		if (item_cmp(&heap[i], &heap[child], s) >= 0)
+			break;
+		heap_swap(heap, i, child);
+	}
+}
+
+/*
+ * Move the @limit smallest of the @cnt items to the front. The front
+ * is a max-heap, every item smaller than its top replaces the top.
+ */
+static void select_first(struct sort_item *items, int cnt, int limit,
+			 const struct rnbd_sort *s)
+{
+	int i;
+
+	for (i = 1; i < limit; i++)
+		heap_up(items, i, s);
+
+	for (; i < cnt; i++) {
+		if (item_cmp(&items[i], &items[0], s) >= 0)
+			continue;
+		items[0] = items[i];
+		heap_down(items, limit, 0, s);
+	}
+}
+
+int rnbd_sort_objs(const struct rnbd_sort *s, void **objs, int cnt,
+		   int limit, const struct rnbd_ctx *ctx)
+{
+	char (*bufs)[CLM_MAX_WIDTH] = NULL;
+	const struct rnbd_sort_key *k;
+	struct sort_item *items;
+	struct sort_val *vals;
+	int i, j;
+
+	if (limit < 0 || limit > cnt)
+		limit = cnt;
+
+	if (!s->cnt || !limit)
+		return limit;
+
+	items = calloc(cnt, sizeof(*items));
+	vals = calloc(cnt * s->cnt, sizeof(*vals));
+	if (!items || !vals)
+		goto err;
+
+	for (j = 0; j < s->cnt; j++)
+		if (s->keys[j].load == FILTER_LOAD_TOSTR)
+			break;
+	if (j < s->cnt) {
+		bufs = malloc(cnt * s->cnt * sizeof(*bufs));
+		if (!bufs)
+			goto err;
+	}
+
+	/* fetch the keys once instead of on every comparison */
+	for (i = 0; i < cnt; i++) {
+		items[i].obj = objs[i];
+		items[i].pos = i;
+		items[i].vals = vals + i * s->cnt;
+
+		for (j = 0; j < s->cnt; j++) {
+			k = &s->keys[j];
+			if (!rnbd_filter_fetch(k->clm, k->load, k->num, objs[i],
+					       ctx, bufs ? bufs[i * s->cnt + j]
+							 : NULL,
+					       &items[i].vals[j].n,
+					       &items[i].vals[j].str))
+				items[i].vals[j].n = 0;
+		}
+	}
+
+	if (limit < cnt)
+		select_first(items, cnt, limit, s);
+	qsort_r(items, limit, sizeof(*items), item_qcmp, (void *)s);
+
+	for (i = 0; i < limit; i++)
+		objs[i] = items[i].obj;
+
+	free(bufs);
+	free(vals);
+	free(items);
+
+	return limit;
+
+err:
+	free(vals);
+	free(items);
+
+	return -ENOMEM;
+}
@@ -0,0 +1,63 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_SORT
+#define __H_SORT
+
+#include <stdbool.h>
+
+#include "table.h"
+#include "filter.h"
+
+#define RNBD_SORT_MAX_KEYS	8
+
+struct rnbd_sort_key {
+	char			name[RNBD_FILTER_NAME_LEN];
+	bool			desc;
+
+	/* set by rnbd_sort_bind() */
+	const struct table_column *clm;
+	enum rnbd_filter_load	load;
+	bool			num;	/* compare as numbers */
+};
+
+struct rnbd_sort {
+	struct rnbd_sort_key	keys[RNBD_SORT_MAX_KEYS];
+	int			cnt;
+};
+
+/*
+ * Append the keys in the comma separated list @arg to @s. A key is a
+ * field name optionally followed by ":desc" or ":asc".
+ */
+int rnbd_sort_parse(struct rnbd_sort *s, const char *arg);
+
+/*
+ * Resolve the key names of @s in the NULL terminated array @all.
+ * On -ENOENT @bad points to the name which couldn't be found.
+ */
+int rnbd_sort_bind(struct rnbd_sort *s, struct table_column **all,
+		   const char **bad);
+
+/*
+ * sysfs attributes needed by the columns of bound keys
+ */
+unsigned int rnbd_sort_attrs(const struct rnbd_sort *s);
+
+/*
+ * Sort the @cnt objects @objs by the bound keys of @s and keep the first
+ * @limit of them, all if @limit is negative. The keys are fetched once
+ * for every object and objects with equal keys keep their order. Only the
+ * first @limit objects are sorted, they are selected with a heap.
+ * Returns the number of objects left in @objs or negative error code.
+ */
+int rnbd_sort_objs(const struct rnbd_sort *s, void **objs, int cnt,
+		   int limit, const struct rnbd_ctx *ctx);
+
+#endif /* __H_SORT */
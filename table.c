@@ -9,6 +9,7 @@
 
 #include "table.h"
 #include "misc.h"
+#include "out.h"
 #include <ctype.h>	/* for isspace(); */
 #include <stdarg.h>
 #include <stdio.h>
@@ -22,17 +23,25 @@ int clr_print(bool trm, enum color clr, const char *format, ...)
 	int ret;
 
 	va_start(args, format);
-	if (trm && clr) {
-		ret = printf("%s", colors[clr]);
-		ret += vprintf(format, args);
-		ret += printf("%s", colors[CNRM]);
-	} else {
-		ret = vprintf(format, args);
-	}
+	ret = out_clr(trm, clr);
+	ret += vprintf(format, args);
+	ret += out_clr_end(trm, clr);
 	va_end(args);
 	return ret;
 }
 
+/*
+ * Print @s padded to @width in color @clr followed by the delimiter
+ */
+static void clr_print_pad(bool trm, enum color clr, const char *s, int width,
+			  char align)
+{
+	out_clr(trm, clr);
+	out_pad(s, width, align);
+	out_str(CLM_DLM);
+	out_clr_end(trm, clr);
+}
+
 static const char * const fld_fmt_str[] = {
 	[FLD_STR] = "%s",
 	[FLD_VAL] = "%d",
@@ -40,56 +49,189 @@ static const char * const fld_fmt_str[] = {
 	[FLD_LLU] = "%" PRIu64,
 };
 
+static unsigned int layout_hash(const struct table_column *c)
+{
+	return ((uintptr_t)c >> 4) & (TABLE_LAYOUT_SIZE - 1);
+}
+
+static const struct table_layout_clm *
+layout_find(const struct table_layout *lt, const struct table_column *c)
+{
+	const struct table_layout_clm *l;
+	unsigned int h, i;
+
+	if (!lt)
+		return NULL;
+
+	h = layout_hash(c);
+	for (i = 0; i < TABLE_LAYOUT_SIZE; i++) {
+		l = &lt->clms[(h + i) & (TABLE_LAYOUT_SIZE - 1)];
+		if (l->clm == c)
+			return l;
+		if (!l->clm)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * The state of @c in @lt, added with the defaults of the column if it
+ * isn't there yet. NULL without @lt or if it is full.
+ */
+static struct table_layout_clm *layout_get(struct table_layout *lt,
+					   const struct table_column *c)
+{
+	struct table_layout_clm *l;
+	unsigned int h, i;
+
+	if (!lt)
+		return NULL;
+
+	h = layout_hash(c);
+	for (i = 0; i < TABLE_LAYOUT_SIZE; i++) {
+		l = &lt->clms[(h + i) & (TABLE_LAYOUT_SIZE - 1)];
+		if (l->clm == c)
+			return l;
+		if (!l->clm) {
+			l->clm = c;
+			l->width = c->m_width;
+			l->hdr_width = c->hdr_width;
+			memcpy(l->header, c->m_header, sizeof(l->header));
+			return l;
+		}
+	}
+
+	return NULL;
+}
+
+static int layout_width(const struct table_layout *lt,
+			const struct table_column *c)
+{
+	const struct table_layout_clm *l = layout_find(lt, c);
+
+	return l ? l->width : c->m_width;
+}
+
+static int layout_hdr_width(const struct table_layout *lt,
+			    const struct table_column *c)
+{
+	const struct table_layout_clm *l = layout_find(lt, c);
+
+	return l ? l->hdr_width : c->hdr_width;
+}
+
+const char *table_layout_header(const struct table_layout *lt,
+				const struct table_column *c)
+{
+	const struct table_layout_clm *l = layout_find(lt, c);
+
+	return l ? l->header : c->m_header;
+}
+
+void table_layout_set_unit(struct table_layout *lt,
+			   const struct table_column *c, const char *unit)
+{
+	struct table_layout_clm *l = layout_get(lt, c);
+	size_t len;
+
+	if (!l)
+		return;
+
+	len = strlen(c->m_header);
+	memcpy(l->header, c->m_header, len);
+	l->width = len + snprintf(l->header + len, sizeof(l->header) - len,
+				  " (%s)", unit);
+	l->hdr_width = strlen(l->header);
+}
+
+static size_t fld_stringify(struct table_fld *fld, struct table_column *c,
+			    void *v, const struct rnbd_ctx *ctx, bool humanize)
+{
+	size_t len;
+
+	fld->num = NULL;
+
+	if (c->m_tostr)
+		return c->m_tostr(fld->str, CLM_MAX_WIDTH, ctx, &fld->clr, v,
+				  humanize);
+
+	if (c->m_type == FLD_INT || c->m_type == FLD_VAL)
+		len = snprintf(fld->str, CLM_MAX_WIDTH, fld_fmt_str[c->m_type],
+			       *(int *)v);
+	else if (c->m_type == FLD_LLU)
+		len = snprintf(fld->str, CLM_MAX_WIDTH, fld_fmt_str[c->m_type],
+			       *(uint64_t *)v);
+	else
+		len = snprintf(fld->str, CLM_MAX_WIDTH, fld_fmt_str[c->m_type],
+			       (char *)v);
+
+	fld->clr = c->clm_color;
+
+	return len;
+}
+
 int table_row_stringify(void *s, struct table_fld *flds,
-			struct table_column **cs, const struct rnbd_ctx *ctx,
-			bool humanize, int pre_len)
+			struct table_column **cs, struct table_layout *lt,
+			const struct rnbd_ctx *ctx, bool humanize, int pre_len)
 {
+	struct table_layout_clm *l;
 	struct table_column *c;
 	size_t len;
 	int clm;
-	void *v;
 
 	for (c = *cs, clm = 0; c; c = *++cs, clm++) {
-		v = (void *)s + c->s_off + c->m_offset;
-
-		if (c->m_tostr) {
-			len = c->m_tostr(flds[clm].str, CLM_MAX_WIDTH, ctx,
-					 &flds[clm].clr, v, humanize);
-		} else {
-			if (c->m_type == FLD_INT || c->m_type == FLD_VAL)
-				len = snprintf(flds[clm].str, CLM_MAX_WIDTH,
-					       fld_fmt_str[c->m_type],
-					       *(int *)v);
-			else if (c->m_type == FLD_LLU)
-				len = snprintf(flds[clm].str, CLM_MAX_WIDTH,
-					       fld_fmt_str[c->m_type],
-					       *(uint64_t *)v);
-			else
-				len = snprintf(flds[clm].str, CLM_MAX_WIDTH,
-					       fld_fmt_str[c->m_type],
-					       (char *)v);
-
-			flds[clm].clr = c->clm_color;
-		}
+		len = fld_stringify(&flds[clm], c,
+				    (void *)s + c->s_off + c->m_offset,
+				    ctx, humanize);
 
 		if (!clm)
 			len += pre_len;
 
-		if (c->m_width < len)
-			c->m_width = len;
+		l = layout_get(lt, c);
+		if (l && l->width < len)
+			l->width = len;
 	}
 
 	return 0;
 }
 
-int table_get_max_h_width(struct table_column **cs)
+/*
+ * table_row_stringify() for the formats not aligning the fields: plain
+ * numbers are left where they are, table_fld_print_esc() prints them
+ * with out_u64() and out_int() instead of formatting them first.
+ */
+static void table_row_fill(void *s, struct table_fld *flds,
+			   struct table_column **cs,
+			   const struct rnbd_ctx *ctx, bool humanize)
+{
+	struct table_column *c;
+	int clm;
+	void *v;
+
+	for (c = *cs, clm = 0; c; c = *++cs, clm++) {
+		v = (void *)s + c->s_off + c->m_offset;
+
+		if (c->m_tostr || c->m_type == FLD_STR) {
+			fld_stringify(&flds[clm], c, v, ctx, humanize);
+			continue;
+		}
+
+		flds[clm].num = v;
+		flds[clm].str[0] = '\0';
+		flds[clm].clr = c->clm_color;
+	}
+}
+
+int table_get_max_h_width(struct table_column **cs,
+			  const struct table_layout *lt)
 {
 	struct table_column *c;
 	int max_hdr_len = 0;
 	int hdr_len;
 
 	for (c = *cs; c; c = *++cs) {
-		hdr_len = strlen(c->m_header);
+		hdr_len = strlen(table_layout_header(lt, c));
 		if (max_hdr_len < hdr_len)
 			max_hdr_len = hdr_len;
 	}
@@ -98,29 +240,52 @@ int table_get_max_h_width(struct table_column **cs)
 }
 
 void table_entry_print_term(const char *prefix, struct table_fld *flds,
-			    struct table_column **cs, int hdr_width,
+			    struct table_column **cs,
+			    const struct table_layout *lt, int hdr_width,
 			    bool trm)
 {
 	struct table_column *c;
 	int clm;
 
 	for (c = *cs, clm = 0; c; c = *++cs, clm++) {
-		printf("%s%-*s" CLM_DLM, prefix, hdr_width, c->m_header);
-		clr_print(trm, flds[clm].clr, "%s\n", flds[clm].str);
+		out_str(prefix);
+		out_pad(table_layout_header(lt, c), hdr_width, 'l');
+		out_str(CLM_DLM);
+		out_clr(trm, flds[clm].clr);
+		out_str(flds[clm].str);
+		out_chr('\n');
+		out_clr_end(trm, flds[clm].clr);
 	}
 }
 
+static int table_fld_print_esc(struct table_fld *fld, struct table_column *cs,
+			       bool trm, enum fmt_type fmt)
+{
+	int ret;
+
+	ret = out_clr(trm, fld->clr);
+	if (fld->num && cs->m_type == FLD_LLU)
+		ret += out_u64(*(uint64_t *)fld->num);
+	else if (fld->num)
+		ret += out_int(*(int *)fld->num);
+	else if (cs->m_type == FLD_STR)
+		ret += out_chr('"') + out_esc(fmt, fld->str) + out_chr('"');
+	else
+		ret += out_esc(fmt, fld->str);
+	ret += out_clr_end(trm, fld->clr);
+
+	return ret;
+}
+
 int table_fld_print_as_str(struct table_fld *fld,
 			   struct table_column *cs, bool trm)
 {
-	if (cs->m_type == FLD_STR)
-		return clr_print(trm, fld->clr, "\"%s\"", fld->str);
-	else
-		return clr_print(trm, fld->clr, "%s", fld->str);
+	return table_fld_print_esc(fld, cs, trm, FMT_TERM);
 }
 
 int table_flds_print_term(const char *pre, struct table_fld *flds,
-			  struct table_column **cs, bool trm, int pwidth)
+			  struct table_column **cs, struct table_layout *lt,
+			  bool trm, int pwidth)
 {
 	struct table_column *c = *cs;
 	int clm = 0;
@@ -128,20 +293,25 @@ int table_flds_print_term(const char *pre, struct table_fld *flds,
 	if (!c)
 		return 0;
 
-	clr_print(trm, flds[clm].clr,
-		  (c->clm_align == 'l') ? "%s%-*s" CLM_DLM : "%s%*s" CLM_DLM,
-		  pre, c->m_width - pwidth, flds[clm].str);
+	out_clr(trm, flds[clm].clr);
+	out_str(pre);
+	out_pad(flds[clm].str, layout_width(lt, c) - pwidth,
+		c->clm_align == 'l' ? 'l' : 'r');
+	out_str(CLM_DLM);
+	out_clr_end(trm, flds[clm].clr);
 
 	for (c = *++cs, clm = 1; c; c = *++cs, clm++)
-		clr_print(trm, flds[clm].clr, (c->clm_align == 'l') ?
-			  "%-*s" CLM_DLM : "%*s" CLM_DLM,
-			  c->m_width, flds[clm].str);
-	printf("\n");
+		clr_print_pad(trm, flds[clm].clr, flds[clm].str,
+			      layout_width(lt, c),
+			      c->clm_align == 'l' ? 'l' : 'r');
+	out_chr('\n');
 
 	return 0;
 }
 
-/* FIXME: escape ',' in strings */
+/*
+ * String fields are quoted, quotes inside of them are doubled
+ */
 int table_flds_print_csv(struct table_fld *flds,
 			 struct table_column **cs, bool trm)
 {
@@ -149,40 +319,51 @@ int table_flds_print_csv(struct table_fld *flds,
 	int clm;
 
 	if (c)
-		table_fld_print_as_str(&flds[0], c, trm);
+		table_fld_print_esc(&flds[0], c, trm, FMT_CSV);
 
 	for (c = *++cs, clm = 1; c; c = *++cs, clm++) {
-		printf(",");
-		table_fld_print_as_str(&flds[clm], c, trm);
+		out_chr(',');
+		table_fld_print_esc(&flds[clm], c, trm, FMT_CSV);
 	}
 
-	printf("\n");
+	out_chr('\n');
 
 	return 0;
 }
 
-/*FIXME: escape '"' in strings */
+static void table_fld_print_json(const char *prefix, struct table_fld *fld,
+				 struct table_column *c, bool trm)
+{
+	out_str(prefix);
+	out_str("\t\"");
+	out_str(c->m_name);
+	out_str("\": ");
+	if (!table_fld_print_esc(fld, c, trm, FMT_JSON))
+		out_str("null");
+}
+
 int table_flds_print_json(const char *prefix, struct table_fld *flds,
 			  struct table_column **cs, bool trm)
 {
 	struct table_column *c = *cs;
 	int clm;
 
-	printf("%s{", prefix);
+	out_str(prefix);
+	out_chr('{');
 
 	if (c) {
-		printf("\n%s\t\"%s\": ", prefix, c->m_name);
-		if (!table_fld_print_as_str(&flds[0], c, trm))
-			clr_print(trm, flds[0].clr, "null");
+		out_chr('\n');
+		table_fld_print_json(prefix, &flds[0], c, trm);
 	}
 
 	for (c = *++cs, clm = 1; c; c = *++cs, clm++) {
-		printf(",\n%s\t\"%s\": ", prefix, c->m_name);
-		if (!table_fld_print_as_str(&flds[clm], c, trm))
-			clr_print(trm, flds[clm].clr, "null");
+		out_str(",\n");
+		table_fld_print_json(prefix, &flds[clm], c, trm);
 	}
 
-	printf("\n%s}", prefix);
+	out_chr('\n');
+	out_str(prefix);
+	out_chr('}');
 
 	return 0;
 }
@@ -194,9 +375,14 @@ int table_flds_print_xml(const char *prefix, struct table_fld *flds,
 	int clm;
 
 	for (c = *cs, clm = 0; c; c = *++cs, clm++) {
-		printf("%s<%s>", prefix, c->m_name);
-		table_fld_print_as_str(&flds[clm], c, trm);
-		printf("</%s>\n", c->m_name);
+		out_str(prefix);
+		out_chr('<');
+		out_str(c->m_name);
+		out_chr('>');
+		table_fld_print_esc(&flds[clm], c, trm, FMT_XML);
+		out_str("</");
+		out_str(c->m_name);
+		out_str(">\n");
 	}
 
 	return 0;
@@ -204,11 +390,12 @@ int table_flds_print_xml(const char *prefix, struct table_fld *flds,
 
 int table_flds_print(enum fmt_type fmt, const char *prefix,
 		     struct table_fld *flds, struct table_column **cs,
-		     bool trm, int pwidth)
+		     struct table_layout *lt, bool trm, int pwidth)
 {
 	switch (fmt) {
 	case FMT_TERM:
-		return table_flds_print_term(prefix, flds, cs, trm, pwidth);
+		return table_flds_print_term(prefix, flds, cs, lt, trm,
+					     pwidth);
 	case FMT_XML:
 		return table_flds_print_xml(prefix, flds, cs, trm);
 	case FMT_CSV:
@@ -221,14 +408,17 @@ int table_flds_print(enum fmt_type fmt, const char *prefix,
 }
 
 int table_row_print(void *v, enum fmt_type fmt, const char *pre,
-		    struct table_column **cs, bool trm,
-		    const struct rnbd_ctx *ctx, bool humanize,
+		    struct table_column **cs, struct table_layout *lt,
+		    bool trm, const struct rnbd_ctx *ctx, bool humanize,
 		    size_t pre_len)
 {
 	struct table_fld flds[CLM_MAX_CNT];
 
-	table_row_stringify(v, flds, cs, ctx, humanize, pre_len);
-	table_flds_print(fmt, pre, flds, cs, trm, pre_len);
+	if (fmt == FMT_TERM)
+		table_row_stringify(v, flds, cs, lt, ctx, humanize, pre_len);
+	else
+		table_row_fill(v, flds, cs, ctx, humanize);
+	table_flds_print(fmt, pre, flds, cs, lt, trm, pre_len);
 
 	return 0;
 }
@@ -244,7 +434,7 @@ size_t print_line(char *str, size_t len, int width)
 }
 
 int table_row_print_line(const char *pre, struct table_column **clms,
-			 bool trm, size_t pre_len)
+			 struct table_layout *lt, bool trm, size_t pre_len)
 {
 	struct table_column **cs = clms, *c;
 	struct table_fld flds[CLM_MAX_CNT];
@@ -252,13 +442,15 @@ int table_row_print_line(const char *pre, struct table_column **clms,
 
 	for (c = *cs, clm = 0; c; c = *++cs, clm++) {
 		flds[clm].clr = CNRM;
+		flds[clm].num = NULL;
 		if (c->m_type == FLD_INT || c->m_type == FLD_LLU)
-			print_line(flds[clm].str, CLM_MAX_WIDTH, c->m_width);
+			print_line(flds[clm].str, CLM_MAX_WIDTH,
+				   layout_width(lt, c));
 		else
 			flds[clm].str[0] = '\0';
 	}
 
-	table_flds_print(FMT_TERM, pre, flds, clms, trm, pre_len);
+	table_flds_print(FMT_TERM, pre, flds, clms, lt, trm, pre_len);
 
 	return 0;
 }
@@ -274,6 +466,17 @@ bool table_has_num(struct table_column **cs)
 	return false;
 }
 
+unsigned int table_clm_attrs(struct table_column **cs)
+{
+	unsigned int attrs = 0;
+	int i;
+
+	for (i = 0; cs[i]; i++)
+		attrs |= cs[i]->m_attrs;
+
+	return attrs;
+}
+
 void table_flds_del_not_num(struct table_fld *flds,
 			    struct table_column **cs)
 {
@@ -288,24 +491,29 @@ void table_flds_del_not_num(struct table_fld *flds,
 }
 
 int table_header_print_term(const char *prefix, struct table_column **cs,
-			    bool trm)
+			    struct table_layout *lt, bool trm)
 {
 	struct table_column *c;
+	const char *header;
+	int width, hdr_width;
 
-	printf("%s", prefix);
+	out_str(prefix);
 	for (c = *cs; c; c = *++cs) {
-		if (c->clm_align == 'c')
-			clr_print(trm, c->hdr_color, "%*s%*s" CLM_DLM,
-				  (c->m_width + c->hdr_width) / 2, c->m_header,
-				  (c->m_width - c->hdr_width + 1) / 2, "");
-		else if (c->clm_align == 'r')
-			clr_print(trm, c->hdr_color, "%*s" CLM_DLM,
-				  c->m_width, c->m_header);
-		else
-			clr_print(trm, c->hdr_color, "%-*s" CLM_DLM,
-				  c->m_width, c->m_header);
+		header = table_layout_header(lt, c);
+		width = layout_width(lt, c);
+		if (c->clm_align == 'c') {
+			hdr_width = layout_hdr_width(lt, c);
+			out_clr(trm, c->hdr_color);
+			out_pad(header, (width + hdr_width) / 2, 'r');
+			out_pad("", (width - hdr_width + 1) / 2, 'l');
+			out_str(CLM_DLM);
+			out_clr_end(trm, c->hdr_color);
+		} else {
+			clr_print_pad(trm, c->hdr_color, header, width,
+				      c->clm_align);
+		}
 	}
-	printf("\n");
+	out_chr('\n');
 
 	return 0;
 }
@@ -315,12 +523,14 @@ void table_header_print_csv(struct table_column **cs)
 	struct table_column *c = *cs;
 
 	if (c)
-		printf("%s", c->m_name);
+		out_str(c->m_name);
 
-	for (c = *++cs; c; c = *++cs)
-		printf(",%s", c->m_name);
+	for (c = *++cs; c; c = *++cs) {
+		out_chr(',');
+		out_str(c->m_name);
+	}
 
-	printf("\n");
+	out_chr('\n');
 }
 
 /*
@@ -461,7 +671,7 @@ int table_extend_columns(const char *arg, const char *delim,
 #define CLM_LST(m_name, m_header, m_width, m_type, tostr, align, h_clr, c_clr,\
 		m_descr) \
 	CLM(table_column, m_name, m_header, m_type, tostr, \
-	    align, h_clr, c_clr, m_descr, m_width, 0)
+	    align, h_clr, c_clr, m_descr, m_width, 0, 0)
 
 static int pstr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 		       enum color *clr, void *v, bool humanize)
@@ -470,8 +680,21 @@ static int pstr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
 	return snprintf(str, len, "%s", *(char **)v);
 }
 
+/*
+ * The header the column has in the layout of the command, with the unit
+ */
+static int hdr_to_str(char *str, size_t len, const struct rnbd_ctx *ctx,
+		      enum color *clr, void *v, bool humanize)
+{
+	const struct table_column *c;
+
+	c = container_of((char *)v, struct table_column, m_header[0]);
+	*clr = 0;
+	return snprintf(str, len, "%s", table_layout_header(ctx->layout, c));
+}
+
 CLM_LST(m_name, "Field", 14, FLD_STR, pstr_to_str, 'l', CBLD, CNRM, "");
-CLM_LST(m_header, "Header", 13, FLD_STR, NULL, 'l', CBLD, CNRM, "");
+CLM_LST(m_header, "Header", 13, FLD_STR, hdr_to_str, 'l', CBLD, CNRM, "");
 CLM_LST(m_descr, "Description", 50, FLD_STR, pstr_to_str, 'l', CBLD, CNRM, "");
 
 static struct table_column *l_clmns[] = {
@@ -484,11 +707,13 @@ static struct table_column *l_clmns[] = {
 int table_tbl_print_term(const char *prefix, struct table_column **clm,
 			 bool trm, const struct rnbd_ctx *ctx)
 {
+	struct table_layout *lt = ctx->layout;
 	int row = 0;
 
-	table_header_print_term(prefix, l_clmns, trm);
+	table_header_print_term(prefix, l_clmns, lt, trm);
 	while (clm[row]) {
-		table_row_print(clm[row], FMT_TERM, prefix, l_clmns, trm, ctx, 1, 0);
+		table_row_print(clm[row], FMT_TERM, prefix, l_clmns, lt, trm,
+				ctx, 1, 0);
 		row++;
 	}
 
@@ -61,10 +61,11 @@ struct table_column {
 	enum color	hdr_color;
 	enum color	clm_color;
 	unsigned long	s_off;	/* TODO: ugly move to an embedding struct */
+	unsigned int	m_attrs; /* sysfs attributes needed for the column */
 };
 
 #define _CLM(str, s_name, name, header, type, tostr, align, h_clr, c_clr,\
-	     descr, width, off) \
+	     descr, width, off, attrs) \
 	{ \
 		.m_name		= s_name, \
 		.m_header	= header, \
@@ -77,14 +78,15 @@ struct table_column {
 		.clm_align	= align, \
 		.hdr_color	= h_clr, \
 		.clm_color	= c_clr, \
-		.s_off		= off \
+		.s_off		= off, \
+		.m_attrs	= attrs \
 	}
 
 #define CLM(str, name, header, type, tostr, align, h_clr, c_clr,\
-	    descr, width, off) \
+	    descr, width, off, attrs) \
 struct table_column clm_ ## str ## _ ## name = \
 	_CLM(str, #name, name, header, type, tostr, align, h_clr, c_clr,\
-	     descr, width, off)
+	     descr, width, off, attrs)
 
 #define CLM_MAX_WIDTH 128
 #define CLM_MAX_CNT 50
@@ -93,8 +95,40 @@ struct table_column clm_ ## str ## _ ## name = \
 struct table_fld {
 	char str[CLM_MAX_WIDTH];
 	enum color clr;
+	void *num;	/* a number not formatted into @str yet, or NULL */
 };
 
+#define TABLE_LAYOUT_SIZE 256	/* power of 2, more than the columns */
+
+struct table_layout_clm {
+	const struct table_column	*clm;
+	int				width;
+	int				hdr_width;
+	char				header[16];
+};
+
+/*
+ * What a render learns about its columns: the width of the widest field
+ * and the header with the unit. The columns themselves stay untouched, so
+ * renders with different layouts can run at the same time. Zero it before
+ * the first use, the columns are added with their defaults as they come.
+ */
+struct table_layout {
+	struct table_layout_clm	clms[TABLE_LAYOUT_SIZE];
+};
+
+/*
+ * Append " (@unit)" to the header of @c
+ */
+void table_layout_set_unit(struct table_layout *lt,
+			   const struct table_column *c, const char *unit);
+
+/*
+ * The header of @c in @lt, the one of the column if @lt doesn't have it
+ */
+const char *table_layout_header(const struct table_layout *lt,
+				const struct table_column *c);
+
 static const char * const colors[] = {
 	[CNRM] = "\x1B[0m",
 	[CBLD] = "\x1B[1m",
@@ -116,22 +150,30 @@ static const char * const colors[] = {
 
 int clr_print(bool trm, enum color clr, const char *format, ...);
 
+/*
+ * The functions taking a layout @lt keep the widths of the fields there,
+ * they work without one if the widths don't matter.
+ */
 int table_row_stringify(void *s, struct table_fld *flds,
-			struct table_column **cs, const struct rnbd_ctx *ctx,
-			bool humanize, int pre_len);
+			struct table_column **cs, struct table_layout *lt,
+			const struct rnbd_ctx *ctx, bool humanize, int pre_len);
 
-int table_get_max_h_width(struct table_column **cs);
+int table_get_max_h_width(struct table_column **cs,
+			  const struct table_layout *lt);
 
 
 void table_entry_print_term(const char *prefix, struct table_fld *flds,
-			    struct table_column **cs, int hdr_width, bool trm);
+			    struct table_column **cs,
+			    const struct table_layout *lt, int hdr_width,
+			    bool trm);
 
 
 int table_fld_print_as_str(struct table_fld *fld, struct table_column *cs,
 			   bool trm);
 
 int table_flds_print_term(const char *pre, struct table_fld *flds,
-			  struct table_column **cs, bool trm, int pwidth);
+			  struct table_column **cs, struct table_layout *lt,
+			  bool trm, int pwidth);
 
 int table_flds_print_csv(struct table_fld *flds,
 			 struct table_column **cs, bool trm);
@@ -144,21 +186,21 @@ int table_flds_print_xml(const char *prefix, struct table_fld *flds,
 
 int table_flds_print(enum fmt_type fmt, const char *prefix,
 		     struct table_fld *flds, struct table_column **cs,
-		     bool trm, int pwidth);
+		     struct table_layout *lt, bool trm, int pwidth);
 
 int table_row_print(void *v, enum fmt_type fmt, const char *pre,
-		    struct table_column **cs, bool trm,
-		    const struct rnbd_ctx *ctx, bool humanize,
+		    struct table_column **cs, struct table_layout *lt,
+		    bool trm, const struct rnbd_ctx *ctx, bool humanize,
 		    size_t pre_len);
 
 int table_row_print_line(const char *pre, struct table_column **clms,
-			 bool trm, size_t pre_len);
+			 struct table_layout *lt, bool trm, size_t pre_len);
 
 void table_flds_del_not_num(struct table_fld *flds,
 			    struct table_column **cs);
 
 int table_header_print_term(const char *prefix, struct table_column **cs,
-			    bool trm);
+			    struct table_layout *lt, bool trm);
 
 void table_header_print_csv(struct table_column **cs);
 /*
@@ -198,4 +240,9 @@ int table_clm_cnt(struct table_column **cs);
  */
 bool table_has_num(struct table_column **cs);
 
+/*
+ * Returns the union of the sysfs attributes needed for the columns @cs
+ */
+unsigned int table_clm_attrs(struct table_column **cs);
+
 #endif /* __H_TABLE */
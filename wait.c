@@ -0,0 +1,682 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <dirent.h>	/* for opendir() */
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>	/* for access() */
+#include <libgen.h>	/* for basename() */
+
+#include "wait.h"
+#include "sampler.h"
+#include "table.h"
+#include "misc.h"
+#include "rnbd-sysfs.h"
+#include "watch.h"
+
+/*
+ * The state files are re-read at least that often, in case neither sysfs
+ * nor a uevent notifies about the changes. The interval starts short and
+ * doubles as long as nothing happens.
+ */
+#define WAIT_BACKOFF_MIN_MS	5
+#define WAIT_BACKOFF_MAX_MS	50
+
+extern bool trm;
+
+struct wait_path {
+	char	name[NAME_MAX];
+	int	slot;		/* in the sampler */
+	bool	seen;
+};
+
+struct wait {
+	const struct rnbd_ctx	*ctx;
+	unsigned int		kind;	/* what the name turned out to be */
+	char			dir[PATH_MAX];
+	struct rnbd_sampler	smp;
+	int			slot;	/* of the device or the path */
+
+	/* the paths of a session */
+	struct wait_path	*paths;
+	int			path_cnt;
+	int			path_size;
+
+	struct pollfd		*pfds;
+	int			pfd_size;
+	bool			poll_state;	/* poll the state files */
+	int			uevent_fd;	/* negative if not open */
+	bool			changed;	/* set by the condition */
+
+	const char		*want;		/* state to wait for */
+	char			state[RNBD_SAMPLER_STATE_LEN];
+	char			last[RNBD_SAMPLER_STATE_LEN];
+
+	/* the device to be mapped */
+	const char		*sessname;
+	const char		*name;
+	char			devname[NAME_MAX];
+};
+
+static const char *kind_to_str(unsigned int kind)
+{
+	switch (kind) {
+	case RNBD_WAIT_DEVICE:
+		return "Device";
+	case RNBD_WAIT_SESSION:
+		return "Session";
+	default:
+		return "Path";
+	}
+}
+
+/*
+ * @dir is the rnbd directory of the device with the entry @link in the
+ * devices/ directory
+ */
+static bool match_device(const char *dir, const char *link, const char *name)
+{
+	char rpath[PATH_MAX], buf[NAME_MAX];
+
+	if (!strcmp(link, name))
+		return true;
+
+	/* <device>/rnbd -> <device> */
+	if (realpath(dir, rpath) &&
+	    !strcmp(basename(dirname(rpath)),
+		    strncmp(name, "/dev/", 5) ? name : name + 5))
+		return true;
+
+	return scanf_sysfs(dir, "mapping_path", "%s", buf) == 1 &&
+	       !strcmp(buf, name);
+}
+
+/*
+ * Look for the client devices with the device name, device path or
+ * mapping path @name. Returns the number of matches, the rnbd directory
+ * of the first one is put into @res.
+ */
+static int find_devices(const struct rnbd_sysfs_info *sysfs,
+			const char *name, char *res)
+{
+	char dir[PATH_MAX], ddir[PATH_MAX];
+	struct dirent *ent;
+	int cnt = 0;
+	DIR *d;
+
+	snprintf(dir, sizeof(dir), "%s/devices/", sysfs->path_dev_clt);
+
+	d = opendir(dir);
+	for (ent = d ? readdir(d) : NULL; ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.' ||
+		    snprintf(ddir, sizeof(ddir), "%s%s/%s", dir, ent->d_name,
+			     sysfs->path_dev_name) >= sizeof(ddir) ||
+		    !match_device(ddir, ent->d_name, name))
+			continue;
+
+		if (!cnt++)
+			strcpy(res, ddir);
+	}
+	if (d)
+		closedir(d);
+
+	return cnt;
+}
+
+/*
+ * A session is looked up by name, @res is its paths/ directory
+ */
+static int find_session(const struct rnbd_sysfs_info *sysfs,
+			const char *name, char *res)
+{
+	if (strchr(name, '/') ||
+	    snprintf(res, PATH_MAX, "%s%s/paths", sysfs->path_sess_clt,
+		     name) >= PATH_MAX)
+		return 0;
+
+	return !access(res, F_OK);
+}
+
+static bool match_path(const char *dir, const char *pname,
+		       const char *name)
+{
+	char buf[NAME_MAX];
+
+	if (!strcmp(pname, name))
+		return true;
+
+	if (scanf_sysfs(dir, "src_addr", "%s", buf) == 1 && !strcmp(buf, name))
+		return true;
+
+	return scanf_sysfs(dir, "dst_addr", "%s", buf) == 1 &&
+	       !strcmp(buf, name);
+}
+
+static int find_session_paths(const struct rnbd_sysfs_info *sysfs,
+			      const char *sessname, const char *name,
+			      char *res)
+{
+	char dir[PATH_MAX], pdir[PATH_MAX];
+	struct dirent *ent;
+	int cnt = 0;
+	DIR *d;
+
+	if (strchr(sessname, '/') ||
+	    snprintf(dir, sizeof(dir), "%s%s/paths/", sysfs->path_sess_clt,
+		     sessname) >= sizeof(dir))
+		return 0;
+
+	d = opendir(dir);
+	for (ent = d ? readdir(d) : NULL; ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		if (snprintf(pdir, sizeof(pdir), "%s%s", dir,
+			     ent->d_name) >= sizeof(pdir) ||
+		    !match_path(pdir, ent->d_name, name))
+			continue;
+
+		if (!cnt++)
+			strcpy(res, pdir);
+	}
+	if (d)
+		closedir(d);
+
+	return cnt;
+}
+
+/*
+ * Look for the client paths with the name, source or destination address
+ * @name in session @sessname or in all sessions if it is NULL
+ */
+static int find_paths(const struct rnbd_sysfs_info *sysfs,
+		      const char *sessname, const char *name, char *res)
+{
+	char dir[PATH_MAX];
+	struct dirent *ent;
+	int cnt = 0;
+	DIR *d;
+
+	if (sessname)
+		return find_session_paths(sysfs, sessname, name, res);
+
+	d = opendir(sysfs->path_sess_clt);
+	for (ent = d ? readdir(d) : NULL; ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		/* keep the directory of the first match */
+		cnt += find_session_paths(sysfs, ent->d_name, name,
+					  cnt ? dir : res);
+	}
+	if (d)
+		closedir(d);
+
+	return cnt;
+}
+
+/*
+ * Look @name up in the @kinds of objects. Returns the number of matches,
+ * the kind and the directory of the first one are kept in @w.
+ */
+static int wait_find(struct wait *w, unsigned int kinds,
+		     const char *sessname, const char *name)
+{
+	const struct rnbd_sysfs_info *sysfs = get_sysfs_info(w->ctx);
+	char dir[PATH_MAX];
+	int cnt = 0, n;
+
+	if (kinds & RNBD_WAIT_DEVICE && !sessname) {
+		n = find_devices(sysfs, name, w->dir);
+		if (n)
+			w->kind = RNBD_WAIT_DEVICE;
+		cnt += n;
+	}
+	if (kinds & RNBD_WAIT_SESSION && !sessname) {
+		n = find_session(sysfs, name, cnt ? dir : w->dir);
+		if (n && !cnt)
+			w->kind = RNBD_WAIT_SESSION;
+		cnt += n;
+	}
+	if (kinds & RNBD_WAIT_PATH) {
+		n = find_paths(sysfs, sessname, name, cnt ? dir : w->dir);
+		if (n && !cnt)
+			w->kind = RNBD_WAIT_PATH;
+		cnt += n;
+	}
+
+	return cnt;
+}
+
+static struct wait_path *wait_path_add(struct wait *w, const char *name)
+{
+	char path[PATH_MAX];
+	struct wait_path *p;
+	int size;
+
+	if (w->path_cnt == w->path_size) {
+		size = w->path_size ? w->path_size * 2 : 4;
+		p = realloc(w->paths, size * sizeof(*p));
+		if (!p)
+			return NULL;
+		w->paths = p;
+		w->path_size = size;
+	}
+
+	if (snprintf(path, sizeof(path), "%s/%s", w->dir, name) >=
+	    sizeof(path))
+		return NULL;
+
+	p = &w->paths[w->path_cnt];
+	memset(p, 0, sizeof(*p));
+	strcpy(p->name, name);
+
+	p->slot = rnbd_sampler_add_path(&w->smp, path, RNBD_SMP_STATE);
+	if (p->slot < 0)
+		return NULL;
+
+	w->path_cnt++;
+
+	return p;
+}
+
+/*
+ * Synchronize the paths of the session with its paths/ directory.
+ * Returns false if the session is gone.
+ */
+static bool wait_sess_scan(struct wait *w)
+{
+	struct wait_path *p;
+	struct dirent *ent;
+	DIR *d;
+	int i;
+
+	d = opendir(w->dir);
+	if (!d)
+		return false;
+
+	for (i = 0; i < w->path_cnt; i++)
+		w->paths[i].seen = false;
+
+	for (ent = readdir(d); ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		for (i = 0; i < w->path_cnt; i++)
+			if (!strcmp(w->paths[i].name, ent->d_name))
+				break;
+
+		p = i < w->path_cnt ? &w->paths[i]
+				    : wait_path_add(w, ent->d_name);
+		if (p)
+			p->seen = true;
+	}
+	closedir(d);
+
+	for (i = 0; i < w->path_cnt; i++) {
+		if (w->paths[i].seen)
+			continue;
+
+		rnbd_sampler_del_path(&w->smp, w->paths[i].slot);
+		w->paths[i--] = w->paths[--w->path_cnt];
+	}
+
+	return true;
+}
+
+/*
+ * Re-read the state of the object into @w->state.
+ * Returns false if the object is gone.
+ */
+static bool wait_read(struct wait *w)
+{
+	int i;
+
+	switch (w->kind) {
+	case RNBD_WAIT_DEVICE:
+		if (!rnbd_sampler_read_dev(&w->smp, w->slot))
+			return false;
+		strcpy(w->state, w->smp.devs.state[w->slot]);
+		break;
+	case RNBD_WAIT_PATH:
+		if (!rnbd_sampler_read_path(&w->smp, w->slot))
+			return false;
+		strcpy(w->state, w->smp.paths.state[w->slot]);
+		break;
+	case RNBD_WAIT_SESSION:
+		if (!wait_sess_scan(w))
+			return false;
+
+		strcpy(w->state, "disconnected");
+		for (i = 0; i < w->path_cnt; i++)
+			if (rnbd_sampler_read_path(&w->smp, w->paths[i].slot) &&
+			    !strcmp(w->smp.paths.state[w->paths[i].slot],
+				    "connected"))
+				strcpy(w->state, "connected");
+		break;
+	}
+
+	return true;
+}
+
+/*
+ * Collect the uevent socket and the state files to poll, returns their
+ * number
+ */
+static int wait_pfds(struct wait *w)
+{
+	struct pollfd *pfds;
+	int i, cnt = 0, size;
+
+	size = w->kind == RNBD_WAIT_SESSION ? w->path_cnt + 1 : 2;
+	if (size > w->pfd_size) {
+		pfds = realloc(w->pfds, size * sizeof(*pfds));
+		if (!pfds)
+			return 0;
+		w->pfds = pfds;
+		w->pfd_size = size;
+	}
+
+	/* poll() skips the socket if it couldn't be opened */
+	w->pfds[cnt].fd = w->uevent_fd;
+	w->pfds[cnt].events = POLLIN;
+	w->pfds[cnt++].revents = 0;
+
+	if (!w->poll_state)
+		return cnt;
+
+	if (w->kind == RNBD_WAIT_DEVICE)
+		w->pfds[cnt++].fd = w->smp.devs.state_fd[w->slot];
+	else if (w->kind == RNBD_WAIT_PATH)
+		w->pfds[cnt++].fd = w->smp.paths.state_fd[w->slot];
+	else
+		for (i = 0; i < w->path_cnt; i++)
+			w->pfds[cnt++].fd =
+				w->smp.paths.state_fd[w->paths[i].slot];
+
+	for (i = 1; i < cnt; i++) {
+		w->pfds[i].events = POLLPRI | POLLERR;
+		w->pfds[i].revents = 0;
+	}
+
+	return cnt;
+}
+
+static long long ts_us(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000LL + ts->tv_nsec / 1000;
+}
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts_us(&ts);
+}
+
+/*
+ * Check @cond until it holds or @deadline (-1 for none) has passed.
+ * @cond returns 1 if the condition holds, 0 if not yet or negative error
+ * code. It sets @w->changed if it saw something move.
+ */
+static int wait_until(struct wait *w, int (*cond)(struct wait *w),
+		      long long deadline)
+{
+	int backoff = WAIT_BACKOFF_MIN_MS;
+	int ret, cnt, tmo, n;
+	long long now;
+
+	for (;;) {
+		w->changed = false;
+		ret = cond(w);
+		if (ret)
+			return ret < 0 ? ret : 0;
+
+		/* more changes are likely to follow the first one */
+		if (w->changed)
+			backoff = WAIT_BACKOFF_MIN_MS;
+
+		now = now_us();
+		if (deadline >= 0 && now >= deadline)
+			return -ETIMEDOUT;
+
+		tmo = backoff;
+		if (deadline >= 0 && (deadline - now + 999) / 1000 < tmo)
+			tmo = (deadline - now + 999) / 1000;
+
+		/*
+		 * sysfs wakes us up with POLLPRI if the attribute notifies,
+		 * the uevent socket if rnbd or rtrs objects come and go or
+		 * change, otherwise poll() only sleeps.
+		 */
+		cnt = wait_pfds(w);
+		n = poll(w->pfds, cnt, tmo);
+		if (n > 0 && (w->pfds[0].revents & POLLIN) &&
+		    rnbd_uevent_drain(w->uevent_fd))
+			backoff = WAIT_BACKOFF_MIN_MS;
+		else if (n <= 0 && backoff < WAIT_BACKOFF_MAX_MS)
+			backoff = backoff * 2 > WAIT_BACKOFF_MAX_MS ?
+				  WAIT_BACKOFF_MAX_MS : backoff * 2;
+	}
+}
+
+static int state_reached(struct wait *w)
+{
+	if (!wait_read(w))
+		return -ENOENT;
+
+	if (strcmp(w->state, w->last)) {
+		strcpy(w->last, w->state);
+		w->changed = true;
+	}
+
+	return !strcmp(w->state, w->want);
+}
+
+static void wait_free(struct wait *w)
+{
+	if (w->uevent_fd >= 0)
+		close(w->uevent_fd);
+	free(w->pfds);
+	free(w->paths);
+	rnbd_sampler_free(&w->smp);
+}
+
+int rnbd_wait(const struct rnbd_ctx *ctx, unsigned int kinds,
+	      const char *sessname, const char *name, const char *state,
+	      int timeout_ms)
+{
+	struct wait w = {
+		.ctx = ctx,
+		.want = state,
+		.poll_state = true,
+		.uevent_fd = -1,
+	};
+	long long start, deadline;
+	int cnt, ret;
+
+	start = now_us();
+	deadline = timeout_ms < 0 ? -1 : start + timeout_ms * 1000LL;
+
+	cnt = wait_find(&w, kinds, sessname, name);
+	if (!cnt) {
+		ERR(trm, "There is no client object matching '%s'\n", name);
+		return -ENOENT;
+	}
+	if (cnt > 1) {
+		ERR(trm, "Multiple entries match '%s'\n", name);
+		return -EINVAL;
+	}
+
+	if (w.kind == RNBD_WAIT_SESSION && strcmp(state, "connected") &&
+	    strcmp(state, "disconnected")) {
+		ERR(trm, "A session is either connected or disconnected\n");
+		return -EINVAL;
+	}
+
+	ret = rnbd_sampler_init(&w.smp, 4, 1);
+	if (ret)
+		return ret;
+	w.uevent_fd = rnbd_uevent_open();
+
+	if (w.kind == RNBD_WAIT_DEVICE)
+		w.slot = rnbd_sampler_add_dev(&w.smp, NULL, w.dir,
+					      RNBD_SMP_STATE);
+	else if (w.kind == RNBD_WAIT_PATH)
+		w.slot = rnbd_sampler_add_path(&w.smp, w.dir, RNBD_SMP_STATE);
+	if (w.slot < 0) {
+		ret = w.slot;
+		goto free;
+	}
+
+	ret = wait_until(&w, state_reached, deadline);
+	if (!ret)
+		printf("%s '%s' is %s after %.3fs\n", kind_to_str(w.kind),
+		       name, state, (now_us() - start) / 1e6);
+	else if (ret == -ENOENT)
+		ERR(trm, "%s '%s' disappeared\n", kind_to_str(w.kind), name);
+	else if (ret == -ETIMEDOUT)
+		ERR(trm, "%s '%s' is still %s after %.3fs\n",
+		    kind_to_str(w.kind), name,
+		    w.state[0] ? w.state : "unknown",
+		    (now_us() - start) / 1e6);
+
+free:
+	wait_free(&w);
+
+	return ret;
+}
+
+/*
+ * The device of session @w->sessname mapped from @w->name appeared in
+ * the devices/ directory
+ */
+static int device_created(struct wait *w)
+{
+	const struct rnbd_sysfs_info *sysfs = get_sysfs_info(w->ctx);
+	char dir[PATH_MAX], ddir[PATH_MAX], rpath[PATH_MAX];
+	char sessname[NAME_MAX], mapping_path[NAME_MAX];
+	struct dirent *ent;
+	DIR *d;
+
+	snprintf(dir, sizeof(dir), "%s/devices/", sysfs->path_dev_clt);
+
+	d = opendir(dir);
+	for (ent = d ? readdir(d) : NULL; ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.' ||
+		    snprintf(ddir, sizeof(ddir), "%s%s/%s", dir, ent->d_name,
+			     sysfs->path_dev_name) >= sizeof(ddir))
+			continue;
+
+		if (scanf_sysfs(ddir, "session", "%s", sessname) != 1 ||
+		    scanf_sysfs(ddir, "mapping_path", "%s",
+				mapping_path) != 1 ||
+		    strcmp(sessname, w->sessname) ||
+		    strcmp(mapping_path, w->name) ||
+		    !realpath(ddir, rpath))
+			continue;
+
+		strcpy(w->dir, ddir);
+		snprintf(w->devname, sizeof(w->devname), "%s",
+			 basename(dirname(rpath)));
+		break;
+	}
+	if (d)
+		closedir(d);
+
+	return ent != NULL;
+}
+
+/*
+ * udev created the device node
+ */
+static int node_created(struct wait *w)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "/dev/%s", w->devname);
+
+	return !access(path, F_OK);
+}
+
+int rnbd_wait_map(const struct rnbd_ctx *ctx, const char *sessname,
+		  const char *mapping_path, const struct timespec *start,
+		  const struct timespec *written, int timeout_ms)
+{
+	struct wait w = {
+		.ctx = ctx,
+		.kind = RNBD_WAIT_DEVICE,
+		.sessname = sessname,
+		.name = mapping_path,
+		.want = "open",
+		.uevent_fd = -1,
+	};
+	long long begin, connected, deadline;
+	int ret;
+
+	begin = ts_us(start);
+	deadline = timeout_ms < 0 ? -1 : begin + timeout_ms * 1000LL;
+
+	ret = rnbd_sampler_init(&w.smp, 0, 1);
+	if (ret)
+		return ret;
+	w.uevent_fd = rnbd_uevent_open();
+
+	ret = wait_until(&w, device_created, deadline);
+	if (ret) {
+		ERR(trm, "Device '%s' of session '%s' didn't appear after %.3fs\n",
+		    mapping_path, sessname, (now_us() - begin) / 1e6);
+		goto free;
+	}
+
+	w.slot = rnbd_sampler_add_dev(&w.smp, NULL, w.dir, RNBD_SMP_STATE);
+	if (w.slot < 0) {
+		ret = w.slot;
+		goto free;
+	}
+
+	w.poll_state = true;
+	ret = wait_until(&w, state_reached, deadline);
+	if (ret == -ENOENT) {
+		ERR(trm, "Device %s disappeared\n", w.devname);
+		goto free;
+	} else if (ret) {
+		ERR(trm, "Device %s is still %s after %.3fs\n", w.devname,
+		    w.state[0] ? w.state : "unknown",
+		    (now_us() - begin) / 1e6);
+		goto free;
+	}
+	connected = now_us();
+
+	w.poll_state = false;
+	ret = wait_until(&w, node_created, deadline);
+	if (ret) {
+		ERR(trm, "Device node /dev/%s doesn't exist after %.3fs\n",
+		    w.devname, (now_us() - begin) / 1e6);
+		goto free;
+	}
+
+	printf("/dev/%s (write %.3fs, connect %.3fs, visible %.3fs)\n",
+	       w.devname, (ts_us(written) - begin) / 1e6,
+	       (connected - ts_us(written)) / 1e6,
+	       (now_us() - connected) / 1e6);
+
+free:
+	wait_free(&w);
+
+	return ret;
+}
@@ -0,0 +1,53 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_WAIT
+#define __H_WAIT
+
+#include <time.h>
+
+struct rnbd_ctx;
+
+/* kinds of objects to look the name up in */
+enum {
+	RNBD_WAIT_DEVICE	= 1,
+	RNBD_WAIT_SESSION	= 1 << 1,
+	RNBD_WAIT_PATH		= 1 << 2,
+	RNBD_WAIT_ALL		= RNBD_WAIT_DEVICE | RNBD_WAIT_SESSION |
+				  RNBD_WAIT_PATH,
+};
+
+/*
+ * Wait until the client object @name of one of the @kinds is in @state.
+ * A path can be narrowed down to the session @sessname, which may be NULL.
+ * A session is connected as long as one of its paths is connected.
+ *
+ * Only the state files of the object are opened, they are polled for
+ * POLLPRI along with the kernel uevents and re-read with a short backoff
+ * in case neither notifies.
+ * Waits forever if @timeout_ms is negative.
+ * Returns 0 as soon as the state is reached, -ETIMEDOUT, -ENOENT if
+ * the object doesn't exist or disappeared or other negative error code.
+ */
+int rnbd_wait(const struct rnbd_ctx *ctx, unsigned int kinds,
+	      const char *sessname, const char *name, const char *state,
+	      int timeout_ms);
+
+/*
+ * Wait until the device of session @sessname mapped from @mapping_path
+ * shows up, is open and has its node in /dev, then print the device name
+ * and the time the phases took: from @start to @written for the write to
+ * map_device, until the device is open and until the node exists.
+ * The @timeout_ms counts from @start, it is ignored if negative.
+ */
+int rnbd_wait_map(const struct rnbd_ctx *ctx, const char *sessname,
+		  const char *mapping_path, const struct timespec *start,
+		  const struct timespec *written, int timeout_ms);
+
+#endif /* __H_WAIT */
@@ -0,0 +1,720 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#include <errno.h>
+#include <dirent.h>	/* for opendir() */
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>	/* for close() */
+#include <libgen.h>	/* for basename() */
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "watch.h"
+#include "hash.h"
+#include "sampler.h"
+#include "table.h"
+#include "misc.h"
+#include "rnbd-sysfs.h"
+
+/*
+ * The paths of every session are rescanned that often in case uevents
+ * are not available or got lost
+ */
+#define WATCH_RESCAN_TICKS 10
+
+struct watch_path {
+	char		name[NAME_MAX];
+	int		slot;		/* in the sampler */
+	char		state[RNBD_SAMPLER_STATE_LEN];
+	int		reconnects;
+	bool		seen;
+};
+
+struct watch_sess {
+	enum rnbdmode		side;
+	char			name[NAME_MAX];
+	struct watch_path	*paths;
+	int			path_cnt;
+	int			path_size;
+	bool			seen;
+};
+
+struct watch_dev {
+	char		link[NAME_MAX];	/* entry under devices/ */
+	char		sessname[NAME_MAX];
+	char		mapping_path[NAME_MAX];
+	char		devname[NAME_MAX];
+	int		slot;		/* in the sampler */
+	char		state[RNBD_SAMPLER_STATE_LEN];
+	bool		seen;
+};
+
+struct watch {
+	const struct rnbd_ctx	*ctx;
+	struct timespec		now;	/* CLOCK_MONOTONIC of the sample */
+	bool			quiet;	/* initial scan, don't report */
+	struct rnbd_sampler	smp;
+
+	struct watch_sess	**sess;
+	int			sess_cnt;
+	int			sess_size;
+	struct rnbd_hash	sess_idx;
+
+	struct watch_dev	**devs;
+	int			dev_cnt;
+	int			dev_size;
+	struct rnbd_hash	dev_idx;
+
+	int			uevent_fd;
+};
+
+static volatile sig_atomic_t watch_stop;
+
+static void watch_sig(int sig)
+{
+	watch_stop = 1;
+}
+
+static void json_str(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		if ((unsigned char)*s < ' ')
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void event_begin(const struct watch *w, const char *event,
+			enum rnbdmode side, const char *sessname)
+{
+	printf("{\"ts\": %lld.%06ld, \"event\": \"%s\", \"direction\": \"%s\", \"session\": ",
+	       (long long)w->now.tv_sec, w->now.tv_nsec / 1000, event,
+	       side == RNBD_CLIENT ? "outgoing" : "incoming");
+	json_str(sessname);
+}
+
+static void event_str(const char *key, const char *val)
+{
+	printf(", \"%s\": ", key);
+	json_str(val);
+}
+
+static void event_int(const char *key, int val)
+{
+	printf(", \"%s\": %d", key, val);
+}
+
+static void event_end(void)
+{
+	printf("}\n");
+}
+
+static const char *sess_dir(const struct watch *w, enum rnbdmode side)
+{
+	if (side == RNBD_CLIENT)
+		return get_sysfs_info(w->ctx)->path_sess_clt;
+
+	return get_sysfs_info(w->ctx)->path_sess_srv;
+}
+
+static void sess_key(char *key, size_t len, enum rnbdmode side,
+		     const char *name)
+{
+	snprintf(key, len, "%c%s", side == RNBD_CLIENT ? 'c' : 's', name);
+}
+
+/*
+ * Report the changes of path @p since the last sample.
+ * Returns false if the path is gone.
+ */
+static bool watch_path_report(struct watch *w, struct watch_sess *s,
+			      struct watch_path *p)
+{
+	const struct rnbd_sampler_set *set = &w->smp.paths;
+	const char *state = set->state[p->slot];
+	int reconnects = set->reconnects[p->slot];
+
+	if (set->gone[p->slot])
+		return false;
+
+	if (strcmp(state, p->state)) {
+		if (!w->quiet) {
+			event_begin(w, "path_state", s->side, s->name);
+			event_str("path", p->name);
+			event_str("old", p->state);
+			event_str("new", state);
+			event_end();
+		}
+		strcpy(p->state, state);
+	}
+
+	if (reconnects > p->reconnects && !w->quiet) {
+		event_begin(w, "reconnects", s->side, s->name);
+		event_str("path", p->name);
+		event_int("old", p->reconnects);
+		event_int("new", reconnects);
+		event_int("delta", reconnects - p->reconnects);
+		event_end();
+	}
+	p->reconnects = reconnects;
+
+	return true;
+}
+
+static struct watch_path *watch_path_add(struct watch *w,
+					 struct watch_sess *s,
+					 const char *dir, const char *name)
+{
+	char path[PATH_MAX];
+	struct watch_path *p;
+	int size;
+
+	if (s->path_cnt == s->path_size) {
+		size = s->path_size ? s->path_size * 2 : 4;
+		p = realloc(s->paths, size * sizeof(*p));
+		if (!p)
+			return NULL;
+		s->paths = p;
+		s->path_size = size;
+	}
+
+	if (snprintf(path, sizeof(path), "%s%s", dir, name) >= sizeof(path))
+		return NULL;
+
+	p = &s->paths[s->path_cnt];
+	memset(p, 0, sizeof(*p));
+	strcpy(p->name, name);
+
+	p->slot = rnbd_sampler_add_path(&w->smp, path,
+					RNBD_SMP_STATE | RNBD_SMP_RECONNECTS);
+	if (p->slot < 0)
+		return NULL;
+
+	s->path_cnt++;
+
+	return p;
+}
+
+/*
+ * Synchronize the paths of session @s with its paths/ directory
+ */
+static void watch_sess_scan(struct watch *w, struct watch_sess *s)
+{
+	char dir[PATH_MAX];
+	struct watch_path *p;
+	struct dirent *ent;
+	bool quiet;
+	DIR *d;
+	int i;
+
+	snprintf(dir, sizeof(dir), "%s%s/paths/", sess_dir(w, s->side),
+		 s->name);
+
+	for (i = 0; i < s->path_cnt; i++)
+		s->paths[i].seen = false;
+
+	d = opendir(dir);
+	for (ent = d ? readdir(d) : NULL; ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		for (i = 0; i < s->path_cnt; i++)
+			if (!strcmp(s->paths[i].name, ent->d_name))
+				break;
+
+		if (i < s->path_cnt) {
+			s->paths[i].seen = true;
+			continue;
+		}
+
+		p = watch_path_add(w, s, dir, ent->d_name);
+		if (!p)
+			continue;
+
+		p->seen = true;
+		quiet = w->quiet;
+		w->quiet = true;
+		rnbd_sampler_read_path(&w->smp, p->slot);
+		watch_path_report(w, s, p);
+		w->quiet = quiet;
+
+		if (!w->quiet) {
+			event_begin(w, "path_appeared", s->side, s->name);
+			event_str("path", p->name);
+			event_str("state", p->state);
+			event_end();
+		}
+	}
+	if (d)
+		closedir(d);
+
+	for (i = 0; i < s->path_cnt; i++) {
+		p = &s->paths[i];
+		if (p->seen)
+			continue;
+
+		if (!w->quiet) {
+			event_begin(w, "path_disappeared", s->side, s->name);
+			event_str("path", p->name);
+			event_str("state", p->state);
+			event_end();
+		}
+		rnbd_sampler_del_path(&w->smp, p->slot);
+		s->paths[i--] = s->paths[--s->path_cnt];
+	}
+}
+
+static void watch_sess_free(struct watch *w, struct watch_sess *s)
+{
+	int i;
+
+	for (i = 0; i < s->path_cnt; i++)
+		rnbd_sampler_del_path(&w->smp, s->paths[i].slot);
+
+	free(s->paths);
+	free(s);
+}
+
+static int watch_reindex(struct watch *w)
+{
+	char key[NAME_MAX + 2];
+	int i, ret;
+
+	rnbd_hash_free(&w->sess_idx);
+	ret = rnbd_hash_init(&w->sess_idx, w->sess_cnt);
+	for (i = 0; !ret && i < w->sess_cnt; i++) {
+		sess_key(key, sizeof(key), w->sess[i]->side, w->sess[i]->name);
+		ret = rnbd_hash_add(&w->sess_idx, key, w->sess[i]);
+	}
+	if (ret)
+		return ret;
+
+	rnbd_hash_free(&w->dev_idx);
+	ret = rnbd_hash_init(&w->dev_idx, w->dev_cnt);
+	for (i = 0; !ret && i < w->dev_cnt; i++)
+		ret = rnbd_hash_add(&w->dev_idx, w->devs[i]->link, w->devs[i]);
+
+	return ret;
+}
+
+static struct watch_sess *watch_sess_add(struct watch *w, enum rnbdmode side,
+					 const char *name)
+{
+	char key[NAME_MAX + 2];
+	struct watch_sess *s, **arr;
+	int size;
+
+	if (w->sess_cnt == w->sess_size) {
+		size = w->sess_size ? w->sess_size * 2 : 16;
+		arr = realloc(w->sess, size * sizeof(*arr));
+		if (!arr)
+			return NULL;
+		w->sess = arr;
+		w->sess_size = size;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->side = side;
+	strcpy(s->name, name);
+
+	sess_key(key, sizeof(key), side, name);
+	if (rnbd_hash_add(&w->sess_idx, key, s)) {
+		free(s);
+		return NULL;
+	}
+	w->sess[w->sess_cnt++] = s;
+
+	return s;
+}
+
+/*
+ * Only the class directory is read, the paths of known sessions are
+ * rescanned if @rescan is set.
+ */
+static int watch_sessions(struct watch *w, enum rnbdmode side, bool rescan)
+{
+	char key[NAME_MAX + 2];
+	struct watch_sess *s;
+	struct dirent *ent;
+	bool removed = false;
+	DIR *d;
+	int i;
+
+	for (i = 0; i < w->sess_cnt; i++)
+		if (w->sess[i]->side == side)
+			w->sess[i]->seen = false;
+
+	d = opendir(sess_dir(w, side));
+	for (ent = d ? readdir(d) : NULL; ent; ent = readdir(d)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		sess_key(key, sizeof(key), side, ent->d_name);
+		s = rnbd_hash_find(&w->sess_idx, key);
+		if (s) {
+			s->seen = true;
+			if (rescan)
+				watch_sess_scan(w, s);
+			continue;
+		}
+
+		s = watch_sess_add(w, side, ent->d_name);
+		if (!s)
+			continue;
+
+		s->seen = true;
+		if (!w->quiet) {
+			event_begin(w, "session_appeared", side, s->name);
+			event_end();
+		}
+		watch_sess_scan(w, s);
+	}
+	if (d)
+		closedir(d);
+
+	for (i = 0; i < w->sess_cnt; i++) {
+		s = w->sess[i];
+		if (s->side != side || s->seen)
+			continue;
+
+		if (!w->quiet) {
+			event_begin(w, "session_disappeared", side, s->name);
+			event_end();
+		}
+		watch_sess_free(w, s);
+		w->sess[i--] = w->sess[--w->sess_cnt];
+		removed = true;
+	}
+
+	return removed ? watch_reindex(w) : 0;
+}
+
+static void watch_dev_report(struct watch *w, struct watch_dev *d)
+{
+	const char *state = w->smp.devs.state[d->slot];
+
+	if (w->smp.devs.gone[d->slot] || !strcmp(state, d->state))
+		return;
+
+	if (!w->quiet) {
+		event_begin(w, "device_state", RNBD_CLIENT, d->sessname);
+		event_str("mapping_path", d->mapping_path);
+		event_str("devname", d->devname);
+		event_str("old", d->state);
+		event_str("new", state);
+		event_end();
+	}
+	strcpy(d->state, state);
+}
+
+static struct watch_dev *watch_dev_add(struct watch *w, const char *dir,
+				       const char *link)
+{
+	char path[PATH_MAX], rpath[PATH_MAX];
+	struct watch_dev *d, **arr;
+	int size;
+
+	if (w->dev_cnt == w->dev_size) {
+		size = w->dev_size ? w->dev_size * 2 : 16;
+		arr = realloc(w->devs, size * sizeof(*arr));
+		if (!arr)
+			return NULL;
+		w->devs = arr;
+		w->dev_size = size;
+	}
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	strcpy(d->link, link);
+
+	if (snprintf(path, sizeof(path), "%s%s", dir, link) < sizeof(path) &&
+	    realpath(path, rpath))
+		strcpy(d->devname, basename(rpath));
+
+	if (snprintf(path, sizeof(path), "%s%s/%s", dir, link,
+		     get_sysfs_info(w->ctx)->path_dev_name) >= sizeof(path))
+		goto free_dev;
+
+	scanf_sysfs(path, "session", "%s", d->sessname);
+	scanf_sysfs(path, "mapping_path", "%s", d->mapping_path);
+
+	d->slot = rnbd_sampler_add_dev(&w->smp, NULL, path, RNBD_SMP_STATE);
+	if (d->slot < 0)
+		goto free_dev;
+
+	if (rnbd_hash_add(&w->dev_idx, d->link, d))
+		goto del_slot;
+
+	w->devs[w->dev_cnt++] = d;
+
+	return d;
+
+del_slot:
+	rnbd_sampler_del_dev(&w->smp, d->slot);
+free_dev:
+	free(d);
+
+	return NULL;
+}
+
+static void watch_dev_free(struct watch *w, struct watch_dev *d)
+{
+	rnbd_sampler_del_dev(&w->smp, d->slot);
+	free(d);
+}
+
+static int watch_devices(struct watch *w)
+{
+	struct watch_dev *d;
+	struct dirent *ent;
+	bool removed = false;
+	char dir[PATH_MAX];
+	bool quiet;
+	DIR *dp;
+	int i;
+
+	snprintf(dir, sizeof(dir), "%s/devices/",
+		 get_sysfs_info(w->ctx)->path_dev_clt);
+
+	for (i = 0; i < w->dev_cnt; i++)
+		w->devs[i]->seen = false;
+
+	dp = opendir(dir);
+	for (ent = dp ? readdir(dp) : NULL; ent; ent = readdir(dp)) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		d = rnbd_hash_find(&w->dev_idx, ent->d_name);
+		if (d) {
+			d->seen = true;
+			continue;
+		}
+
+		d = watch_dev_add(w, dir, ent->d_name);
+		if (!d)
+			continue;
+
+		d->seen = true;
+		quiet = w->quiet;
+		w->quiet = true;
+		rnbd_sampler_read_dev(&w->smp, d->slot);
+		watch_dev_report(w, d);
+		w->quiet = quiet;
+
+		if (!w->quiet) {
+			event_begin(w, "device_appeared", RNBD_CLIENT,
+				    d->sessname);
+			event_str("mapping_path", d->mapping_path);
+			event_str("devname", d->devname);
+			event_str("state", d->state);
+			event_end();
+		}
+	}
+	if (dp)
+		closedir(dp);
+
+	for (i = 0; i < w->dev_cnt; i++) {
+		d = w->devs[i];
+		if (d->seen)
+			continue;
+
+		if (!w->quiet) {
+			event_begin(w, "device_disappeared", RNBD_CLIENT,
+				    d->sessname);
+			event_str("mapping_path", d->mapping_path);
+			event_str("devname", d->devname);
+			event_str("state", d->state);
+			event_end();
+		}
+		watch_dev_free(w, d);
+		w->devs[i--] = w->devs[--w->dev_cnt];
+		removed = true;
+	}
+
+	return removed ? watch_reindex(w) : 0;
+}
+
+static int watch_tick(struct watch *w, bool rescan)
+{
+	struct watch_sess *s;
+	int i, j, ret = 0;
+	bool gone;
+
+	clock_gettime(CLOCK_MONOTONIC, &w->now);
+
+	if (w->ctx->rnbdmode & RNBD_CLIENT) {
+		ret = watch_sessions(w, RNBD_CLIENT, rescan);
+		if (!ret)
+			ret = watch_devices(w);
+	}
+	if (!ret && (w->ctx->rnbdmode & RNBD_SERVER))
+		ret = watch_sessions(w, RNBD_SERVER, rescan);
+
+	rnbd_sampler_sample(&w->smp);
+
+	for (i = 0; i < w->dev_cnt; i++)
+		watch_dev_report(w, w->devs[i]);
+
+	for (i = 0; i < w->sess_cnt; i++) {
+		s = w->sess[i];
+		gone = false;
+		for (j = 0; j < s->path_cnt; j++)
+			if (!watch_path_report(w, s, &s->paths[j]))
+				gone = true;
+		if (gone)
+			watch_sess_scan(w, s);
+	}
+
+	fflush(stdout);
+
+	return ret;
+}
+
+int rnbd_uevent_open(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,
+	};
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+	if (fd < 0)
+		return -errno;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -errno;
+	}
+
+	return fd;
+}
+
+bool rnbd_uevent_drain(int fd)
+{
+	char buf[4096];
+	bool hit = false;
+	ssize_t len;
+
+	while ((len = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[len] = '\0';
+		if (strstr(buf, "rtrs") || strstr(buf, "rnbd") ||
+		    strstr(buf, "ibtrs") || strstr(buf, "ibnbd"))
+			hit = true;
+	}
+
+	return hit;
+}
+
+static long long ts_ms(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000LL + ts->tv_nsec / 1000000;
+}
+
+int rnbd_watch(const struct rnbd_ctx *ctx)
+{
+	struct watch w = {
+		.ctx = ctx,
+		.quiet = true,
+	};
+	struct sigaction sa = {
+		.sa_handler = watch_sig,
+	};
+	long long next, now;
+	struct pollfd pfd;
+	bool rescan;
+	int tick, ret, i;
+
+	ret = rnbd_sampler_init(&w.smp, 256, 64);
+	if (ret)
+		return ret;
+
+	ret = rnbd_hash_init(&w.sess_idx, 64);
+	if (ret)
+		goto free_smp;
+
+	ret = rnbd_hash_init(&w.dev_idx, 64);
+	if (ret)
+		goto free_sess_idx;
+
+	w.uevent_fd = rnbd_uevent_open();
+
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	/* remember the current state without reporting it */
+	ret = watch_tick(&w, true);
+	w.quiet = false;
+
+	next = ts_ms(&w.now) + ctx->interval_ms;
+
+	for (tick = 1; !ret && !watch_stop &&
+	     (!ctx->count_set || tick <= ctx->count); tick++) {
+		rescan = !(tick % WATCH_RESCAN_TICKS);
+
+		pfd.fd = w.uevent_fd;
+		pfd.events = POLLIN;
+		for (;;) {
+			clock_gettime(CLOCK_MONOTONIC, &w.now);
+			now = ts_ms(&w.now);
+			if (now >= next || watch_stop)
+				break;
+
+			if (poll(&pfd, 1, next - now) > 0 &&
+			    rnbd_uevent_drain(w.uevent_fd))
+				rescan = true;
+		}
+		if (watch_stop)
+			break;
+
+		ret = watch_tick(&w, rescan);
+
+		/* don't try to catch up with missed samples */
+		next += ctx->interval_ms;
+		if (next < now)
+			next = now + ctx->interval_ms;
+	}
+
+	if (w.uevent_fd >= 0)
+		close(w.uevent_fd);
+
+	for (i = 0; i < w.dev_cnt; i++)
+		watch_dev_free(&w, w.devs[i]);
+	free(w.devs);
+
+	for (i = 0; i < w.sess_cnt; i++)
+		watch_sess_free(&w, w.sess[i]);
+	free(w.sess);
+
+	rnbd_hash_free(&w.dev_idx);
+free_sess_idx:
+	rnbd_hash_free(&w.sess_idx);
+free_smp:
+	rnbd_sampler_free(&w.smp);
+
+	return ret;
+}
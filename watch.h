@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Configuration tool for RNBD driver and RTRS library.
+ *
+ * Copyright (c) 2019 1&1 IONOS SE. All rights reserved.
+ * Authors: Danil Kipnis <danil.kipnis@cloud.ionos.com>
+ *          Lutz Pogrell <lutz.pogrell@cloud.ionos.com>
+ */
+
+#ifndef __H_WATCH
+#define __H_WATCH
+
+#include <stdbool.h>
+
+struct rnbd_ctx;
+
+/*
+ * Print one JSON object per line for every change of sessions, paths
+ * and devices of the sides selected in ctx->rnbdmode, every
+ * ctx->interval_ms milliseconds, until interrupted or until
+ * ctx->count samples have been taken.
+ */
+int rnbd_watch(const struct rnbd_ctx *ctx);
+
+/*
+ * Open a non-blocking socket for the kernel uevents.
+ * Returns the file descriptor or negative error code.
+ */
+int rnbd_uevent_open(void);
+
+/*
+ * Read all pending uevents from @fd.
+ * Returns true if any of them concerns rnbd or rtrs.
+ */
+bool rnbd_uevent_drain(int fd);
+
+#endif /* __H_WATCH */